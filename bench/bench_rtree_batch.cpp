@@ -0,0 +1,80 @@
+#include <benchmark/benchmark.h>
+
+#include <functional>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "algorithm/geometry/rtree.h"
+
+// 一帧内的大量窗口查询：逐个调用 std::function 版本的 Search 与 SearchBatch
+
+namespace {
+
+typedef RTree<int, double, 2> TREE;
+
+const int ENTRY_COUNT = 1000000;
+const int QUERY_COUNT = 50000;
+const double WORLD_SIZE = 1000.0;
+
+const TREE& getTree() {
+    static TREE tree;
+    static bool built = false;
+    if (!built) {
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<double> position(0.0, WORLD_SIZE);
+        std::uniform_real_distribution<double> size(0.0, 1.0);
+        for (int i = 0; i < ENTRY_COUNT; ++i) {
+            double min[2] = {position(rng), position(rng)};
+            double max[2] = {min[0] + size(rng), min[1] + size(rng)};
+            tree.Insert(min, max, i);
+        }
+        built = true;
+    }
+    return tree;
+}
+
+// 查询顺序随机，与真实的碰撞检测顺序类似
+std::vector<TREE::Rect> makeQueries() {
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> position(0.0, WORLD_SIZE - 5.0);
+    std::vector<TREE::Rect> queries(QUERY_COUNT);
+    for (auto& query : queries) {
+        for (int axis = 0; axis < 2; ++axis) {
+            query.m_min[axis] = position(rng);
+            query.m_max[axis] = query.m_min[axis] + 5.0;
+        }
+    }
+    return queries;
+}
+
+void BM_SearchLoop(benchmark::State& state) {
+    const TREE& tree = getTree();
+    const auto queries = makeQueries();
+    std::vector<int> hits;
+    for (auto _ : state) {
+        hits.clear();
+        for (const auto& query : queries) {
+            tree.Search(query.m_min, query.m_max, std::function<bool(const int&)>([&hits](const int& id) {
+                hits.push_back(id);
+                return true;
+            }));
+        }
+    }
+    state.counters["hits"] = (double) hits.size();
+}
+
+void BM_SearchBatch(benchmark::State& state) {
+    const TREE& tree = getTree();
+    const auto queries = makeQueries();
+    TREE::SearchBatchResult result;
+    for (auto _ : state) {
+        tree.SearchBatch(queries.data(), QUERY_COUNT, result, (int) state.range(0));
+    }
+    state.counters["hits"] = (double) result.Hits().size();
+}
+
+} // namespace
+
+BENCHMARK(BM_SearchLoop)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_SearchBatch)->Arg(1)->Arg(4)->Unit(benchmark::kMillisecond)->UseRealTime();
@@ -0,0 +1,132 @@
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <vector>
+
+#include "algorithm/geometry/rtree.h"
+
+// 大量删除后的窗口查询：删除后未整理、Compact 扫完一轮、整棵 BulkLoad 重建三种树的对比
+// 以及单次 Compact 调用的耗时，参数为预算
+
+namespace {
+
+typedef RTree<int, double, 2> TREE;
+
+const int ENTRY_COUNT = 400000;
+const double WORLD_SIZE = 1000.0;
+
+std::vector<std::pair<TREE::Rect, int>> makeEntries() {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> position(0.0, WORLD_SIZE);
+    std::uniform_real_distribution<double> size(0.0, 1.0);
+    std::vector<std::pair<TREE::Rect, int>> entries(ENTRY_COUNT);
+    for (int i = 0; i < ENTRY_COUNT; ++i) {
+        for (int axis = 0; axis < 2; ++axis) {
+            entries[i].first.m_min[axis] = position(rng);
+            entries[i].first.m_max[axis] = entries[i].first.m_min[axis] + size(rng);
+        }
+        entries[i].second = i;
+    }
+    return entries;
+}
+
+// 逐条插入后删除四分之三
+void buildWorn(TREE& tree) {
+    for (const auto& entry : makeEntries()) {
+        tree.Insert(entry.first.m_min, entry.first.m_max, entry.second);
+    }
+    for (const auto& entry : makeEntries()) {
+        if (entry.second % 4 != 0) {
+            tree.Remove(entry.first.m_min, entry.first.m_max, entry.second);
+        }
+    }
+}
+
+const TREE& getWorn() {
+    static TREE tree;
+    if (tree.Count() == 0) {
+        buildWorn(tree);
+    }
+    return tree;
+}
+
+const TREE& getCompacted() {
+    static TREE tree;
+    if (tree.Count() == 0) {
+        buildWorn(tree);
+        while (!tree.Compact(10000).sweepDone) {
+        }
+    }
+    return tree;
+}
+
+const TREE& getRebuilt() {
+    static TREE tree;
+    if (tree.Count() == 0) {
+        auto entries = makeEntries();
+        std::vector<std::pair<TREE::Rect, int>> kept;
+        for (const auto& entry : entries) {
+            if (entry.second % 4 == 0) {
+                kept.push_back(entry);
+            }
+        }
+        tree.BulkLoad(kept.begin(), kept.end());
+    }
+    return tree;
+}
+
+void runWindows(benchmark::State& state, const TREE& tree) {
+    const double window = (double) state.range(0);
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> position(0.0, WORLD_SIZE - window);
+
+    std::size_t total = 0;
+    for (auto _ : state) {
+        const double min[2] = {position(rng), position(rng)};
+        const double max[2] = {min[0] + window, min[1] + window};
+        total += tree.Search(min, max, [](const int&) {
+            return true;
+        });
+    }
+    state.counters["hits"] = benchmark::Counter((double) total / state.iterations());
+    state.counters["nodes"] = tree.CalcStats().nodeCount;
+}
+
+void BM_WornWindow(benchmark::State& state) {
+    runWindows(state, getWorn());
+}
+
+void BM_CompactedWindow(benchmark::State& state) {
+    runWindows(state, getCompacted());
+}
+
+void BM_RebuiltWindow(benchmark::State& state) {
+    runWindows(state, getRebuilt());
+}
+
+// 每次调用从上次停下的位置继续，扫完一轮后重新建一棵未整理的树
+void BM_CompactStep(benchmark::State& state) {
+    const int budget = (int) state.range(0);
+    TREE tree;
+    buildWorn(tree);
+
+    long long moved = 0;
+    for (auto _ : state) {
+        const auto stats = tree.Compact(budget);
+        moved += stats.entriesMoved;
+        if (stats.sweepDone) {
+            state.PauseTiming();
+            tree.RemoveAll();
+            buildWorn(tree);
+            state.ResumeTiming();
+        }
+    }
+    state.counters["moved"] = benchmark::Counter((double) moved / state.iterations());
+}
+
+} // namespace
+
+BENCHMARK(BM_WornWindow)->Arg(2)->Arg(10);
+BENCHMARK(BM_CompactedWindow)->Arg(2)->Arg(10);
+BENCHMARK(BM_RebuiltWindow)->Arg(2)->Arg(10);
+BENCHMARK(BM_CompactStep)->Arg(1000)->Arg(10000)->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,121 @@
+#include <benchmark/benchmark.h>
+
+#include <mutex>
+#include <random>
+#include <vector>
+
+#include "algorithm/geometry/rtree.h"
+#include "algorithm/geometry/rtree_concurrent.h"
+
+// 读写混合吞吐：线程 0 不停移动条目（删除再插入），其余线程做窗口查询
+// 一把互斥锁保护的 RTree 与读者无锁、写者路径复制的 RTreeConcurrent 对比，参数为线程数
+
+namespace {
+
+typedef RTree<int, double, 2> TREE;
+typedef RTreeConcurrent<int, double, 2> CONCURRENT;
+
+const int ENTRY_COUNT = 200000;
+const double WORLD_SIZE = 1000.0;
+const double WINDOW = 5.0;
+
+std::vector<TREE::Rect> makeRects() {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> position(0.0, WORLD_SIZE);
+    std::uniform_real_distribution<double> size(0.0, 1.0);
+    std::vector<TREE::Rect> rects(ENTRY_COUNT);
+    for (auto& rect : rects) {
+        for (int axis = 0; axis < 2; ++axis) {
+            rect.m_min[axis] = position(rng);
+            rect.m_max[axis] = rect.m_min[axis] + size(rng);
+        }
+    }
+    return rects;
+}
+
+struct Locked {
+    TREE tree;
+    std::mutex mutex;
+    std::vector<TREE::Rect> rects = makeRects();
+
+    Locked() {
+        for (int i = 0; i < ENTRY_COUNT; ++i) {
+            tree.Insert(rects[i].m_min, rects[i].m_max, i);
+        }
+    }
+
+    int search(const double min[2], const double max[2]) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return tree.Search(min, max, [](const int&) {
+            return true;
+        });
+    }
+
+    void move(int id, const TREE::Rect& rect) {
+        std::lock_guard<std::mutex> lock(mutex);
+        tree.Remove(rects[id].m_min, rects[id].m_max, id);
+        tree.Insert(rect.m_min, rect.m_max, id);
+        rects[id] = rect;
+    }
+};
+
+struct Concurrent {
+    CONCURRENT tree;
+    std::vector<TREE::Rect> rects = makeRects();
+
+    Concurrent() {
+        for (int i = 0; i < ENTRY_COUNT; ++i) {
+            tree.Insert(rects[i].m_min, rects[i].m_max, i);
+        }
+    }
+
+    int search(const double min[2], const double max[2]) {
+        return tree.Search(min, max, [](const int&) {
+            return true;
+        });
+    }
+
+    // 只有线程 0 写，rects 不需要保护
+    void move(int id, const TREE::Rect& rect) {
+        tree.Remove(rects[id].m_min, rects[id].m_max, id);
+        tree.Insert(rect.m_min, rect.m_max, id);
+        rects[id] = rect;
+    }
+};
+
+template <class INDEX>
+void BM_Mixed(benchmark::State& state) {
+    static INDEX index;
+    std::mt19937 rng(7 + state.thread_index());
+    std::uniform_real_distribution<double> position(0.0, WORLD_SIZE - WINDOW);
+    std::uniform_int_distribution<int> pick(0, ENTRY_COUNT - 1);
+    std::uniform_real_distribution<double> step(-0.5, 0.5);
+
+    int64_t reads = 0;
+    int64_t writes = 0;
+    for (auto _ : state) {
+        if (state.thread_index() == 0) {
+            const int id = pick(rng);
+            TREE::Rect moved = index.rects[id];
+            for (int axis = 0; axis < 2; ++axis) {
+                const double delta = step(rng);
+                moved.m_min[axis] += delta;
+                moved.m_max[axis] += delta;
+            }
+            index.move(id, moved);
+            ++writes;
+        } else {
+            const double min[2] = {position(rng), position(rng)};
+            const double max[2] = {min[0] + WINDOW, min[1] + WINDOW};
+            benchmark::DoNotOptimize(index.search(min, max));
+            ++reads;
+        }
+    }
+    state.counters["reads"] = benchmark::Counter((double) reads, benchmark::Counter::kIsRate);
+    state.counters["writes"] = benchmark::Counter((double) writes, benchmark::Counter::kIsRate);
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(BM_Mixed, Locked)->Threads(2)->Threads(4)->Threads(8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Mixed, Concurrent)->Threads(2)->Threads(4)->Threads(8)->UseRealTime();
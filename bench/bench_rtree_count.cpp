@@ -0,0 +1,58 @@
+#include <benchmark/benchmark.h>
+
+#include <random>
+
+#include "algorithm/geometry/rtree.h"
+
+// 窗口计数：Search 逐个访问命中项与 Count 利用子树计数
+
+namespace {
+
+typedef RTree<int, double, 2> TREE;
+
+const int ENTRY_COUNT = 1000000;
+const double WORLD_SIZE = 1000.0;
+
+const TREE& getTree() {
+    static TREE tree;
+    static bool built = false;
+    if (!built) {
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<double> position(0.0, WORLD_SIZE);
+        std::uniform_real_distribution<double> size(0.0, 1.0);
+        for (int i = 0; i < ENTRY_COUNT; ++i) {
+            double min[2] = {position(rng), position(rng)};
+            double max[2] = {min[0] + size(rng), min[1] + size(rng)};
+            tree.Insert(min, max, i);
+        }
+        built = true;
+    }
+    return tree;
+}
+
+template <bool AGGREGATE>
+void BM_WindowCount(benchmark::State& state) {
+    const TREE& tree = getTree();
+    const double window = (double) state.range(0);
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> position(0.0, WORLD_SIZE - window);
+
+    std::size_t total = 0;
+    for (auto _ : state) {
+        double min[2] = {position(rng), position(rng)};
+        double max[2] = {min[0] + window, min[1] + window};
+        if (AGGREGATE) {
+            total += tree.Count(min, max);
+        } else {
+            total += tree.Search(min, max, [](const int&) {
+                return true;
+            });
+        }
+    }
+    state.counters["count"] = benchmark::Counter((double) total / state.iterations());
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(BM_WindowCount, false)->Arg(10)->Arg(100)->Arg(500);
+BENCHMARK_TEMPLATE(BM_WindowCount, true)->Arg(10)->Arg(100)->Arg(500);
@@ -0,0 +1,93 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "algorithm/geometry/rtree_external.h"
+
+// 从记录文件构建映射格式的树：外排序构建，参数为内存预算（MB），与整份读入内存后 BulkLoad 再写出对比
+// 计数器给出有序段数、归并趟数与读写吞吐
+
+namespace {
+
+typedef RTreeExternalBuilder<int, double, 2> BUILDER;
+typedef RTree<int, double, 2> TREE;
+
+const int RECORD_COUNT = 2000000;
+const double WORLD_SIZE = 1000.0;
+const char* INPUT_FILE = "bench_rtree_external.in";
+const char* OUTPUT_FILE = "bench_rtree_external.map";
+
+// 第一次使用时写出输入文件，进程结束时删除
+struct InputFile {
+    InputFile() {
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<double> position(0.0, WORLD_SIZE);
+        std::uniform_real_distribution<double> size(0.0, 1.0);
+        FILE* file = std::fopen(INPUT_FILE, "wb");
+        for (int i = 0; i < RECORD_COUNT; ++i) {
+            BUILDER::Record record;
+            for (int axis = 0; axis < 2; ++axis) {
+                record.m_min[axis] = position(rng);
+                record.m_max[axis] = record.m_min[axis] + size(rng);
+            }
+            record.m_data = i;
+            std::fwrite(&record, sizeof(record), 1, file);
+        }
+        std::fclose(file);
+    }
+
+    ~InputFile() {
+        std::remove(INPUT_FILE);
+        std::remove(OUTPUT_FILE);
+    }
+};
+
+void getInput() {
+    static InputFile input;
+}
+
+void BM_ExternalBuild(benchmark::State& state) {
+    getInput();
+    BUILDER builder((size_t) state.range(0) << 20);
+    for (auto _ : state) {
+        if (!builder.Build(INPUT_FILE, OUTPUT_FILE)) {
+            state.SkipWithError("build failed");
+            break;
+        }
+    }
+    const auto& stats = builder.GetStats();
+    state.SetItemsProcessed(state.iterations() * RECORD_COUNT);
+    state.counters["runs"] = stats.runs;
+    state.counters["passes"] = stats.mergePasses;
+    state.counters["readMBps"] = stats.readMBps;
+    state.counters["writeMBps"] = stats.writeMBps;
+}
+
+// 对照：整份读入内存，希尔伯特排序打包后写出
+void BM_InMemoryBuild(benchmark::State& state) {
+    getInput();
+    for (auto _ : state) {
+        std::vector<BUILDER::Record> records(RECORD_COUNT);
+        FILE* file = std::fopen(INPUT_FILE, "rb");
+        std::fread(records.data(), sizeof(BUILDER::Record), records.size(), file);
+        std::fclose(file);
+
+        std::vector<std::pair<TREE::Rect, int>> entries(RECORD_COUNT);
+        for (int i = 0; i < RECORD_COUNT; ++i) {
+            std::copy(records[i].m_min, records[i].m_min + 2, entries[i].first.m_min);
+            std::copy(records[i].m_max, records[i].m_max + 2, entries[i].first.m_max);
+            entries[i].second = records[i].m_data;
+        }
+        TREE tree;
+        tree.BulkLoad(entries.begin(), entries.end(), TREE::BulkLoadMethod::HILBERT);
+        BUILDER::View::Save(tree, OUTPUT_FILE);
+    }
+    state.SetItemsProcessed(state.iterations() * RECORD_COUNT);
+}
+
+} // namespace
+
+BENCHMARK(BM_ExternalBuild)->Arg(8)->Arg(32)->Arg(256)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_InMemoryBuild)->Unit(benchmark::kMillisecond);
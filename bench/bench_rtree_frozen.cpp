@@ -0,0 +1,113 @@
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <vector>
+
+#include "algorithm/geometry/rtree_frozen.h"
+
+// 冻结后的只读树：原树与按广度优先、van Emde Boas 顺序连续存放的冻结副本，窗口查询与 k 近邻的对比
+// 窗口查询参数为窗口边长，k 近邻参数为 k
+
+namespace {
+
+typedef RTree<int, double, 2> TREE;
+typedef RTreeFrozen<int, double, 2> FROZEN;
+
+const int ENTRY_COUNT = 1000000;
+const double WORLD_SIZE = 1000.0;
+
+std::vector<TREE::Rect> rects;
+
+// 逐条插入构建，节点散落在堆上
+const TREE& getTree() {
+    static TREE tree;
+    if (rects.empty()) {
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<double> position(0.0, WORLD_SIZE);
+        std::uniform_real_distribution<double> size(0.0, 1.0);
+        rects.resize(ENTRY_COUNT);
+        for (int i = 0; i < ENTRY_COUNT; ++i) {
+            for (int axis = 0; axis < 2; ++axis) {
+                rects[i].m_min[axis] = position(rng);
+                rects[i].m_max[axis] = rects[i].m_min[axis] + size(rng);
+            }
+            tree.Insert(rects[i].m_min, rects[i].m_max, i);
+        }
+    }
+    return tree;
+}
+
+const FROZEN& getFrozen(RTreeFrozenLayout layout) {
+    static FROZEN breadthFirst(getTree(), RTreeFrozenLayout::BREADTH_FIRST);
+    static FROZEN vanEmdeBoas(getTree(), RTreeFrozenLayout::VAN_EMDE_BOAS);
+    return layout == RTreeFrozenLayout::BREADTH_FIRST ? breadthFirst : vanEmdeBoas;
+}
+
+template <class INDEX>
+void runWindows(benchmark::State& state, const INDEX& index) {
+    const double window = (double) state.range(0);
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> position(0.0, WORLD_SIZE - window);
+
+    std::size_t total = 0;
+    for (auto _ : state) {
+        const double min[2] = {position(rng), position(rng)};
+        const double max[2] = {min[0] + window, min[1] + window};
+        total += index.Search(min, max, [](const int&) {
+            return true;
+        });
+    }
+    state.counters["hits"] = benchmark::Counter((double) total / state.iterations());
+}
+
+template <class INDEX>
+void runNearest(benchmark::State& state, const INDEX& index) {
+    const int k = (int) state.range(0);
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> position(0.0, WORLD_SIZE);
+    typename INDEX::NearestNeighborBuffer buffer;
+
+    auto squaredDist = [](const double point[2], const int& id) {
+        return TREE::MinDistSq(point, rects[id]);
+    };
+    auto any = [](const int&) {
+        return true;
+    };
+    for (auto _ : state) {
+        const double point[2] = {position(rng), position(rng)};
+        benchmark::DoNotOptimize(index.NearestNeighbors(point, k, squaredDist, any, buffer));
+    }
+}
+
+void BM_TreeWindow(benchmark::State& state) {
+    runWindows(state, getTree());
+}
+
+void BM_FrozenBfsWindow(benchmark::State& state) {
+    runWindows(state, getFrozen(RTreeFrozenLayout::BREADTH_FIRST));
+}
+
+void BM_FrozenVebWindow(benchmark::State& state) {
+    runWindows(state, getFrozen(RTreeFrozenLayout::VAN_EMDE_BOAS));
+}
+
+void BM_TreeNearest(benchmark::State& state) {
+    runNearest(state, getTree());
+}
+
+void BM_FrozenBfsNearest(benchmark::State& state) {
+    runNearest(state, getFrozen(RTreeFrozenLayout::BREADTH_FIRST));
+}
+
+void BM_FrozenVebNearest(benchmark::State& state) {
+    runNearest(state, getFrozen(RTreeFrozenLayout::VAN_EMDE_BOAS));
+}
+
+} // namespace
+
+BENCHMARK(BM_TreeWindow)->Arg(1)->Arg(10);
+BENCHMARK(BM_FrozenBfsWindow)->Arg(1)->Arg(10);
+BENCHMARK(BM_FrozenVebWindow)->Arg(1)->Arg(10);
+BENCHMARK(BM_TreeNearest)->Arg(1)->Arg(16);
+BENCHMARK(BM_FrozenBfsNearest)->Arg(1)->Arg(16);
+BENCHMARK(BM_FrozenVebNearest)->Arg(1)->Arg(16);
@@ -0,0 +1,103 @@
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "algorithm/geometry/rtree.h"
+
+// 两个集合求全部相交对：逐个 Search 与同步遍历的 Join，以及多线程的 ParallelJoin
+
+namespace {
+
+typedef RTree<int, double, 2> TREE;
+
+const int PART_COUNT = 200000;
+const int ZONE_COUNT = 50000;
+const double WORLD_SIZE = 1000.0;
+
+std::vector<std::pair<TREE::Rect, int>> makeRects(int count, double maxSize, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> position(0.0, WORLD_SIZE);
+    std::uniform_real_distribution<double> size(0.0, maxSize);
+
+    std::vector<std::pair<TREE::Rect, int>> entries(count);
+    for (int i = 0; i < count; ++i) {
+        auto& rect = entries[i].first;
+        for (int axis = 0; axis < 2; ++axis) {
+            rect.m_min[axis] = position(rng);
+            rect.m_max[axis] = rect.m_min[axis] + size(rng);
+        }
+        entries[i].second = i;
+    }
+    return entries;
+}
+
+struct Fixture {
+    std::vector<std::pair<TREE::Rect, int>> zones = makeRects(ZONE_COUNT, 3.0, 2);
+    TREE parts;
+    TREE zoneTree;
+
+    Fixture() {
+        auto partRects = makeRects(PART_COUNT, 1.0, 1);
+        parts.BulkLoad(partRects.begin(), partRects.end());
+        zoneTree.BulkLoad(zones.begin(), zones.end());
+    }
+};
+
+const Fixture& getFixture() {
+    static Fixture fixture;
+    return fixture;
+}
+
+void BM_SearchPerEntry(benchmark::State& state) {
+    const Fixture& fixture = getFixture();
+    std::size_t pairs = 0;
+    for (auto _ : state) {
+        pairs = 0;
+        for (const auto& zone : fixture.zones) {
+            pairs += fixture.parts.Search(zone.first.m_min, zone.first.m_max, [](const int&) {
+                return true;
+            });
+        }
+    }
+    state.counters["pairs"] = (double) pairs;
+}
+
+void BM_Join(benchmark::State& state) {
+    const Fixture& fixture = getFixture();
+    std::size_t pairs = 0;
+    for (auto _ : state) {
+        pairs = fixture.parts.Join(fixture.zoneTree, [](const int&, const int&) {
+            return true;
+        });
+    }
+    state.counters["pairs"] = (double) pairs;
+}
+
+void BM_ParallelJoin(benchmark::State& state) {
+    const Fixture& fixture = getFixture();
+    std::size_t pairs = 0;
+    for (auto _ : state) {
+        pairs = fixture.parts.ParallelJoin(fixture.zoneTree, (int) state.range(0)).size();
+    }
+    state.counters["pairs"] = (double) pairs;
+}
+
+void BM_SelfJoin(benchmark::State& state) {
+    const Fixture& fixture = getFixture();
+    std::size_t pairs = 0;
+    for (auto _ : state) {
+        pairs = fixture.zoneTree.SelfJoin([](const int&, const int&) {
+            return true;
+        });
+    }
+    state.counters["pairs"] = (double) pairs;
+}
+
+} // namespace
+
+BENCHMARK(BM_SearchPerEntry)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Join)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_ParallelJoin)->Arg(1)->Arg(2)->Arg(4)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_SelfJoin)->Unit(benchmark::kMillisecond);
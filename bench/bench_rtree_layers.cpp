@@ -0,0 +1,90 @@
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <vector>
+
+#include "algorithm/geometry/rtree.h"
+
+// 只查一个图层的窗口查询：普通 Search 在回调里丢掉其它图层，与带图层掩码、跳过无关子树的 Search 对比
+// 参数 0 为图层按区域聚集（像元件分区），1 为图层在空间上完全混杂
+
+namespace {
+
+typedef RTree<int, double, 2, double, 8, 4, RTreePoolAllocator, RTreeAoSLayout, RTreeQuadraticSplit,
+              RTreeSphericalVolume, RTreeNoQueryStats, RTreeLayers>
+    TREE;
+
+const int ENTRY_COUNT = 500000;
+const int LAYER_COUNT = 32;
+const double WORLD_SIZE = 1000.0;
+const double WINDOW = 20.0;
+
+struct Board {
+    TREE tree;
+    std::vector<TREE::LayerMask> layers;
+};
+
+const Board& getBoard(bool mixed) {
+    static Board boards[2];
+    Board& board = boards[mixed ? 1 : 0];
+    if (board.layers.empty()) {
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<double> position(0.0, WORLD_SIZE);
+        std::uniform_real_distribution<double> size(0.0, 1.0);
+        board.layers.resize(ENTRY_COUNT);
+        for (int i = 0; i < ENTRY_COUNT; ++i) {
+            double min[2];
+            double max[2];
+            for (int axis = 0; axis < 2; ++axis) {
+                min[axis] = position(rng);
+                max[axis] = min[axis] + size(rng);
+            }
+            // 聚集时每个 50x50 的区域属于一个图层
+            const int cell = (int) (min[0] / 50) * 7 + (int) (min[1] / 50) * 13;
+            const int layer = mixed ? i % LAYER_COUNT : cell % LAYER_COUNT;
+            board.layers[i] = TREE::LayerMask(1) << layer;
+            board.tree.Insert(min, max, i, board.layers[i]);
+        }
+    }
+    return board;
+}
+
+void BM_FilterInCallback(benchmark::State& state) {
+    const Board& board = getBoard(state.range(0) != 0);
+    const TREE::LayerMask wanted = TREE::LayerMask(1) << 3;
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> position(0.0, WORLD_SIZE - WINDOW);
+
+    std::size_t total = 0;
+    for (auto _ : state) {
+        const double min[2] = {position(rng), position(rng)};
+        const double max[2] = {min[0] + WINDOW, min[1] + WINDOW};
+        board.tree.Search(min, max, [&](const int& id) {
+            total += (board.layers[id] & wanted) != 0;
+            return true;
+        });
+    }
+    state.counters["hits"] = benchmark::Counter((double) total / state.iterations());
+}
+
+void BM_MaskedSearch(benchmark::State& state) {
+    const Board& board = getBoard(state.range(0) != 0);
+    const TREE::LayerMask wanted = TREE::LayerMask(1) << 3;
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> position(0.0, WORLD_SIZE - WINDOW);
+
+    std::size_t total = 0;
+    for (auto _ : state) {
+        const double min[2] = {position(rng), position(rng)};
+        const double max[2] = {min[0] + WINDOW, min[1] + WINDOW};
+        total += board.tree.Search(min, max, wanted, [](const int&) {
+            return true;
+        });
+    }
+    state.counters["hits"] = benchmark::Counter((double) total / state.iterations());
+}
+
+} // namespace
+
+BENCHMARK(BM_FilterInCallback)->Arg(0)->Arg(1);
+BENCHMARK(BM_MaskedSearch)->Arg(0)->Arg(1);
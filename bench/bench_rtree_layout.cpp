@@ -0,0 +1,87 @@
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "algorithm/geometry/rtree.h"
+
+// 比较默认的 AoS 节点布局与 SoA 布局在窗口查询上的开销，二维 double 与 float 坐标
+
+namespace {
+
+const int ENTRY_COUNT = 1000000;
+const int QUERY_COUNT = 4096;
+const double WORLD_SIZE = 1000.0;
+
+template <class TREE>
+std::vector<std::pair<typename TREE::Rect, int>> makeEntries() {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> position(0.0, WORLD_SIZE);
+    std::uniform_real_distribution<double> size(0.0, 1.0);
+
+    std::vector<std::pair<typename TREE::Rect, int>> entries(ENTRY_COUNT);
+    for (int i = 0; i < ENTRY_COUNT; ++i) {
+        auto& rect = entries[i].first;
+        for (int axis = 0; axis < 2; ++axis) {
+            rect.m_min[axis] = position(rng);
+            rect.m_max[axis] = rect.m_min[axis] + size(rng);
+        }
+        entries[i].second = i;
+    }
+    return entries;
+}
+
+// 每种树只构建一次，按插入顺序构建以得到真实的节点重叠
+template <class TREE>
+const TREE& getTree() {
+    static TREE tree;
+    static bool built = false;
+    if (!built) {
+        for (const auto& entry : makeEntries<TREE>()) {
+            tree.Insert(entry.first.m_min, entry.first.m_max, entry.second);
+        }
+        built = true;
+    }
+    return tree;
+}
+
+template <class ELEMTYPE, int MAXNODES, class LAYOUT>
+void BM_WindowQuery(benchmark::State& state) {
+    typedef RTree<int, ELEMTYPE, 2, ELEMTYPE, MAXNODES, MAXNODES / 2, RTreePoolAllocator, LAYOUT> TREE;
+    const TREE& tree = getTree<TREE>();
+    const double window = (double) state.range(0);
+
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> position(0.0, WORLD_SIZE - window);
+    std::vector<typename TREE::Rect> queries(QUERY_COUNT);
+    for (auto& query : queries) {
+        for (int axis = 0; axis < 2; ++axis) {
+            query.m_min[axis] = position(rng);
+            query.m_max[axis] = query.m_min[axis] + window;
+        }
+    }
+
+    auto visitor = [](const int&) {
+        return true;
+    };
+
+    std::size_t hits = 0;
+    std::size_t next = 0;
+    for (auto _ : state) {
+        const auto& query = queries[next++ % QUERY_COUNT];
+        hits += tree.Search(query.m_min, query.m_max, visitor);
+    }
+    state.counters["hits"] = benchmark::Counter((double) hits / state.iterations());
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(BM_WindowQuery, double, 8, RTreeAoSLayout)->Arg(1)->Arg(10);
+BENCHMARK_TEMPLATE(BM_WindowQuery, double, 8, RTreeSoALayout)->Arg(1)->Arg(10);
+BENCHMARK_TEMPLATE(BM_WindowQuery, float, 8, RTreeAoSLayout)->Arg(1)->Arg(10);
+BENCHMARK_TEMPLATE(BM_WindowQuery, float, 8, RTreeSoALayout)->Arg(1)->Arg(10);
+BENCHMARK_TEMPLATE(BM_WindowQuery, double, 16, RTreeAoSLayout)->Arg(1)->Arg(10);
+BENCHMARK_TEMPLATE(BM_WindowQuery, double, 16, RTreeSoALayout)->Arg(1)->Arg(10);
+BENCHMARK_TEMPLATE(BM_WindowQuery, float, 16, RTreeAoSLayout)->Arg(1)->Arg(10);
+BENCHMARK_TEMPLATE(BM_WindowQuery, float, 16, RTreeSoALayout)->Arg(1)->Arg(10);
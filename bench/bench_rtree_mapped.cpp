@@ -0,0 +1,93 @@
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "algorithm/geometry/rtree_mapped.h"
+
+// 打开一个大索引：逐字段读取的 Load 与映射格式的 Open，以及两者的窗口查询
+
+namespace {
+
+typedef RTree<int, double, 2> TREE;
+typedef RTreeMappedView<int, double, 2> VIEW;
+
+const int ENTRY_COUNT = 1000000;
+const double WORLD_SIZE = 1000.0;
+const char* STREAM_FILE = "bench_rtree_stream.bin";
+const char* MAPPED_FILE = "bench_rtree_mapped.bin";
+
+// 生成两种格式的文件，只做一次
+void writeFiles() {
+    static bool written = false;
+    if (written) {
+        return;
+    }
+    TREE tree;
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> position(0.0, WORLD_SIZE);
+    std::uniform_real_distribution<double> size(0.0, 1.0);
+    for (int i = 0; i < ENTRY_COUNT; ++i) {
+        double min[2] = {position(rng), position(rng)};
+        double max[2] = {min[0] + size(rng), min[1] + size(rng)};
+        tree.Insert(min, max, i);
+    }
+    tree.Save(STREAM_FILE);
+    VIEW::Save(tree, MAPPED_FILE);
+    written = true;
+}
+
+void BM_StreamLoad(benchmark::State& state) {
+    writeFiles();
+    for (auto _ : state) {
+        TREE tree;
+        tree.Load(STREAM_FILE);
+        benchmark::DoNotOptimize(tree.Count());
+    }
+}
+
+void BM_MappedOpen(benchmark::State& state) {
+    writeFiles();
+    for (auto _ : state) {
+        VIEW view;
+        view.Open(MAPPED_FILE, state.range(0) != 0);
+        benchmark::DoNotOptimize(view.Count());
+    }
+}
+
+template <class INDEX>
+void windowQueries(benchmark::State& state, const INDEX& index) {
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> position(0.0, WORLD_SIZE - 10.0);
+    std::size_t hits = 0;
+    for (auto _ : state) {
+        double min[2] = {position(rng), position(rng)};
+        double max[2] = {min[0] + 10.0, min[1] + 10.0};
+        hits += index.Search(min, max, [](const int&) {
+            return true;
+        });
+    }
+    state.counters["hits"] = benchmark::Counter((double) hits / state.iterations());
+}
+
+void BM_TreeQuery(benchmark::State& state) {
+    writeFiles();
+    TREE tree;
+    tree.Load(STREAM_FILE);
+    windowQueries(state, tree);
+}
+
+void BM_MappedQuery(benchmark::State& state) {
+    writeFiles();
+    VIEW view;
+    view.Open(MAPPED_FILE);
+    windowQueries(state, view);
+}
+
+} // namespace
+
+BENCHMARK(BM_StreamLoad)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_MappedOpen)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_TreeQuery);
+BENCHMARK(BM_MappedQuery);
@@ -0,0 +1,132 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "algorithm/geometry/rtree.h"
+
+// 命中后读取数据：每条记录单独分配、树中存指针，与树内旁路数组连续存放数据的对比
+// 两棵树都用 STR 批量构建，旁路数组按叶子顺序排列
+
+namespace {
+
+const int ENTRY_COUNT = 500000;
+const double WORLD_SIZE = 1000.0;
+
+struct Record {
+    double weight;
+    double geometry[7];
+
+    bool operator==(const Record& other) const {
+        return std::equal(geometry, geometry + 7, other.geometry) && weight == other.weight;
+    }
+};
+
+struct Entry {
+    double min[2];
+    double max[2];
+    Record record;
+};
+
+std::vector<Entry> makeEntries() {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> position(0.0, WORLD_SIZE);
+    std::uniform_real_distribution<double> size(0.0, 1.0);
+    std::vector<Entry> entries(ENTRY_COUNT);
+    for (auto& entry : entries) {
+        for (int axis = 0; axis < 2; ++axis) {
+            entry.min[axis] = position(rng);
+            entry.max[axis] = entry.min[axis] + size(rng);
+        }
+        entry.record.weight = size(rng);
+        std::fill(entry.record.geometry, entry.record.geometry + 7, entry.record.weight);
+    }
+    return entries;
+}
+
+typedef RTree<const Record*, double, 2> POINTER_TREE;
+typedef RTree<Record, double, 2> PAYLOAD_TREE;
+
+const POINTER_TREE& getPointerTree() {
+    static POINTER_TREE tree;
+    static std::vector<std::unique_ptr<Record>> records;
+    if (records.empty()) {
+        auto entries = makeEntries();
+        // 按随机顺序分配，模拟长期运行后分散在堆上的记录
+        std::vector<int> order(ENTRY_COUNT);
+        for (int i = 0; i < ENTRY_COUNT; ++i) {
+            order[i] = i;
+        }
+        std::shuffle(order.begin(), order.end(), std::mt19937(3));
+        records.resize(ENTRY_COUNT);
+        for (int i : order) {
+            records[i].reset(new Record(entries[i].record));
+        }
+        std::vector<std::pair<POINTER_TREE::Rect, const Record*>> items(ENTRY_COUNT);
+        for (int i = 0; i < ENTRY_COUNT; ++i) {
+            std::copy(entries[i].min, entries[i].min + 2, items[i].first.m_min);
+            std::copy(entries[i].max, entries[i].max + 2, items[i].first.m_max);
+            items[i].second = records[i].get();
+        }
+        tree.BulkLoad(items.begin(), items.end());
+    }
+    return tree;
+}
+
+const PAYLOAD_TREE& getPayloadTree() {
+    static PAYLOAD_TREE tree;
+    static bool built = false;
+    if (!built) {
+        auto entries = makeEntries();
+        std::vector<std::pair<PAYLOAD_TREE::Rect, Record>> items(ENTRY_COUNT);
+        for (int i = 0; i < ENTRY_COUNT; ++i) {
+            std::copy(entries[i].min, entries[i].min + 2, items[i].first.m_min);
+            std::copy(entries[i].max, entries[i].max + 2, items[i].first.m_max);
+            items[i].second = entries[i].record;
+        }
+        tree.BulkLoad(items.begin(), items.end());
+        built = true;
+    }
+    return tree;
+}
+
+double weightOf(const Record* record) {
+    return record->weight;
+}
+
+double weightOf(const Record& record) {
+    return record.weight;
+}
+
+template <class TREE>
+void runQueries(benchmark::State& state, const TREE& tree) {
+    const double window = (double) state.range(0);
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> position(0.0, WORLD_SIZE - window);
+
+    double total = 0.0;
+    for (auto _ : state) {
+        double min[2] = {position(rng), position(rng)};
+        double max[2] = {min[0] + window, min[1] + window};
+        tree.Search(min, max, [&total](const typename TREE::DataType& data) {
+            total += weightOf(data);
+            return true;
+        });
+    }
+    benchmark::DoNotOptimize(total);
+}
+
+void BM_PointerPayload(benchmark::State& state) {
+    runQueries(state, getPointerTree());
+}
+
+void BM_SideStoredPayload(benchmark::State& state) {
+    runQueries(state, getPayloadTree());
+}
+
+} // namespace
+
+BENCHMARK(BM_PointerPayload)->Arg(5)->Arg(20);
+BENCHMARK(BM_SideStoredPayload)->Arg(5)->Arg(20);
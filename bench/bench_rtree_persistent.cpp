@@ -0,0 +1,92 @@
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <vector>
+
+#include "algorithm/geometry/rtree.h"
+#include "algorithm/geometry/rtree_persistent.h"
+
+// 百万条目的多版本树：每个新版本复制（O(1)）后改一条，只保留最近 100 个版本
+// 与每个版本整份重建一棵 RTree 对比写入耗时，计数器给出 100 个版本共占的节点数与字节数
+
+namespace {
+
+typedef RTree<int, double, 2> TREE;
+typedef RTreePersistent<int, double, 2> PERSISTENT;
+
+const int ENTRY_COUNT = 1000000;
+const int VERSION_COUNT = 100;
+const double WORLD_SIZE = 1000.0;
+
+std::vector<std::pair<TREE::Rect, int>> entries;
+
+const PERSISTENT& getBase() {
+    static PERSISTENT tree;
+    if (entries.empty()) {
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<double> position(0.0, WORLD_SIZE);
+        std::uniform_real_distribution<double> size(0.0, 1.0);
+        entries.resize(ENTRY_COUNT);
+        for (int i = 0; i < ENTRY_COUNT; ++i) {
+            for (int axis = 0; axis < 2; ++axis) {
+                entries[i].first.m_min[axis] = position(rng);
+                entries[i].first.m_max[axis] = entries[i].first.m_min[axis] + size(rng);
+            }
+            entries[i].second = i;
+            tree.Insert(entries[i].first.m_min, entries[i].first.m_max, i);
+        }
+    }
+    return tree;
+}
+
+// 新版本：复制上一个版本，随机移动一个条目
+void BM_VersionMove(benchmark::State& state) {
+    std::vector<PERSISTENT> versions(VERSION_COUNT, getBase());
+    std::vector<TREE::Rect> rects(ENTRY_COUNT);
+    for (int i = 0; i < ENTRY_COUNT; ++i) {
+        rects[i] = entries[i].first;
+    }
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> pick(0, ENTRY_COUNT - 1);
+    std::uniform_real_distribution<double> step(-0.5, 0.5);
+
+    size_t latest = 0;
+    for (auto _ : state) {
+        const size_t next = (latest + 1) % VERSION_COUNT;
+        versions[next] = versions[latest];
+        latest = next;
+
+        const int id = pick(rng);
+        TREE::Rect moved = rects[id];
+        for (int axis = 0; axis < 2; ++axis) {
+            const double delta = step(rng);
+            moved.m_min[axis] += delta;
+            moved.m_max[axis] += delta;
+        }
+        versions[latest].Remove(rects[id].m_min, rects[id].m_max, id);
+        versions[latest].Insert(moved.m_min, moved.m_max, id);
+        rects[id] = moved;
+    }
+
+    const size_t nodes = PERSISTENT::CountNodes(versions.begin(), versions.end());
+    const PERSISTENT single = versions[latest];
+    const size_t singleNodes = PERSISTENT::CountNodes(&single, &single + 1);
+    state.counters["nodes"] = (double) nodes;
+    state.counters["singleNodes"] = (double) singleNodes;
+    state.counters["MB"] = nodes * PERSISTENT::NodeBytes() / 1e6;
+}
+
+// 对照：每个版本都是整份副本，用 BulkLoad 重建
+void BM_FullCopy(benchmark::State& state) {
+    getBase();
+    for (auto _ : state) {
+        TREE tree;
+        tree.BulkLoad(entries.begin(), entries.end());
+        benchmark::DoNotOptimize(tree.Count());
+    }
+}
+
+} // namespace
+
+BENCHMARK(BM_VersionMove)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_FullCopy)->Unit(benchmark::kMillisecond);
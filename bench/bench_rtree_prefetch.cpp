@@ -0,0 +1,67 @@
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <vector>
+
+#include "algorithm/geometry/rtree.h"
+
+// 远大于缓存的树上的窗口查询：深度优先的 Search 与按层预取的 SearchFrontier 对比，AoS 与 SoA 两种节点布局
+// 逐条插入构建，节点散落在堆上；查询点随机，几乎每个节点都要从内存读取。参数为窗口边长
+
+namespace {
+
+typedef RTree<int, double, 2> AOS_TREE;
+typedef RTree<int, double, 2, double, 8, 4, RTreePoolAllocator, RTreeSoALayout> SOA_TREE;
+
+const int ENTRY_COUNT = 2000000;
+const double WORLD_SIZE = 1000.0;
+
+template <class TREE>
+const TREE& getTree() {
+    static TREE tree;
+    if (tree.Count() == 0) {
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<double> position(0.0, WORLD_SIZE);
+        std::uniform_real_distribution<double> size(0.0, 1.0);
+        for (int i = 0; i < ENTRY_COUNT; ++i) {
+            double min[2], max[2];
+            for (int axis = 0; axis < 2; ++axis) {
+                min[axis] = position(rng);
+                max[axis] = min[axis] + size(rng);
+            }
+            tree.Insert(min, max, i);
+        }
+    }
+    return tree;
+}
+
+template <class TREE, bool FRONTIER>
+void BM_Window(benchmark::State& state) {
+    const TREE& tree = getTree<TREE>();
+    const double window = (double) state.range(0);
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> position(0.0, WORLD_SIZE - window);
+    typename TREE::SearchBuffer buffer;
+    auto any = [](const int&) {
+        return true;
+    };
+
+    std::size_t total = 0;
+    for (auto _ : state) {
+        const double min[2] = {position(rng), position(rng)};
+        const double max[2] = {min[0] + window, min[1] + window};
+        if (FRONTIER) {
+            total += tree.SearchFrontier(min, max, any, buffer);
+        } else {
+            total += tree.Search(min, max, any);
+        }
+    }
+    state.counters["hits"] = benchmark::Counter((double) total / state.iterations());
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(BM_Window, AOS_TREE, false)->Arg(1)->Arg(10)->Arg(50);
+BENCHMARK_TEMPLATE(BM_Window, AOS_TREE, true)->Arg(1)->Arg(10)->Arg(50);
+BENCHMARK_TEMPLATE(BM_Window, SOA_TREE, false)->Arg(1)->Arg(10)->Arg(50);
+BENCHMARK_TEMPLATE(BM_Window, SOA_TREE, true)->Arg(1)->Arg(10)->Arg(50);
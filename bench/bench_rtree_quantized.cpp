@@ -0,0 +1,92 @@
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <vector>
+
+#include "algorithm/geometry/rtree_frozen.h"
+#include "algorithm/geometry/rtree_quantized.h"
+
+// 量化节点的只读树：分支框按父节点覆盖范围量化为 8 或 16 位，与原树、冻结副本的窗口查询对比
+// 参数为窗口边长，计数器给出每条数据占用的字节数和命中数；候选模式的命中含舍入带来的多余结果
+
+namespace {
+
+typedef RTree<int, double, 2> TREE;
+typedef RTreeFrozen<int, double, 2> FROZEN;
+typedef RTreeQuantized<int, double, 2> QUANTIZED8;
+typedef RTreeQuantized<int, double, 2, double, 8, uint16_t> QUANTIZED16;
+
+const int ENTRY_COUNT = 1000000;
+const double WORLD_SIZE = 1000.0;
+
+const TREE& getTree() {
+    static TREE tree;
+    if (tree.Count() == 0) {
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<double> position(0.0, WORLD_SIZE);
+        std::uniform_real_distribution<double> size(0.0, 1.0);
+        for (int i = 0; i < ENTRY_COUNT; ++i) {
+            TREE::Rect rect;
+            for (int axis = 0; axis < 2; ++axis) {
+                rect.m_min[axis] = position(rng);
+                rect.m_max[axis] = rect.m_min[axis] + size(rng);
+            }
+            tree.Insert(rect.m_min, rect.m_max, i);
+        }
+    }
+    return tree;
+}
+
+template <class INDEX>
+void runWindows(benchmark::State& state, const INDEX& index, size_t bytes) {
+    const double window = (double) state.range(0);
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> position(0.0, WORLD_SIZE - window);
+
+    std::size_t total = 0;
+    for (auto _ : state) {
+        const double min[2] = {position(rng), position(rng)};
+        const double max[2] = {min[0] + window, min[1] + window};
+        total += index.Search(min, max, [](const int&) {
+            return true;
+        });
+    }
+    state.counters["hits"] = benchmark::Counter((double) total / state.iterations());
+    state.counters["bytes/entry"] = (double) bytes / ENTRY_COUNT;
+}
+
+void BM_TreeWindow(benchmark::State& state) {
+    const auto& tree = getTree();
+    runWindows(state, tree, (size_t) (tree.CalcQuality().bytesPerEntry * ENTRY_COUNT));
+}
+
+void BM_FrozenWindow(benchmark::State& state) {
+    static FROZEN frozen(getTree(), RTreeFrozenLayout::BREADTH_FIRST);
+    runWindows(state, frozen, frozen.MemoryBytes());
+}
+
+void BM_Quantized8Window(benchmark::State& state) {
+    static QUANTIZED8 quantized(getTree(), RTreeQuantizedLeaves::EXACT);
+    runWindows(state, quantized, quantized.MemoryBytes());
+    state.counters["node"] = sizeof(QUANTIZED8::Node);
+}
+
+void BM_Quantized8Candidates(benchmark::State& state) {
+    static QUANTIZED8 quantized(getTree(), RTreeQuantizedLeaves::CANDIDATES);
+    runWindows(state, quantized, quantized.MemoryBytes());
+    state.counters["node"] = sizeof(QUANTIZED8::Node);
+}
+
+void BM_Quantized16Window(benchmark::State& state) {
+    static QUANTIZED16 quantized(getTree(), RTreeQuantizedLeaves::EXACT);
+    runWindows(state, quantized, quantized.MemoryBytes());
+    state.counters["node"] = sizeof(QUANTIZED16::Node);
+}
+
+} // namespace
+
+BENCHMARK(BM_TreeWindow)->Arg(1)->Arg(10);
+BENCHMARK(BM_FrozenWindow)->Arg(1)->Arg(10);
+BENCHMARK(BM_Quantized8Window)->Arg(1)->Arg(10);
+BENCHMARK(BM_Quantized8Candidates)->Arg(1)->Arg(10);
+BENCHMARK(BM_Quantized16Window)->Arg(1)->Arg(10);
@@ -0,0 +1,107 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "algorithm/geometry/rtree.h"
+
+// 求线段的首个命中：按进入顺序遍历的 RayCast 与先用包围盒 Search 再逐个求交取最近的对比
+// 条目为小圆，参数为线段长度
+
+namespace {
+
+typedef RTree<int, double, 2> TREE;
+
+const int ENTRY_COUNT = 1000000;
+const double WORLD_SIZE = 1000.0;
+const double RADIUS = 0.4;
+
+std::vector<double> centers;
+
+const TREE& getTree() {
+    static TREE tree;
+    if (centers.empty()) {
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<double> position(0.0, WORLD_SIZE);
+        std::vector<std::pair<TREE::Rect, int>> items(ENTRY_COUNT);
+        centers.resize(2 * ENTRY_COUNT);
+        for (int i = 0; i < ENTRY_COUNT; ++i) {
+            for (int axis = 0; axis < 2; ++axis) {
+                centers[2 * i + axis] = position(rng);
+                items[i].first.m_min[axis] = centers[2 * i + axis] - RADIUS;
+                items[i].first.m_max[axis] = centers[2 * i + axis] + RADIUS;
+            }
+            items[i].second = i;
+        }
+        tree.BulkLoad(items.begin(), items.end());
+    }
+    return tree;
+}
+
+bool hitCircle(int id, const double origin[2], const double direction[2], double& t) {
+    const double offset[2] = {origin[0] - centers[2 * id], origin[1] - centers[2 * id + 1]};
+    const double a = direction[0] * direction[0] + direction[1] * direction[1];
+    const double b = 2 * (direction[0] * offset[0] + direction[1] * offset[1]);
+    const double c = offset[0] * offset[0] + offset[1] * offset[1] - RADIUS * RADIUS;
+    const double disc = b * b - 4 * a * c;
+    if (disc < 0) {
+        return false;
+    }
+    const double t1 = (-b + std::sqrt(disc)) / (2 * a);
+    if (t1 < 0) {
+        return false;
+    }
+    t = std::max((-b - std::sqrt(disc)) / (2 * a), 0.0);
+    return true;
+}
+
+template <bool RAY_CAST>
+void BM_FirstHit(benchmark::State& state) {
+    const TREE& tree = getTree();
+    const double length = (double) state.range(0);
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> position(0.0, WORLD_SIZE);
+    std::uniform_real_distribution<double> angle(0.0, 6.283185307179586);
+
+    int hits = 0;
+    std::vector<std::pair<double, int>> candidates;
+    for (auto _ : state) {
+        const double origin[2] = {position(rng), position(rng)};
+        const double heading = angle(rng);
+        const double direction[2] = {std::cos(heading) * length, std::sin(heading) * length};
+
+        if (RAY_CAST) {
+            std::pair<double, int> hit;
+            hits += tree.RayCast(
+                    origin, direction, 1.0,
+                    [&](const int& id, double& t) {
+                        return hitCircle(id, origin, direction, t);
+                    },
+                    hit);
+        } else {
+            // 包围盒查询，逐个精确求交后取最近
+            const double min[2] = {std::min(origin[0], origin[0] + direction[0]),
+                                   std::min(origin[1], origin[1] + direction[1])};
+            const double max[2] = {std::max(origin[0], origin[0] + direction[0]),
+                                   std::max(origin[1], origin[1] + direction[1])};
+            candidates.clear();
+            tree.Search(min, max, [&](const int& id) {
+                double t;
+                if (hitCircle(id, origin, direction, t) && t <= 1.0) {
+                    candidates.emplace_back(t, id);
+                }
+                return true;
+            });
+            std::sort(candidates.begin(), candidates.end());
+            hits += !candidates.empty();
+        }
+    }
+    state.counters["hitRate"] = benchmark::Counter((double) hits / state.iterations());
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(BM_FirstHit, false)->Arg(10)->Arg(100)->Arg(1000);
+BENCHMARK_TEMPLATE(BM_FirstHit, true)->Arg(10)->Arg(100)->Arg(1000);
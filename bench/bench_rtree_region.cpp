@@ -0,0 +1,124 @@
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "algorithm/geometry/geometry_algo_core.h"
+#include "algorithm/geometry/rtree.h"
+
+// 圆形与多边形区域查询：包围盒 Search 后由调用方逐个过滤，与按区域剪枝并整棵报告完全包含子树的对比
+// 参数为区域半径
+
+namespace {
+
+typedef RTree<int, double, 2> TREE;
+
+const int ENTRY_COUNT = 1000000;
+const double WORLD_SIZE = 1000.0;
+
+// 调用方自己保存的条目矩形，过滤时按编号取用
+std::vector<TREE::Rect> rects;
+
+const TREE& getTree() {
+    static TREE tree;
+    if (rects.empty()) {
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<double> position(0.0, WORLD_SIZE);
+        std::uniform_real_distribution<double> size(0.0, 1.0);
+        rects.resize(ENTRY_COUNT);
+        for (int i = 0; i < ENTRY_COUNT; ++i) {
+            for (int axis = 0; axis < 2; ++axis) {
+                rects[i].m_min[axis] = position(rng);
+                rects[i].m_max[axis] = rects[i].m_min[axis] + size(rng);
+            }
+            tree.Insert(rects[i].m_min, rects[i].m_max, i);
+        }
+    }
+    return tree;
+}
+
+template <bool REGION>
+void BM_Radius(benchmark::State& state) {
+    const TREE& tree = getTree();
+    const double radius = (double) state.range(0);
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> position(radius, WORLD_SIZE - radius);
+
+    std::size_t total = 0;
+    for (auto _ : state) {
+        const double center[2] = {position(rng), position(rng)};
+        auto count = [&total](const int&) {
+            ++total;
+            return true;
+        };
+        if (REGION) {
+            tree.SearchRadius(center, radius, count);
+        } else {
+            const double min[2] = {center[0] - radius, center[1] - radius};
+            const double max[2] = {center[0] + radius, center[1] + radius};
+            tree.Search(min, max, [&](const int& id) {
+                return TREE::MinDistSq(center, rects[id]) > radius * radius || count(id);
+            });
+        }
+    }
+    state.counters["hits"] = benchmark::Counter((double) total / state.iterations());
+}
+
+// 正八边形，逐个过滤时检查条目矩形的四个角是否都在多边形内
+template <bool REGION>
+void BM_Polygon(benchmark::State& state) {
+    const TREE& tree = getTree();
+    const double radius = (double) state.range(0);
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> position(radius, WORLD_SIZE - radius);
+
+    auto inside = [](const geometry::POLYGON& polygon, double x, double y) {
+        bool result = false;
+        for (size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++) {
+            if ((polygon[i].y > y) != (polygon[j].y > y) &&
+                x < (polygon[j].x - polygon[i].x) * (y - polygon[i].y) / (polygon[j].y - polygon[i].y) +
+                            polygon[i].x) {
+                result = !result;
+            }
+        }
+        return result;
+    };
+
+    std::size_t total = 0;
+    geometry::POLYGON polygon;
+    for (auto _ : state) {
+        const double center[2] = {position(rng), position(rng)};
+        polygon.clear();
+        for (int i = 0; i < 8; ++i) {
+            polygon.emplace_back(center[0] + radius * std::cos(i * 0.785398),
+                                 center[1] + radius * std::sin(i * 0.785398));
+        }
+        auto count = [&total](const int&) {
+            ++total;
+            return true;
+        };
+        if (REGION) {
+            tree.SearchPolygon(polygon, count, TREE::RegionMatch::INSIDE);
+        } else {
+            const double min[2] = {center[0] - radius, center[1] - radius};
+            const double max[2] = {center[0] + radius, center[1] + radius};
+            tree.Search(min, max, [&](const int& id) {
+                const TREE::Rect& rect = rects[id];
+                if (inside(polygon, rect.m_min[0], rect.m_min[1]) && inside(polygon, rect.m_max[0], rect.m_min[1]) &&
+                    inside(polygon, rect.m_max[0], rect.m_max[1]) && inside(polygon, rect.m_min[0], rect.m_max[1])) {
+                    count(id);
+                }
+                return true;
+            });
+        }
+    }
+    state.counters["hits"] = benchmark::Counter((double) total / state.iterations());
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(BM_Radius, false)->Arg(10)->Arg(50)->Arg(200);
+BENCHMARK_TEMPLATE(BM_Radius, true)->Arg(10)->Arg(50)->Arg(200);
+BENCHMARK_TEMPLATE(BM_Polygon, false)->Arg(10)->Arg(50)->Arg(200);
+BENCHMARK_TEMPLATE(BM_Polygon, true)->Arg(10)->Arg(50)->Arg(200);
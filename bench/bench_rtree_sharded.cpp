@@ -0,0 +1,158 @@
+#include <benchmark/benchmark.h>
+
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "algorithm/geometry/rtree.h"
+#include "algorithm/geometry/rtree_sharded.h"
+
+// 并行写入吞吐：参数为提交线程数，每轮写入 50 万条目直到全部生效
+// 一把互斥锁保护的 RTree 与 4 个分片各带写线程的 RTreeSharded 对比；另测两者的窗口查询与 k 近邻
+
+namespace {
+
+typedef RTree<int, double, 2> TREE;
+typedef RTreeSharded<int, double, 2> SHARDED;
+
+const int ENTRY_COUNT = 500000;
+const int SHARD_COUNT = 4;
+const double WORLD_SIZE = 1000.0;
+const double WORLD_MIN[2] = {0, 0};
+const double WORLD_MAX[2] = {WORLD_SIZE, WORLD_SIZE};
+
+const std::vector<TREE::Rect>& getRects() {
+    static std::vector<TREE::Rect> rects;
+    if (rects.empty()) {
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<double> position(0.0, WORLD_SIZE);
+        std::uniform_real_distribution<double> size(0.0, 1.0);
+        rects.resize(ENTRY_COUNT);
+        for (auto& rect : rects) {
+            for (int axis = 0; axis < 2; ++axis) {
+                rect.m_min[axis] = position(rng);
+                rect.m_max[axis] = rect.m_min[axis] + size(rng);
+            }
+        }
+    }
+    return rects;
+}
+
+template <class FUNC>
+void onThreads(int threadCount, FUNC&& func) {
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&func, t]() {
+            func(t);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void BM_IngestLocked(benchmark::State& state) {
+    const auto& rects = getRects();
+    const int threadCount = (int) state.range(0);
+    for (auto _ : state) {
+        TREE tree;
+        std::mutex mutex;
+        onThreads(threadCount, [&](int t) {
+            for (int i = t; i < ENTRY_COUNT; i += threadCount) {
+                std::lock_guard<std::mutex> lock(mutex);
+                tree.Insert(rects[i].m_min, rects[i].m_max, i);
+            }
+        });
+        benchmark::DoNotOptimize(tree.Count());
+    }
+    state.SetItemsProcessed(state.iterations() * ENTRY_COUNT);
+}
+
+void BM_IngestSharded(benchmark::State& state) {
+    const auto& rects = getRects();
+    const int threadCount = (int) state.range(0);
+    for (auto _ : state) {
+        SHARDED tree(SHARD_COUNT, WORLD_MIN, WORLD_MAX);
+        onThreads(threadCount, [&](int t) {
+            for (int i = t; i < ENTRY_COUNT; i += threadCount) {
+                tree.Insert(rects[i].m_min, rects[i].m_max, i);
+            }
+        });
+        tree.Flush();
+        benchmark::DoNotOptimize(tree.Count());
+    }
+    state.SetItemsProcessed(state.iterations() * ENTRY_COUNT);
+}
+
+const TREE& getTree() {
+    static TREE tree;
+    if (tree.Count() == 0) {
+        const auto& rects = getRects();
+        for (int i = 0; i < ENTRY_COUNT; ++i) {
+            tree.Insert(rects[i].m_min, rects[i].m_max, i);
+        }
+    }
+    return tree;
+}
+
+const SHARDED& getSharded() {
+    static SHARDED tree(SHARD_COUNT, WORLD_MIN, WORLD_MAX);
+    if (tree.Count() == 0) {
+        const auto& rects = getRects();
+        for (int i = 0; i < ENTRY_COUNT; ++i) {
+            tree.Insert(rects[i].m_min, rects[i].m_max, i);
+        }
+        tree.Flush();
+    }
+    return tree;
+}
+
+// 窗口查询：参数 0 为单棵 RTree，1 为分片
+void BM_Search(benchmark::State& state) {
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> position(0.0, WORLD_SIZE - 20);
+    auto visitor = [](const int&) {
+        return true;
+    };
+    const TREE& tree = getTree();
+    const SHARDED& sharded = getSharded();
+    int found = 0;
+    for (auto _ : state) {
+        const double min[2] = {position(rng), position(rng)};
+        const double max[2] = {min[0] + 20, min[1] + 20};
+        found += state.range(0) ? sharded.Search(min, max, visitor) : tree.Search(min, max, visitor);
+    }
+    benchmark::DoNotOptimize(found);
+}
+
+// k = 16 近邻，点落在分片边界附近时要合并多个分片
+void BM_NearestNeighbors(benchmark::State& state) {
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> position(0.0, WORLD_SIZE);
+    const auto& rects = getRects();
+    auto squaredDist = [&rects](const double point[2], const int& id) {
+        return TREE::MinDistSq(point, rects[id]);
+    };
+    auto all = [](const int&) {
+        return true;
+    };
+    TREE::NearestNeighborBuffer treeBuffer;
+    SHARDED::NearestNeighborBuffer shardedBuffer;
+    const TREE& tree = getTree();
+    const SHARDED& sharded = getSharded();
+    int found = 0;
+    for (auto _ : state) {
+        const double point[2] = {position(rng), position(rng)};
+        found += state.range(0) ? sharded.NearestNeighbors(point, 16, squaredDist, all, shardedBuffer)
+                                : tree.NearestNeighbors(point, 16, squaredDist, all, treeBuffer);
+    }
+    benchmark::DoNotOptimize(found);
+}
+
+} // namespace
+
+BENCHMARK(BM_IngestLocked)->Arg(1)->Arg(2)->Arg(4)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_IngestSharded)->Arg(1)->Arg(2)->Arg(4)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_Search)->Arg(0)->Arg(1);
+BENCHMARK(BM_NearestNeighbors)->Arg(0)->Arg(1);
@@ -0,0 +1,156 @@
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "algorithm/geometry/rtree.h"
+
+// 比较二次分裂、R* 与希尔伯特插入策略、球体积与矩形体积度量：成簇数据上的插入耗时、窗口查询耗时、访问节点数与节点填充率
+
+namespace {
+
+const int ENTRY_COUNT = 200000;
+const int CLUSTER_COUNT = 64;
+const int QUERY_COUNT = 4096;
+const double WORLD_SIZE = 1000.0;
+
+// 高斯簇，簇的大小各不相同，按簇依次插入以模拟逐块导入的数据
+std::vector<std::pair<RTree<int, double, 2>::Rect, int>> makeClusters() {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> centre(0.0, WORLD_SIZE);
+    std::uniform_real_distribution<double> spread(2.0, 20.0);
+    std::uniform_real_distribution<double> size(0.0, 0.5);
+
+    std::vector<std::pair<RTree<int, double, 2>::Rect, int>> entries;
+    for (int c = 0; c < CLUSTER_COUNT; ++c) {
+        std::normal_distribution<double> x(centre(rng), spread(rng));
+        std::normal_distribution<double> y(centre(rng), spread(rng));
+        for (int i = 0; i < ENTRY_COUNT / CLUSTER_COUNT; ++i) {
+            RTree<int, double, 2>::Rect rect;
+            rect.m_min[0] = x(rng);
+            rect.m_min[1] = y(rng);
+            rect.m_max[0] = rect.m_min[0] + size(rng);
+            rect.m_max[1] = rect.m_min[1] + size(rng);
+            entries.emplace_back(rect, (int) entries.size());
+        }
+    }
+    return entries;
+}
+
+const std::vector<std::pair<RTree<int, double, 2>::Rect, int>>& getEntries() {
+    static const auto entries = makeClusters();
+    return entries;
+}
+
+// 查询窗口以数据点为中心，保证落在簇内
+std::vector<RTree<int, double, 2>::Rect> makeQueries(double window) {
+    const auto& entries = getEntries();
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> pick(0, (int) entries.size() - 1);
+
+    std::vector<RTree<int, double, 2>::Rect> queries(QUERY_COUNT);
+    for (auto& query : queries) {
+        const auto& rect = entries[pick(rng)].first;
+        for (int axis = 0; axis < 2; ++axis) {
+            query.m_min[axis] = rect.m_min[axis] - window / 2;
+            query.m_max[axis] = rect.m_min[axis] + window / 2;
+        }
+    }
+    return queries;
+}
+
+// 统计查询经过的节点数，与 Search 的剪枝条件相同
+template <class TREE>
+class VisitCounter : public TREE {
+public:
+    int countVisits(const double min[2], const double max[2]) const {
+        typename TREE::Rect query;
+        for (int axis = 0; axis < 2; ++axis) {
+            query.m_min[axis] = min[axis];
+            query.m_max[axis] = max[axis];
+        }
+        return countRec(this->m_root, query);
+    }
+
+private:
+    int countRec(const typename TREE::Node* node, const typename TREE::Rect& query) const {
+        int visits = 1;
+        if (!node->IsLeaf()) {
+            for (int i = 0; i < node->m_count; ++i) {
+                if (this->Overlap(&query, &node->m_branch[i].m_rect)) {
+                    visits += countRec(node->m_branch[i].m_child, query);
+                }
+            }
+        }
+        return visits;
+    }
+};
+
+template <class SPLITPOLICY, class VOLUMEPOLICY>
+using SplitTree =
+    VisitCounter<RTree<int, double, 2, double, 8, 4, RTreePoolAllocator, RTreeAoSLayout, SPLITPOLICY, VOLUMEPOLICY>>;
+
+template <class TREE>
+const TREE& getTree() {
+    static TREE tree;
+    static bool built = false;
+    if (!built) {
+        for (const auto& entry : getEntries()) {
+            tree.Insert(entry.first.m_min, entry.first.m_max, entry.second);
+        }
+        built = true;
+    }
+    return tree;
+}
+
+template <class SPLITPOLICY, class VOLUMEPOLICY>
+void BM_Insert(benchmark::State& state) {
+    const auto& entries = getEntries();
+    for (auto _ : state) {
+        SplitTree<SPLITPOLICY, VOLUMEPOLICY> tree;
+        for (const auto& entry : entries) {
+            tree.Insert(entry.first.m_min, entry.first.m_max, entry.second);
+        }
+        benchmark::DoNotOptimize(tree.Count());
+    }
+    state.SetItemsProcessed(state.iterations() * entries.size());
+}
+
+template <class SPLITPOLICY, class VOLUMEPOLICY>
+void BM_WindowQuery(benchmark::State& state) {
+    const auto& tree = getTree<SplitTree<SPLITPOLICY, VOLUMEPOLICY>>();
+    const auto queries = makeQueries((double) state.range(0));
+
+    double visits = 0;
+    for (const auto& query : queries) {
+        visits += tree.countVisits(query.m_min, query.m_max);
+    }
+
+    auto visitor = [](const int&) {
+        return true;
+    };
+
+    std::size_t hits = 0;
+    std::size_t next = 0;
+    for (auto _ : state) {
+        const auto& query = queries[next++ % QUERY_COUNT];
+        hits += tree.Search(query.m_min, query.m_max, visitor);
+    }
+    state.counters["hits"] = benchmark::Counter((double) hits / state.iterations());
+    state.counters["nodes"] = benchmark::Counter(visits / QUERY_COUNT);
+    state.counters["fill"] = benchmark::Counter(tree.CalcStats().fillFactor);
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(BM_Insert, RTreeQuadraticSplit, RTreeSphericalVolume)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Insert, RTreeQuadraticSplit, RTreeRectVolume)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Insert, RTreeRStarSplit, RTreeSphericalVolume)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Insert, RTreeRStarSplit, RTreeRectVolume)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Insert, RTreeHilbertSplit, RTreeSphericalVolume)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_WindowQuery, RTreeQuadraticSplit, RTreeSphericalVolume)->Arg(1)->Arg(10);
+BENCHMARK_TEMPLATE(BM_WindowQuery, RTreeQuadraticSplit, RTreeRectVolume)->Arg(1)->Arg(10);
+BENCHMARK_TEMPLATE(BM_WindowQuery, RTreeRStarSplit, RTreeSphericalVolume)->Arg(1)->Arg(10);
+BENCHMARK_TEMPLATE(BM_WindowQuery, RTreeRStarSplit, RTreeRectVolume)->Arg(1)->Arg(10);
+BENCHMARK_TEMPLATE(BM_WindowQuery, RTreeHilbertSplit, RTreeSphericalVolume)->Arg(1)->Arg(10);
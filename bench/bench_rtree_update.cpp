@@ -0,0 +1,77 @@
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <vector>
+
+#include "algorithm/geometry/rtree.h"
+
+// 移动对象：删除再插入与原地 Update 的开销，参数为每步最大位移
+
+namespace {
+
+typedef RTree<int, double, 2> TREE;
+
+const int ENTRY_COUNT = 200000;
+const double WORLD_SIZE = 1000.0;
+
+struct Item {
+    double min[2];
+    double max[2];
+};
+
+std::vector<Item> makeItems() {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> position(0.0, WORLD_SIZE);
+    std::uniform_real_distribution<double> size(0.0, 1.0);
+    std::vector<Item> items(ENTRY_COUNT);
+    for (auto& item : items) {
+        for (int axis = 0; axis < 2; ++axis) {
+            item.min[axis] = position(rng);
+            item.max[axis] = item.min[axis] + size(rng);
+        }
+    }
+    return items;
+}
+
+template <bool IN_PLACE>
+void BM_Move(benchmark::State& state) {
+    std::vector<Item> items = makeItems();
+    TREE tree;
+    for (int i = 0; i < ENTRY_COUNT; ++i) {
+        tree.Insert(items[i].min, items[i].max, i);
+    }
+
+    const double stepSize = state.range(0) / 100.0;
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> pick(0, ENTRY_COUNT - 1);
+    std::uniform_real_distribution<double> step(-stepSize, stepSize);
+
+    for (auto _ : state) {
+        const int id = pick(rng);
+        Item moved = items[id];
+        for (int axis = 0; axis < 2; ++axis) {
+            const double delta = step(rng);
+            moved.min[axis] += delta;
+            moved.max[axis] += delta;
+        }
+        if (IN_PLACE) {
+            tree.Update(items[id].min, items[id].max, moved.min, moved.max, id);
+        } else {
+            tree.Remove(items[id].min, items[id].max, id);
+            tree.Insert(moved.min, moved.max, id);
+        }
+        items[id] = moved;
+    }
+
+    const auto& stats = tree.GetUpdateStats();
+    const double updates = (double) state.iterations();
+    state.counters["inPlace"] = IN_PLACE ? stats.inPlace / updates : 0.0;
+    state.counters["enlarged"] = IN_PLACE ? stats.enlarged / updates : 0.0;
+    state.counters["reinserted"] = IN_PLACE ? stats.reinserted / updates : 0.0;
+}
+
+} // namespace
+
+// 参数以百分之一世界单位计
+BENCHMARK_TEMPLATE(BM_Move, false)->Arg(10)->Arg(100)->Arg(1000);
+BENCHMARK_TEMPLATE(BM_Move, true)->Arg(10)->Arg(100)->Arg(1000);
@@ -50,1960 +50,6223 @@
 
 // NOTE These next few lines may be win32 specific, you may need to modify them to compile on other platform
 #include <cassert>
+#include <climits>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <iterator>
 #include <limits>
+#include <new>
 #include <queue>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#if defined( __AVX__ )
+#include <immintrin.h>
+#elif defined( __SSE2__ ) || defined( _M_X64 )
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 #ifdef DEBUG
 #define ASSERT assert    // RTree uses ASSERT( condition )
 #else
 #define ASSERT( _x )
 #endif
 
+// Add to a query counter of RTree, compiled out unless its STATSPOLICY counts
+#define RTREE_COUNT( _counter, _amount ) \
+    do \
+    { \
+        if constexpr( STATSPOLICY::COUNTED ) \
+            m_queryCounters._counter.fetch_add( _amount, std::memory_order_relaxed ); \
+    } while( 0 )
+
 //
 // RTree.h
 //
 
 #define RTREE_TEMPLATE          template <class DATATYPE, class ELEMTYPE, int NUMDIMS, \
-    class ELEMTYPEREAL, int TMAXNODES, int TMINNODES>
+    class ELEMTYPEREAL, int TMAXNODES, int TMINNODES, class ALLOCATOR, class LAYOUT, \
+    class SPLITPOLICY, class VOLUMEPOLICY, class STATSPOLICY, class LAYERPOLICY>
 #define RTREE_SEARCH_TEMPLATE   template <class DATATYPE, class ELEMTYPE, int NUMDIMS, \
-    class ELEMTYPEREAL, int TMAXNODES, int TMINNODES, class VISITOR>
+    class ELEMTYPEREAL, int TMAXNODES, int TMINNODES, class ALLOCATOR, class LAYOUT, \
+    class SPLITPOLICY, class VOLUMEPOLICY, class STATSPOLICY, class LAYERPOLICY, class VISITOR>
 #define RTREE_QUAL              RTree<DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL, TMAXNODES, \
-    TMINNODES>
+    TMINNODES, ALLOCATOR, LAYOUT, SPLITPOLICY, VOLUMEPOLICY, STATSPOLICY, LAYERPOLICY>
 #define RTREE_SEARCH_QUAL       RTree<DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL, TMAXNODES, \
-    TMINNODES, VISITOR>
-
-#define RTREE_DONT_USE_MEMPOOLS     // This version does not contain a fixed memory allocator, fill in lines with EXAMPLE to implement one.
-#define RTREE_USE_SPHERICAL_VOLUME  // Better split classification, may be slower on some systems
+    TMINNODES, ALLOCATOR, LAYOUT, SPLITPOLICY, VOLUMEPOLICY, STATSPOLICY, LAYERPOLICY, VISITOR>
 
 // Fwd decl
 class RTFileStream;    // File I/O helper class, look below for implementation and notes.
 
+template <class DATATYPE, class ELEMTYPE, int NUMDIMS, class ELEMTYPEREAL>
+class RTreeMappedView; // Read-only view of a memory-mapped tree, see rtree_mapped.h
 
-/// \class RTree
-/// Implementation of RTree, a multidimensional bounding rectangle tree.
-/// Example usage: For a 3-dimensional tree use RTree<Object*, float, 3> myTree;
-///
-/// This modified, templated C++ version by Greg Douglas at Auran (http://www.auran.com)
-///
-/// DATATYPE Referenced data, should be int, void*, obj* etc. no larger than sizeof<void*> and simple type
-/// ELEMTYPE Type of element such as int or float
-/// NUMDIMS Number of dimensions such as 2 or 3
-/// ELEMTYPEREAL Type of element that allows fractional and large values such as float or double, for use in volume calcs
-///
-/// NOTES: Inserting and removing data requires the knowledge of its constant Minimal Bounding Rectangle.
-///        This version uses new/delete for nodes, I recommend using a fixed size allocator for efficiency.
-///        Instead of using a callback function for returned results, I recommend and efficient pre-sized, grow-only memory
-///        array similar to MFC CArray or STL Vector for returning search query result.
-///
-template <class DATATYPE, class ELEMTYPE, int NUMDIMS,
-          class ELEMTYPEREAL = ELEMTYPE, int TMAXNODES = 8, int TMINNODES = TMAXNODES / 2>
-class RTree
-{
-protected:
-
-    struct Node; // Fwd decl.  Used by other internal structs and iterator
+template <class DATATYPE, class ELEMTYPE, int NUMDIMS, class ELEMTYPEREAL>
+class RTreeFrozen;     // Immutable contiguous copy, see rtree_frozen.h
 
-public:
-    /// Minimal bounding rectangle (n-dimensional)
-    struct Rect
-    {
-        ELEMTYPE m_min[NUMDIMS]; ///< Min dimensions of bounding box
-        ELEMTYPE m_max[NUMDIMS]; ///< Max dimensions of bounding box
-    };
+template <class DATATYPE, class ELEMTYPE, int NUMDIMS, class ELEMTYPEREAL, int TMAXNODES, int TMINNODES>
+class RTreeSharded;    // Spatially partitioned shards with writer threads, see rtree_sharded.h
 
-    // These constant must be declared after Branch and before Node struct
-    // Stuck up here for MSVC 6 compiler.  NSVC .NET 2003 is much happier.
-    enum {
-        MAXNODES = TMAXNODES,                       ///< Max elements in node
-        MINNODES = TMINNODES                        ///< Min elements in node
-    };
+template <class DATATYPE, class ELEMTYPE, int NUMDIMS, class ELEMTYPEREAL, int TMAXNODES>
+class RTreeExternalBuilder; // Builds mapped trees larger than memory, see rtree_external.h
 
-    struct Statistics {
-        int maxDepth;
-        int avgDepth;
+template <class DATATYPE, class ELEMTYPE, int NUMDIMS, class ELEMTYPEREAL, int TMAXNODES, class CODE>
+class RTreeQuantized;  // Read-only copy with quantized branch boxes, see rtree_quantized.h
 
-        int maxNodeLoad;
-        int avgNodeLoad;
-        int totalItems;
-    };
 
+/// \class RTreeMemoryPool
+/// Fixed size object pool used by RTreePoolAllocator.
+/// Objects are carved out of cache line aligned chunks and recycled through an intrusive free
+/// list.  Release() hands every chunk back at once without visiting the objects, so TYPE must
+/// be trivially destructible.
+template <class TYPE, int CHUNKITEMS = 256>
+class RTreeMemoryPool
+{
 public:
+    enum
+    {
+        CACHE_LINE = 64
+    };
 
-    RTree();
-    virtual ~RTree();
-
-    /// Insert entry
-    /// \param a_min Min of bounding rect
-    /// \param a_max Max of bounding rect
-    /// \param a_dataId Positive Id of data.  Maybe zero, but negative numbers not allowed.
-    void Insert( const ELEMTYPE     a_min[NUMDIMS],
-                 const ELEMTYPE     a_max[NUMDIMS],
-                 const DATATYPE&    a_dataId );
-
-    /// Remove entry
-    /// \param a_min Min of bounding rect
-    /// \param a_max Max of bounding rect
-    /// \param a_dataId Positive Id of data.  Maybe zero, but negative numbers not allowed.
-    /// \return  1 if record not found, 0 if success.
-    bool Remove( const ELEMTYPE     a_min[NUMDIMS],
-                 const ELEMTYPE     a_max[NUMDIMS],
-                 const DATATYPE&    a_dataId );
+    RTreeMemoryPool() : m_freeList( nullptr ), m_used( CHUNKITEMS )
+    {
+    }
 
-    /// Find all within search rectangle
-    /// \param a_min Min of search bounding rect
-    /// \param a_max Max of search bounding rect
-    /// \param a_callback Callback function to return result.  Callback should return 'true' to continue searching
-    /// \return Returns the number of entries found
-    int Search( const ELEMTYPE a_min[NUMDIMS],
-                const ELEMTYPE a_max[NUMDIMS],
-                std::function<bool (const DATATYPE&)> a_callback ) const;
+    ~RTreeMemoryPool()
+    {
+        Release();
+    }
 
-    /// Find all within search rectangle
-    /// \param a_min Min of search bounding rect
-    /// \param a_max Max of search bounding rect
-    /// \param a_callback Callback function to return result.  Callback should return 'true' to continue searching
-    /// \param aFinished This is set to true if the search completed and false if it was interupted
-    /// \return Returns the number of entries found
-    int Search( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS],
-            std::function<bool( const DATATYPE& )> a_callback, bool& aFinished ) const;
+    RTreeMemoryPool( const RTreeMemoryPool& ) = delete;
+    RTreeMemoryPool& operator=( const RTreeMemoryPool& ) = delete;
 
-    template <class VISITOR>
-    int Search( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS], VISITOR& a_visitor ) const
+    TYPE* Allocate()
     {
-  #ifdef _DEBUG
+        Slot* slot;
 
-        for( int index = 0; index < NUMDIMS; ++index )
+        if( m_freeList )
         {
-            ASSERT( a_min[index] <= a_max[index] );
+            slot = m_freeList;
+            m_freeList = slot->m_next;
         }
-
-  #endif    // _DEBUG
-
-        Rect rect;
-
-        for( int axis = 0; axis < NUMDIMS; ++axis )
+        else
         {
-            rect.m_min[axis] = a_min[axis];
-            rect.m_max[axis] = a_max[axis];
-        }
-
-
-        // NOTE: May want to return search result another way, perhaps returning the number of found elements here.
-        int cnt = 0;
+            if( m_used == CHUNKITEMS )
+            {
+                m_chunks.push_back( static_cast<Slot*>(
+                        ::operator new( sizeof( Slot ) * CHUNKITEMS, std::align_val_t( CACHE_LINE ) ) ) );
+                m_used = 0;
+            }
 
-        Search( m_root, &rect, a_visitor, cnt );
+            slot = m_chunks.back() + m_used++;
+        }
 
-        return cnt;
+        return new( slot->m_storage ) TYPE;
     }
 
-    /// Calculate Statistics
+    void Deallocate( TYPE* a_object )
+    {
+        Slot* slot = reinterpret_cast<Slot*>( a_object );
+        slot->m_next = m_freeList;
+        m_freeList = slot;
+    }
 
-    Statistics CalcStats();
+    /// Free all chunks, every pointer handed out before becomes invalid
+    void Release()
+    {
+        for( Slot* chunk : m_chunks )
+        {
+            ::operator delete( chunk, std::align_val_t( CACHE_LINE ) );
+        }
 
-    /// Remove all entries from tree
-    void    RemoveAll();
+        m_chunks.clear();
+        m_freeList = nullptr;
+        m_used = CHUNKITEMS;
+    }
 
-    /// Count the data elements in this container.  This is slow as no internal counter is maintained.
-    int     Count() const;
+    /// Bytes currently reserved from the system
+    std::size_t Capacity() const
+    {
+        return m_chunks.size() * sizeof( Slot ) * CHUNKITEMS;
+    }
 
-    /// Load tree contents from file
-    bool    Load( const char* a_fileName );
+private:
+    static_assert( std::is_trivially_destructible<TYPE>::value, "Release() does not run destructors" );
 
-    /// Load tree contents from stream
-    bool    Load( RTFileStream& a_stream ) const;
+    // Objects spanning at least a cache line start on one, smaller ones are packed
+    static constexpr std::size_t SLOT_ALIGN =
+            sizeof( TYPE ) >= CACHE_LINE ? CACHE_LINE : std::max( alignof( TYPE ), alignof( void* ) );
 
+    union alignas( SLOT_ALIGN ) Slot
+    {
+        Slot*         m_next;
+        unsigned char m_storage[sizeof( TYPE )];
+    };
 
-    /// Save tree contents to file
-    bool    Save( const char* a_fileName );
+    Slot*              m_freeList;  ///< Recycled slots
+    std::vector<Slot*> m_chunks;    ///< All chunks, the last one is being carved
+    int                m_used;      ///< Slots taken from the last chunk
+};
 
-    /// Save tree contents to stream
-    bool    Save( RTFileStream& a_stream ) const;
 
-    /**
-     * Gets an ordered vector of the nearest data elements to a specified point
-     * @param aPoint coordinate to measure against
-     * @param aTerminate Callback routine to check when we have gathered sufficient elements
-     * @param aFilter Callback routine to remove specific elements from the query results
-     * @param aSquaredDist Callback routine to measure the distance from the point to the data element
-     * @return vector of matching elements and their distance to the point
-     */
-    std::vector<std::pair<ELEMTYPE, DATATYPE>> NearestNeighbors(
-            const ELEMTYPE aPoint[NUMDIMS],
-            std::function<bool( const std::size_t aNumResults, const ELEMTYPE aMinDist )> aTerminate,
-            std::function<bool( const DATATYPE aElement )> aFilter,
-            std::function<ELEMTYPE( const ELEMTYPE a_point[NUMDIMS], const DATATYPE a_data )> aSquaredDist ) const;
+/// Node allocation policies for the ALLOCATOR parameter of RTree.
+/// A policy provides Pool<TYPE> with Allocate(), Deallocate( TYPE* ) and Release().  When
+/// RELEASE_ALL is set, Release() frees everything and RemoveAll skips walking the tree.
 
-public:
-    /// Iterator is not remove safe.
-    class Iterator
+/// Plain new/delete for every node
+struct RTreeHeapAllocator
+{
+    enum
     {
-    private:
-        enum
-        {
-            MAX_STACK = 32
-        }; // Max stack size. Allows almost n^32 where n is number of branches in node
-
-        struct StackElement
-        {
-            Node* m_node;
-            int   m_branchIndex;
-        };
-
-    public:
-        typedef std::forward_iterator_tag iterator_category;
-        typedef DATATYPE                  value_type;
-        typedef ptrdiff_t                 difference_type;
-        typedef DATATYPE*                 pointer;
-        typedef DATATYPE&                 reference;
+        RELEASE_ALL = false
+    };
 
-    public:
-        Iterator() : m_stack( {} ), m_tos( 0 )
+    template <class TYPE>
+    struct Pool
+    {
+        TYPE* Allocate()
         {
-            for( int i = 0; i < NUMDIMS; ++i )
-            {
-                m_rect.m_min[i] = std::numeric_limits<ELEMTYPE>::min();
-                m_rect.m_max[i] = std::numeric_limits<ELEMTYPE>::max();
-            }
+            return new TYPE;
         }
 
-        Iterator( const Rect& aRect ) : m_stack( {} ), m_tos( 0 ), m_rect( aRect )
+        void Deallocate( TYPE* a_object )
         {
+            delete a_object;
         }
 
-        ~Iterator()
+        void Release()
         {
         }
+    };
+};
 
-        /// Is iterator pointing to valid data
-        constexpr bool IsNotNull() const
-        {
-            return m_tos > 0;
-        }
+/// Chunked pools with free lists, see RTreeMemoryPool
+struct RTreePoolAllocator
+{
+    enum
+    {
+        RELEASE_ALL = true
+    };
 
-        /// Access the current data element. Caller must be sure iterator is not NULL first.
-        DATATYPE& operator*()
-        {
-            ASSERT( IsNotNull() );
-            StackElement& curTos = m_stack[m_tos - 1];
-            return curTos.m_node->m_branch[curTos.m_branchIndex].m_data;
-        }
+    template <class TYPE>
+    using Pool = RTreeMemoryPool<TYPE>;
+};
 
-        /// Access the current data element. Caller must be sure iterator is not NULL first.
-        const DATATYPE& operator*() const
-        {
-            ASSERT( IsNotNull() );
-            StackElement& curTos = m_stack[m_tos - 1];
-            return curTos.m_node->m_branch[curTos.m_branchIndex].m_data;
-        }
 
-        DATATYPE* operator->()
-        {
-            ASSERT( IsNotNull() );
-            StackElement& curTos = m_stack[m_tos - 1];
-            return &( curTos.m_node->m_branch[curTos.m_branchIndex].m_data );
-        }
+/// Node layout policies for the LAYOUT parameter of RTree.
+/// Branch rects always live in Node::m_branch.  A layout may keep a second copy of them arranged
+/// for faster overlap tests in Lanes, which RTree keeps in sync through Lanes::Set.
 
-        /// Prefix ++ operator
-        Iterator& operator++()
+/// Array of Branch structs only, overlap tests run one branch at a time
+struct RTreeAoSLayout
+{
+    template <class ELEMTYPE, int NUMDIMS, int MAXNODES>
+    struct Lanes
+    {
+        enum
         {
-            FindNextData();
-            return *this;
-        }
+            SOA = false
+        };
 
-        /// Postfix ++ operator
-        Iterator operator++( int )
+        void Set( int, const ELEMTYPE[NUMDIMS], const ELEMTYPE[NUMDIMS] )
         {
-            Iterator retval = *this;
-            FindNextData();
-            return retval;
         }
+    };
+};
 
-        bool operator==( const Iterator& rhs ) const
+/// Additionally keeps the min and max of every axis of all branches in contiguous lanes, so a
+/// whole node is tested against a query rect with a few SSE/AVX compares per axis.
+/// Costs 2 * NUMDIMS * MAXNODES extra ELEMTYPEs per node.  MAXNODES may not exceed 64.
+struct RTreeSoALayout
+{
+    template <class ELEMTYPE, int NUMDIMS, int MAXNODES>
+    struct Lanes
+    {
+        static_assert( MAXNODES <= 64, "the overlap mask holds at most 64 branches" );
+
+        enum
         {
-            return ( ( m_tos <= 0 && rhs.m_tos <= 0 )
-                     || ( m_tos == rhs.m_tos && m_stack[m_tos].m_node == rhs.m_stack[m_tos].m_node
-                                && m_stack[m_tos].m_branchIndex
-                                           == rhs.m_stack[m_tos].m_branchIndex ) );
-        }
+            SOA = true,
+            VECTOR_BYTES = 32,
+            WIDTH = ( ( MAXNODES * sizeof( ELEMTYPE ) + VECTOR_BYTES - 1 ) / VECTOR_BYTES ) * VECTOR_BYTES
+                    / sizeof( ELEMTYPE )    ///< Lane length padded to whole vectors
+        };
 
-        bool operator!=( const Iterator& rhs ) const
+        void Set( int a_index, const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS] )
         {
-            return ( ( m_tos > 0 || rhs.m_tos > 0 )
-                     && ( m_tos != rhs.m_tos || m_stack[m_tos].m_node != rhs.m_stack[m_tos].m_node
-                                || m_stack[m_tos].m_branchIndex
-                                           != rhs.m_stack[m_tos].m_branchIndex ) );
+            for( int axis = 0; axis < NUMDIMS; ++axis )
+            {
+                m_laneMin[axis][a_index] = a_min[axis];
+                m_laneMax[axis][a_index] = a_max[axis];
+            }
         }
 
-    private:
-        /// Find the next data element in the tree (For internal use only)
-        void FindNextData()
+        /// Bit i is set when branch i overlaps the rect, only the first a_count branches are tested
+        uint64_t OverlapMask( int a_count, const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS] ) const
         {
-            while( m_tos > 0 )
+            const uint64_t valid = a_count >= 64 ? ~uint64_t( 0 ) : ( uint64_t( 1 ) << a_count ) - 1;
+
+#if defined( __AVX__ )
+            if constexpr( std::is_same<ELEMTYPE, double>::value )
             {
-                StackElement curTos     = Pop();
-                int          nextBranch = curTos.m_branchIndex + 1;
+                return valid & Mask256<4>( a_count, a_min, a_max );
+            }
+            else if constexpr( std::is_same<ELEMTYPE, float>::value )
+            {
+                return valid & Mask256<8>( a_count, a_min, a_max );
+            }
+            else
+#elif defined( __SSE2__ ) || defined( _M_X64 )
+            if constexpr( std::is_same<ELEMTYPE, double>::value )
+            {
+                return valid & Mask128<2>( a_count, a_min, a_max );
+            }
+            else if constexpr( std::is_same<ELEMTYPE, float>::value )
+            {
+                return valid & Mask128<4>( a_count, a_min, a_max );
+            }
+            else
+#endif
+            {
+                uint64_t mask = 0;
 
-                if( curTos.m_node->IsLeaf() )
+                for( int index = 0; index < a_count; ++index )
                 {
-                    // Keep walking through siblings until we find an overlapping leaf
-                    for( int i = nextBranch; i < curTos.m_node->m_count; i++ )
+                    bool overlap = true;
+
+                    for( int axis = 0; axis < NUMDIMS; ++axis )
                     {
-                        if( RTree::Overlap( &m_rect, &curTos.m_node->m_branch[i].m_rect ) )
-                        {
-                            Push( curTos.m_node, i );
-                            return;
-                        }
+                        overlap &= m_laneMin[axis][index] <= a_max[axis] && a_min[axis] <= m_laneMax[axis][index];
                     }
-                    // No more data, so it will fall back to previous level
+
+                    mask |= uint64_t( overlap ) << index;
+                }
+
+                return mask;
+            }
+        }
+
+#if defined( __AVX__ )
+        template <int STEP>
+        uint64_t Mask256( int a_count, const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS] ) const
+        {
+            uint64_t mask = 0;
+
+            for( int block = 0; block < a_count; block += STEP )
+            {
+                if constexpr( STEP == 4 )
+                {
+                    __m256d hit = _mm256_castsi256_pd( _mm256_set1_epi64x( -1 ) );
+
+                    for( int axis = 0; axis < NUMDIMS; ++axis )
+                    {
+                        const __m256d lo = _mm256_load_pd( &m_laneMin[axis][block] );
+                        const __m256d hi = _mm256_load_pd( &m_laneMax[axis][block] );
+                        hit = _mm256_and_pd( hit, _mm256_cmp_pd( lo, _mm256_set1_pd( a_max[axis] ), _CMP_LE_OQ ) );
+                        hit = _mm256_and_pd( hit, _mm256_cmp_pd( hi, _mm256_set1_pd( a_min[axis] ), _CMP_GE_OQ ) );
+                    }
+
+                    mask |= uint64_t( _mm256_movemask_pd( hit ) ) << block;
                 }
                 else
                 {
-                    // Look for an overlapping sibling that we can use as the fall-back node
-                    // when we've iterated down the current branch
-                    for( int i = nextBranch; i < curTos.m_node->m_count; i++ )
+                    __m256 hit = _mm256_castsi256_ps( _mm256_set1_epi32( -1 ) );
+
+                    for( int axis = 0; axis < NUMDIMS; ++axis )
                     {
-                        if( RTree::Overlap( &m_rect, &curTos.m_node->m_branch[i].m_rect ) )
-                        {
-                            Push( curTos.m_node, i );
-                            break;
-                        }
+                        const __m256 lo = _mm256_load_ps( &m_laneMin[axis][block] );
+                        const __m256 hi = _mm256_load_ps( &m_laneMax[axis][block] );
+                        hit = _mm256_and_ps( hit, _mm256_cmp_ps( lo, _mm256_set1_ps( a_max[axis] ), _CMP_LE_OQ ) );
+                        hit = _mm256_and_ps( hit, _mm256_cmp_ps( hi, _mm256_set1_ps( a_min[axis] ), _CMP_GE_OQ ) );
                     }
 
-                    Node* nextLevelnode = curTos.m_node->m_branch[curTos.m_branchIndex].m_child;
+                    mask |= uint64_t( _mm256_movemask_ps( hit ) ) << block;
+                }
+            }
 
-                    // Since cur node is not a leaf, push first of next level,
-                    // zero-th branch to get deeper into the tree
-                    Push( nextLevelnode, 0 );
+            return mask;
+        }
+#elif defined( __SSE2__ ) || defined( _M_X64 )
+        template <int STEP>
+        uint64_t Mask128( int a_count, const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS] ) const
+        {
+            uint64_t mask = 0;
 
-                    // If the branch is a leaf, and it overlaps, then break with the current data
-                    // Otherwise, we allow it to seed our next iteration as it may have siblings that
-                    // do overlap
-                    if( nextLevelnode->IsLeaf()
-                            && RTree::Overlap( &m_rect, &nextLevelnode->m_branch[0].m_rect ) )
-                        return;
+            for( int block = 0; block < a_count; block += STEP )
+            {
+                if constexpr( STEP == 2 )
+                {
+                    __m128d hit = _mm_castsi128_pd( _mm_set1_epi32( -1 ) );
+
+                    for( int axis = 0; axis < NUMDIMS; ++axis )
+                    {
+                        const __m128d lo = _mm_load_pd( &m_laneMin[axis][block] );
+                        const __m128d hi = _mm_load_pd( &m_laneMax[axis][block] );
+                        hit = _mm_and_pd( hit, _mm_cmple_pd( lo, _mm_set1_pd( a_max[axis] ) ) );
+                        hit = _mm_and_pd( hit, _mm_cmpge_pd( hi, _mm_set1_pd( a_min[axis] ) ) );
+                    }
+
+                    mask |= uint64_t( _mm_movemask_pd( hit ) ) << block;
+                }
+                else
+                {
+                    __m128 hit = _mm_castsi128_ps( _mm_set1_epi32( -1 ) );
+
+                    for( int axis = 0; axis < NUMDIMS; ++axis )
+                    {
+                        const __m128 lo = _mm_load_ps( &m_laneMin[axis][block] );
+                        const __m128 hi = _mm_load_ps( &m_laneMax[axis][block] );
+                        hit = _mm_and_ps( hit, _mm_cmple_ps( lo, _mm_set1_ps( a_max[axis] ) ) );
+                        hit = _mm_and_ps( hit, _mm_cmpge_ps( hi, _mm_set1_ps( a_min[axis] ) ) );
+                    }
+
+                    mask |= uint64_t( _mm_movemask_ps( hit ) ) << block;
                 }
             }
+
+            return mask;
         }
+#endif
 
-        /// Push node and branch onto iteration stack (For internal use only)
-        void Push( Node* a_node, int a_branchIndex )
+        alignas( VECTOR_BYTES ) ELEMTYPE m_laneMin[NUMDIMS][WIDTH];  ///< Min of each branch, per axis
+        alignas( VECTOR_BYTES ) ELEMTYPE m_laneMax[NUMDIMS][WIDTH];  ///< Max of each branch, per axis
+    };
+};
+
+
+/// Insertion policies for the SPLITPOLICY parameter of RTree
+
+/// Guttman's quadratic split, PickBranch by least volume enlargement
+struct RTreeQuadraticSplit
+{
+    enum
+    {
+        RSTAR = false,
+        HILBERT = false
+    };
+};
+
+/// R*-tree (Beckmann, Kriegel, Schneider, Seeger 1990).  Leaf level parents pick the child with
+/// the least overlap enlargement, splits run along the axis with the smallest total margin, and
+/// the first overflow of each level during an insert evicts REINSERT_PERCENT of the node's
+/// entries, farthest from its centre, for reinsertion instead of splitting.
+struct RTreeRStarSplit
+{
+    enum
+    {
+        RSTAR = true,
+        HILBERT = false,
+        REINSERT_PERCENT = 30
+    };
+};
+
+/// Hilbert R-tree (Kamel, Faloutsos 1994).  Every entry carries the Hilbert key of its centre
+/// and every branch the largest key below it.  Inserts descend to the child with the smallest
+/// key not below the entry's.  An overflowing node shares its entries with a neighbour in key
+/// order, and only when both neighbours are full do the node and one of them become three
+/// (2-to-3 split), so nodes are left at least two thirds full.  Keys are taken from the
+/// coordinates themselves rather than a grid over the data, which only has enough resolution in
+/// one or two dimensions; they also jump at zero on every axis, so data straddling the origin
+/// is grouped as if cut apart there.
+struct RTreeHilbertSplit
+{
+    enum
+    {
+        RSTAR = false,
+        HILBERT = true
+    };
+};
+
+
+/// Key field of RTree branches, only present under RTreeHilbertSplit
+template <bool HILBERT>
+struct RTreeBranchKey
+{
+};
+
+template <>
+struct RTreeBranchKey<true>
+{
+    uint64_t m_key;     ///< Hilbert key of the entry's centre, or the largest key below the child
+};
+
+
+/// Layer policies for the LAYERPOLICY parameter of RTree, see RTree::LayerMask
+
+/// Entries carry no layers, every entry is on all layers
+struct RTreeNoLayers
+{
+    enum
+    {
+        LAYERS = false
+    };
+};
+
+/// Every branch keeps a layer mask so layer queries skip subtrees holding none of the wanted
+/// layers.  Costs 8 bytes per branch.
+struct RTreeLayers
+{
+    enum
+    {
+        LAYERS = true
+    };
+};
+
+
+/// Layer field of RTree branches, only present under RTreeLayers
+template <bool LAYERS>
+struct RTreeBranchLayers
+{
+};
+
+template <>
+struct RTreeBranchLayers<true>
+{
+    uint64_t m_layers;  ///< Layers of the entry, or of all entries below the child
+};
+
+
+/// Volume metrics for the VOLUMEPOLICY parameter of RTree, used to rank branches and splits
+
+/// Volume of the bounding sphere of the rectangle.  Better split classification since
+/// degenerate rectangles still get a size, but needs a sqrt per call above two dimensions.
+struct RTreeSphericalVolume
+{
+    /// Precomputed volumes of the unit spheres for the first few dimensions
+    static constexpr double UNIT_SPHERE_VOLUMES[] =
+    {
+        0.000000, 2.000000, 3.141593,   // Dimension  0,1,2
+        4.188790, 4.934802, 5.263789,   // Dimension  3,4,5
+        5.167713, 4.724766, 4.058712,   // Dimension  6,7,8
+        3.298509, 2.550164, 1.884104,   // Dimension  9,10,11
+        1.335263, 0.910629, 0.599265,   // Dimension  12,13,14
+        0.381443, 0.235331, 0.140981,   // Dimension  15,16,17
+        0.082146, 0.046622, 0.025807,   // Dimension  18,19,20
+    };
+
+    template <class ELEMTYPEREAL, int NUMDIMS, class ELEMTYPE>
+    static ELEMTYPEREAL Volume( const ELEMTYPE* a_min, const ELEMTYPE* a_max )
+    {
+        static_assert( NUMDIMS > 0 && NUMDIMS <= 20, "No unit sphere volume for NUMDIMS" );
+
+        constexpr ELEMTYPEREAL unitVolume = (ELEMTYPEREAL) UNIT_SPHERE_VOLUMES[NUMDIMS];
+        ELEMTYPEREAL           sumOfSquares = (ELEMTYPEREAL) 0;
+
+        for( int index = 0; index < NUMDIMS; ++index )
         {
-            m_stack[m_tos].m_node = a_node;
-            m_stack[m_tos].m_branchIndex = a_branchIndex;
-            ++m_tos;
-            ASSERT( m_tos <= MAX_STACK );
+            ELEMTYPEREAL halfExtent =
+                ( (ELEMTYPEREAL) a_max[index] - (ELEMTYPEREAL) a_min[index] ) * 0.5f;
+            sumOfSquares += halfExtent * halfExtent;
         }
 
-        /// Pop element off iteration stack (For internal use only)
-        StackElement& Pop()
+        // The squared radius is the area factor in 2D, 3D only needs one sqrt
+        if constexpr( NUMDIMS == 2 )
         {
-            ASSERT( m_tos > 0 );
-            --m_tos;
-            return m_stack[m_tos];
+            return sumOfSquares * unitVolume;
+        }
+        else if constexpr( NUMDIMS == 3 )
+        {
+            return sumOfSquares * (ELEMTYPEREAL) std::sqrt( sumOfSquares ) * unitVolume;
         }
+        else
+        {
+            ELEMTYPEREAL radius = (ELEMTYPEREAL) std::sqrt( sumOfSquares );
 
-        std::array<StackElement, MAX_STACK> m_stack; ///< Stack for iteration
-        int                                 m_tos;   ///< Top Of Stack index
-        Rect                                m_rect;  ///< Search rectangle
+            return (ELEMTYPEREAL) ( std::pow( radius, NUMDIMS ) * unitVolume );
+        }
+    }
+};
 
-        friend class RTree;
-        // Allow hiding of non-public functions while allowing manipulation by logical owner
-    };
+/// Product of the extents of the rectangle.  Cheapest metric, but zero for degenerate
+/// rectangles which can cause poor merges.
+struct RTreeRectVolume
+{
+    template <class ELEMTYPEREAL, int NUMDIMS, class ELEMTYPE>
+    static ELEMTYPEREAL Volume( const ELEMTYPE* a_min, const ELEMTYPE* a_max )
+    {
+        if constexpr( NUMDIMS == 2 )
+        {
+            return (ELEMTYPEREAL) ( a_max[0] - a_min[0] ) * (ELEMTYPEREAL) ( a_max[1] - a_min[1] );
+        }
+        else if constexpr( NUMDIMS == 3 )
+        {
+            return (ELEMTYPEREAL) ( a_max[0] - a_min[0] ) * (ELEMTYPEREAL) ( a_max[1] - a_min[1] )
+                   * (ELEMTYPEREAL) ( a_max[2] - a_min[2] );
+        }
+        else
+        {
+            ELEMTYPEREAL volume = (ELEMTYPEREAL) 1;
 
-    using iterator       = Iterator;
-    using const_iterator = const Iterator;
+            for( int index = 0; index < NUMDIMS; ++index )
+            {
+                volume *= a_max[index] - a_min[index];
+            }
 
-    iterator begin( const Rect& aRect ) const
+            return volume;
+        }
+    }
+};
+
+
+/// Query counter policies for the STATSPOLICY parameter of RTree, see RTree::GetQueryStats
+
+/// Counts nothing, queries pay nothing
+struct RTreeNoQueryStats
+{
+    enum
     {
-        iterator retval( aRect );
+        COUNTED = false
+    };
+};
 
-        if( !m_root->m_count )
-            return retval;
+/// Counts the work done by queries.  All threads querying a tree share the atomic counters, so
+/// keep it out of hot release builds.
+struct RTreeQueryStats
+{
+    enum
+    {
+        COUNTED = true
+    };
+};
 
-        retval.Push( m_root, 0 );
 
-        // If the first leaf matches, return the root pointer, otherwise,
-        // increment to the first match or empty if none.
-        if( m_root->IsLeaf() && Overlap( &aRect, &m_root->m_branch[0].m_rect ) )
-            return retval;
+/// Squared distance from a point to the closest point of the box a_min, a_max, zero inside
+template <class ELEMTYPEREAL, int NUMDIMS, class ELEMTYPE>
+ELEMTYPEREAL RTreeMinDistSq( const ELEMTYPE a_point[NUMDIMS], const ELEMTYPE a_min[NUMDIMS],
+                             const ELEMTYPE a_max[NUMDIMS] )
+{
+    ELEMTYPEREAL minDist = 0;
 
-        ++retval;
-        return retval;
+    for( int index = 0; index < NUMDIMS; ++index )
+    {
+        ELEMTYPEREAL addend = 0;
+
+        if( a_point[index] < a_min[index] )
+        {
+            addend = (ELEMTYPEREAL) a_min[index] - (ELEMTYPEREAL) a_point[index];
+        }
+        else if( a_point[index] > a_max[index] )
+        {
+            addend = (ELEMTYPEREAL) a_point[index] - (ELEMTYPEREAL) a_max[index];
+        }
+
+        minDist += addend * addend;
     }
 
-    iterator begin() const
+    return minDist;
+}
+
+
+/// Best first search for the a_k nearest entries, shared by RTree and its read-only copies, which
+/// differ only in how they reach nodes and branches.  Nodes are visited nearest first from a
+/// min-heap on the distance to their rect, and the best matches so far kept in a max-heap.
+/// ACCESS adapts one node layout, NodeRef naming a node:
+///   NodeRef         Root() const
+///   bool            IsLeaf( NodeRef ) const
+///   int             Count( NodeRef ) const
+///   bool            Skip( NodeRef, int a_index ) const         Leave the branch out of the search
+///   ELEMTYPEREAL    MinDistSq( NodeRef, int a_index ) const    Squared distance to the branch rect
+///   NodeRef         Child( NodeRef, int a_index ) const
+///   const DATATYPE& Data( NodeRef, int a_index ) const
+///   void            Visited( NodeRef ) const, Pushed() const   Hooks for query counters
+/// \param a_maxDistSq Nodes and entries farther than this, squared, are left out
+/// \param a_squaredDist functor ELEMTYPEREAL( const DATATYPE& ), squared distance to an entry, never
+///                      less than the squared distance to its rect
+/// \param a_filter functor bool( const DATATYPE& ), entries it rejects are skipped
+/// \param a_queue, a_results Reusable storage, a_results holds the matches by ascending distance
+/// \return number of results
+template <class ACCESS, class ELEMTYPEREAL, class DATATYPE, class DISTANCE, class FILTER>
+int RTreeNearestSearch( const ACCESS& a_access, int a_k, ELEMTYPEREAL a_maxDistSq, DISTANCE&& a_squaredDist,
+                        FILTER&& a_filter, std::vector<std::pair<ELEMTYPEREAL, typename ACCESS::NodeRef>>& a_queue,
+                        std::vector<std::pair<ELEMTYPEREAL, DATATYPE>>& a_results )
+{
+    typedef typename ACCESS::NodeRef          NodeRef;
+    typedef std::pair<ELEMTYPEREAL, NodeRef>  QueueEntry;
+    typedef std::pair<ELEMTYPEREAL, DATATYPE> Result;
+
+    auto nearerNode = []( const QueueEntry& a_entryA, const QueueEntry& a_entryB )
     {
-        Rect full_rect;
+        return a_entryA.first > a_entryB.first;
+    };
+    auto nearerResult = []( const Result& a_resultA, const Result& a_resultB )
+    {
+        return a_resultA.first < a_resultB.first;
+    };
 
-        std::fill_n( full_rect.m_min, NUMDIMS, INT_MIN );
-        std::fill_n( full_rect.m_max, NUMDIMS, INT_MAX );
+    a_queue.clear();
+    a_results.clear();
 
-        return begin( full_rect );
-    }
+    if( a_k <= 0 )
+        return 0;
 
-    iterator end() const
+    // Anything beyond the bound or farther than the worst of k results can be skipped
+    auto pruned = [&]( ELEMTYPEREAL a_dist )
     {
-        iterator retval;
-        return retval;
-    }
+        return a_dist > a_maxDistSq || ( (int) a_results.size() == a_k && a_dist > a_results.front().first );
+    };
 
-    iterator end( const Rect& aRect ) const
+    a_queue.push_back( QueueEntry( 0, a_access.Root() ) );
+
+    while( !a_queue.empty() )
     {
-        return end();
+        std::pop_heap( a_queue.begin(), a_queue.end(), nearerNode );
+        const QueueEntry entry = a_queue.back();
+        a_queue.pop_back();
+
+        // The queue is ordered, nothing left can beat the results
+        if( pruned( entry.first ) )
+            break;
+
+        const NodeRef node = entry.second;
+        const int     count = a_access.Count( node );
+        const bool    leaf = a_access.IsLeaf( node );
+
+        a_access.Visited( node );
+
+        for( int index = 0; index < count; ++index )
+        {
+            if( a_access.Skip( node, index ) )
+                continue;
+
+            const ELEMTYPEREAL rectDist = a_access.MinDistSq( node, index );
+
+            if( pruned( rectDist ) )
+                continue;
+
+            if( !leaf )
+            {
+                a_queue.push_back( QueueEntry( rectDist, a_access.Child( node, index ) ) );
+                std::push_heap( a_queue.begin(), a_queue.end(), nearerNode );
+                a_access.Pushed();
+                continue;
+            }
+
+            const DATATYPE& data = a_access.Data( node, index );
+
+            if( !a_filter( data ) )
+                continue;
+
+            const ELEMTYPEREAL dist = a_squaredDist( data );
+
+            if( dist > a_maxDistSq )
+                continue;
+
+            if( (int) a_results.size() < a_k )
+            {
+                a_results.emplace_back( dist, data );
+                std::push_heap( a_results.begin(), a_results.end(), nearerResult );
+                a_access.Pushed();
+            }
+            else if( dist < a_results.front().first )
+            {
+                std::pop_heap( a_results.begin(), a_results.end(), nearerResult );
+                a_results.back() = Result( dist, data );
+                std::push_heap( a_results.begin(), a_results.end(), nearerResult );
+                a_access.Pushed();
+            }
+        }
+    }
+
+    std::sort_heap( a_results.begin(), a_results.end(), nearerResult );
+
+    return (int) a_results.size();
+}
+
+
+/// \class RTree
+/// Implementation of RTree, a multidimensional bounding rectangle tree.
+/// Example usage: For a 3-dimensional tree use RTree<Object*, float, 3> myTree;
+///
+/// This modified, templated C++ version by Greg Douglas at Auran (http://www.auran.com)
+///
+/// DATATYPE Referenced data, should be int, void*, obj* etc. no larger than sizeof<void*> and simple type
+/// ELEMTYPE Type of element such as int or float
+/// NUMDIMS Number of dimensions such as 2 or 3
+/// ELEMTYPEREAL Type of element that allows fractional and large values such as float or double, for use in volume calcs
+/// ALLOCATOR Node allocation policy, RTreePoolAllocator or RTreeHeapAllocator
+/// LAYOUT Node layout policy, RTreeAoSLayout or RTreeSoALayout for SIMD overlap tests
+/// SPLITPOLICY Insertion policy, RTreeQuadraticSplit, RTreeRStarSplit or RTreeHilbertSplit
+/// VOLUMEPOLICY Volume metric for insertion and splits, RTreeSphericalVolume or RTreeRectVolume
+/// STATSPOLICY Query counters, RTreeNoQueryStats or RTreeQueryStats
+/// LAYERPOLICY Per-entry layer masks, RTreeNoLayers or RTreeLayers
+///
+/// NOTES: Inserting and removing data requires the knowledge of its constant Minimal Bounding Rectangle.
+///        Nodes come from pooled chunks by default, pass RTreeHeapAllocator to use new/delete instead.
+///        Instead of using a callback function for returned results, I recommend and efficient pre-sized, grow-only memory
+///        array similar to MFC CArray or STL Vector for returning search query result.
+///
+template <class DATATYPE, class ELEMTYPE, int NUMDIMS,
+          class ELEMTYPEREAL = ELEMTYPE, int TMAXNODES = 8, int TMINNODES = TMAXNODES / 2,
+          class ALLOCATOR = RTreePoolAllocator, class LAYOUT = RTreeAoSLayout,
+          class SPLITPOLICY = RTreeQuadraticSplit, class VOLUMEPOLICY = RTreeSphericalVolume,
+          class STATSPOLICY = RTreeNoQueryStats, class LAYERPOLICY = RTreeNoLayers>
+class RTree
+{
+protected:
+
+    struct Node; // Fwd decl.  Used by other internal structs and iterator
+
+    // Joins walk the nodes of trees with other parameters
+    template <class, class, int, class, int, int, class, class, class, class, class, class>
+    friend class RTree;
+
+    // Writes the nodes into the flat mapped format
+    template <class, class, int, class>
+    friend class RTreeMappedView;
+
+    // Copies the nodes into its contiguous array
+    template <class, class, int, class>
+    friend class RTreeFrozen;
+
+    // Collects the entries of its shards when rebalancing
+    template <class, class, int, class, int, int>
+    friend class RTreeSharded;
+
+    // Orders records by the Hilbert key used for packing
+    template <class, class, int, class, int>
+    friend class RTreeExternalBuilder;
+
+    // Quantizes each node's branches to its cover
+    template <class, class, int, class, int, class>
+    friend class RTreeQuantized;
+
+public:
+    typedef DATATYPE DataType;  ///< Type of the referenced data
+
+    /// Set of layers, one bit each, an entry belongs to.  Under RTreeLayers every branch keeps the
+    /// union of the layers below it so queries for some layers skip subtrees holding none of them;
+    /// under RTreeNoLayers the masks passed in are dropped and every entry is on all layers.
+    typedef uint64_t LayerMask;
+
+    static constexpr LayerMask ALL_LAYERS = ~LayerMask( 0 );    ///< Default for entries inserted without layers
+
+    /// Minimal bounding rectangle (n-dimensional)
+    struct Rect
+    {
+        ELEMTYPE m_min[NUMDIMS]; ///< Min dimensions of bounding box
+        ELEMTYPE m_max[NUMDIMS]; ///< Max dimensions of bounding box
+    };
+
+    // These constant must be declared after Branch and before Node struct
+    // Stuck up here for MSVC 6 compiler.  NSVC .NET 2003 is much happier.
+    enum {
+        MAXNODES = TMAXNODES,                       ///< Max elements in node
+        MINNODES = TMINNODES                        ///< Min elements in node
+    };
+
+    struct Statistics {
+        int maxDepth;
+        int avgDepth;
+
+        int maxNodeLoad;
+        int avgNodeLoad;
+        int totalItems;
+
+        int    nodeCount;
+        double fillFactor;  ///< Branches in use divided by the capacity of all nodes
+    };
+
+    /// Packing strategy used by BulkLoad
+    enum class BulkLoadMethod
+    {
+        STR,        ///< Sort-Tile-Recursive (Leutenegger, Lopez, Edgington 1997)
+        HILBERT     ///< Sort by Hilbert value of the rect centres (Kamel, Faloutsos 1993)
+    };
+
+    /// How Update relocated an entry
+    enum class UpdatePath
+    {
+        NOT_FOUND,  ///< No entry with that id overlapping the old rect
+        IN_PLACE,   ///< New rect fits the cover of its leaf, only the leaf changed
+        ENLARGED,   ///< Ancestor covers were grown bottom-up until one contained the new rect
+        REINSERTED  ///< Leaf cover would grow past the limit, removed and inserted again
+    };
+
+    /// Number of Update calls that took each path, see GetUpdateStats
+    struct UpdateStats {
+        int inPlace;
+        int enlarged;
+        int reinserted;
+        int notFound;
+    };
+
+    /// Work done by Search, Count and NearestNeighbors since construction or the last
+    /// ResetQueryStats.  Only counted when STATSPOLICY is RTreeQueryStats, zero otherwise.
+    struct QueryStats {
+        uint64_t nodesVisited;  ///< Nodes whose branches were examined
+        uint64_t leavesTested;  ///< Leaf nodes among them
+        uint64_t overlapTests;  ///< Branch rects tested against a query window
+        uint64_t heapPushes;    ///< Pushes onto the nearest neighbour queues
+    };
+
+    /// Shape of the nodes on one level, see QualityStats
+    struct LevelQuality {
+        int    nodeCount;
+        double fillFactor;  ///< Branches in use divided by the capacity of the level's nodes
+        double overlap;     ///< Volume shared by sibling branches, summed over all pairs
+        double deadSpace;   ///< Volume of branch rects not covered by their children, a lower bound
+    };
+
+    /// Tree quality for spotting degenerate indexes, see CalcQuality.  Volumes are products
+    /// of extents whatever the VOLUMEPOLICY.
+    struct QualityStats {
+        std::vector<LevelQuality> levels;   ///< Indexed by node level, leaves first
+        double totalOverlap;
+        double deadSpace;
+        double bytesPerEntry;               ///< Node and side stored data memory per entry
+    };
+
+    /// Work done by one Compact call
+    struct CompactStats {
+        int  nodesVisited;
+        int  groupsRepacked;    ///< Sibling groups rebuilt with packed loading
+        int  entriesMoved;      ///< Data entries under the rebuilt groups
+        bool sweepDone;         ///< The call finished a pass over the tree, the next one starts over
+    };
+
+    struct BulkLoadStats {
+        double buildTime;   ///< Seconds spent sorting and packing
+        double fillFactor;  ///< Branches in use divided by the capacity of all nodes
+        int    nodeCount;
+        int    height;      ///< Number of levels, a lone leaf root is 1
+    };
+
+public:
+
+    RTree();
+
+    /// Build a packed tree from a range of std::pair<Rect, DATATYPE>, or std::tuple<Rect, DATATYPE,
+    /// LayerMask>, see BulkLoad
+    template <class ITERATOR>
+    RTree( ITERATOR a_first, ITERATOR a_last, BulkLoadMethod a_method = BulkLoadMethod::STR );
+
+    virtual ~RTree();
+
+    /// Insert entry
+    /// \param a_min Min of bounding rect
+    /// \param a_max Max of bounding rect
+    /// \param a_dataId Positive Id of data.  Maybe zero, but negative numbers not allowed.
+    /// \param a_layers Layers of the entry, for the queries taking a LayerMask.  Dropped under RTreeNoLayers.
+    void Insert( const ELEMTYPE     a_min[NUMDIMS],
+                 const ELEMTYPE     a_max[NUMDIMS],
+                 const DATATYPE&    a_dataId,
+                 LayerMask          a_layers = ALL_LAYERS );
+
+    /// Remove entry
+    /// \param a_min Min of bounding rect
+    /// \param a_max Max of bounding rect
+    /// \param a_dataId Positive Id of data.  Maybe zero, but negative numbers not allowed.
+    /// \return  1 if record not found, 0 if success.
+    bool Remove( const ELEMTYPE     a_min[NUMDIMS],
+                 const ELEMTYPE     a_max[NUMDIMS],
+                 const DATATYPE&    a_dataId );
+
+    /// Move an entry to a new rect.  Cheaper than Remove and Insert for small moves: the leaf
+    /// entry is changed in place and covers on the way up are only grown, never recomputed.
+    /// \param a_oldMin, a_oldMax Current bounding rect
+    /// \param a_newMin, a_newMax New bounding rect
+    /// \param a_dataId Id of data
+    /// \param a_maxGrowth Largest growth of the leaf cover margin, relative to the cover of the
+    ///                   other entries of the leaf, accepted before the entry is removed and
+    ///                   inserted again instead
+    /// \return The path taken, also counted in GetUpdateStats
+    UpdatePath Update( const ELEMTYPE   a_oldMin[NUMDIMS],
+                       const ELEMTYPE   a_oldMax[NUMDIMS],
+                       const ELEMTYPE   a_newMin[NUMDIMS],
+                       const ELEMTYPE   a_newMax[NUMDIMS],
+                       const DATATYPE&  a_dataId,
+                       double           a_maxGrowth = 0.25 );
+
+    /// Paths taken by Update since construction or the last ResetUpdateStats
+    const UpdateStats& GetUpdateStats() const { return m_updateStats; }
+
+    void ResetUpdateStats() { m_updateStats = UpdateStats(); }
+
+    /// Repair a tree worn down by many Remove calls, a bounded step at a time so it can run in
+    /// idle frames.  Each call resumes a sweep over the internal nodes where the last one
+    /// stopped.  Wherever the children of a node overlap or are poorly filled, a group of them
+    /// is rebuilt with packed loading into subtrees of the same height, so the node keeps its
+    /// entries and cover and nothing outside the group changes.  Invalidates iterators.
+    /// \param a_budget Work allowed in this call: one per node visited plus one per entry moved
+    /// \param a_maxBadness Nodes scoring at most this are left alone.  The score adds the area the
+    ///                    children share pairwise, as a fraction of the node cover and at most 1,
+    ///                    to the fraction of children beyond the fewest that could hold the
+    ///                    entries.  A packed node scores near 0, the default of 0.5 repacks nodes
+    ///                    with half their cover shared or half their children to spare
+    /// \return What was visited and rebuilt
+    CompactStats Compact( int a_budget, double a_maxBadness = 0.5 );
+
+    /// Replace the contents of the tree with a packed tree built bottom-up.
+    /// Much faster than repeated Insert and leaves nodes (almost) completely full.
+    /// \param a_first, a_last Forward range of std::pair<Rect, DATATYPE>, or of std::tuple<Rect,
+    ///                      DATATYPE, LayerMask> to give the entries layers
+    /// \param a_method Sort order used to group entries into nodes.  Ignored under
+    ///                 RTreeHilbertSplit, which packs in the order of the entry keys so later
+    ///                 inserts find disjoint key ranges
+    /// \return Build time and resulting node statistics
+    template <class ITERATOR>
+    BulkLoadStats BulkLoad( ITERATOR a_first, ITERATOR a_last,
+                            BulkLoadMethod a_method = BulkLoadMethod::STR );
+
+    /// Find all within search rectangle
+    /// \param a_min Min of search bounding rect
+    /// \param a_max Max of search bounding rect
+    /// \param a_callback Callback function to return result.  Callback should return 'true' to continue searching
+    /// \return Returns the number of entries found
+    int Search( const ELEMTYPE a_min[NUMDIMS],
+                const ELEMTYPE a_max[NUMDIMS],
+                std::function<bool (const DATATYPE&)> a_callback ) const;
+
+    /// Find all within search rectangle
+    /// \param a_min Min of search bounding rect
+    /// \param a_max Max of search bounding rect
+    /// \param a_callback Callback function to return result.  Callback should return 'true' to continue searching
+    /// \param aFinished This is set to true if the search completed and false if it was interupted
+    /// \return Returns the number of entries found
+    int Search( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS],
+            std::function<bool( const DATATYPE& )> a_callback, bool& aFinished ) const;
+
+    template <class VISITOR>
+    int Search( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS], VISITOR& a_visitor ) const
+    {
+  #ifdef _DEBUG
+
+        for( int index = 0; index < NUMDIMS; ++index )
+        {
+            ASSERT( a_min[index] <= a_max[index] );
+        }
+
+  #endif    // _DEBUG
+
+        Rect rect;
+
+        for( int axis = 0; axis < NUMDIMS; ++axis )
+        {
+            rect.m_min[axis] = a_min[axis];
+            rect.m_max[axis] = a_max[axis];
+        }
+
+
+        // NOTE: May want to return search result another way, perhaps returning the number of found elements here.
+        int cnt = 0;
+
+        Search( m_root, &rect, a_visitor, cnt );
+
+        return cnt;
+    }
+
+    /// Find all within search rectangle on any of the given layers.  Subtrees without one of
+    /// them are skipped whole.
+    /// \param a_layers Entries sharing no layer with this are not reported
+    /// \param a_visitor functor bool( const DATATYPE& ).  Return 'true' to continue searching
+    /// \return Returns the number of entries found
+    template <class VISITOR>
+    int Search( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS], LayerMask a_layers,
+                VISITOR&& a_visitor ) const;
+
+    /// Scratch storage for SearchFrontier.  Keep one per thread and pass it to every query; once
+    /// its vectors have grown to the working size queries stop allocating.
+    class SearchBuffer
+    {
+    private:
+        std::vector<const Node*> m_frontier;    ///< Matching nodes of the level being tested
+        std::vector<const Node*> m_next;        ///< Their matching children
+
+        friend class RTree;
+    };
+
+    /// Find all within search rectangle, a level at a time instead of depth first.  All matching
+    /// children of a level are collected and prefetched before the first of them is tested, so
+    /// their cache misses overlap rather than stalling the walk once per level.  Pays off on
+    /// trees much larger than the cache; entries are reported leaf by leaf in level order, which
+    /// differs from the order of Search.
+    /// \param a_visitor functor bool( const DATATYPE& ).  Return 'true' to continue searching
+    /// \param a_buffer reusable storage for the frontier
+    /// \return Returns the number of entries found
+    template <class VISITOR>
+    int SearchFrontier( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS], VISITOR&& a_visitor,
+                        SearchBuffer& a_buffer ) const;
+
+    /// Calculate Statistics
+    Statistics CalcStats() const;
+
+    /// Measure fill, overlap and dead space of every level.  Visits the whole tree.
+    QualityStats CalcQuality() const;
+
+    /// CalcStats, CalcQuality and GetQueryStats as a single line JSON object, for logs
+    std::string StatsJson() const;
+
+    /// Query counters, see QueryStats
+    QueryStats GetQueryStats() const;
+
+    void ResetQueryStats();
+
+    /// Remove all entries from tree
+    void    RemoveAll();
+
+    /// Count the data elements in this container, kept in the root
+    int     Count() const;
+
+    /// Count the data elements whose rects overlap the search rectangle.  Subtrees inside the
+    /// rectangle add their stored entry count without being visited.
+    /// \param a_min Min of search bounding rect
+    /// \param a_max Max of search bounding rect
+    int     Count( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS] ) const;
+
+    /// Load tree contents from file
+    bool    Load( const char* a_fileName );
+
+    /// Load tree contents from stream
+    bool    Load( RTFileStream& a_stream );
+
+
+    /// Save tree contents to file
+    bool    Save( const char* a_fileName );
+
+    /// Save tree contents to stream
+    bool    Save( RTFileStream& a_stream ) const;
+
+    /**
+     * Gets an ordered vector of the nearest data elements to a specified point
+     * @param aPoint coordinate to measure against
+     * @param aTerminate Callback routine to check when we have gathered sufficient elements
+     * @param aFilter Callback routine to remove specific elements from the query results
+     * @param aSquaredDist Callback routine to measure the distance from the point to the data element
+     * @return vector of matching elements and their distance to the point
+     */
+    std::vector<std::pair<ELEMTYPE, DATATYPE>> NearestNeighbors(
+            const ELEMTYPE aPoint[NUMDIMS],
+            std::function<bool( const std::size_t aNumResults, const ELEMTYPE aMinDist )> aTerminate,
+            std::function<bool( const DATATYPE aElement )> aFilter,
+            std::function<ELEMTYPE( const ELEMTYPE a_point[NUMDIMS], const DATATYPE a_data )> aSquaredDist ) const;
+
+    /// Scratch storage for the templated NearestNeighbors.  Keep one per thread and pass it to
+    /// every query; once its vectors have grown to the working size queries stop allocating.
+    class NearestNeighborBuffer
+    {
+    public:
+        typedef std::pair<ELEMTYPEREAL, DATATYPE> Result;
+
+        /// Matches of the last query, ordered by ascending squared distance
+        const std::vector<Result>& Results() const
+        {
+            return m_results;
+        }
+
+    private:
+        std::vector<std::pair<ELEMTYPEREAL, const Node*>> m_queue;      ///< Node distance and node, min-heap
+        std::vector<Result>                               m_results;    ///< Best matches so far, max-heap
+
+        friend class RTree;
+    };
+
+    /**
+     * Find the a_k nearest data elements to a point, best first with a bounded result heap.
+     * @param aPoint coordinate to measure against
+     * @param aK maximum number of results
+     * @param aSquaredDist functor ELEMTYPEREAL( const ELEMTYPE aPoint[NUMDIMS], const DATATYPE& ) giving the
+     *                     squared distance to an element, never less than the squared distance to its rect
+     * @param aFilter functor bool( const DATATYPE& ), elements it rejects are skipped
+     * @param aBuffer reusable storage, holds the results afterwards
+     * @return number of results
+     */
+    template <class DISTANCE, class FILTER>
+    int NearestNeighbors( const ELEMTYPE aPoint[NUMDIMS], int aK, DISTANCE&& aSquaredDist, FILTER&& aFilter,
+                          NearestNeighborBuffer& aBuffer ) const;
+
+    /// As above, for elements on any of the layers in aLayers.  Subtrees without one of them
+    /// are never queued.
+    template <class DISTANCE, class FILTER>
+    int NearestNeighbors( const ELEMTYPE aPoint[NUMDIMS], int aK, LayerMask aLayers, DISTANCE&& aSquaredDist,
+                          FILTER&& aFilter, NearestNeighborBuffer& aBuffer ) const;
+
+    /// As above, for elements no farther than aMaxDistSq, squared.  Nodes beyond it are never
+    /// queued, so a caller merging the results of several trees can pass its current k-th distance.
+    template <class DISTANCE, class FILTER>
+    int NearestNeighbors( const ELEMTYPE aPoint[NUMDIMS], int aK, LayerMask aLayers, ELEMTYPEREAL aMaxDistSq,
+                          DISTANCE&& aSquaredDist, FILTER&& aFilter, NearestNeighborBuffer& aBuffer ) const;
+
+    /// Squared distance from a point to the closest point of a rect, zero inside
+    static ELEMTYPEREAL MinDistSq( const ELEMTYPE a_point[NUMDIMS], const Rect& a_rect );
+
+    /// Find the first entry hit by the ray a_origin + t * a_direction, 0 <= t <= a_maxT.
+    /// ELEMTYPEREAL must be a floating point type.  Nodes are entered in order of the t where the
+    /// ray enters their rect, and the walk ends once nothing left can be entered before the
+    /// nearest confirmed hit.
+    /// \param a_hitTest functor bool( const DATATYPE&, ELEMTYPEREAL& a_t ), exact test of an entry
+    ///                  whose rect the ray enters at a_t.  Return true with a_t moved to the hit,
+    ///                  which must not be less than the given value
+    /// \param a_hit Receives the nearest hit as ( t, data )
+    /// \return Returns whether anything was hit
+    template <class HITTEST>
+    bool RayCast( const ELEMTYPE a_origin[NUMDIMS], const ELEMTYPE a_direction[NUMDIMS], ELEMTYPEREAL a_maxT,
+                  HITTEST&& a_hitTest, std::pair<ELEMTYPEREAL, DATATYPE>& a_hit ) const;
+
+    /// Visit every entry whose rect the segment from a_start to a_end crosses, in order of
+    /// where the segment enters the rect.  ELEMTYPEREAL must be a floating point type.
+    /// \param a_visitor functor bool( const DATATYPE&, ELEMTYPEREAL a_t ), a_t from 0 at a_start to 1
+    ///                  at a_end.  Return 'true' to continue
+    /// \return Returns the number of entries visited
+    template <class VISITOR>
+    int SegmentCast( const ELEMTYPE a_start[NUMDIMS], const ELEMTYPE a_end[NUMDIMS], VISITOR&& a_visitor ) const;
+
+    /// Which entries a region query reports
+    enum class RegionMatch
+    {
+        OVERLAP,    ///< Rects sharing any point with the region
+        INSIDE      ///< Rects completely inside the region
+    };
+
+    /// Find all entries within a_radius of a_center.  Nodes are pruned with exact rect to ball
+    /// tests, and a node completely inside the ball is reported whole without testing its entries.
+    /// \param a_visitor functor bool( const DATATYPE& ).  Return 'true' to continue searching
+    /// \return Returns the number of entries found
+    template <class VISITOR>
+    int SearchRadius( const ELEMTYPE a_center[NUMDIMS], ELEMTYPEREAL a_radius, VISITOR&& a_visitor,
+                      RegionMatch a_match = RegionMatch::OVERLAP ) const;
+
+    /// Find all entries in a simple polygon, two dimensions and a floating point ELEMTYPEREAL
+    /// only.  Pruning and reporting whole nodes as SearchRadius.  Rects touching the outline do
+    /// not count as INSIDE.
+    /// \param a_polygon Sequence of points with members x and y such as geometry::POLYGON,
+    ///                  the closing edge is implied
+    /// \param a_visitor functor bool( const DATATYPE& ).  Return 'true' to continue searching
+    /// \return Returns the number of entries found
+    template <class POLYGON, class VISITOR>
+    int SearchPolygon( const POLYGON& a_polygon, VISITOR&& a_visitor,
+                       RegionMatch a_match = RegionMatch::OVERLAP ) const;
+
+    /// Find every pair of entries, one from each tree, whose rects overlap.
+    /// Both trees are walked together and node pairs with disjoint covers are skipped.
+    /// \param a_other Tree with the same ELEMTYPE and NUMDIMS, other parameters may differ
+    /// \param a_visitor functor bool( const DATATYPE&, const OTHERTREE::DataType& ).  Return 'true' to continue
+    /// \return Returns the number of pairs found
+    template <class OTHERTREE, class VISITOR>
+    int Join( const OTHERTREE& a_other, VISITOR&& a_visitor ) const;
+
+    /// Join of the entries of this tree on a_layers with those of a_other on a_otherLayers.
+    /// Node pairs where either side holds none of its layers are skipped.
+    template <class OTHERTREE, class VISITOR>
+    int Join( const OTHERTREE& a_other, LayerMask a_layers, typename OTHERTREE::LayerMask a_otherLayers,
+              VISITOR&& a_visitor ) const;
+
+    /// Find every pair of distinct entries of this tree whose rects overlap, each pair once
+    /// \param a_visitor functor bool( const DATATYPE&, const DATATYPE& ).  Return 'true' to continue
+    /// \return Returns the number of pairs found
+    template <class VISITOR>
+    int SelfJoin( VISITOR&& a_visitor ) const;
+
+    /// Join on a_threadCount threads.  Node pairs near the roots are handed out to the threads,
+    /// the order of the returned pairs is unspecified.
+    template <class OTHERTREE>
+    std::vector<std::pair<DATATYPE, typename OTHERTREE::DataType>> ParallelJoin( const OTHERTREE& a_other,
+                                                                                int a_threadCount ) const;
+
+    /// SelfJoin on a_threadCount threads, the order of the returned pairs is unspecified.
+    std::vector<std::pair<DATATYPE, DATATYPE>> ParallelSelfJoin( int a_threadCount ) const;
+
+    /// Output of SearchBatch.  Hits of query i are Hits()[Offsets()[i]] .. Hits()[Offsets()[i + 1]],
+    /// in the order Search would report them.  Reuse one across calls, once its vectors have grown
+    /// to the working size batches stop allocating.
+    class SearchBatchResult
+    {
+    public:
+        const std::vector<DATATYPE>& Hits() const
+        {
+            return m_hits;
+        }
+
+        const std::vector<size_t>& Offsets() const
+        {
+            return m_offsets;
+        }
+
+        size_t HitCount( int a_query ) const
+        {
+            return m_offsets[a_query + 1] - m_offsets[a_query];
+        }
+
+        const DATATYPE* begin( int a_query ) const
+        {
+            return m_hits.data() + m_offsets[a_query];
+        }
+
+        const DATATYPE* end( int a_query ) const
+        {
+            return m_hits.data() + m_offsets[a_query + 1];
+        }
+
+    private:
+        /// Hits of one query inside the buffer of the thread that ran it
+        struct Span
+        {
+            int    m_thread;
+            size_t m_begin;
+            size_t m_count;
+        };
+
+        std::vector<DATATYPE>                   m_hits;
+        std::vector<size_t>                     m_offsets;
+        std::vector<std::pair<uint64_t, int>>   m_order;        ///< Hilbert key and index of each query
+        std::vector<Span>                       m_spans;        ///< Where each query left its hits
+        std::vector<std::vector<DATATYPE>>      m_threadHits;   ///< Hits of each thread, in run order
+
+        friend class RTree;
+    };
+
+    /// Run many window queries at once.  Queries are ordered along a Hilbert curve so that
+    /// consecutive ones touch the same nodes, split into runs handed out to a_threadCount threads,
+    /// and their hits gathered into one flat buffer in query order.
+    /// \param a_queries, a_queryCount Search rects
+    /// \param a_result Receives the hits, see SearchBatchResult
+    /// \param a_threadCount Number of threads to use, including the calling one
+    /// \return Returns the total number of hits
+    size_t SearchBatch( const Rect* a_queries, int a_queryCount, SearchBatchResult& a_result,
+                        int a_threadCount = 1 ) const;
+
+public:
+    /// Iterator is not remove safe.
+    class Iterator
+    {
+    private:
+        enum
+        {
+            MAX_STACK = 32
+        }; // Max stack size. Allows almost n^32 where n is number of branches in node
+
+        struct StackElement
+        {
+            Node* m_node;
+            int   m_branchIndex;
+        };
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef DATATYPE                  value_type;
+        typedef ptrdiff_t                 difference_type;
+        typedef DATATYPE*                 pointer;
+        typedef DATATYPE&                 reference;
+
+    public:
+        Iterator() : m_stack( {} ), m_tos( 0 ), m_payloads( NULL )
+        {
+            for( int i = 0; i < NUMDIMS; ++i )
+            {
+                m_rect.m_min[i] = std::numeric_limits<ELEMTYPE>::min();
+                m_rect.m_max[i] = std::numeric_limits<ELEMTYPE>::max();
+            }
+        }
+
+        Iterator( const Rect& aRect ) : m_stack( {} ), m_tos( 0 ), m_rect( aRect ), m_payloads( NULL )
+        {
+        }
+
+        ~Iterator()
+        {
+        }
+
+        /// Is iterator pointing to valid data
+        constexpr bool IsNotNull() const
+        {
+            return m_tos > 0;
+        }
+
+        /// Access the current data element. Caller must be sure iterator is not NULL first.
+        DATATYPE& operator*()
+        {
+            ASSERT( IsNotNull() );
+            return CurrentData();
+        }
+
+        /// Access the current data element. Caller must be sure iterator is not NULL first.
+        const DATATYPE& operator*() const
+        {
+            ASSERT( IsNotNull() );
+            return CurrentData();
+        }
+
+        DATATYPE* operator->()
+        {
+            ASSERT( IsNotNull() );
+            return &CurrentData();
+        }
+
+        /// Prefix ++ operator
+        Iterator& operator++()
+        {
+            FindNextData();
+            return *this;
+        }
+
+        /// Postfix ++ operator
+        Iterator operator++( int )
+        {
+            Iterator retval = *this;
+            FindNextData();
+            return retval;
+        }
+
+        bool operator==( const Iterator& rhs ) const
+        {
+            return ( ( m_tos <= 0 && rhs.m_tos <= 0 )
+                     || ( m_tos == rhs.m_tos && m_stack[m_tos].m_node == rhs.m_stack[m_tos].m_node
+                                && m_stack[m_tos].m_branchIndex
+                                           == rhs.m_stack[m_tos].m_branchIndex ) );
+        }
+
+        bool operator!=( const Iterator& rhs ) const
+        {
+            return ( ( m_tos > 0 || rhs.m_tos > 0 )
+                     && ( m_tos != rhs.m_tos || m_stack[m_tos].m_node != rhs.m_stack[m_tos].m_node
+                                || m_stack[m_tos].m_branchIndex
+                                           != rhs.m_stack[m_tos].m_branchIndex ) );
+        }
+
+    private:
+        /// Data of the branch on top of the stack (For internal use only)
+        DATATYPE& CurrentData() const
+        {
+            const StackElement& curTos = m_stack[m_tos - 1];
+            Branch&             branch = curTos.m_node->m_branch[curTos.m_branchIndex];
+
+            if constexpr( INLINE_DATA )
+                return branch.m_data;
+            else
+                return m_payloads[branch.m_data];
+        }
+
+        /// Find the next data element in the tree (For internal use only)
+        void FindNextData()
+        {
+            while( m_tos > 0 )
+            {
+                StackElement curTos     = Pop();
+                int          nextBranch = curTos.m_branchIndex + 1;
+
+                if( curTos.m_node->IsLeaf() )
+                {
+                    // Keep walking through siblings until we find an overlapping leaf
+                    for( int i = nextBranch; i < curTos.m_node->m_count; i++ )
+                    {
+                        if( RTree::Overlap( &m_rect, &curTos.m_node->m_branch[i].m_rect ) )
+                        {
+                            Push( curTos.m_node, i );
+                            return;
+                        }
+                    }
+                    // No more data, so it will fall back to previous level
+                }
+                else
+                {
+                    // Look for an overlapping sibling that we can use as the fall-back node
+                    // when we've iterated down the current branch
+                    for( int i = nextBranch; i < curTos.m_node->m_count; i++ )
+                    {
+                        if( RTree::Overlap( &m_rect, &curTos.m_node->m_branch[i].m_rect ) )
+                        {
+                            Push( curTos.m_node, i );
+                            break;
+                        }
+                    }
+
+                    Node* nextLevelnode = curTos.m_node->m_branch[curTos.m_branchIndex].m_child;
+
+                    // Since cur node is not a leaf, push first of next level,
+                    // zero-th branch to get deeper into the tree
+                    Push( nextLevelnode, 0 );
+
+                    // If the branch is a leaf, and it overlaps, then break with the current data
+                    // Otherwise, we allow it to seed our next iteration as it may have siblings that
+                    // do overlap
+                    if( nextLevelnode->IsLeaf()
+                            && RTree::Overlap( &m_rect, &nextLevelnode->m_branch[0].m_rect ) )
+                        return;
+                }
+            }
+        }
+
+        /// Push node and branch onto iteration stack (For internal use only)
+        void Push( Node* a_node, int a_branchIndex )
+        {
+            m_stack[m_tos].m_node = a_node;
+            m_stack[m_tos].m_branchIndex = a_branchIndex;
+            ++m_tos;
+            ASSERT( m_tos <= MAX_STACK );
+        }
+
+        /// Pop element off iteration stack (For internal use only)
+        StackElement& Pop()
+        {
+            ASSERT( m_tos > 0 );
+            --m_tos;
+            return m_stack[m_tos];
+        }
+
+        std::array<StackElement, MAX_STACK> m_stack; ///< Stack for iteration
+        int                                 m_tos;   ///< Top Of Stack index
+        Rect                                m_rect;  ///< Search rectangle
+        DATATYPE*                           m_payloads; ///< Side storage of the tree, unless INLINE_DATA
+
+        friend class RTree;
+        // Allow hiding of non-public functions while allowing manipulation by logical owner
+    };
+
+    using iterator       = Iterator;
+    using const_iterator = const Iterator;
+
+    iterator begin( const Rect& aRect ) const
+    {
+        iterator retval( aRect );
+
+        retval.m_payloads = m_payloads.data();
+
+        if( !m_root->m_count )
+            return retval;
+
+        retval.Push( m_root, 0 );
+
+        // If the first leaf matches, return the root pointer, otherwise,
+        // increment to the first match or empty if none.
+        if( m_root->IsLeaf() && Overlap( &aRect, &m_root->m_branch[0].m_rect ) )
+            return retval;
+
+        ++retval;
+        return retval;
+    }
+
+    iterator begin() const
+    {
+        Rect full_rect;
+
+        std::fill_n( full_rect.m_min, NUMDIMS, INT_MIN );
+        std::fill_n( full_rect.m_max, NUMDIMS, INT_MAX );
+
+        return begin( full_rect );
+    }
+
+    iterator end() const
+    {
+        iterator retval;
+        return retval;
+    }
+
+    iterator end( const Rect& aRect ) const
+    {
+        return end();
+    }
+
+
+protected:
+    typedef SPLITPOLICY SplitPolicy;    ///< Insertion policy, tells whether branches carry Hilbert keys
+
+    /// Data small and trivial enough to share the union with the child pointer is kept in
+    /// the leaf branch.  Any other DATATYPE lives in m_payloads and leaves hold its slot.
+    static constexpr bool INLINE_DATA = std::is_trivially_copyable<DATATYPE>::value
+                                        && sizeof( DATATYPE ) <= sizeof( void* );
+
+    typedef typename std::conditional<INLINE_DATA, DATATYPE, uint32_t>::type DataSlot;
+
+    /// May be data or may be another subtree
+    /// The parents level determines this.
+    /// If the parents level is 0, then this is data
+    struct Branch : RTreeBranchKey<SPLITPOLICY::HILBERT>, RTreeBranchLayers<LAYERPOLICY::LAYERS>
+    {
+        Rect m_rect;                              ///< Bounds
+        union
+        {
+            Node*       m_child;                    ///< Child node
+            DataSlot    m_data;                     ///< Data Id or Ptr, or its slot in m_payloads
+        };
+    };
+
+    typedef typename LAYOUT::template Lanes<ELEMTYPE, NUMDIMS, MAXNODES> Lanes;
+
+    /// Node for each branch level
+    struct Node : Lanes
+    {
+        constexpr bool IsInternalNode() const { return m_level > 0; }   // Not a leaf, but a internal node
+        constexpr bool IsLeaf()         const { return m_level == 0; }  // A leaf, contains data
+
+        /// Copy the rect of a branch into the layout lanes, needed after every change of m_branch
+        void UpdateLane( int a_index )
+        {
+            Lanes::Set( a_index, m_branch[a_index].m_rect.m_min, m_branch[a_index].m_rect.m_max );
+        }
+
+        int     m_count;                            ///< Count
+        int     m_level;                            ///< Leaf is zero, others positive
+        int     m_entryCount;                       ///< Data entries in the subtree
+        Branch  m_branch[MAXNODES];                 ///< Branch
+    };
+
+    /// A link list of nodes for reinsertion after a delete operation
+    struct ListNode
+    {
+        ListNode*   m_next;                         ///< Next in list
+        Node*       m_node;                         ///< Node
+    };
+
+    /// Variables for finding a split partition
+    struct PartitionVars
+    {
+        int             m_partition[MAXNODES + 1];
+        int             m_total;
+        int             m_minFill;
+        bool            m_taken[MAXNODES + 1];
+        int             m_count[2];
+        Rect            m_cover[2];
+        ELEMTYPEREAL    m_area[2];
+
+        Branch          m_branchBuf[MAXNODES + 1];
+        int             m_branchCount;
+        Rect            m_coverSplit;
+        ELEMTYPEREAL    m_coverSplitArea;
+    };
+
+    /// Bookkeeping of one insert under the R* policy
+    struct ReinsertState
+    {
+        const Node* m_root;             ///< Root when the insert started, it is never reinserted from
+        uint64_t    m_treatedLevels;    ///< Bit per level that already had its forced reinsertion
+        bool        m_coverShrunk;      ///< Entries left a node on the insert path, covers need recomputing
+    };
+
+    /// Data structure used for Nearest Neighbor search implementation
+    struct NNNode
+    {
+        Branch m_branch;
+        ELEMTYPE minDist;
+        bool isLeaf;
+
+        inline bool operator<(const NNNode &other) const
+        {
+            /// This is reversed on purpose to use std::priority_queue
+            return other.minDist < minDist;
+        }
+    };
+
+    Node*           AllocNode() const;
+    void            FreeNode( Node* a_node ) const;
+    void            InitNode( Node* a_node ) const;
+    void            InitRect( Rect* a_rect ) const;
+    bool            InsertRectRec( const Branch*    a_branch,
+                                   Node*            a_node,
+                                   Node**           a_newNode,
+                                   int              a_level,
+                                   ReinsertState*   a_state ) const;
+    bool            InsertRect( const Branch* a_branch, Node** a_root, int a_level ) const;
+    bool            InsertRectRoot( const Branch* a_branch, Node** a_root, int a_level,
+                                    ReinsertState* a_state ) const;
+    bool            InsertBranch( const Branch* a_branch, Node* a_node, Node** a_newNode,
+                                  ReinsertState* a_state ) const;
+    void            ForcedReinsert( Node* a_node, const Branch* a_branch ) const;
+    Rect            NodeCover( Node* a_node ) const;
+    static LayerMask NodeLayers( const Node* a_node );
+    static LayerMask BranchLayers( const Branch& a_branch );
+    static void     SetBranchLayers( Branch& a_branch, LayerMask a_layers );
+    Branch          ChildBranch( Node* a_child ) const;
+    void            RefreshBranch( Node* a_node, int a_index ) const;
+    bool            AddBranch( const Branch* a_branch, Node* a_node, Node** a_newNode ) const;
+    void            DisconnectBranch( Node* a_node, int a_index ) const;
+    int             PickBranch( const Rect* a_rect, Node* a_node ) const;
+    int             PickBranchRStar( const Rect* a_rect, Node* a_node ) const;
+    static int      PickBranchHilbert( uint64_t a_key, const Node* a_node );
+    static int      HilbertSibling( const Node* a_node, int a_index );
+    bool            ShareOverflow( Node* a_node, int a_index, Node* a_other, Node** a_newNode,
+                                   ReinsertState* a_state ) const;
+    void            DistributeByKey( Branch* a_branches, int a_count, Node* const* a_nodes,
+                                     int a_nodeCount ) const;
+    static void     KeyEntry( Branch& a_branch );
+    static void     KeyChild( Branch& a_branch );
+    static uint64_t NodeKey( const Node* a_node );
+    void            RefreshPathKeys() const;
+    Rect            CombineRect( const Rect* a_rectA, const Rect* a_rectB ) const;
+    void            SplitNode( Node* a_node, const Branch* a_branch, Node** a_newNode ) const;
+    ELEMTYPEREAL    CalcRectVolume( const Rect* a_rect ) const;
+    void            GetBranches( Node* a_node, const Branch* a_branch, PartitionVars* a_parVars ) const;
+    void            ChoosePartition( PartitionVars* a_parVars, int a_minFill ) const;
+    void            ChoosePartitionRStar( PartitionVars* a_parVars, int a_minFill ) const;
+    void            SortOnAxis( const PartitionVars* a_parVars, int a_axis, bool a_byMax, int* a_order ) const;
+    void            CoverRuns( const PartitionVars* a_parVars, const int* a_order, Rect* a_prefix,
+                               Rect* a_suffix ) const;
+    ELEMTYPEREAL    RectMargin( const Rect* a_rect ) const;
+    static ELEMTYPEREAL OverlapArea( const Rect* a_rectA, const Rect* a_rectB );
+    void            LoadNodes( Node* a_nodeA, Node* a_nodeB, PartitionVars* a_parVars ) const;
+    void            InitParVars( PartitionVars* a_parVars, int a_maxRects, int a_minFill ) const;
+    void            PickSeeds( PartitionVars* a_parVars ) const;
+    void            Classify( int a_index, int a_group, PartitionVars* a_parVars ) const;
+    bool            RemoveRect( const Rect* a_rect, const DATATYPE& a_id, Node** a_root ) const;
+    bool            RemoveRectRec( const Rect*      a_rect,
+                                   const DATATYPE&  a_id,
+                                   Node*            a_node,
+                                   ListNode**       a_listNode ) const;
+    DataSlot        StoreData( const DATATYPE& a_data ) const;
+    void            ReleaseData( DataSlot a_slot ) const;
+    void            OrderDataRec( Node* a_node, std::vector<DATATYPE>& a_ordered );
+
+    const DATATYPE& BranchData( const Branch& a_branch ) const
+    {
+        if constexpr( INLINE_DATA )
+            return a_branch.m_data;
+        else
+            return m_payloads[a_branch.m_data];
+    }
+
+    bool            FindEntryPath( const Rect* a_rect, const DATATYPE& a_id, Node* a_node,
+                                   std::vector<std::pair<Node*, int>>& a_path ) const;
+    ListNode*       AllocListNode() const;
+    void            FreeListNode( ListNode* a_listNode ) const;
+    static bool     Overlap( const Rect* a_rectA, const Rect* a_rectB );
+    static bool     Contains( const Rect* a_outer, const Rect* a_inner );
+    void            SetBranchRect( Node* a_node, int a_index, const Rect& a_rect ) const;
+    void            ReInsert( Node* a_node, ListNode** a_listNode ) const;
+    ELEMTYPE        MinDist( const ELEMTYPE a_point[NUMDIMS], const Rect& a_rect ) const;
+    Node*           PackBranches( std::vector<Branch>& a_branches, BulkLoadMethod a_method ) const;
+    void            PackLevel( const std::vector<Branch>& a_branches, int a_level,
+                               std::vector<Branch>& a_parents ) const;
+    void            SortTileRecursive( Branch* a_first, Branch* a_last, int a_axis ) const;
+    double          NodeBadness( Node* a_node ) const;
+    int             RepackGroup( Node* a_node, int a_budget ) const;
+    void            CollectEntriesRec( Node* a_node, std::vector<Branch>& a_entries ) const;
+    Node*           BuildTopDown( Branch* a_first, Branch* a_last, int a_level ) const;
+    int             TileCount( std::size_t a_entries, int a_level ) const;
+    void            PartitionTiles( Branch* a_first, Branch* a_last, int a_tiles, int a_axis,
+                                    std::vector<Branch*>& a_ends ) const;
+    static std::size_t LevelCapacity( int a_level, int a_fanout );
+    static void     SortByKey( Branch* a_first, Branch* a_last );
+    void            SortHilbert( std::vector<Branch>& a_branches ) const;
+    static uint64_t HilbertKey( const Rect& a_rect, const Rect& a_bounds );
+    static uint64_t HilbertKey( const Rect& a_rect );
+    static uint64_t HilbertIndex( uint32_t a_coord[NUMDIMS] );
+
+    bool Search( const Node* a_node, const Rect* a_rect, int& a_foundCount,
+                 std::function<bool (const DATATYPE&)> a_callback ) const;
+
+    /// Call a_func( index ) for every branch of the node overlapping the rect, in index order.
+    /// Stops and returns false as soon as a_func returns false.
+    template <class FUNC>
+    static bool ForEachOverlap( const Node* a_node, const Rect* a_rect, FUNC&& a_func )
+    {
+        if constexpr( Lanes::SOA )
+        {
+            uint64_t mask = a_node->OverlapMask( a_node->m_count, a_rect->m_min, a_rect->m_max );
+
+            for( ; mask; mask &= mask - 1 )
+            {
+                if( !a_func( LowestBit( mask ) ) )
+                {
+                    return false;
+                }
+            }
+        }
+        else
+        {
+            for( int index = 0; index < a_node->m_count; ++index )
+            {
+                if( Overlap( a_rect, &a_node->m_branch[index].m_rect ) && !a_func( index ) )
+                {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    /// Index of the lowest set bit, a_mask must not be zero
+    static int LowestBit( uint64_t a_mask )
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward64( &index, a_mask );
+        return (int) index;
+#else
+        return __builtin_ctzll( a_mask );
+#endif
+    }
+
+    template <class VISITOR>
+    bool Search( const Node* a_node, const Rect* a_rect, VISITOR& a_visitor, int& a_foundCount ) const
+    {
+        ASSERT( a_node );
+        ASSERT( a_node->m_level >= 0 );
+        ASSERT( a_rect );
+
+        RTREE_COUNT( nodesVisited, 1 );
+        RTREE_COUNT( overlapTests, a_node->m_count );
+
+        if( a_node->IsInternalNode() ) // This is an internal node in the tree
+        {
+            return ForEachOverlap( a_node, a_rect,
+                                   [&]( int index )
+                                   {
+                                       return Search( a_node->m_branch[index].m_child, a_rect, a_visitor,
+                                                      a_foundCount );
+                                   } );
+        }
+        else // This is a leaf node
+        {
+            RTREE_COUNT( leavesTested, 1 );
+
+            return ForEachOverlap( a_node, a_rect,
+                                   [&]( int index )
+                                   {
+                                       const DATATYPE& id = BranchData( a_node->m_branch[index] );
+
+                                       if( !a_visitor( id ) )
+                                           return false;
+
+                                       a_foundCount++;
+                                       return true;
+                                   } );
+        }
+    }
+
+    /// Node access for RTreeNearestSearch, skipping branches without one of m_layers
+    struct NearestAccess
+    {
+        typedef const Node* NodeRef;
+
+        const RTree*    m_tree;
+        const ELEMTYPE* m_point;
+        LayerMask       m_layers;
+
+        NodeRef Root() const { return m_tree->m_root; }
+
+        bool IsLeaf( NodeRef a_node ) const { return a_node->IsLeaf(); }
+
+        int Count( NodeRef a_node ) const { return a_node->m_count; }
+
+        bool Skip( NodeRef a_node, int a_index ) const { return !( BranchLayers( a_node->m_branch[a_index] ) & m_layers ); }
+
+        ELEMTYPEREAL MinDistSq( NodeRef a_node, int a_index ) const
+        {
+            return RTree::MinDistSq( m_point, a_node->m_branch[a_index].m_rect );
+        }
+
+        NodeRef Child( NodeRef a_node, int a_index ) const { return a_node->m_branch[a_index].m_child; }
+
+        const DATATYPE& Data( NodeRef a_node, int a_index ) const
+        {
+            return m_tree->BranchData( a_node->m_branch[a_index] );
+        }
+
+        void Visited( NodeRef a_node ) const { m_tree->CountVisit( a_node ); }
+
+        void Pushed() const { m_tree->CountPush(); }
+    };
+
+    void CountVisit( const Node* a_node ) const
+    {
+        RTREE_COUNT( nodesVisited, 1 );
+        RTREE_COUNT( leavesTested, a_node->IsLeaf() ? 1 : 0 );
+    }
+
+    void CountPush() const { RTREE_COUNT( heapPushes, 1 ); }
+
+    /// Start loading every cache line of a_node, without waiting for it
+    static void PrefetchNode( const Node* a_node )
+    {
+        const char* bytes = reinterpret_cast<const char*>( a_node );
+
+        for( size_t offset = 0; offset < sizeof( Node ); offset += 64 )
+        {
+#ifdef _MSC_VER
+            _mm_prefetch( bytes + offset, _MM_HINT_T0 );
+#else
+            __builtin_prefetch( bytes + offset );
+#endif
+        }
+    }
+
+    /// Search restricted to entries on a_layers, see the public overload
+    template <class VISITOR>
+    bool SearchLayers( const Node* a_node, const Rect* a_rect, LayerMask a_layers, VISITOR& a_visitor,
+                       int& a_foundCount ) const;
+
+    /// Ray prepared for slab tests
+    struct Ray
+    {
+        ELEMTYPEREAL m_origin[NUMDIMS];
+        ELEMTYPEREAL m_invDir[NUMDIMS];     ///< Reciprocal of the direction, unused where it is zero
+        bool         m_parallel[NUMDIMS];   ///< Direction is zero on this axis
+    };
+
+    template <class COORD>
+    static Ray  MakeRay( const COORD a_origin[NUMDIMS], const COORD a_direction[NUMDIMS] );
+    static bool RayEnter( const Ray& a_ray, const Rect& a_rect, ELEMTYPEREAL a_limit, ELEMTYPEREAL& a_t );
+
+    /// Call a_func( data, t ) for entries crossed by a_ray up to a_limit in order of t, until it
+    /// returns false.  a_func may lower a_limit to prune the rest of the walk.
+    template <class FUNC>
+    void RayWalk( const Ray& a_ray, ELEMTYPEREAL& a_limit, FUNC&& a_func ) const;
+
+    /// Where a rect lies relative to a query region
+    enum class RegionRelation
+    {
+        OUTSIDE,
+        CROSSING,
+        INSIDE
+    };
+
+    /// Report entries below a_node by a_classify( const Rect& ) -> RegionRelation, whole
+    /// subtrees for nodes INSIDE.  Returns false if the visitor asked to stop.
+    template <class CLASSIFY, class VISITOR>
+    bool RegionSearch( const Node* a_node, CLASSIFY& a_classify, RegionMatch a_match, VISITOR& a_visitor,
+                       int& a_foundCount ) const;
+
+    template <class VISITOR>
+    bool VisitSubtree( const Node* a_node, VISITOR& a_visitor, int& a_foundCount ) const;
+
+    /// Squared distance from a point to the farthest point of a rect
+    static ELEMTYPEREAL MaxDistSq( const ELEMTYPE a_point[NUMDIMS], const Rect& a_rect );
+
+    /// A pair of subtrees still to be joined.  m_self marks a single subtree joined with itself.
+    template <class OTHERTREE>
+    struct JoinTask
+    {
+        const Node*                         m_node;
+        Rect                                m_rect;
+        const typename OTHERTREE::Node*     m_other;
+        typename OTHERTREE::Rect            m_otherRect;
+        bool                                m_self;
+    };
+
+    template <class OTHERRECT>
+    static bool     OverlapWith( const Rect* a_rect, const OTHERRECT* a_other );
+
+    template <class OTHERTREE, class FUNC>
+    static bool     ForEachJoinChild( const Node* a_node, const Rect* a_rect,
+                                      const typename OTHERTREE::Node* a_other,
+                                      const typename OTHERTREE::Rect* a_otherRect, FUNC&& a_func,
+                                      LayerMask a_layers = ALL_LAYERS,
+                                      typename OTHERTREE::LayerMask a_otherLayers = OTHERTREE::ALL_LAYERS );
+
+    template <class OTHERTREE, class VISITOR>
+    bool            JoinRec( const OTHERTREE& a_otherTree, const Node* a_node, const Rect* a_rect,
+                             const typename OTHERTREE::Node* a_other, const typename OTHERTREE::Rect* a_otherRect,
+                             VISITOR& a_visitor, int& a_foundCount, LayerMask a_layers = ALL_LAYERS,
+                             typename OTHERTREE::LayerMask a_otherLayers = OTHERTREE::ALL_LAYERS ) const;
+
+    template <class VISITOR>
+    bool            SelfJoinRec( const Node* a_node, VISITOR& a_visitor, int& a_foundCount ) const;
+
+    template <class OTHERTREE>
+    std::vector<std::pair<DATATYPE, typename OTHERTREE::DataType>>
+                    RunJoinTasks( const OTHERTREE& a_otherTree, std::vector<JoinTask<OTHERTREE>>& a_tasks,
+                                  int a_threadCount ) const;
+
+    /// Call a_work( thread ) for thread 0 .. a_threadCount - 1, each on its own thread, the
+    /// first one on the calling thread.  Returns when all are done.
+    template <class FUNC>
+    static void     RunOnThreads( int a_threadCount, FUNC&& a_work );
+
+    void    RemoveAllRec( Node* a_node ) const;
+    void    Reset() const;
+    int     CountRec( const Node* a_node, const Rect* a_rect ) const;
+    void    CalcStatsRec( const Node* a_node, Statistics& a_stats, int& a_branchCount ) const;
+    void    CalcQualityRec( const Node* a_node, QualityStats& a_quality, std::vector<int>& a_branchCounts ) const;
+    static ELEMTYPEREAL RectArea( const Rect& a_rect );
+
+    bool    SaveRec( const Node* a_node, RTFileStream& a_stream ) const;
+    bool    LoadRec( Node* a_node, RTFileStream& a_stream, bool a_hasLayers ) const;
+
+    Node*           m_root;                         ///< Root of tree
+
+    mutable typename ALLOCATOR::template Pool<Node>     m_nodePool;     ///< Storage for nodes
+    mutable typename ALLOCATOR::template Pool<ListNode> m_listNodePool; ///< Storage for reinsertion lists
+
+    mutable std::vector<std::pair<Branch, int>> m_reinsertQueue;    ///< R* evictions and their level
+
+    mutable std::vector<DATATYPE>               m_payloads;         ///< Leaf data by slot, unless INLINE_DATA
+    mutable std::vector<uint32_t>               m_freeSlots;        ///< Released slots of m_payloads
+
+    std::vector<std::pair<Node*, int>>          m_updatePath;       ///< Node and branch index from root to leaf
+    UpdateStats                                 m_updateStats;      ///< Paths taken by Update
+    std::vector<int>                            m_compactCursor;    ///< Branch indices down to where Compact stopped
+
+    struct QueryCounters
+    {
+        std::atomic<uint64_t> nodesVisited{ 0 };
+        std::atomic<uint64_t> leavesTested{ 0 };
+        std::atomic<uint64_t> overlapTests{ 0 };
+        std::atomic<uint64_t> heapPushes{ 0 };
+    };
+
+    struct NoQueryCounters
+    {
+    };
+
+    typedef typename std::conditional<STATSPOLICY::COUNTED, QueryCounters, NoQueryCounters>::type Counters;
+
+    mutable Counters                            m_queryCounters;    ///< See GetQueryStats
+};
+
+
+// Because there is not stream support, this is a quick and dirty file I/O helper.
+// Users will likely replace its usage with a Stream implementation from their favorite API.
+class RTFileStream
+{
+    FILE* m_file;
+public:
+
+
+    RTFileStream()
+    {
+        m_file = NULL;
+    }
+
+    ~RTFileStream()
+    {
+        Close();
+    }
+
+    bool OpenRead( const char* a_fileName )
+    {
+        m_file = std::fopen( a_fileName, "rb" );
+
+        if( !m_file )
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    bool OpenWrite( const char* a_fileName )
+    {
+        m_file = std::fopen( a_fileName, "wb" );
+
+        if( !m_file )
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    void Close()
+    {
+        if( m_file )
+        {
+            std::fclose( m_file );
+            m_file = NULL;
+        }
+    }
+
+    template <typename TYPE>
+    size_t Write( const TYPE& a_value )
+    {
+        ASSERT( m_file );
+        return std::fwrite( (void*) &a_value, sizeof(a_value), 1, m_file );
+    }
+
+    template <typename TYPE>
+    size_t WriteArray( const TYPE* a_array, int a_count )
+    {
+        ASSERT( m_file );
+        return std::fwrite( (void*) a_array, sizeof(TYPE) * a_count, 1, m_file );
+    }
+
+    template <typename TYPE>
+    size_t Read( TYPE& a_value )
+    {
+        ASSERT( m_file );
+        return std::fread( (void*) &a_value, sizeof(a_value), 1, m_file );
+    }
+
+    template <typename TYPE>
+    size_t ReadArray( TYPE* a_array, int a_count )
+    {
+        ASSERT( m_file );
+        return std::fread( (void*) a_array, sizeof(TYPE) * a_count, 1, m_file );
+    }
+};
+
+
+RTREE_TEMPLATE RTREE_QUAL::RTree()
+{
+    ASSERT( MAXNODES > MINNODES );
+    ASSERT( MINNODES > 0 );
+
+    m_root = AllocNode();
+    m_root->m_level = 0;
+    m_updateStats = UpdateStats();
+}
+
+
+RTREE_TEMPLATE
+template <class ITERATOR>
+RTREE_QUAL::RTree( ITERATOR a_first, ITERATOR a_last, BulkLoadMethod a_method ) : RTree()
+{
+    BulkLoad( a_first, a_last, a_method );
+}
+
+
+RTREE_TEMPLATE
+RTREE_QUAL::~RTree() {
+    Reset(); // Free, or reset node memory
+}
+
+
+RTREE_TEMPLATE
+void RTREE_QUAL::Insert( const ELEMTYPE     a_min[NUMDIMS],
+                         const ELEMTYPE     a_max[NUMDIMS],
+                         const DATATYPE&    a_dataId,
+                         LayerMask          a_layers )
+{
+#ifdef _DEBUG
+
+    for( int index = 0; index<NUMDIMS; ++index )
+    {
+        ASSERT( a_min[index] <= a_max[index] );
+    }
+
+#endif    // _DEBUG
+
+    Branch branch;
+    branch.m_data = StoreData( a_dataId );
+    SetBranchLayers( branch, a_layers );
+
+    for( int axis = 0; axis < NUMDIMS; ++axis )
+    {
+        branch.m_rect.m_min[axis] = a_min[axis];
+        branch.m_rect.m_max[axis] = a_max[axis];
+    }
+
+    KeyEntry( branch );
+    InsertRect( &branch, &m_root, 0 );
+}
+
+
+RTREE_TEMPLATE
+bool RTREE_QUAL::Remove( const ELEMTYPE     a_min[NUMDIMS],
+                         const ELEMTYPE     a_max[NUMDIMS],
+                         const DATATYPE&    a_dataId )
+{
+#ifdef _DEBUG
+
+    for( int index = 0; index<NUMDIMS; ++index )
+    {
+        ASSERT( a_min[index] <= a_max[index] );
+    }
+
+#endif    // _DEBUG
+
+    Rect rect;
+
+    for( int axis = 0; axis < NUMDIMS; ++axis )
+    {
+        rect.m_min[axis] = a_min[axis];
+        rect.m_max[axis] = a_max[axis];
+    }
+
+    return RemoveRect( &rect, a_dataId, &m_root );
+}
+
+
+RTREE_TEMPLATE
+typename RTREE_QUAL::UpdatePath RTREE_QUAL::Update( const ELEMTYPE   a_oldMin[NUMDIMS],
+                                                    const ELEMTYPE   a_oldMax[NUMDIMS],
+                                                    const ELEMTYPE   a_newMin[NUMDIMS],
+                                                    const ELEMTYPE   a_newMax[NUMDIMS],
+                                                    const DATATYPE&  a_dataId,
+                                                    double           a_maxGrowth )
+{
+#ifdef _DEBUG
+
+    for( int index = 0; index<NUMDIMS; ++index )
+    {
+        ASSERT( a_oldMin[index] <= a_oldMax[index] );
+        ASSERT( a_newMin[index] <= a_newMax[index] );
+    }
+
+#endif    // _DEBUG
+
+    Rect oldRect;
+    Rect newRect;
+
+    for( int axis = 0; axis < NUMDIMS; ++axis )
+    {
+        oldRect.m_min[axis] = a_oldMin[axis];
+        oldRect.m_max[axis] = a_oldMax[axis];
+        newRect.m_min[axis] = a_newMin[axis];
+        newRect.m_max[axis] = a_newMax[axis];
+    }
+
+    m_updatePath.clear();
+
+    if( !FindEntryPath( &oldRect, a_dataId, m_root, m_updatePath ) )
+    {
+        ++m_updateStats.notFound;
+        return UpdatePath::NOT_FOUND;
+    }
+
+    Node* leaf = m_updatePath.back().first;
+    const int leafIndex = m_updatePath.back().second;
+
+    // The branch pointing at the leaf holds its cover, the root leaf has none
+    if( m_updatePath.size() == 1 )
+    {
+        SetBranchRect( leaf, leafIndex, newRect );
+        RefreshPathKeys();
+        ++m_updateStats.inPlace;
+        return UpdatePath::IN_PLACE;
+    }
+
+    std::pair<Node*, int>& parent = m_updatePath[m_updatePath.size() - 2];
+    const Rect& leafCover = parent.first->m_branch[parent.second].m_rect;
+
+    if( Contains( &leafCover, &newRect ) )
+    {
+        SetBranchRect( leaf, leafIndex, newRect );
+        RefreshPathKeys();
+        ++m_updateStats.inPlace;
+        return UpdatePath::IN_PLACE;
+    }
+
+    // Growing a leaf far beyond its neighbours degrades every later query,
+    // move the entry to the subtree that suits it instead.  Growth is measured from the exact
+    // cover of the other entries: the stored cover may hold slack from earlier updates, and
+    // measuring from it would let each call add another a_maxGrowth.
+    Rect others;
+    bool hasOthers = false;
+
+    for( int index = 0; index < leaf->m_count; ++index )
+    {
+        if( index != leafIndex )
+        {
+            others = hasOthers ? CombineRect( &others, &leaf->m_branch[index].m_rect ) : leaf->m_branch[index].m_rect;
+            hasOthers = true;
+        }
+    }
+
+    const Rect grown = hasOthers ? CombineRect( &others, &newRect ) : newRect;
+
+    if( !hasOthers || RectMargin( &grown ) > RectMargin( &others ) * (ELEMTYPEREAL) (1.0 + a_maxGrowth) )
+    {
+        // Copy the stored data before removal releases it
+        Branch branch;
+        branch.m_rect = newRect;
+        branch.m_data = StoreData( BranchData( leaf->m_branch[leafIndex] ) );
+        SetBranchLayers( branch, BranchLayers( leaf->m_branch[leafIndex] ) );
+        KeyEntry( branch );
+
+        RemoveRect( &oldRect, a_dataId, &m_root );
+        InsertRect( &branch, &m_root, 0 );
+
+        ++m_updateStats.reinserted;
+        return UpdatePath::REINSERTED;
+    }
+
+    SetBranchRect( leaf, leafIndex, newRect );
+
+    // The leaf cover is set exactly, dropping the slack of earlier updates, so it stays within
+    // a_maxGrowth of the other entries however often they move
+    SetBranchRect( parent.first, parent.second, grown );
+
+    // Grow covers above it bottom-up, stopping at the first one already containing the new rect
+    for( int depth = (int) m_updatePath.size() - 3; depth >= 0; --depth )
+    {
+        Node* node = m_updatePath[depth].first;
+        const int index = m_updatePath[depth].second;
+
+        if( Contains( &(node->m_branch[index].m_rect), &newRect ) )
+        {
+            break;
+        }
+
+        SetBranchRect( node, index, CombineRect( &(node->m_branch[index].m_rect), &newRect ) );
+    }
+
+    RefreshPathKeys();
+    ++m_updateStats.enlarged;
+    return UpdatePath::ENLARGED;
+}
+
+
+RTREE_TEMPLATE
+template <class ITERATOR>
+typename RTREE_QUAL::BulkLoadStats RTREE_QUAL::BulkLoad( ITERATOR a_first, ITERATOR a_last,
+                                                         BulkLoadMethod a_method )
+{
+    const auto startTime = std::chrono::steady_clock::now();
+
+    std::vector<Branch> branches;
+    branches.reserve( std::distance( a_first, a_last ) );
+
+    // The loaded entries replace all existing ones
+    m_payloads.clear();
+    m_freeSlots.clear();
+
+    typedef typename std::iterator_traits<ITERATOR>::value_type Entry;
+
+    for( ; a_first != a_last; ++a_first )
+    {
+        Branch branch;
+        branch.m_rect = std::get<0>( *a_first );
+        branch.m_data = StoreData( std::get<1>( *a_first ) );
+
+        if constexpr( std::tuple_size<Entry>::value > 2 )
+            SetBranchLayers( branch, std::get<2>( *a_first ) );
+        else
+            SetBranchLayers( branch, ALL_LAYERS );
+
+        KeyEntry( branch );
+        branches.push_back( branch );
+    }
+
+    Reset();
+    m_root = PackBranches( branches, a_method );
+
+    if constexpr( !INLINE_DATA )
+    {
+        // Lay the data out in leaf order, so the hits of a query are next to each other
+        std::vector<DATATYPE> ordered;
+        ordered.reserve( m_payloads.size() );
+        OrderDataRec( m_root, ordered );
+        m_payloads.swap( ordered );
+    }
+
+    const std::chrono::duration<double> buildTime = std::chrono::steady_clock::now() - startTime;
+    const Statistics                    treeStats = CalcStats();
+
+    BulkLoadStats stats;
+    stats.buildTime  = buildTime.count();
+    stats.fillFactor = treeStats.fillFactor;
+    stats.nodeCount  = treeStats.nodeCount;
+    stats.height     = m_root->m_level + 1;
+
+    return stats;
+}
+
+
+RTREE_TEMPLATE
+int RTREE_QUAL::Search( const ELEMTYPE a_min[NUMDIMS],
+                        const ELEMTYPE a_max[NUMDIMS],
+                        std::function<bool (const DATATYPE&)> a_callback ) const
+{
+#ifdef _DEBUG
+
+    for( int index = 0; index < NUMDIMS; ++index )
+    {
+        ASSERT( a_min[index] <= a_max[index] );
+    }
+
+#endif    // _DEBUG
+
+    Rect rect;
+
+    for( int axis = 0; axis < NUMDIMS; ++axis )
+    {
+        rect.m_min[axis] = a_min[axis];
+        rect.m_max[axis] = a_max[axis];
+    }
+
+    // NOTE: May want to return search result another way, perhaps returning the number of found elements here.
+
+    int foundCount = 0;
+    Search( m_root, &rect, foundCount, a_callback );
+    return foundCount;
+}
+
+
+RTREE_TEMPLATE
+int RTREE_QUAL::Search( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS],
+        std::function<bool( const DATATYPE& )> a_callback, bool& aFinished ) const
+{
+#ifdef _DEBUG
+
+    for( int index = 0; index < NUMDIMS; ++index )
+    {
+        ASSERT( a_min[index] <= a_max[index] );
+    }
+
+#endif // _DEBUG
+
+    Rect rect;
+
+    for( int axis = 0; axis < NUMDIMS; ++axis )
+    {
+        rect.m_min[axis] = a_min[axis];
+        rect.m_max[axis] = a_max[axis];
+    }
+
+    // NOTE: May want to return search result another way, perhaps returning the number of found elements here.
+
+    int foundCount = 0;
+    aFinished      = Search( m_root, &rect, foundCount, a_callback );
+    return foundCount;
+}
+
+
+RTREE_TEMPLATE
+template <class VISITOR>
+int RTREE_QUAL::Search( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS], LayerMask a_layers,
+                        VISITOR&& a_visitor ) const
+{
+    Rect rect;
+
+    for( int axis = 0; axis < NUMDIMS; ++axis )
+    {
+        rect.m_min[axis] = a_min[axis];
+        rect.m_max[axis] = a_max[axis];
+    }
+
+    int foundCount = 0;
+    SearchLayers( m_root, &rect, a_layers, a_visitor, foundCount );
+    return foundCount;
+}
+
+
+RTREE_TEMPLATE
+template <class VISITOR>
+int RTREE_QUAL::SearchFrontier( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS], VISITOR&& a_visitor,
+                                SearchBuffer& a_buffer ) const
+{
+    Rect rect;
+
+    for( int axis = 0; axis < NUMDIMS; ++axis )
+    {
+        rect.m_min[axis] = a_min[axis];
+        rect.m_max[axis] = a_max[axis];
+    }
+
+    std::vector<const Node*>& frontier = a_buffer.m_frontier;
+    std::vector<const Node*>& next = a_buffer.m_next;
+    int                       foundCount = 0;
+
+    frontier.assign( 1, m_root );
+
+    // The tree is balanced, so the whole frontier is on one level
+    while( !frontier.empty() && frontier.front()->IsInternalNode() )
+    {
+        next.clear();
+
+        for( const Node* node : frontier )
+        {
+            RTREE_COUNT( nodesVisited, 1 );
+            RTREE_COUNT( overlapTests, node->m_count );
+
+            ForEachOverlap( node, &rect,
+                            [&]( int index )
+                            {
+                                PrefetchNode( node->m_branch[index].m_child );
+                                next.push_back( node->m_branch[index].m_child );
+                                return true;
+                            } );
+        }
+
+        frontier.swap( next );
+    }
+
+    for( const Node* leaf : frontier )
+    {
+        RTREE_COUNT( nodesVisited, 1 );
+        RTREE_COUNT( leavesTested, 1 );
+        RTREE_COUNT( overlapTests, leaf->m_count );
+
+        const bool more = ForEachOverlap( leaf, &rect,
+                                          [&]( int index )
+                                          {
+                                              if( !a_visitor( BranchData( leaf->m_branch[index] ) ) )
+                                                  return false;
+
+                                              foundCount++;
+                                              return true;
+                                          } );
+
+        if( !more )
+            break;
+    }
+
+    return foundCount;
+}
+
+
+// Search below a_node, descending only into branches holding one of the layers.
+RTREE_TEMPLATE
+template <class VISITOR>
+bool RTREE_QUAL::SearchLayers( const Node* a_node, const Rect* a_rect, LayerMask a_layers, VISITOR& a_visitor,
+                               int& a_foundCount ) const
+{
+    RTREE_COUNT( nodesVisited, 1 );
+    RTREE_COUNT( leavesTested, a_node->IsLeaf() ? 1 : 0 );
+    RTREE_COUNT( overlapTests, a_node->m_count );
+
+    return ForEachOverlap( a_node, a_rect,
+                           [&]( int index )
+                           {
+                               const Branch& branch = a_node->m_branch[index];
+
+                               if( !( BranchLayers( branch ) & a_layers ) )
+                                   return true;
+
+                               if( a_node->IsInternalNode() )
+                                   return SearchLayers( branch.m_child, a_rect, a_layers, a_visitor, a_foundCount );
+
+                               if( !a_visitor( BranchData( branch ) ) )
+                                   return false;
+
+                               a_foundCount++;
+                               return true;
+                           } );
+}
+
+
+RTREE_TEMPLATE
+std::vector<std::pair<ELEMTYPE, DATATYPE>> RTREE_QUAL::NearestNeighbors(
+        const ELEMTYPE a_point[NUMDIMS],
+        std::function<bool( const std::size_t aNumResults, const ELEMTYPE aMinDist )> aTerminate,
+        std::function<bool( const DATATYPE aElement )> aFilter,
+        std::function<ELEMTYPE( const ELEMTYPE a_point[NUMDIMS], const DATATYPE a_data )> aSquaredDist ) const
+{
+    std::vector<std::pair<ELEMTYPE, DATATYPE>> result;
+    std::priority_queue<NNNode> search_q;
+
+    RTREE_COUNT( nodesVisited, 1 );
+    RTREE_COUNT( leavesTested, m_root->IsLeaf() ? 1 : 0 );
+    RTREE_COUNT( heapPushes, m_root->m_count );
+
+    for( int i = 0; i < m_root->m_count; ++i )
+    {
+        if( m_root->IsLeaf() )
+        {
+            search_q.push( NNNode{ m_root->m_branch[i],
+                               aSquaredDist( a_point, BranchData( m_root->m_branch[i] ) ),
+                               m_root->IsLeaf() });
+        }
+        else
+        {
+            search_q.push( NNNode{ m_root->m_branch[i],
+                               MinDist(a_point, m_root->m_branch[i].m_rect),
+                               m_root->IsLeaf() });
+        }
+    }
+
+    while( !search_q.empty() )
+    {
+        const NNNode curNode = search_q.top();
+
+        if( aTerminate( result.size(), curNode.minDist ) )
+            break;
+
+        search_q.pop();
+
+        if( curNode.isLeaf )
+        {
+            if( aFilter( BranchData( curNode.m_branch ) ) )
+                result.emplace_back( curNode.minDist, BranchData( curNode.m_branch ) );
+        }
+        else
+        {
+            Node* node = curNode.m_branch.m_child;
+
+            RTREE_COUNT( nodesVisited, 1 );
+            RTREE_COUNT( leavesTested, node->IsLeaf() ? 1 : 0 );
+            RTREE_COUNT( heapPushes, node->m_count );
+
+            for( int i = 0; i < node->m_count; ++i )
+            {
+                NNNode newNode;
+                newNode.isLeaf = node->IsLeaf();
+                newNode.m_branch = node->m_branch[i];
+                if( newNode.isLeaf )
+                    newNode.minDist = aSquaredDist( a_point, BranchData( newNode.m_branch ) );
+                else
+                    newNode.minDist = this->MinDist( a_point, node->m_branch[i].m_rect );
+
+                search_q.push( newNode );
+            }
+        }
+    }
+
+    return result;
+}
+
+
+RTREE_TEMPLATE
+template <class DISTANCE, class FILTER>
+int RTREE_QUAL::NearestNeighbors( const ELEMTYPE aPoint[NUMDIMS], int aK, DISTANCE&& aSquaredDist,
+                                  FILTER&& aFilter, NearestNeighborBuffer& aBuffer ) const
+{
+    return NearestNeighbors( aPoint, aK, ALL_LAYERS, aSquaredDist, aFilter, aBuffer );
+}
+
+
+RTREE_TEMPLATE
+template <class DISTANCE, class FILTER>
+int RTREE_QUAL::NearestNeighbors( const ELEMTYPE aPoint[NUMDIMS], int aK, LayerMask aLayers,
+                                  DISTANCE&& aSquaredDist, FILTER&& aFilter,
+                                  NearestNeighborBuffer& aBuffer ) const
+{
+    return NearestNeighbors( aPoint, aK, aLayers, std::numeric_limits<ELEMTYPEREAL>::max(), aSquaredDist,
+                             aFilter, aBuffer );
+}
+
+
+RTREE_TEMPLATE
+template <class DISTANCE, class FILTER>
+int RTREE_QUAL::NearestNeighbors( const ELEMTYPE aPoint[NUMDIMS], int aK, LayerMask aLayers,
+                                  ELEMTYPEREAL aMaxDistSq, DISTANCE&& aSquaredDist, FILTER&& aFilter,
+                                  NearestNeighborBuffer& aBuffer ) const
+{
+    const NearestAccess access{ this, aPoint, aLayers };
+
+    return RTreeNearestSearch(
+            access, aK, aMaxDistSq,
+            [&]( const DATATYPE& a_data )
+            {
+                return aSquaredDist( aPoint, a_data );
+            },
+            aFilter, aBuffer.m_queue, aBuffer.m_results );
+}
+
+
+RTREE_TEMPLATE
+template <class HITTEST>
+bool RTREE_QUAL::RayCast( const ELEMTYPE a_origin[NUMDIMS], const ELEMTYPE a_direction[NUMDIMS],
+                          ELEMTYPEREAL a_maxT, HITTEST&& a_hitTest, std::pair<ELEMTYPEREAL, DATATYPE>& a_hit ) const
+{
+    static_assert( std::is_floating_point<ELEMTYPEREAL>::value,
+                   "Ray and segment casts need a floating point ELEMTYPEREAL for the slab tests" );
+
+    const Ray    ray   = MakeRay( a_origin, a_direction );
+    ELEMTYPEREAL limit = a_maxT;
+    bool         found = false;
+
+    RayWalk( ray, limit,
+             [&]( const DATATYPE& a_data, ELEMTYPEREAL a_t )
+             {
+                 ELEMTYPEREAL t = a_t;
+
+                 // Entries are entered in order, but an exact hit may lie deeper than the next rect
+                 if( a_hitTest( a_data, t ) && t <= limit )
+                 {
+                     ASSERT( t >= a_t );
+                     limit = t;
+                     a_hit = std::pair<ELEMTYPEREAL, DATATYPE>( t, a_data );
+                     found = true;
+                 }
+
+                 return true;
+             } );
+
+    return found;
+}
+
+
+RTREE_TEMPLATE
+template <class VISITOR>
+int RTREE_QUAL::SegmentCast( const ELEMTYPE a_start[NUMDIMS], const ELEMTYPE a_end[NUMDIMS],
+                             VISITOR&& a_visitor ) const
+{
+    static_assert( std::is_floating_point<ELEMTYPEREAL>::value,
+                   "Ray and segment casts need a floating point ELEMTYPEREAL for the slab tests" );
+
+    ELEMTYPE direction[NUMDIMS];
+
+    for( int axis = 0; axis < NUMDIMS; ++axis )
+    {
+        direction[axis] = a_end[axis] - a_start[axis];
+    }
+
+    const Ray    ray        = MakeRay( a_start, direction );
+    ELEMTYPEREAL limit      = 1;
+    int          foundCount = 0;
+
+    RayWalk( ray, limit,
+             [&]( const DATATYPE& a_data, ELEMTYPEREAL a_t )
+             {
+                 ++foundCount;
+                 return a_visitor( a_data, a_t );
+             } );
+
+    return foundCount;
+}
+
+
+RTREE_TEMPLATE
+template <class VISITOR>
+int RTREE_QUAL::SearchRadius( const ELEMTYPE a_center[NUMDIMS], ELEMTYPEREAL a_radius, VISITOR&& a_visitor,
+                              RegionMatch a_match ) const
+{
+    const ELEMTYPEREAL radiusSq = a_radius * a_radius;
+
+    auto classify = [&]( const Rect& a_rect )
+    {
+        if( MinDistSq( a_center, a_rect ) > radiusSq )
+            return RegionRelation::OUTSIDE;
+
+        return MaxDistSq( a_center, a_rect ) <= radiusSq ? RegionRelation::INSIDE : RegionRelation::CROSSING;
+    };
+
+    int foundCount = 0;
+
+    RegionSearch( m_root, classify, a_match, a_visitor, foundCount );
+
+    return foundCount;
+}
+
+
+RTREE_TEMPLATE
+template <class POLYGON, class VISITOR>
+int RTREE_QUAL::SearchPolygon( const POLYGON& a_polygon, VISITOR&& a_visitor, RegionMatch a_match ) const
+{
+    static_assert( NUMDIMS == 2, "SearchPolygon needs a two dimensional tree" );
+    static_assert( std::is_floating_point<ELEMTYPEREAL>::value,
+                   "SearchPolygon needs a floating point ELEMTYPEREAL for its edge crossings" );
+
+    const int pointCount = (int) a_polygon.size();
+
+    if( pointCount < 3 )
+        return 0;
+
+    std::vector<ELEMTYPEREAL> points( 2 * pointCount );
+    std::vector<Ray>          edges( pointCount );
+    ELEMTYPEREAL              bounds[4] = { std::numeric_limits<ELEMTYPEREAL>::max(),
+                                            std::numeric_limits<ELEMTYPEREAL>::max(),
+                                            std::numeric_limits<ELEMTYPEREAL>::lowest(),
+                                            std::numeric_limits<ELEMTYPEREAL>::lowest() };
+    int                       index = 0;
+
+    for( const auto& point : a_polygon )
+    {
+        points[2 * index]     = (ELEMTYPEREAL) point.x;
+        points[2 * index + 1] = (ELEMTYPEREAL) point.y;
+        bounds[0] = std::min( bounds[0], points[2 * index] );
+        bounds[1] = std::min( bounds[1], points[2 * index + 1] );
+        bounds[2] = std::max( bounds[2], points[2 * index] );
+        bounds[3] = std::max( bounds[3], points[2 * index + 1] );
+        ++index;
+    }
+
+    for( index = 0; index < pointCount; ++index )
+    {
+        const ELEMTYPEREAL* start = &points[2 * index];
+        const ELEMTYPEREAL* end   = &points[2 * ( ( index + 1 ) % pointCount )];
+        const ELEMTYPEREAL  direction[2] = { end[0] - start[0], end[1] - start[1] };
+
+        edges[index] = MakeRay( start, direction );
+    }
+
+    // Even-odd rule
+    auto containsPoint = [&]( ELEMTYPEREAL a_x, ELEMTYPEREAL a_y )
+    {
+        bool inside = false;
+
+        for( int current = 0, previous = pointCount - 1; current < pointCount; previous = current++ )
+        {
+            const ELEMTYPEREAL* pointA = &points[2 * current];
+            const ELEMTYPEREAL* pointB = &points[2 * previous];
+
+            if( ( pointA[1] > a_y ) != ( pointB[1] > a_y )
+                && a_x < ( pointB[0] - pointA[0] ) * ( a_y - pointA[1] ) / ( pointB[1] - pointA[1] ) + pointA[0] )
+            {
+                inside = !inside;
+            }
+        }
+
+        return inside;
+    };
+
+    // A rect meeting no edge is either completely inside or completely outside
+    auto classify = [&]( const Rect& a_rect )
+    {
+        if( a_rect.m_max[0] < bounds[0] || a_rect.m_min[0] > bounds[2] || a_rect.m_max[1] < bounds[1]
+            || a_rect.m_min[1] > bounds[3] )
+        {
+            return RegionRelation::OUTSIDE;
+        }
+
+        for( const Ray& edge : edges )
+        {
+            ELEMTYPEREAL t;
+
+            if( RayEnter( edge, a_rect, 1, t ) )
+                return RegionRelation::CROSSING;
+        }
+
+        return containsPoint( a_rect.m_min[0], a_rect.m_min[1] ) ? RegionRelation::INSIDE
+                                                                  : RegionRelation::OUTSIDE;
+    };
+
+    int foundCount = 0;
+
+    RegionSearch( m_root, classify, a_match, a_visitor, foundCount );
+
+    return foundCount;
+}
+
+
+RTREE_TEMPLATE
+template <class CLASSIFY, class VISITOR>
+bool RTREE_QUAL::RegionSearch( const Node* a_node, CLASSIFY& a_classify, RegionMatch a_match,
+                               VISITOR& a_visitor, int& a_foundCount ) const
+{
+    RTREE_COUNT( nodesVisited, 1 );
+    RTREE_COUNT( leavesTested, a_node->IsLeaf() ? 1 : 0 );
+    RTREE_COUNT( overlapTests, a_node->m_count );
+
+    for( int index = 0; index < a_node->m_count; ++index )
+    {
+        const Branch&        branch   = a_node->m_branch[index];
+        const RegionRelation relation = a_classify( branch.m_rect );
+
+        if( relation == RegionRelation::OUTSIDE )
+            continue;
+
+        if( a_node->IsInternalNode() )
+        {
+            const bool proceed = relation == RegionRelation::INSIDE
+                                         ? VisitSubtree( branch.m_child, a_visitor, a_foundCount )
+                                         : RegionSearch( branch.m_child, a_classify, a_match, a_visitor,
+                                                         a_foundCount );
+
+            if( !proceed )
+                return false;
+        }
+        else if( relation == RegionRelation::INSIDE || a_match == RegionMatch::OVERLAP )
+        {
+            if( !a_visitor( BranchData( branch ) ) )
+                return false;
+
+            a_foundCount++;
+        }
+    }
+
+    return true;
+}
+
+
+// Report every entry below a_node.  Returns false if the visitor asked to stop.
+RTREE_TEMPLATE
+template <class VISITOR>
+bool RTREE_QUAL::VisitSubtree( const Node* a_node, VISITOR& a_visitor, int& a_foundCount ) const
+{
+    RTREE_COUNT( nodesVisited, 1 );
+
+    for( int index = 0; index < a_node->m_count; ++index )
+    {
+        const Branch& branch = a_node->m_branch[index];
+
+        if( a_node->IsInternalNode() )
+        {
+            if( !VisitSubtree( branch.m_child, a_visitor, a_foundCount ) )
+                return false;
+        }
+        else
+        {
+            if( !a_visitor( BranchData( branch ) ) )
+                return false;
+
+            a_foundCount++;
+        }
+    }
+
+    return true;
+}
+
+
+// Best first walk along a ray.  Nodes and entries share one min-heap on the t where the
+// ray enters their rect, so entries come out in order across leaves.
+RTREE_TEMPLATE
+template <class FUNC>
+void RTREE_QUAL::RayWalk( const Ray& a_ray, ELEMTYPEREAL& a_limit, FUNC&& a_func ) const
+{
+    struct Pending
+    {
+        ELEMTYPEREAL  m_t;
+        const Branch* m_branch;
+        bool          m_isData;
+    };
+
+    auto later = []( const Pending& a_pendingA, const Pending& a_pendingB )
+    {
+        return a_pendingA.m_t > a_pendingB.m_t;
+    };
+
+    std::vector<Pending> heap;
+
+    auto expand = [&]( const Node* a_node )
+    {
+        RTREE_COUNT( nodesVisited, 1 );
+        RTREE_COUNT( leavesTested, a_node->IsLeaf() ? 1 : 0 );
+        RTREE_COUNT( overlapTests, a_node->m_count );
+
+        for( int index = 0; index < a_node->m_count; ++index )
+        {
+            ELEMTYPEREAL t;
+
+            if( RayEnter( a_ray, a_node->m_branch[index].m_rect, a_limit, t ) )
+            {
+                heap.push_back( Pending{ t, &a_node->m_branch[index], a_node->IsLeaf() } );
+                std::push_heap( heap.begin(), heap.end(), later );
+                RTREE_COUNT( heapPushes, 1 );
+            }
+        }
+    };
+
+    expand( m_root );
+
+    while( !heap.empty() )
+    {
+        std::pop_heap( heap.begin(), heap.end(), later );
+        const Pending next = heap.back();
+        heap.pop_back();
+
+        // Nothing left starts before the limit
+        if( next.m_t > a_limit )
+            break;
+
+        if( !next.m_isData )
+            expand( next.m_branch->m_child );
+        else if( !a_func( BranchData( *next.m_branch ), next.m_t ) )
+            break;
+    }
+}
+
+
+RTREE_TEMPLATE
+template <class OTHERTREE, class VISITOR>
+int RTREE_QUAL::Join( const OTHERTREE& a_other, VISITOR&& a_visitor ) const
+{
+    static_assert( std::is_same<decltype( Rect::m_min ), decltype( OTHERTREE::Rect::m_min )>::value,
+                   "Join needs trees with the same ELEMTYPE and NUMDIMS" );
+
+    int foundCount = 0;
+
+    if( m_root->m_count == 0 || a_other.m_root->m_count == 0 )
+        return foundCount;
+
+    const Rect                     rect = NodeCover( m_root );
+    const typename OTHERTREE::Rect otherRect = a_other.NodeCover( a_other.m_root );
+
+    if( OverlapWith( &rect, &otherRect ) )
+    {
+        JoinRec<OTHERTREE>( a_other, m_root, &rect, a_other.m_root, &otherRect, a_visitor, foundCount );
+    }
+
+    return foundCount;
+}
+
+
+RTREE_TEMPLATE
+template <class OTHERTREE, class VISITOR>
+int RTREE_QUAL::Join( const OTHERTREE& a_other, LayerMask a_layers, typename OTHERTREE::LayerMask a_otherLayers,
+                      VISITOR&& a_visitor ) const
+{
+    static_assert( std::is_same<decltype( Rect::m_min ), decltype( OTHERTREE::Rect::m_min )>::value,
+                   "Join needs trees with the same ELEMTYPE and NUMDIMS" );
+
+    int foundCount = 0;
+
+    if( !( NodeLayers( m_root ) & a_layers ) || !( a_other.NodeLayers( a_other.m_root ) & a_otherLayers ) )
+        return foundCount;
+
+    const Rect                     rect = NodeCover( m_root );
+    const typename OTHERTREE::Rect otherRect = a_other.NodeCover( a_other.m_root );
+
+    if( OverlapWith( &rect, &otherRect ) )
+    {
+        JoinRec<OTHERTREE>( a_other, m_root, &rect, a_other.m_root, &otherRect, a_visitor, foundCount, a_layers,
+                            a_otherLayers );
+    }
+
+    return foundCount;
+}
+
+
+RTREE_TEMPLATE
+template <class VISITOR>
+int RTREE_QUAL::SelfJoin( VISITOR&& a_visitor ) const
+{
+    int foundCount = 0;
+
+    SelfJoinRec( m_root, a_visitor, foundCount );
+
+    return foundCount;
+}
+
+
+RTREE_TEMPLATE
+template <class OTHERTREE>
+std::vector<std::pair<DATATYPE, typename OTHERTREE::DataType>> RTREE_QUAL::ParallelJoin( const OTHERTREE& a_other,
+                                                                                       int a_threadCount ) const
+{
+    std::vector<JoinTask<OTHERTREE>> tasks;
+
+    if( m_root->m_count > 0 && a_other.m_root->m_count > 0 )
+    {
+        JoinTask<OTHERTREE> root;
+        root.m_node      = m_root;
+        root.m_rect      = NodeCover( m_root );
+        root.m_other     = a_other.m_root;
+        root.m_otherRect = a_other.NodeCover( a_other.m_root );
+        root.m_self      = false;
+
+        if( OverlapWith( &root.m_rect, &root.m_otherRect ) )
+            tasks.push_back( root );
+    }
+
+    return RunJoinTasks<OTHERTREE>( a_other, tasks, a_threadCount );
+}
+
+
+RTREE_TEMPLATE
+std::vector<std::pair<DATATYPE, DATATYPE>> RTREE_QUAL::ParallelSelfJoin( int a_threadCount ) const
+{
+    std::vector<JoinTask<RTree>> tasks;
+
+    if( m_root->m_count > 0 )
+    {
+        JoinTask<RTree> root;
+        root.m_node      = m_root;
+        root.m_rect      = NodeCover( m_root );
+        root.m_other     = m_root;
+        root.m_otherRect = root.m_rect;
+        root.m_self      = true;
+        tasks.push_back( root );
+    }
+
+    return RunJoinTasks<RTree>( *this, tasks, a_threadCount );
+}
+
+
+// Decide whether rects of two trees with the same ELEMTYPE and NUMDIMS overlap.
+RTREE_TEMPLATE
+template <class OTHERRECT>
+bool RTREE_QUAL::OverlapWith( const Rect* a_rect, const OTHERRECT* a_other )
+{
+    for( int index = 0; index < NUMDIMS; ++index )
+    {
+        if( a_rect->m_min[index] > a_other->m_max[index] || a_other->m_min[index] > a_rect->m_max[index] )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+// Call a_func( node, rect, other, otherRect ) for the overlapping child pairs one step below a
+// pair of overlapping subtrees.  Only the higher of the two is descended, both if their levels
+// match, so the walk reaches the leaves of both trees together even when heights differ.
+RTREE_TEMPLATE
+template <class OTHERTREE, class FUNC>
+bool RTREE_QUAL::ForEachJoinChild( const Node* a_node, const Rect* a_rect,
+                                   const typename OTHERTREE::Node* a_other,
+                                   const typename OTHERTREE::Rect* a_otherRect, FUNC&& a_func,
+                                   LayerMask a_layers, typename OTHERTREE::LayerMask a_otherLayers )
+{
+    ASSERT( a_node->IsInternalNode() || a_other->IsInternalNode() );
+
+    if( a_node->m_level > a_other->m_level )
+    {
+        for( int index = 0; index < a_node->m_count; ++index )
+        {
+            const Branch& branch = a_node->m_branch[index];
+
+            if( ( BranchLayers( branch ) & a_layers ) && OverlapWith( &branch.m_rect, a_otherRect )
+                && !a_func( branch.m_child, &branch.m_rect, a_other, a_otherRect ) )
+            {
+                return false;
+            }
+        }
+    }
+    else if( a_node->m_level < a_other->m_level )
+    {
+        for( int index = 0; index < a_other->m_count; ++index )
+        {
+            const auto& branch = a_other->m_branch[index];
+
+            if( ( OTHERTREE::BranchLayers( branch ) & a_otherLayers ) && OverlapWith( a_rect, &branch.m_rect )
+                && !a_func( a_node, a_rect, branch.m_child, &branch.m_rect ) )
+            {
+                return false;
+            }
+        }
+    }
+    else
+    {
+        // Only children inside the other cover can pair up
+        int candidates[MAXNODES];
+        int candidateCount = 0;
+
+        for( int index = 0; index < a_node->m_count; ++index )
+        {
+            const Branch& branch = a_node->m_branch[index];
+
+            if( ( BranchLayers( branch ) & a_layers ) && OverlapWith( &branch.m_rect, a_otherRect ) )
+                candidates[candidateCount++] = index;
+        }
+
+        for( int otherIndex = 0; otherIndex < a_other->m_count && candidateCount > 0; ++otherIndex )
+        {
+            const auto& otherBranch = a_other->m_branch[otherIndex];
+
+            if( !( OTHERTREE::BranchLayers( otherBranch ) & a_otherLayers ) || !OverlapWith( a_rect, &otherBranch.m_rect ) )
+                continue;
+
+            for( int candidate = 0; candidate < candidateCount; ++candidate )
+            {
+                const Branch& branch = a_node->m_branch[candidates[candidate]];
+
+                if( OverlapWith( &branch.m_rect, &otherBranch.m_rect )
+                    && !a_func( branch.m_child, &branch.m_rect, otherBranch.m_child, &otherBranch.m_rect ) )
+                {
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+
+// Join two overlapping subtrees.  Returns false if the visitor asked to stop.
+RTREE_TEMPLATE
+template <class OTHERTREE, class VISITOR>
+bool RTREE_QUAL::JoinRec( const OTHERTREE& a_otherTree, const Node* a_node, const Rect* a_rect,
+                          const typename OTHERTREE::Node* a_other, const typename OTHERTREE::Rect* a_otherRect,
+                          VISITOR& a_visitor, int& a_foundCount, LayerMask a_layers,
+                          typename OTHERTREE::LayerMask a_otherLayers ) const
+{
+    if( a_node->IsLeaf() && a_other->IsLeaf() )
+    {
+        for( int index = 0; index < a_node->m_count; ++index )
+        {
+            const Branch& branch = a_node->m_branch[index];
+
+            if( !( BranchLayers( branch ) & a_layers ) || !OverlapWith( &branch.m_rect, a_otherRect ) )
+                continue;
+
+            for( int otherIndex = 0; otherIndex < a_other->m_count; ++otherIndex )
+            {
+                const auto& otherBranch = a_other->m_branch[otherIndex];
+
+                if( ( OTHERTREE::BranchLayers( otherBranch ) & a_otherLayers ) && OverlapWith( &branch.m_rect, &otherBranch.m_rect ) )
+                {
+                    if( !a_visitor( BranchData( branch ), a_otherTree.BranchData( otherBranch ) ) )
+                        return false;
+
+                    a_foundCount++;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    return ForEachJoinChild<OTHERTREE>( a_node, a_rect, a_other, a_otherRect,
+            [&]( const Node* a_child, const Rect* a_childRect, const typename OTHERTREE::Node* a_otherChild,
+                 const typename OTHERTREE::Rect* a_otherChildRect )
+            {
+                return JoinRec<OTHERTREE>( a_otherTree, a_child, a_childRect, a_otherChild, a_otherChildRect,
+                                           a_visitor, a_foundCount, a_layers, a_otherLayers );
+            }, a_layers, a_otherLayers );
+}
+
+
+// Join a subtree with itself: every child with itself, then every unordered pair of
+// overlapping children.  Pairs between disjoint subtrees are reported once.
+RTREE_TEMPLATE
+template <class VISITOR>
+bool RTREE_QUAL::SelfJoinRec( const Node* a_node, VISITOR& a_visitor, int& a_foundCount ) const
+{
+    for( int index = 0; index < a_node->m_count; ++index )
+    {
+        const Branch& branch = a_node->m_branch[index];
+
+        if( a_node->IsInternalNode() && !SelfJoinRec( branch.m_child, a_visitor, a_foundCount ) )
+            return false;
+
+        for( int other = index + 1; other < a_node->m_count; ++other )
+        {
+            const Branch& otherBranch = a_node->m_branch[other];
+
+            if( !Overlap( &branch.m_rect, &otherBranch.m_rect ) )
+                continue;
+
+            if( a_node->IsLeaf() )
+            {
+                if( !a_visitor( BranchData( branch ), BranchData( otherBranch ) ) )
+                    return false;
+
+                a_foundCount++;
+            }
+            else if( !JoinRec<RTree>( *this, branch.m_child, &branch.m_rect, otherBranch.m_child,
+                                      &otherBranch.m_rect, a_visitor, a_foundCount ) )
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+// Split the join tasks near the roots until there are a few per thread, then let the threads
+// take them in turn and concatenate what each found.
+RTREE_TEMPLATE
+template <class OTHERTREE>
+std::vector<std::pair<DATATYPE, typename OTHERTREE::DataType>>
+RTREE_QUAL::RunJoinTasks( const OTHERTREE& a_otherTree, std::vector<JoinTask<OTHERTREE>>& a_tasks,
+                          int a_threadCount ) const
+{
+    typedef JoinTask<OTHERTREE>                                         Task;
+    typedef std::vector<std::pair<DATATYPE, typename OTHERTREE::DataType>> Results;
+
+    const size_t TASKS_PER_THREAD = 8;
+    const size_t wantedTasks = TASKS_PER_THREAD * std::max( a_threadCount, 1 );
+    std::vector<Task> expanded;
+
+    while( a_tasks.size() < wantedTasks )
+    {
+        bool split = false;
+
+        expanded.clear();
+
+        for( const Task& task : a_tasks )
+        {
+            if( task.m_node->IsLeaf() && task.m_other->IsLeaf() )
+            {
+                expanded.push_back( task );
+                continue;
+            }
+
+            split = true;
+
+            if constexpr( std::is_same<OTHERTREE, RTree>::value )
+            {
+                if( task.m_self )
+                {
+                    // Same split as SelfJoinRec, with the children as new tasks
+                    const Node* node = task.m_node;
+
+                    for( int index = 0; index < node->m_count; ++index )
+                    {
+                        const Branch& branch = node->m_branch[index];
+
+                        expanded.push_back( Task{ branch.m_child, branch.m_rect, branch.m_child, branch.m_rect,
+                                                  true } );
+
+                        for( int other = index + 1; other < node->m_count; ++other )
+                        {
+                            const Branch& otherBranch = node->m_branch[other];
+
+                            if( Overlap( &branch.m_rect, &otherBranch.m_rect ) )
+                            {
+                                expanded.push_back( Task{ branch.m_child, branch.m_rect, otherBranch.m_child,
+                                                          otherBranch.m_rect, false } );
+                            }
+                        }
+                    }
+
+                    continue;
+                }
+            }
+
+            ForEachJoinChild<OTHERTREE>( task.m_node, &task.m_rect, task.m_other, &task.m_otherRect,
+                    [&]( const Node* a_child, const Rect* a_childRect,
+                         const typename OTHERTREE::Node* a_otherChild,
+                         const typename OTHERTREE::Rect* a_otherChildRect )
+                    {
+                        expanded.push_back( Task{ a_child, *a_childRect, a_otherChild, *a_otherChildRect,
+                                                  false } );
+                        return true;
+                    } );
+        }
+
+        a_tasks.swap( expanded );
+
+        if( !split )
+            break;
+    }
+
+    const int           threadCount = (int) std::min<size_t>( std::max( a_threadCount, 1 ), a_tasks.size() );
+    std::vector<Results> threadResults( std::max( threadCount, 1 ) );
+    std::atomic<size_t>  nextTask( 0 );
+
+    auto work = [&]( Results& a_results )
+    {
+        auto collect = [&a_results]( const DATATYPE& a_data, const typename OTHERTREE::DataType& a_otherData )
+        {
+            a_results.emplace_back( a_data, a_otherData );
+            return true;
+        };
+
+        int foundCount = 0;
+
+        for( size_t taskIndex = nextTask++; taskIndex < a_tasks.size(); taskIndex = nextTask++ )
+        {
+            const Task& task = a_tasks[taskIndex];
+
+            if constexpr( std::is_same<OTHERTREE, RTree>::value )
+            {
+                if( task.m_self )
+                {
+                    SelfJoinRec( task.m_node, collect, foundCount );
+                    continue;
+                }
+            }
+
+            JoinRec<OTHERTREE>( a_otherTree, task.m_node, &task.m_rect, task.m_other, &task.m_otherRect, collect,
+                                foundCount );
+        }
+    };
+
+    RunOnThreads( threadCount,
+                  [&]( int a_thread )
+                  {
+                      work( threadResults[a_thread] );
+                  } );
+
+    Results results = std::move( threadResults[0] );
+
+    for( int index = 1; index < threadCount; ++index )
+    {
+        results.insert( results.end(), threadResults[index].begin(), threadResults[index].end() );
+    }
+
+    return results;
+}
+
+
+RTREE_TEMPLATE
+template <class FUNC>
+void RTREE_QUAL::RunOnThreads( int a_threadCount, FUNC&& a_work )
+{
+    std::vector<std::thread> threads;
+
+    for( int index = 1; index < a_threadCount; ++index )
+    {
+        threads.emplace_back( a_work, index );
+    }
+
+    a_work( 0 );
+
+    for( std::thread& thread : threads )
+    {
+        thread.join();
+    }
+}
+
+
+RTREE_TEMPLATE
+size_t RTREE_QUAL::SearchBatch( const Rect* a_queries, int a_queryCount, SearchBatchResult& a_result,
+                                int a_threadCount ) const
+{
+    typedef typename SearchBatchResult::Span Span;
+
+    // Queries per unit of work, consecutive along the curve
+    const int RUN_LENGTH = 64;
+
+    a_result.m_hits.clear();
+    a_result.m_offsets.assign( 1, 0 );
+
+    if( a_queryCount <= 0 )
+        return 0;
+
+    Rect bounds = a_queries[0];
+
+    for( int index = 1; index < a_queryCount; ++index )
+    {
+        bounds = CombineRect( &bounds, &a_queries[index] );
+    }
+
+    std::vector<std::pair<uint64_t, int>>& order = a_result.m_order;
+    order.resize( a_queryCount );
+
+    for( int index = 0; index < a_queryCount; ++index )
+    {
+        order[index] = std::make_pair( HilbertKey( a_queries[index], bounds ), index );
+    }
+
+    std::sort( order.begin(), order.end() );
+
+    const int runCount = ( a_queryCount + RUN_LENGTH - 1 ) / RUN_LENGTH;
+    const int threadCount = std::max( 1, std::min( a_threadCount, runCount ) );
+
+    if( (int) a_result.m_threadHits.size() < threadCount )
+        a_result.m_threadHits.resize( threadCount );
+
+    a_result.m_spans.resize( a_queryCount );
+
+    std::atomic<int> nextRun( 0 );
+
+    RunOnThreads( threadCount,
+                  [&]( int a_thread )
+                  {
+                      std::vector<DATATYPE>& hits = a_result.m_threadHits[a_thread];
+                      hits.clear();
+
+                      auto collect = [&hits]( const DATATYPE& a_data )
+                      {
+                          hits.push_back( a_data );
+                          return true;
+                      };
+
+                      for( int run = nextRun++; run < runCount; run = nextRun++ )
+                      {
+                          const int last = std::min( a_queryCount, ( run + 1 ) * RUN_LENGTH );
+
+                          for( int position = run * RUN_LENGTH; position < last; ++position )
+                          {
+                              const int query = order[position].second;
+                              const size_t begin = hits.size();
+                              int foundCount = 0;
+
+                              Search( m_root, &a_queries[query], collect, foundCount );
+                              a_result.m_spans[query] = Span{ a_thread, begin, hits.size() - begin };
+                          }
+                      }
+                  } );
+
+    // Gather into query order
+    a_result.m_offsets.resize( a_queryCount + 1 );
+
+    for( int query = 0; query < a_queryCount; ++query )
+    {
+        a_result.m_offsets[query + 1] = a_result.m_offsets[query] + a_result.m_spans[query].m_count;
+    }
+
+    a_result.m_hits.resize( a_result.m_offsets[a_queryCount] );
+
+    for( int query = 0; query < a_queryCount; ++query )
+    {
+        const Span&                  span = a_result.m_spans[query];
+        const std::vector<DATATYPE>& hits = a_result.m_threadHits[span.m_thread];
+
+        std::copy( hits.begin() + span.m_begin, hits.begin() + span.m_begin + span.m_count,
+                   a_result.m_hits.begin() + a_result.m_offsets[query] );
+    }
+
+    return a_result.m_hits.size();
+}
+
+
+RTREE_TEMPLATE
+int RTREE_QUAL::Count() const
+{
+    return m_root->m_entryCount;
+}
+
+
+RTREE_TEMPLATE
+int RTREE_QUAL::Count( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS] ) const
+{
+    Rect rect;
+
+    for( int axis = 0; axis < NUMDIMS; ++axis )
+    {
+        rect.m_min[axis] = a_min[axis];
+        rect.m_max[axis] = a_max[axis];
+    }
+
+    return CountRec( m_root, &rect );
+}
+
+
+RTREE_TEMPLATE
+int RTREE_QUAL::CountRec( const Node* a_node, const Rect* a_rect ) const
+{
+    int count = 0;
+
+    RTREE_COUNT( nodesVisited, 1 );
+    RTREE_COUNT( leavesTested, a_node->IsLeaf() ? 1 : 0 );
+    RTREE_COUNT( overlapTests, a_node->m_count );
+
+    ForEachOverlap( a_node, a_rect,
+                    [&]( int index )
+                    {
+                        const Branch& branch = a_node->m_branch[index];
+
+                        if( a_node->IsLeaf() )
+                            count++;
+                        else if( Contains( a_rect, &branch.m_rect ) )
+                            count += branch.m_child->m_entryCount;
+                        else
+                            count += CountRec( branch.m_child, a_rect );
+
+                        return true;
+                    } );
+
+    return count;
+}
+
+
+RTREE_TEMPLATE
+typename RTREE_QUAL::Statistics RTREE_QUAL::CalcStats() const
+{
+    Statistics stats = {};
+    int        branchCount = 0;
+
+    CalcStatsRec( m_root, stats, branchCount );
+
+    // All leaves of an R-tree sit at the same depth
+    stats.maxDepth    = m_root->m_level + 1;
+    stats.avgDepth    = stats.maxDepth;
+    stats.avgNodeLoad = branchCount / stats.nodeCount;
+    stats.fillFactor  = (double) branchCount / ( (double) stats.nodeCount * MAXNODES );
+
+    return stats;
+}
+
+
+RTREE_TEMPLATE
+void RTREE_QUAL::CalcStatsRec( const Node* a_node, Statistics& a_stats, int& a_branchCount ) const
+{
+    ++a_stats.nodeCount;
+    a_branchCount += a_node->m_count;
+    a_stats.maxNodeLoad = std::max( a_stats.maxNodeLoad, a_node->m_count );
+
+    if( a_node->IsInternalNode() ) // not a leaf node
+    {
+        for( int index = 0; index < a_node->m_count; ++index )
+        {
+            CalcStatsRec( a_node->m_branch[index].m_child, a_stats, a_branchCount );
+        }
+    }
+    else // A leaf node
+    {
+        a_stats.totalItems += a_node->m_count;
+    }
+}
+
+
+RTREE_TEMPLATE
+typename RTREE_QUAL::QualityStats RTREE_QUAL::CalcQuality() const
+{
+    QualityStats     quality = {};
+    std::vector<int> branchCounts( m_root->m_level + 1, 0 );
+
+    quality.levels.resize( m_root->m_level + 1, LevelQuality() );
+
+    CalcQualityRec( m_root, quality, branchCounts );
+
+    size_t nodeCount = 0;
+
+    for( size_t level = 0; level < quality.levels.size(); ++level )
+    {
+        LevelQuality& levelQuality = quality.levels[level];
+
+        levelQuality.fillFactor = (double) branchCounts[level] / ( (double) levelQuality.nodeCount * MAXNODES );
+        quality.totalOverlap += levelQuality.overlap;
+        quality.deadSpace    += levelQuality.deadSpace;
+        nodeCount            += levelQuality.nodeCount;
+    }
+
+    const size_t bytes = nodeCount * sizeof( Node ) + m_payloads.capacity() * sizeof( DATATYPE )
+                         + m_freeSlots.capacity() * sizeof( uint32_t );
+
+    quality.bytesPerEntry = (double) bytes / std::max( m_root->m_entryCount, 1 );
+
+    return quality;
+}
+
+
+RTREE_TEMPLATE
+void RTREE_QUAL::CalcQualityRec( const Node* a_node, QualityStats& a_quality,
+                                 std::vector<int>& a_branchCounts ) const
+{
+    LevelQuality& levelQuality = a_quality.levels[a_node->m_level];
+
+    ++levelQuality.nodeCount;
+    a_branchCounts[a_node->m_level] += a_node->m_count;
+
+    for( int index = 0; index < a_node->m_count; ++index )
+    {
+        const Branch& branch = a_node->m_branch[index];
+
+        for( int other = index + 1; other < a_node->m_count; ++other )
+        {
+            levelQuality.overlap += OverlapArea( &branch.m_rect, &a_node->m_branch[other].m_rect );
+        }
+
+        if( a_node->IsInternalNode() )
+        {
+            // Children may overlap each other, so their sum can only underestimate the gap
+            ELEMTYPEREAL covered = 0;
+
+            for( int child = 0; child < branch.m_child->m_count; ++child )
+            {
+                covered += RectArea( branch.m_child->m_branch[child].m_rect );
+            }
+
+            levelQuality.deadSpace += std::max( (double) ( RectArea( branch.m_rect ) - covered ), 0.0 );
+
+            CalcQualityRec( branch.m_child, a_quality, a_branchCounts );
+        }
+    }
+}
+
+
+RTREE_TEMPLATE
+ELEMTYPEREAL RTREE_QUAL::RectArea( const Rect& a_rect )
+{
+    return RTreeRectVolume::template Volume<ELEMTYPEREAL, NUMDIMS>( a_rect.m_min, a_rect.m_max );
+}
+
+
+RTREE_TEMPLATE
+std::string RTREE_QUAL::StatsJson() const
+{
+    const Statistics   stats   = CalcStats();
+    const QualityStats quality = CalcQuality();
+    const QueryStats   queries = GetQueryStats();
+
+    char        buffer[256];
+    std::string json;
+
+    std::snprintf( buffer, sizeof( buffer ),
+                   "{\"entries\":%d,\"nodes\":%d,\"height\":%d,\"fillFactor\":%.6g,\"bytesPerEntry\":%.6g,"
+                   "\"totalOverlap\":%.6g,\"deadSpace\":%.6g,\"levels\":[",
+                   m_root->m_entryCount, stats.nodeCount, stats.maxDepth, stats.fillFactor,
+                   quality.bytesPerEntry, quality.totalOverlap, quality.deadSpace );
+    json += buffer;
+
+    for( size_t level = 0; level < quality.levels.size(); ++level )
+    {
+        const LevelQuality& levelQuality = quality.levels[level];
+
+        std::snprintf( buffer, sizeof( buffer ),
+                       "%s{\"level\":%d,\"nodes\":%d,\"fillFactor\":%.6g,\"overlap\":%.6g,\"deadSpace\":%.6g}",
+                       level ? "," : "", (int) level, levelQuality.nodeCount, levelQuality.fillFactor,
+                       levelQuality.overlap, levelQuality.deadSpace );
+        json += buffer;
+    }
+
+    const char* counted = STATSPOLICY::COUNTED ? "true" : "false";
+
+    std::snprintf( buffer, sizeof( buffer ),
+                   "],\"queries\":{\"counted\":%s,\"nodesVisited\":%llu,\"leavesTested\":%llu,"
+                   "\"overlapTests\":%llu,\"heapPushes\":%llu}}",
+                   counted, (unsigned long long) queries.nodesVisited, (unsigned long long) queries.leavesTested,
+                   (unsigned long long) queries.overlapTests, (unsigned long long) queries.heapPushes );
+    json += buffer;
+
+    return json;
+}
+
+
+RTREE_TEMPLATE
+typename RTREE_QUAL::QueryStats RTREE_QUAL::GetQueryStats() const
+{
+    QueryStats queries = {};
+
+    if constexpr( STATSPOLICY::COUNTED )
+    {
+        queries.nodesVisited = m_queryCounters.nodesVisited.load( std::memory_order_relaxed );
+        queries.leavesTested = m_queryCounters.leavesTested.load( std::memory_order_relaxed );
+        queries.overlapTests = m_queryCounters.overlapTests.load( std::memory_order_relaxed );
+        queries.heapPushes   = m_queryCounters.heapPushes.load( std::memory_order_relaxed );
+    }
+
+    return queries;
+}
+
+
+RTREE_TEMPLATE
+void RTREE_QUAL::ResetQueryStats()
+{
+    if constexpr( STATSPOLICY::COUNTED )
+    {
+        m_queryCounters.nodesVisited = 0;
+        m_queryCounters.leavesTested = 0;
+        m_queryCounters.overlapTests = 0;
+        m_queryCounters.heapPushes   = 0;
+    }
+}
+
+
+RTREE_TEMPLATE
+bool RTREE_QUAL::Load( const char* a_fileName )
+{
+    RemoveAll(); // Clear existing tree
+
+    RTFileStream stream;
+
+    if( !stream.OpenRead( a_fileName ) )
+    {
+        return false;
+    }
+
+    bool result = Load( stream );
+
+    stream.Close();
+
+    return result;
+}
+
+
+RTREE_TEMPLATE
+bool RTREE_QUAL::Load( RTFileStream& a_stream )
+{
+    static_assert( std::is_trivially_copyable<DATATYPE>::value, "Load reads DATATYPE as raw bytes" );
+
+    // Write some kind of header.  Files from before layers have the id 'RTRE' and no layer masks.
+    int _dataFileId         = ('R' << 0) | ('T' << 8) | ('R' << 16) | ('L' << 24);
+    int _dataFileIdNoLayers = ('R' << 0) | ('T' << 8) | ('R' << 16) | ('E' << 24);
+    int _dataSize           = sizeof(DATATYPE);
+    int _dataNumDims        = NUMDIMS;
+    int _dataElemSize       = sizeof(ELEMTYPE);
+    int _dataElemRealSize   = sizeof(ELEMTYPEREAL);
+    int _dataMaxNodes       = TMAXNODES;
+    int _dataMinNodes       = TMINNODES;
+
+    int dataFileId          = 0;
+    int dataSize            = 0;
+    int dataNumDims         = 0;
+    int dataElemSize        = 0;
+    int dataElemRealSize    = 0;
+    int dataMaxNodes        = 0;
+    int dataMinNodes        = 0;
+
+    a_stream.Read( dataFileId );
+    a_stream.Read( dataSize );
+    a_stream.Read( dataNumDims );
+    a_stream.Read( dataElemSize );
+    a_stream.Read( dataElemRealSize );
+    a_stream.Read( dataMaxNodes );
+    a_stream.Read( dataMinNodes );
+
+    bool result = false;
+
+    // Test if header was valid and compatible
+    if( (dataFileId == _dataFileId || dataFileId == _dataFileIdNoLayers)
+        && (dataSize == _dataSize)
+        && (dataNumDims == _dataNumDims)
+        && (dataElemSize == _dataElemSize)
+        && (dataElemRealSize == _dataElemRealSize)
+        && (dataMaxNodes == _dataMaxNodes)
+        && (dataMinNodes == _dataMinNodes)
+         )
+    {
+        // Recursively load tree
+        result = LoadRec( m_root, a_stream, dataFileId == _dataFileId );
+    }
+
+    return result;
+}
+
+
+RTREE_TEMPLATE
+bool RTREE_QUAL::LoadRec( Node* a_node, RTFileStream& a_stream, bool a_hasLayers ) const
+{
+    a_stream.Read( a_node->m_level );
+    a_stream.Read( a_node->m_count );
+
+    if( a_node->IsInternalNode() ) // not a leaf node
+    {
+        for( int index = 0; index < a_node->m_count; ++index )
+        {
+            Branch* curBranch = &a_node->m_branch[index];
+
+            a_stream.ReadArray( curBranch->m_rect.m_min, NUMDIMS );
+            a_stream.ReadArray( curBranch->m_rect.m_max, NUMDIMS );
+            a_node->UpdateLane( index );
+
+            curBranch->m_child = AllocNode();
+            LoadRec( curBranch->m_child, a_stream, a_hasLayers );
+            SetBranchLayers( *curBranch, NodeLayers( curBranch->m_child ) );
+            KeyChild( *curBranch );
+        }
+    }
+    else // A leaf node
+    {
+        for( int index = 0; index < a_node->m_count; ++index )
+        {
+            Branch* curBranch = &a_node->m_branch[index];
+
+            a_stream.ReadArray( curBranch->m_rect.m_min, NUMDIMS );
+            a_stream.ReadArray( curBranch->m_rect.m_max, NUMDIMS );
+            a_node->UpdateLane( index );
+
+            if constexpr( INLINE_DATA )
+            {
+                a_stream.Read( curBranch->m_data );
+            }
+            else
+            {
+                DATATYPE data;
+                a_stream.Read( data );
+                curBranch->m_data = StoreData( data );
+            }
+
+            LayerMask layers = ALL_LAYERS;
+
+            if( a_hasLayers )
+                a_stream.Read( layers );
+
+            SetBranchLayers( *curBranch, layers );
+
+            KeyEntry( *curBranch );
+        }
+    }
+
+    a_node->m_entryCount = 0;
+
+    for( int index = 0; index < a_node->m_count; ++index )
+    {
+        a_node->m_entryCount += a_node->IsLeaf() ? 1 : a_node->m_branch[index].m_child->m_entryCount;
+    }
+
+    return true; // Should do more error checking on I/O operations
+}
+
+
+RTREE_TEMPLATE
+bool RTREE_QUAL::Save( const char* a_fileName )
+{
+    RTFileStream stream;
+
+    if( !stream.OpenWrite( a_fileName ) )
+    {
+        return false;
+    }
+
+    bool result = Save( stream );
+
+    stream.Close();
+
+    return result;
+}
+
+
+RTREE_TEMPLATE
+bool RTREE_QUAL::Save( RTFileStream& a_stream ) const
+{
+    static_assert( std::is_trivially_copyable<DATATYPE>::value, "Save writes DATATYPE as raw bytes" );
+
+    // Write some kind of header.  Only trees keeping layers write the id 'RTRL' and layer masks.
+    int dataFileId          = LAYERPOLICY::LAYERS ? ('R' << 0) | ('T' << 8) | ('R' << 16) | ('L' << 24)
+                                                  : ('R' << 0) | ('T' << 8) | ('R' << 16) | ('E' << 24);
+    int dataSize            = sizeof(DATATYPE);
+    int dataNumDims         = NUMDIMS;
+    int dataElemSize        = sizeof(ELEMTYPE);
+    int dataElemRealSize    = sizeof(ELEMTYPEREAL);
+    int dataMaxNodes        = TMAXNODES;
+    int dataMinNodes        = TMINNODES;
+
+    a_stream.Write( dataFileId );
+    a_stream.Write( dataSize );
+    a_stream.Write( dataNumDims );
+    a_stream.Write( dataElemSize );
+    a_stream.Write( dataElemRealSize );
+    a_stream.Write( dataMaxNodes );
+    a_stream.Write( dataMinNodes );
+
+    // Recursively save tree
+    bool result = SaveRec( m_root, a_stream );
+
+    return result;
+}
+
+
+RTREE_TEMPLATE
+bool RTREE_QUAL::SaveRec( const Node* a_node, RTFileStream& a_stream ) const
+{
+    a_stream.Write( a_node->m_level );
+    a_stream.Write( a_node->m_count );
+
+    if( a_node->IsInternalNode() ) // not a leaf node
+    {
+        for( int index = 0; index < a_node->m_count; ++index )
+        {
+            const Branch* curBranch = &a_node->m_branch[index];
+
+            a_stream.WriteArray( curBranch->m_rect.m_min, NUMDIMS );
+            a_stream.WriteArray( curBranch->m_rect.m_max, NUMDIMS );
+
+            SaveRec( curBranch->m_child, a_stream );
+        }
+    }
+    else // A leaf node
+    {
+        for( int index = 0; index < a_node->m_count; ++index )
+        {
+            const Branch* curBranch = &a_node->m_branch[index];
+
+            a_stream.WriteArray( curBranch->m_rect.m_min, NUMDIMS );
+            a_stream.WriteArray( curBranch->m_rect.m_max, NUMDIMS );
+
+            a_stream.Write( BranchData( *curBranch ) );
+
+            if constexpr( LAYERPOLICY::LAYERS )
+                a_stream.Write( curBranch->m_layers );
+        }
+    }
+
+    return true; // Should do more error checking on I/O operations
+}
+
+
+RTREE_TEMPLATE
+void RTREE_QUAL::RemoveAll()
+{
+    // Delete all existing nodes
+    Reset();
+
+    m_payloads.clear();
+    m_freeSlots.clear();
+
+    m_root = AllocNode();
+    m_root->m_level = 0;
+}
+
+
+RTREE_TEMPLATE
+void RTREE_QUAL::Reset() const
+{
+    if constexpr( ALLOCATOR::RELEASE_ALL )
+    {
+        // Just reset memory pools.  We are not using complex types
+        m_nodePool.Release();
+        m_listNodePool.Release();
+    }
+    else
+    {
+        // Delete all existing nodes
+        RemoveAllRec( m_root );
+    }
+}
+
+
+RTREE_TEMPLATE
+void RTREE_QUAL::RemoveAllRec( Node* a_node ) const
+{
+    ASSERT( a_node );
+    ASSERT( a_node->m_level >= 0 );
+
+    if( a_node->IsInternalNode() ) // This is an internal node in the tree
+    {
+        for( int index = 0; index < a_node->m_count; ++index )
+        {
+            RemoveAllRec( a_node->m_branch[index].m_child );
+        }
+    }
+
+    FreeNode( a_node );
+}
+
+
+RTREE_TEMPLATE
+typename RTREE_QUAL::Node* RTREE_QUAL::AllocNode() const
+{
+    Node* newNode = m_nodePool.Allocate();
+
+    InitNode( newNode );
+    return newNode;
+}
+
+
+RTREE_TEMPLATE
+void RTREE_QUAL::FreeNode( Node* a_node ) const
+{
+    ASSERT( a_node );
+
+    m_nodePool.Deallocate( a_node );
+}
+
+
+// Allocate space for a node in the list used in DeletRect to
+// store Nodes that are too empty.
+RTREE_TEMPLATE
+typename RTREE_QUAL::ListNode* RTREE_QUAL::AllocListNode() const
+{
+    return m_listNodePool.Allocate();
+}
+
+
+RTREE_TEMPLATE
+void RTREE_QUAL::FreeListNode( ListNode* a_listNode ) const
+{
+    m_listNodePool.Deallocate( a_listNode );
+}
+
+
+RTREE_TEMPLATE
+void RTREE_QUAL::InitNode( Node* a_node ) const
+{
+    a_node->m_count = 0;
+    a_node->m_level = -1;
+    a_node->m_entryCount = 0;
+}
+
+
+RTREE_TEMPLATE
+void RTREE_QUAL::InitRect( Rect* a_rect ) const
+{
+    for( int index = 0; index < NUMDIMS; ++index )
+    {
+        a_rect->m_min[index] = (ELEMTYPE) 0;
+        a_rect->m_max[index] = (ELEMTYPE) 0;
+    }
+}
+
+
+// Inserts a new data rectangle into the index structure.
+// Recursively descends tree, propagates splits back up.
+// Returns 0 if node was not split.  Old node updated.
+// If node was split, returns 1 and sets the pointer pointed to by
+// new_node to point to the new node.  Old node updated to become one of two.
+// The level argument specifies the number of steps up from the leaf
+// level to insert; e.g. a data rectangle goes in at level = 0.
+// The branch holds data at level 0 and a subtree of level - 1 above that.
+RTREE_TEMPLATE
+bool RTREE_QUAL::InsertRectRec( const Branch*   a_branch,
+                                Node*           a_node,
+                                Node**          a_newNode,
+                                int             a_level,
+                                ReinsertState*  a_state ) const
+{
+    ASSERT( a_branch && a_node && a_newNode && a_state );
+    ASSERT( a_level >= 0 && a_level <= a_node->m_level );
+
+    int     index;
+    Branch  branch;
+    Node*   otherNode;
+
+    // Still above level for insertion, go down tree recursively
+    if( a_node->m_level > a_level )
+    {
+        if constexpr( SPLITPOLICY::RSTAR )
+        {
+            index = ( a_node->m_level == a_level + 1 ) ? PickBranchRStar( &a_branch->m_rect, a_node )
+                                                       : PickBranch( &a_branch->m_rect, a_node );
+        }
+        else if constexpr( SPLITPOLICY::HILBERT )
+        {
+            index = PickBranchHilbert( a_branch->m_key, a_node );
+        }
+        else
+        {
+            index = PickBranch( &a_branch->m_rect, a_node );
+        }
+
+        Node*       child = a_node->m_branch[index].m_child;
+        const int   childEntries = child->m_entryCount;
+        const bool  childSplit = InsertRectRec( a_branch, child, &otherNode, a_level, a_state );
+
+        // The subtree gained the new entries and may have lost forced reinsertions
+        a_node->m_entryCount += child->m_entryCount - childEntries;
+
+        if( !childSplit )
+        {
+            // Child was not split, but may have given entries away for reinsertion
+            if( a_state->m_coverShrunk )
+            {
+                RefreshBranch( a_node, index );
+            }
+            else
+            {
+                SetBranchRect( a_node, index, CombineRect( &a_branch->m_rect, &(a_node->m_branch[index].m_rect) ) );
+
+                if constexpr( LAYERPOLICY::LAYERS )
+                    a_node->m_branch[index].m_layers |= a_branch->m_layers;
+
+                if constexpr( SPLITPOLICY::HILBERT )
+                    a_node->m_branch[index].m_key = std::max( a_node->m_branch[index].m_key, a_branch->m_key );
+            }
+
+            return false;
+        }
+        else // Child was split
+        {
+            RefreshBranch( a_node, index );
+
+            if constexpr( SPLITPOLICY::HILBERT )
+                return ShareOverflow( a_node, index, otherNode, a_newNode, a_state );
+
+            branch = ChildBranch( otherNode );
+            return InsertBranch( &branch, a_node, a_newNode, a_state );
+        }
+    }
+    else if( a_node->m_level == a_level ) // Have reached level for insertion. Add rect, split if necessary
+    {
+        return InsertBranch( a_branch, a_node, a_newNode, a_state );
+    }
+    else
+    {
+        // Should never occur
+        ASSERT( 0 );
+        return false;
+    }
+}
+
+
+// Insert a data rectangle into an index structure.
+// InsertRect provides for splitting the root;
+// returns 1 if root was split, 0 if it was not.
+// The level argument specifies the number of steps up from the leaf
+// level to insert; e.g. a data rectangle goes in at level = 0.
+// InsertRect2 does the recursion.
+//
+RTREE_TEMPLATE
+bool RTREE_QUAL::InsertRect( const Branch* a_branch, Node** a_root, int a_level ) const
+{
+    ASSERT( a_branch && a_root );
+    ASSERT( a_level >= 0 && a_level <= (*a_root)->m_level );
+#ifdef _DEBUG
+
+    for( int index = 0; index < NUMDIMS; ++index )
+    {
+        ASSERT( a_branch->m_rect.m_min[index] <= a_branch->m_rect.m_max[index] );
+    }
+
+#endif    // _DEBUG
+
+    ReinsertState state;
+    state.m_treatedLevels = 0;
+
+    bool rootSplit = InsertRectRoot( a_branch, a_root, a_level, &state );
+
+    if constexpr( SPLITPOLICY::RSTAR )
+    {
+        // Put evicted entries back, each level is only treated once so this terminates
+        while( !m_reinsertQueue.empty() )
+        {
+            const std::pair<Branch, int> pending = m_reinsertQueue.back();
+            m_reinsertQueue.pop_back();
+
+            rootSplit |= InsertRectRoot( &pending.first, a_root, pending.second, &state );
+        }
+    }
+
+    return rootSplit;
+}
+
+
+// Insert a branch and grow a new root if the old one was split.
+RTREE_TEMPLATE
+bool RTREE_QUAL::InsertRectRoot( const Branch* a_branch, Node** a_root, int a_level,
+                                 ReinsertState* a_state ) const
+{
+    Node*   newRoot;
+    Node*   newNode;
+    Branch  branch;
+
+    a_state->m_root         = *a_root;
+    a_state->m_coverShrunk  = false;
+
+    if( InsertRectRec( a_branch, *a_root, &newNode, a_level, a_state ) ) // Root split
+    {
+        newRoot = AllocNode();                                      // Grow tree taller and new root
+        newRoot->m_level    = (*a_root)->m_level + 1;
+        branch              = ChildBranch( *a_root );
+        AddBranch( &branch, newRoot, NULL );
+        branch          = ChildBranch( newNode );
+        AddBranch( &branch, newRoot, NULL );
+        *a_root = newRoot;
+        return true;
+    }
+
+    return false;
+}
+
+
+// Find the smallest rectangle that includes all rectangles in branches of a node.
+RTREE_TEMPLATE
+typename RTREE_QUAL::Rect RTREE_QUAL::NodeCover( Node* a_node ) const
+{
+    ASSERT( a_node );
+
+    bool     firstTime = true;
+    Rect    rect;
+    InitRect( &rect );
+
+    for( int index = 0; index < a_node->m_count; ++index )
+    {
+        if( firstTime )
+        {
+            rect = a_node->m_branch[index].m_rect;
+            firstTime = false;
+        }
+        else
+        {
+            rect = CombineRect( &rect, &(a_node->m_branch[index].m_rect) );
+        }
+    }
+
+    return rect;
+}
+
+
+// Union of the layers of all branches of a node.
+RTREE_TEMPLATE
+typename RTREE_QUAL::LayerMask RTREE_QUAL::NodeLayers( const Node* a_node )
+{
+    LayerMask layers = 0;
+
+    for( int index = 0; index < a_node->m_count; ++index )
+    {
+        layers |= BranchLayers( a_node->m_branch[index] );
+    }
+
+    return layers;
+}
+
+
+// Layers of a branch, all of them when the tree keeps no layers.
+RTREE_TEMPLATE
+typename RTREE_QUAL::LayerMask RTREE_QUAL::BranchLayers( const Branch& a_branch )
+{
+    if constexpr( LAYERPOLICY::LAYERS )
+        return a_branch.m_layers;
+    else
+        return ALL_LAYERS;
+}
+
+
+// Store the layers of a branch, dropped when the tree keeps no layers.
+RTREE_TEMPLATE
+void RTREE_QUAL::SetBranchLayers( Branch& a_branch, LayerMask a_layers )
+{
+    if constexpr( LAYERPOLICY::LAYERS )
+        a_branch.m_layers = a_layers;
+}
+
+
+// Branch of a parent pointing at a_child, with its cover, layers and key.
+RTREE_TEMPLATE
+typename RTREE_QUAL::Branch RTREE_QUAL::ChildBranch( Node* a_child ) const
+{
+    Branch branch;
+    branch.m_rect   = NodeCover( a_child );
+    branch.m_child  = a_child;
+    SetBranchLayers( branch, NodeLayers( a_child ) );
+    KeyChild( branch );
+    return branch;
+}
+
+
+// Recompute cover, layers and key of a branch after its child lost or moved branches.
+RTREE_TEMPLATE
+void RTREE_QUAL::RefreshBranch( Node* a_node, int a_index ) const
+{
+    Node* child = a_node->m_branch[a_index].m_child;
+
+    SetBranchRect( a_node, a_index, NodeCover( child ) );
+    SetBranchLayers( a_node->m_branch[a_index], NodeLayers( child ) );
+    KeyChild( a_node->m_branch[a_index] );
+}
+
+
+// Add a branch to a node.  Split the node if necessary.
+// Returns 0 if node not split.  Old node updated.
+// Returns 1 if node split, sets *new_node to address of new node.
+// Old node updated, becomes one of two.
+RTREE_TEMPLATE
+bool RTREE_QUAL::AddBranch( const Branch* a_branch, Node* a_node, Node** a_newNode ) const
+{
+    ASSERT( a_branch );
+    ASSERT( a_node );
+
+    if( a_node->m_count < MAXNODES ) // Split won't be necessary
+    {
+        a_node->m_branch[a_node->m_count] = *a_branch;
+        a_node->UpdateLane( a_node->m_count );
+        ++a_node->m_count;
+        a_node->m_entryCount += a_node->IsLeaf() ? 1 : a_branch->m_child->m_entryCount;
+
+        return false;
+    }
+    else
+    {
+        ASSERT( a_newNode );
+
+        SplitNode( a_node, a_branch, a_newNode );
+        return true;
+    }
+}
+
+
+// Add a branch to a node that may be full.
+// The R* policy first tries a forced reinsertion, once per level and never from the root.
+// Returns true if the node was split, like AddBranch.
+RTREE_TEMPLATE
+bool RTREE_QUAL::InsertBranch( const Branch* a_branch, Node* a_node, Node** a_newNode,
+                               ReinsertState* a_state ) const
+{
+    if constexpr( SPLITPOLICY::RSTAR )
+    {
+        const uint64_t levelBit = uint64_t( 1 ) << a_node->m_level;
+
+        if( a_node->m_count == MAXNODES && a_node != a_state->m_root
+            && !( a_state->m_treatedLevels & levelBit ) )
+        {
+            a_state->m_treatedLevels |= levelBit;
+            a_state->m_coverShrunk = true;
+            ForcedReinsert( a_node, a_branch );
+            return false;
+        }
+    }
+
+    return AddBranch( a_branch, a_node, a_newNode );
+}
+
+
+// Keep the entries of an overflowing node closest to its centre and queue the rest for
+// reinsertion at the same level, closest first.
+RTREE_TEMPLATE
+void RTREE_QUAL::ForcedReinsert( Node* a_node, const Branch* a_branch ) const
+{
+    ASSERT( a_node->m_count == MAXNODES );
+
+    const int       total = MAXNODES + 1;
+    const int       evictCount = std::max( 1, total * SPLITPOLICY::REINSERT_PERCENT / 100 );
+    Branch          buffer[MAXNODES + 1];
+    ELEMTYPEREAL    distance[MAXNODES + 1];
+    int             order[MAXNODES + 1];
+
+    std::copy( a_node->m_branch, a_node->m_branch + MAXNODES, buffer );
+    buffer[MAXNODES] = *a_branch;
+
+    Rect cover = buffer[0].m_rect;
+
+    for( int index = 1; index < total; ++index )
+    {
+        cover = CombineRect( &cover, &buffer[index].m_rect );
+    }
+
+    // Distances between doubled centres, the factor does not change the order
+    for( int index = 0; index < total; ++index )
+    {
+        distance[index] = 0;
+
+        for( int axis = 0; axis < NUMDIMS; ++axis )
+        {
+            const ELEMTYPEREAL delta =
+                    ( (ELEMTYPEREAL) buffer[index].m_rect.m_min[axis] + buffer[index].m_rect.m_max[axis] )
+                    - ( (ELEMTYPEREAL) cover.m_min[axis] + cover.m_max[axis] );
+            distance[index] += delta * delta;
+        }
+
+        order[index] = index;
+    }
+
+    std::sort( order, order + total,
+               [&distance]( int a_indexA, int a_indexB )
+               {
+                   return distance[a_indexA] < distance[a_indexB];
+               } );
+
+    a_node->m_count = 0;
+    a_node->m_entryCount = 0;
+
+    for( int index = 0; index < total - evictCount; ++index )
+    {
+        AddBranch( &buffer[order[index]], a_node, NULL );
+    }
+
+    // The queue is popped from the back, push the farthest first
+    for( int index = total - 1; index >= total - evictCount; --index )
+    {
+        m_reinsertQueue.emplace_back( buffer[order[index]], a_node->m_level );
+    }
+}
+
+
+// Disconnect a dependent node.
+// Caller must return (or stop using iteration index) after this as count has changed
+RTREE_TEMPLATE
+void RTREE_QUAL::DisconnectBranch( Node* a_node, int a_index ) const
+{
+    ASSERT( a_node && (a_index >= 0) && (a_index < MAXNODES) );
+    ASSERT( a_node->m_count > 0 );
+
+    a_node->m_entryCount -= a_node->IsLeaf() ? 1 : a_node->m_branch[a_index].m_child->m_entryCount;
+
+    // Remove element by swapping with the last element to prevent gaps in array
+    a_node->m_branch[a_index] = a_node->m_branch[a_node->m_count - 1];
+    a_node->UpdateLane( a_index );
+
+    --a_node->m_count;
+}
+
+
+// Pick a branch.  Pick the one that will need the smallest increase
+// in area to accomodate the new rectangle.  This will result in the
+// least total area for the covering rectangles in the current node.
+// In case of a tie, pick the one which was smaller before, to get
+// the best resolution when searching.
+RTREE_TEMPLATE
+int RTREE_QUAL::PickBranch( const Rect* a_rect, Node* a_node ) const
+{
+    ASSERT( a_rect && a_node );
+
+    bool            firstTime = true;
+    ELEMTYPEREAL    increase;
+    ELEMTYPEREAL    bestIncr = (ELEMTYPEREAL) -1;
+    ELEMTYPEREAL    area;
+    ELEMTYPEREAL    bestArea = 0;
+    int             best = 0;
+    Rect            tempRect;
+
+    for( int index = 0; index < a_node->m_count; ++index )
+    {
+        Rect* curRect = &a_node->m_branch[index].m_rect;
+        area        = CalcRectVolume( curRect );
+        tempRect    = CombineRect( a_rect, curRect );
+        increase    = CalcRectVolume( &tempRect ) - area;
+
+        if( (increase < bestIncr) || firstTime )
+        {
+            best        = index;
+            bestArea    = area;
+            bestIncr    = increase;
+            firstTime   = false;
+        }
+        else if( (increase == bestIncr) && (area < bestArea) )
+        {
+            best        = index;
+            bestArea    = area;
+            bestIncr    = increase;
+        }
     }
 
+    return best;
+}
 
-protected:
-    /// May be data or may be another subtree
-    /// The parents level determines this.
-    /// If the parents level is 0, then this is data
-    struct Branch
+
+// R* ChooseSubtree for parents of the insertion level.  Pick the branch whose enlargement
+// adds the least overlap with its siblings, then the least volume enlargement, then the
+// smallest volume.
+RTREE_TEMPLATE
+int RTREE_QUAL::PickBranchRStar( const Rect* a_rect, Node* a_node ) const
+{
+    ASSERT( a_rect && a_node );
+
+    int             best = 0;
+    ELEMTYPEREAL    bestOverlap = 0;
+    ELEMTYPEREAL    bestIncr = 0;
+    ELEMTYPEREAL    bestArea = 0;
+
+    for( int index = 0; index < a_node->m_count; ++index )
     {
-        Rect m_rect;                              ///< Bounds
-        union
+        const Rect*  curRect = &a_node->m_branch[index].m_rect;
+        const Rect   enlarged = CombineRect( a_rect, curRect );
+        ELEMTYPEREAL overlap = 0;
+
+        for( int other = 0; other < a_node->m_count; ++other )
         {
-            Node*       m_child;                    ///< Child node
-            DATATYPE    m_data;                     ///< Data Id or Ptr
-        };
-    };
+            if( other != index )
+            {
+                const Rect* otherRect = &a_node->m_branch[other].m_rect;
+                overlap += OverlapArea( &enlarged, otherRect ) - OverlapArea( curRect, otherRect );
+            }
+        }
 
-    /// Node for each branch level
-    struct Node
-    {
-        constexpr bool IsInternalNode() const { return m_level > 0; }   // Not a leaf, but a internal node
-        constexpr bool IsLeaf()         const { return m_level == 0; }  // A leaf, contains data
+        const ELEMTYPEREAL area = CalcRectVolume( curRect );
+        const ELEMTYPEREAL increase = CalcRectVolume( &enlarged ) - area;
 
-        int     m_count;                            ///< Count
-        int     m_level;                            ///< Leaf is zero, others positive
-        Branch  m_branch[MAXNODES];                 ///< Branch
-    };
+        if( index == 0 || overlap < bestOverlap
+            || ( overlap == bestOverlap
+                 && ( increase < bestIncr || ( increase == bestIncr && area < bestArea ) ) ) )
+        {
+            best        = index;
+            bestOverlap = overlap;
+            bestIncr    = increase;
+            bestArea    = area;
+        }
+    }
 
-    /// A link list of nodes for reinsertion after a delete operation
-    struct ListNode
-    {
-        ListNode*   m_next;                         ///< Next in list
-        Node*       m_node;                         ///< Node
-    };
+    return best;
+}
 
-    /// Variables for finding a split partition
-    struct PartitionVars
-    {
-        int             m_partition[MAXNODES + 1];
-        int             m_total;
-        int             m_minFill;
-        bool            m_taken[MAXNODES + 1];
-        int             m_count[2];
-        Rect            m_cover[2];
-        ELEMTYPEREAL    m_area[2];
 
-        Branch          m_branchBuf[MAXNODES + 1];
-        int             m_branchCount;
-        Rect            m_coverSplit;
-        ELEMTYPEREAL    m_coverSplitArea;
-    };
+// Hilbert ChooseSubtree: the child with the smallest largest key not below a_key, so entries
+// stay sorted across leaves.  Keys past every child go to the child holding the largest keys.
+RTREE_TEMPLATE
+int RTREE_QUAL::PickBranchHilbert( uint64_t a_key, const Node* a_node )
+{
+    int best = -1;
+    int last = 0;
 
-    /// Data structure used for Nearest Neighbor search implementation
-    struct NNNode
+    for( int index = 0; index < a_node->m_count; ++index )
     {
-        Branch m_branch;
-        ELEMTYPE minDist;
-        bool isLeaf;
+        const uint64_t key = a_node->m_branch[index].m_key;
 
-        inline bool operator<(const NNNode &other) const
+        if( key >= a_key && ( best < 0 || key < a_node->m_branch[best].m_key ) )
         {
-            /// This is reversed on purpose to use std::priority_queue
-            return other.minDist < minDist;
+            best = index;
         }
-    };
 
-    Node*           AllocNode() const;
-    void            FreeNode( Node* a_node ) const;
-    void            InitNode( Node* a_node ) const;
-    void            InitRect( Rect* a_rect ) const;
-    bool            InsertRectRec( const Rect*      a_rect,
-                                   const DATATYPE&  a_id,
-                                   Node*            a_node,
-                                   Node**           a_newNode,
-                                   int              a_level ) const;
-    bool            InsertRect( const Rect* a_rect, const DATATYPE& a_id, Node** a_root, int a_level ) const;
-    Rect            NodeCover( Node* a_node ) const;
-    bool            AddBranch( const Branch* a_branch, Node* a_node, Node** a_newNode ) const;
-    void            DisconnectBranch( Node* a_node, int a_index ) const;
-    int             PickBranch( const Rect* a_rect, Node* a_node ) const;
-    Rect            CombineRect( const Rect* a_rectA, const Rect* a_rectB ) const;
-    void            SplitNode( Node* a_node, const Branch* a_branch, Node** a_newNode ) const;
-    ELEMTYPEREAL    RectSphericalVolume( const Rect* a_rect ) const;
-    ELEMTYPEREAL    RectVolume( const Rect* a_rect ) const;
-    ELEMTYPEREAL    CalcRectVolume( const Rect* a_rect ) const;
-    void            GetBranches( Node* a_node, const Branch* a_branch, PartitionVars* a_parVars ) const;
-    void            ChoosePartition( PartitionVars* a_parVars, int a_minFill ) const;
-    void            LoadNodes( Node* a_nodeA, Node* a_nodeB, PartitionVars* a_parVars ) const;
-    void            InitParVars( PartitionVars* a_parVars, int a_maxRects, int a_minFill ) const;
-    void            PickSeeds( PartitionVars* a_parVars ) const;
-    void            Classify( int a_index, int a_group, PartitionVars* a_parVars ) const;
-    bool            RemoveRect( const Rect* a_rect, const DATATYPE& a_id, Node** a_root ) const;
-    bool            RemoveRectRec( const Rect*      a_rect,
-                                   const DATATYPE&  a_id,
-                                   Node*            a_node,
-                                   ListNode**       a_listNode ) const;
-    ListNode*       AllocListNode() const;
-    void            FreeListNode( ListNode* a_listNode ) const;
-    static bool     Overlap( const Rect* a_rectA, const Rect* a_rectB );
-    void            ReInsert( Node* a_node, ListNode** a_listNode ) const;
-    ELEMTYPE        MinDist( const ELEMTYPE a_point[NUMDIMS], const Rect& a_rect ) const;
+        if( key > a_node->m_branch[last].m_key )
+        {
+            last = index;
+        }
+    }
 
-    bool Search( const Node* a_node, const Rect* a_rect, int& a_foundCount,
-                 std::function<bool (const DATATYPE&)> a_callback ) const;
+    return best >= 0 ? best : last;
+}
 
-    template <class VISITOR>
-    bool Search( const Node* a_node, const Rect* a_rect, VISITOR& a_visitor, int& a_foundCount ) const
+
+// Cooperating sibling of a_node's branch a_index: the neighbour in key order that still has
+// room, the next one before the previous one.  With both neighbours full the next one is
+// returned, or the previous one for the last child.  -1 if a_index has no siblings.
+RTREE_TEMPLATE
+int RTREE_QUAL::HilbertSibling( const Node* a_node, int a_index )
+{
+    const uint64_t key = a_node->m_branch[a_index].m_key;
+    int            next = -1;
+    int            prev = -1;
+
+    for( int index = 0; index < a_node->m_count; ++index )
     {
-        ASSERT( a_node );
-        ASSERT( a_node->m_level >= 0 );
-        ASSERT( a_rect );
+        if( index == a_index )
+            continue;
 
-        if( a_node->IsInternalNode() ) // This is an internal node in the tree
+        const uint64_t otherKey = a_node->m_branch[index].m_key;
+
+        if( otherKey >= key )
         {
-            for( int index = 0; index < a_node->m_count; ++index )
-            {
-                if( Overlap( a_rect, &a_node->m_branch[index].m_rect ) )
-                {
-                    if( !Search( a_node->m_branch[index].m_child, a_rect, a_visitor, a_foundCount ) )
-                    {
-                        return false; // Don't continue searching
-                    }
-                }
-            }
+            if( next < 0 || otherKey < a_node->m_branch[next].m_key )
+                next = index;
         }
-        else // This is a leaf node
+        else if( prev < 0 || otherKey > a_node->m_branch[prev].m_key )
         {
-            for( int index = 0; index < a_node->m_count; ++index )
-            {
-                if( Overlap( a_rect, &a_node->m_branch[index].m_rect ) )
-                {
-                    const DATATYPE& id = a_node->m_branch[index].m_data;
-
-                    if( !a_visitor( id ) )
-                        return false;
-
-                    a_foundCount++;
-                }
-            }
+            prev = index;
         }
-
-        return true; // Continue searching
     }
 
-    void    RemoveAllRec( Node* a_node ) const;
-    void    Reset() const;
-    void    CountRec( const Node* a_node, int& a_count ) const;
+    if( next >= 0 && a_node->m_branch[next].m_child->m_count < MAXNODES )
+        return next;
 
-    bool    SaveRec( const Node* a_node, RTFileStream& a_stream ) const;
-    bool    LoadRec( const Node* a_node, RTFileStream& a_stream ) const;
+    if( prev >= 0 && a_node->m_branch[prev].m_child->m_count < MAXNODES )
+        return prev;
 
-    Node*           m_root;                         ///< Root of tree
-    ELEMTYPEREAL    m_unitSphereVolume;             ///< Unit sphere constant for required number of dimensions
-};
+    return next >= 0 ? next : prev;
+}
 
 
-// Because there is not stream support, this is a quick and dirty file I/O helper.
-// Users will likely replace its usage with a Stream implementation from their favorite API.
-class RTFileStream
+// Deferred splitting for the Hilbert policy.  The child at a_index has just overflowed into
+// a_other; pour both and a cooperating sibling back in key order.  If the sibling had room
+// the three nodes fit in two and a_other is released, otherwise all three are refilled evenly
+// and a_other is added to a_node, which may split in turn.
+RTREE_TEMPLATE
+bool RTREE_QUAL::ShareOverflow( Node* a_node, int a_index, Node* a_other, Node** a_newNode,
+                                ReinsertState* a_state ) const
 {
-    FILE* m_file;
-public:
+    const int sibling = HilbertSibling( a_node, a_index );
 
-
-    RTFileStream()
+    if( sibling < 0 )
     {
-        m_file = NULL;
+        Branch branch = ChildBranch( a_other );
+        return InsertBranch( &branch, a_node, a_newNode, a_state );
     }
 
-    ~RTFileStream()
+    Node*       child = a_node->m_branch[a_index].m_child;
+    Node*       share = a_node->m_branch[sibling].m_child;
+    const int   otherEntries = a_other->m_entryCount;
+    Branch      buffer[3 * MAXNODES];
+    int         count = 0;
+
+    for( Node* node : { child, a_other, share } )
     {
-        Close();
+        std::copy( node->m_branch, node->m_branch + node->m_count, buffer + count );
+        count += node->m_count;
     }
 
-    bool OpenRead( const char* a_fileName )
+    if( count <= 2 * MAXNODES )
     {
-        m_file = std::fopen( a_fileName, "rb" );
+        Node* const nodes[2] = { child, share };
+        DistributeByKey( buffer, count, nodes, 2 );
+        FreeNode( a_other );
+
+        // a_other's entries now live in nodes a_node already counts
+        a_node->m_entryCount += otherEntries;
+        RefreshBranch( a_node, a_index );
+        RefreshBranch( a_node, sibling );
+        return false;
+    }
 
-        if( !m_file )
-        {
-            return false;
-        }
+    Node* const nodes[3] = { child, a_other, share };
+    DistributeByKey( buffer, count, nodes, 3 );
 
-        return true;
-    }
+    a_node->m_entryCount += otherEntries - a_other->m_entryCount;
+    RefreshBranch( a_node, a_index );
+    RefreshBranch( a_node, sibling );
 
-    bool OpenWrite( const char* a_fileName )
-    {
-        m_file = std::fopen( a_fileName, "wb" );
+    Branch branch = ChildBranch( a_other );
+    return InsertBranch( &branch, a_node, a_newNode, a_state );
+}
 
-        if( !m_file )
-        {
-            return false;
-        }
 
-        return true;
-    }
+// Sort a_branches by key and refill a_nodes with even, contiguous runs of them.
+// The nodes keep their level.
+RTREE_TEMPLATE
+void RTREE_QUAL::DistributeByKey( Branch* a_branches, int a_count, Node* const* a_nodes,
+                                  int a_nodeCount ) const
+{
+    SortByKey( a_branches, a_branches + a_count );
 
-    void Close()
+    const int level = a_nodes[0]->m_level;
+    int       first = 0;
+
+    for( int share = 0; share < a_nodeCount; ++share )
     {
-        if( m_file )
+        Node*     node = a_nodes[share];
+        const int last = (int) ( (int64_t) a_count * ( share + 1 ) / a_nodeCount );
+
+        InitNode( node );
+        node->m_level = level;
+
+        for( ; first < last; ++first )
         {
-            std::fclose( m_file );
-            m_file = NULL;
+            AddBranch( &a_branches[first], node, NULL );
         }
     }
+}
 
-    template <typename TYPE>
-    size_t Write( const TYPE& a_value )
-    {
-        ASSERT( m_file );
-        return std::fwrite( (void*) &a_value, sizeof(a_value), 1, m_file );
-    }
 
-    template <typename TYPE>
-    size_t WriteArray( const TYPE* a_array, int a_count )
-    {
-        ASSERT( m_file );
-        return std::fwrite( (void*) a_array, sizeof(TYPE) * a_count, 1, m_file );
-    }
+// Entry key of a leaf branch, a no-op unless the Hilbert policy keeps keys.
+RTREE_TEMPLATE
+void RTREE_QUAL::KeyEntry( Branch& a_branch )
+{
+    if constexpr( SPLITPOLICY::HILBERT )
+        a_branch.m_key = HilbertKey( a_branch.m_rect );
+}
 
-    template <typename TYPE>
-    size_t Read( TYPE& a_value )
-    {
-        ASSERT( m_file );
-        return std::fread( (void*) &a_value, sizeof(a_value), 1, m_file );
-    }
 
-    template <typename TYPE>
-    size_t ReadArray( TYPE* a_array, int a_count )
-    {
-        ASSERT( m_file );
-        return std::fread( (void*) a_array, sizeof(TYPE) * a_count, 1, m_file );
-    }
-};
+// Key of an internal branch, the largest key in its child.
+RTREE_TEMPLATE
+void RTREE_QUAL::KeyChild( Branch& a_branch )
+{
+    if constexpr( SPLITPOLICY::HILBERT )
+        a_branch.m_key = NodeKey( a_branch.m_child );
+}
 
 
-RTREE_TEMPLATE RTREE_QUAL::RTree()
+// Largest key among the branches of a node.
+RTREE_TEMPLATE
+uint64_t RTREE_QUAL::NodeKey( const Node* a_node )
 {
-    ASSERT( MAXNODES > MINNODES );
-    ASSERT( MINNODES > 0 );
+    uint64_t key = 0;
+
+    if constexpr( SPLITPOLICY::HILBERT )
+    {
+        for( int index = 0; index < a_node->m_count; ++index )
+        {
+            key = std::max( key, a_node->m_branch[index].m_key );
+        }
+    }
 
+    return key;
+}
 
-    // We only support machine word size simple data type eg. integer index or object pointer.
-    // Since we are storing as union with non data branch
-    ASSERT( sizeof(DATATYPE) == sizeof(void*) || sizeof(DATATYPE) == sizeof(int) );
 
-    // Precomputed volumes of the unit spheres for the first few dimensions
-    const float UNIT_SPHERE_VOLUMES[] =
+// Rekey the entry at the end of m_updatePath and every branch above it after Update moved it.
+RTREE_TEMPLATE
+void RTREE_QUAL::RefreshPathKeys() const
+{
+    if constexpr( SPLITPOLICY::HILBERT )
     {
-        0.000000f, 2.000000f, 3.141593f,    // Dimension  0,1,2
-        4.188790f, 4.934802f, 5.263789f,    // Dimension  3,4,5
-        5.167713f, 4.724766f, 4.058712f,    // Dimension  6,7,8
-        3.298509f, 2.550164f, 1.884104f,    // Dimension  9,10,11
-        1.335263f, 0.910629f, 0.599265f,    // Dimension  12,13,14
-        0.381443f, 0.235331f, 0.140981f,    // Dimension  15,16,17
-        0.082146f, 0.046622f, 0.025807f,    // Dimension  18,19,20
-    };
+        const std::pair<Node*, int>& leaf = m_updatePath.back();
+        KeyEntry( leaf.first->m_branch[leaf.second] );
 
-    m_root = AllocNode();
-    m_root->m_level     = 0;
-    m_unitSphereVolume  = (ELEMTYPEREAL) UNIT_SPHERE_VOLUMES[NUMDIMS];
+        for( int depth = (int) m_updatePath.size() - 2; depth >= 0; --depth )
+        {
+            KeyChild( m_updatePath[depth].first->m_branch[m_updatePath[depth].second] );
+        }
+    }
 }
 
 
+// Combine two rectangles into larger one containing both
 RTREE_TEMPLATE
-RTREE_QUAL::~RTree() {
-    Reset(); // Free, or reset node memory
+typename RTREE_QUAL::Rect RTREE_QUAL::CombineRect( const Rect* a_rectA, const Rect* a_rectB ) const
+{
+    ASSERT( a_rectA && a_rectB );
+
+    Rect newRect;
+
+    for( int index = 0; index < NUMDIMS; ++index )
+    {
+        newRect.m_min[index] = std::min( a_rectA->m_min[index], a_rectB->m_min[index] );
+        newRect.m_max[index] = std::max( a_rectA->m_max[index], a_rectB->m_max[index] );
+    }
+
+    return newRect;
 }
 
 
+// Split a node.
+// Divides the nodes branches and the extra one between two nodes.
+// Old node is one of the new ones, and one really new one is created.
+// Tries more than one method for choosing a partition, uses best result.
 RTREE_TEMPLATE
-void RTREE_QUAL::Insert( const ELEMTYPE     a_min[NUMDIMS],
-                         const ELEMTYPE     a_max[NUMDIMS],
-                         const DATATYPE&    a_dataId )
+void RTREE_QUAL::SplitNode( Node* a_node, const Branch* a_branch, Node** a_newNode ) const
 {
-#ifdef _DEBUG
+    ASSERT( a_node );
+    ASSERT( a_branch );
 
-    for( int index = 0; index<NUMDIMS; ++index )
+    if constexpr( SPLITPOLICY::HILBERT )
     {
-        ASSERT( a_min[index] <= a_max[index] );
+        // Lower keys stay, the upper half moves to the new node
+        Branch buffer[MAXNODES + 1];
+        std::copy( a_node->m_branch, a_node->m_branch + MAXNODES, buffer );
+        buffer[MAXNODES] = *a_branch;
+
+        *a_newNode = AllocNode();
+        (*a_newNode)->m_level = a_node->m_level;
+
+        Node* const nodes[2] = { a_node, *a_newNode };
+        DistributeByKey( buffer, MAXNODES + 1, nodes, 2 );
+        return;
     }
 
-#endif    // _DEBUG
+    // Could just use local here, but member or external is faster since it is reused
+    PartitionVars   localVars;
+    PartitionVars*  parVars = &localVars;
+    int             level;
 
-    Rect rect;
+    // Load all the branches into a buffer, initialize old node
+    level = a_node->m_level;
+    GetBranches( a_node, a_branch, parVars );
 
-    for( int axis = 0; axis < NUMDIMS; ++axis )
-    {
-        rect.m_min[axis] = a_min[axis];
-        rect.m_max[axis] = a_max[axis];
-    }
+    // Find partition
+    if constexpr( SPLITPOLICY::RSTAR )
+        ChoosePartitionRStar( parVars, MINNODES );
+    else
+        ChoosePartition( parVars, MINNODES );
+
+    // Put branches from buffer into 2 nodes according to chosen partition
+    *a_newNode = AllocNode();
+    (*a_newNode)->m_level = a_node->m_level = level;
+    LoadNodes( a_node, *a_newNode, parVars );
 
-    InsertRect( &rect, a_dataId, &m_root, 0 );
+    ASSERT( (a_node->m_count + (*a_newNode)->m_count) == parVars->m_total );
 }
 
 
+// Volume of a rectangle under the tree's volume metric
 RTREE_TEMPLATE
-bool RTREE_QUAL::Remove( const ELEMTYPE     a_min[NUMDIMS],
-                         const ELEMTYPE     a_max[NUMDIMS],
-                         const DATATYPE&    a_dataId )
+ELEMTYPEREAL RTREE_QUAL::CalcRectVolume( const Rect* a_rect ) const
 {
-#ifdef _DEBUG
-
-    for( int index = 0; index<NUMDIMS; ++index )
-    {
-        ASSERT( a_min[index] <= a_max[index] );
-    }
-
-#endif    // _DEBUG
+    ASSERT( a_rect );
 
-    Rect rect;
+    ELEMTYPEREAL volume = VOLUMEPOLICY::template Volume<ELEMTYPEREAL, NUMDIMS>( a_rect->m_min, a_rect->m_max );
 
-    for( int axis = 0; axis < NUMDIMS; ++axis )
-    {
-        rect.m_min[axis] = a_min[axis];
-        rect.m_max[axis] = a_max[axis];
-    }
+    ASSERT( volume >= (ELEMTYPEREAL) 0 );
 
-    return RemoveRect( &rect, a_dataId, &m_root );
+    return volume;
 }
 
 
+// Load branch buffer with branches from full node plus the extra branch.
 RTREE_TEMPLATE
-int RTREE_QUAL::Search( const ELEMTYPE a_min[NUMDIMS],
-                        const ELEMTYPE a_max[NUMDIMS],
-                        std::function<bool (const DATATYPE&)> a_callback ) const
+void RTREE_QUAL::GetBranches( Node* a_node, const Branch* a_branch, PartitionVars* a_parVars ) const
 {
-#ifdef _DEBUG
+    ASSERT( a_node );
+    ASSERT( a_branch );
 
-    for( int index = 0; index < NUMDIMS; ++index )
+    ASSERT( a_node->m_count == MAXNODES );
+
+    // Load the branch buffer
+    for( int index = 0; index < MAXNODES; ++index )
     {
-        ASSERT( a_min[index] <= a_max[index] );
+        a_parVars->m_branchBuf[index] = a_node->m_branch[index];
     }
 
-#endif    // _DEBUG
+    a_parVars->m_branchBuf[MAXNODES] = *a_branch;
+    a_parVars->m_branchCount = MAXNODES + 1;
 
-    Rect rect;
+    // Calculate rect containing all in the set
+    a_parVars->m_coverSplit = a_parVars->m_branchBuf[0].m_rect;
 
-    for( int axis = 0; axis < NUMDIMS; ++axis )
+    for( int index = 1; index < MAXNODES + 1; ++index )
     {
-        rect.m_min[axis] = a_min[axis];
-        rect.m_max[axis] = a_max[axis];
+        a_parVars->m_coverSplit =
+            CombineRect( &a_parVars->m_coverSplit, &a_parVars->m_branchBuf[index].m_rect );
     }
 
-    // NOTE: May want to return search result another way, perhaps returning the number of found elements here.
+    a_parVars->m_coverSplitArea = CalcRectVolume( &a_parVars->m_coverSplit );
 
-    int foundCount = 0;
-    Search( m_root, &rect, foundCount, a_callback );
-    return foundCount;
+    InitNode( a_node );
 }
 
 
+// Method #0 for choosing a partition:
+// As the seeds for the two groups, pick the two rects that would waste the
+// most area if covered by a single rectangle, i.e. evidently the worst pair
+// to have in the same group.
+// Of the remaining, one at a time is chosen to be put in one of the two groups.
+// The one chosen is the one with the greatest difference in area expansion
+// depending on which group - the rect most strongly attracted to one group
+// and repelled from the other.
+// If one group gets too full (more would force other group to violate min
+// fill requirement) then other group gets the rest.
+// These last are the ones that can go in either group most easily.
 RTREE_TEMPLATE
-int RTREE_QUAL::Search( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS],
-        std::function<bool( const DATATYPE& )> a_callback, bool& aFinished ) const
+void RTREE_QUAL::ChoosePartition( PartitionVars* a_parVars, int a_minFill ) const
 {
-#ifdef _DEBUG
-
-    for( int index = 0; index < NUMDIMS; ++index )
-    {
-        ASSERT( a_min[index] <= a_max[index] );
-    }
+    ASSERT( a_parVars );
 
-#endif // _DEBUG
+    ELEMTYPEREAL    biggestDiff;
+    int             group, chosen = 0, betterGroup = 0;
 
-    Rect rect;
+    InitParVars( a_parVars, a_parVars->m_branchCount, a_minFill );
+    PickSeeds( a_parVars );
 
-    for( int axis = 0; axis < NUMDIMS; ++axis )
+    while( ( (a_parVars->m_count[0] + a_parVars->m_count[1]) < a_parVars->m_total )
+           && ( a_parVars->m_count[0] < (a_parVars->m_total - a_parVars->m_minFill) )
+           && ( a_parVars->m_count[1] < (a_parVars->m_total - a_parVars->m_minFill) ) )
     {
-        rect.m_min[axis] = a_min[axis];
-        rect.m_max[axis] = a_max[axis];
-    }
+        biggestDiff = (ELEMTYPEREAL) -1;
 
-    // NOTE: May want to return search result another way, perhaps returning the number of found elements here.
+        for( int index = 0; index<a_parVars->m_total; ++index )
+        {
+            if( !a_parVars->m_taken[index] )
+            {
+                const Rect*     curRect = &a_parVars->m_branchBuf[index].m_rect;
+                const Rect      rect0   = CombineRect( curRect, &a_parVars->m_cover[0] );
+                const Rect      rect1   = CombineRect( curRect, &a_parVars->m_cover[1] );
+                ELEMTYPEREAL    growth0 = CalcRectVolume( &rect0 ) - a_parVars->m_area[0];
+                ELEMTYPEREAL    growth1 = CalcRectVolume( &rect1 ) - a_parVars->m_area[1];
+                ELEMTYPEREAL    diff    = growth1 - growth0;
 
-    int foundCount = 0;
-    aFinished      = Search( m_root, &rect, foundCount, a_callback );
-    return foundCount;
-}
+                if( diff >= 0 )
+                {
+                    group = 0;
+                }
+                else
+                {
+                    group = 1;
+                    diff  = -diff;
+                }
 
+                if( diff > biggestDiff )
+                {
+                    biggestDiff = diff;
+                    chosen = index;
+                    betterGroup = group;
+                }
+                else if( (diff == biggestDiff)
+                         && (a_parVars->m_count[group] < a_parVars->m_count[betterGroup]) )
+                {
+                    chosen = index;
+                    betterGroup = group;
+                }
+            }
+        }
 
-RTREE_TEMPLATE
-std::vector<std::pair<ELEMTYPE, DATATYPE>> RTREE_QUAL::NearestNeighbors(
-        const ELEMTYPE a_point[NUMDIMS],
-        std::function<bool( const std::size_t aNumResults, const ELEMTYPE aMinDist )> aTerminate,
-        std::function<bool( const DATATYPE aElement )> aFilter,
-        std::function<ELEMTYPE( const ELEMTYPE a_point[NUMDIMS], const DATATYPE a_data )> aSquaredDist ) const
-{
-    std::vector<std::pair<ELEMTYPE, DATATYPE>> result;
-    std::priority_queue<NNNode> search_q;
+        Classify( chosen, betterGroup, a_parVars );
+    }
 
-    for( int i = 0; i < m_root->m_count; ++i )
+    // If one group too full, put remaining rects in the other
+    if( (a_parVars->m_count[0] + a_parVars->m_count[1]) < a_parVars->m_total )
     {
-        if( m_root->IsLeaf() )
+        if( a_parVars->m_count[0] >= a_parVars->m_total - a_parVars->m_minFill )
         {
-            search_q.push( NNNode{ m_root->m_branch[i],
-                               aSquaredDist( a_point, m_root->m_branch[i].m_data ),
-                               m_root->IsLeaf() });
+            group = 1;
         }
         else
         {
-            search_q.push( NNNode{ m_root->m_branch[i],
-                               MinDist(a_point, m_root->m_branch[i].m_rect),
-                               m_root->IsLeaf() });
+            group = 0;
+        }
+
+        for( int index = 0; index<a_parVars->m_total; ++index )
+        {
+            if( !a_parVars->m_taken[index] )
+            {
+                Classify( index, group, a_parVars );
+            }
         }
     }
 
-    while( !search_q.empty() )
+    ASSERT( (a_parVars->m_count[0] + a_parVars->m_count[1]) == a_parVars->m_total );
+    ASSERT( (a_parVars->m_count[0] >= a_parVars->m_minFill)
+            && (a_parVars->m_count[1] >= a_parVars->m_minFill) );
+}
+
+
+// R* split.  Among the sorts of all branches by min and by max of each axis, pick the axis
+// whose candidate distributions have the smallest total margin, then the distribution on that
+// axis with the least overlap between the two groups, then the least total volume.
+RTREE_TEMPLATE
+void RTREE_QUAL::ChoosePartitionRStar( PartitionVars* a_parVars, int a_minFill ) const
+{
+    ASSERT( a_parVars );
+
+    InitParVars( a_parVars, a_parVars->m_branchCount, a_minFill );
+
+    const int       total = a_parVars->m_total;
+    int             order[MAXNODES + 1];
+    Rect            prefix[MAXNODES + 1];
+    Rect            suffix[MAXNODES + 1];
+    int             bestAxis = 0;
+    ELEMTYPEREAL    bestMargin = 0;
+
+    for( int axis = 0; axis < NUMDIMS; ++axis )
     {
-        const NNNode curNode = search_q.top();
+        ELEMTYPEREAL margin = 0;
 
-        if( aTerminate( result.size(), curNode.minDist ) )
-            break;
+        for( int byMax = 0; byMax < 2; ++byMax )
+        {
+            SortOnAxis( a_parVars, axis, byMax, order );
+            CoverRuns( a_parVars, order, prefix, suffix );
 
-        search_q.pop();
+            for( int split = a_minFill; split <= total - a_minFill; ++split )
+            {
+                margin += RectMargin( &prefix[split - 1] ) + RectMargin( &suffix[split] );
+            }
+        }
 
-        if( curNode.isLeaf )
+        if( axis == 0 || margin < bestMargin )
         {
-            if( aFilter( curNode.m_branch.m_data ) )
-                result.emplace_back( curNode.minDist, curNode.m_branch.m_data );
+            bestAxis   = axis;
+            bestMargin = margin;
         }
-        else
+    }
+
+    int             bestOrder[MAXNODES + 1];
+    int             bestSplit = -1;
+    ELEMTYPEREAL    bestOverlap = 0;
+    ELEMTYPEREAL    bestVolume = 0;
+
+    for( int byMax = 0; byMax < 2; ++byMax )
+    {
+        SortOnAxis( a_parVars, bestAxis, byMax, order );
+        CoverRuns( a_parVars, order, prefix, suffix );
+
+        for( int split = a_minFill; split <= total - a_minFill; ++split )
         {
-            Node* node = curNode.m_branch.m_child;
+            const ELEMTYPEREAL overlap = OverlapArea( &prefix[split - 1], &suffix[split] );
+            const ELEMTYPEREAL volume = CalcRectVolume( &prefix[split - 1] ) + CalcRectVolume( &suffix[split] );
 
-            for( int i = 0; i < node->m_count; ++i )
+            if( bestSplit < 0 || overlap < bestOverlap || ( overlap == bestOverlap && volume < bestVolume ) )
             {
-                NNNode newNode;
-                newNode.isLeaf = node->IsLeaf();
-                newNode.m_branch = node->m_branch[i];
-                if( newNode.isLeaf )
-                    newNode.minDist = aSquaredDist( a_point, newNode.m_branch.m_data );
-                else
-                    newNode.minDist = this->MinDist( a_point, node->m_branch[i].m_rect );
-
-                search_q.push( newNode );
+                bestSplit   = split;
+                bestOverlap = overlap;
+                bestVolume  = volume;
+                std::copy( order, order + total, bestOrder );
             }
         }
     }
 
-    return result;
+    for( int index = 0; index < total; ++index )
+    {
+        Classify( bestOrder[index], index < bestSplit ? 0 : 1, a_parVars );
+    }
+
+    ASSERT( (a_parVars->m_count[0] >= a_parVars->m_minFill)
+            && (a_parVars->m_count[1] >= a_parVars->m_minFill) );
 }
 
+
+// Order branch buffer indices by the min or max of their rects along an axis.
 RTREE_TEMPLATE
-int RTREE_QUAL::Count() const
+void RTREE_QUAL::SortOnAxis( const PartitionVars* a_parVars, int a_axis, bool a_byMax, int* a_order ) const
 {
-    int count = 0;
+    const Branch* buffer = a_parVars->m_branchBuf;
+
+    for( int index = 0; index < a_parVars->m_total; ++index )
+    {
+        a_order[index] = index;
+    }
 
-    CountRec( m_root, count );
+    std::sort( a_order, a_order + a_parVars->m_total,
+               [buffer, a_axis, a_byMax]( int a_indexA, int a_indexB )
+               {
+                   const Rect& rectA = buffer[a_indexA].m_rect;
+                   const Rect& rectB = buffer[a_indexB].m_rect;
 
-    return count;
+                   return a_byMax ? rectA.m_max[a_axis] < rectB.m_max[a_axis]
+                                  : rectA.m_min[a_axis] < rectB.m_min[a_axis];
+               } );
 }
 
 
+// Covers of the first i + 1 and of the last total - i branches in the given order.
 RTREE_TEMPLATE
-void RTREE_QUAL::CountRec( const Node* a_node, int& a_count ) const
+void RTREE_QUAL::CoverRuns( const PartitionVars* a_parVars, const int* a_order, Rect* a_prefix,
+                            Rect* a_suffix ) const
 {
-    if( a_node->IsInternalNode() ) // not a leaf node
+    const Branch* buffer = a_parVars->m_branchBuf;
+    const int     total = a_parVars->m_total;
+
+    a_prefix[0] = buffer[a_order[0]].m_rect;
+
+    for( int index = 1; index < total; ++index )
     {
-        for( int index = 0; index < a_node->m_count; ++index )
-        {
-            CountRec( a_node->m_branch[index].m_child, a_count );
-        }
+        a_prefix[index] = CombineRect( &a_prefix[index - 1], &buffer[a_order[index]].m_rect );
     }
-    else // A leaf node
+
+    a_suffix[total - 1] = buffer[a_order[total - 1]].m_rect;
+
+    for( int index = total - 2; index >= 0; --index )
     {
-        a_count += a_node->m_count;
+        a_suffix[index] = CombineRect( &a_suffix[index + 1], &buffer[a_order[index]].m_rect );
     }
 }
 
 
+// Sum of the edge lengths of a rectangle
 RTREE_TEMPLATE
-bool RTREE_QUAL::Load( const char* a_fileName )
+ELEMTYPEREAL RTREE_QUAL::RectMargin( const Rect* a_rect ) const
 {
-    RemoveAll(); // Clear existing tree
-
-    RTFileStream stream;
+    ELEMTYPEREAL margin = 0;
 
-    if( !stream.OpenRead( a_fileName ) )
+    for( int index = 0; index < NUMDIMS; ++index )
     {
-        return false;
+        margin += (ELEMTYPEREAL) a_rect->m_max[index] - (ELEMTYPEREAL) a_rect->m_min[index];
     }
 
-    bool result = Load( stream );
-
-    stream.Close();
-
-    return result;
+    return margin;
 }
 
 
+// Area of the intersection of two rectangles, zero if they are disjoint or only touch.  Always the
+// product of the extents: the spherical VOLUMEPOLICY would count touching rects as overlapping.
 RTREE_TEMPLATE
-bool RTREE_QUAL::Load( RTFileStream& a_stream ) const
+ELEMTYPEREAL RTREE_QUAL::OverlapArea( const Rect* a_rectA, const Rect* a_rectB )
 {
-    // Write some kind of header
-    int _dataFileId         = ('R' << 0) | ('T' << 8) | ('R' << 16) | ('E' << 24);
-    int _dataSize           = sizeof(DATATYPE);
-    int _dataNumDims        = NUMDIMS;
-    int _dataElemSize       = sizeof(ELEMTYPE);
-    int _dataElemRealSize   = sizeof(ELEMTYPEREAL);
-    int _dataMaxNodes       = TMAXNODES;
-    int _dataMinNodes       = TMINNODES;
-
-    int dataFileId          = 0;
-    int dataSize            = 0;
-    int dataNumDims         = 0;
-    int dataElemSize        = 0;
-    int dataElemRealSize    = 0;
-    int dataMaxNodes        = 0;
-    int dataMinNodes        = 0;
-
-    a_stream.Read( dataFileId );
-    a_stream.Read( dataSize );
-    a_stream.Read( dataNumDims );
-    a_stream.Read( dataElemSize );
-    a_stream.Read( dataElemRealSize );
-    a_stream.Read( dataMaxNodes );
-    a_stream.Read( dataMinNodes );
-
-    bool result = false;
+    Rect intersection;
 
-    // Test if header was valid and compatible
-    if( (dataFileId == _dataFileId)
-        && (dataSize == _dataSize)
-        && (dataNumDims == _dataNumDims)
-        && (dataElemSize == _dataElemSize)
-        && (dataElemRealSize == _dataElemRealSize)
-        && (dataMaxNodes == _dataMaxNodes)
-        && (dataMinNodes == _dataMinNodes)
-         )
+    for( int index = 0; index < NUMDIMS; ++index )
     {
-        // Recursively load tree
-        result = LoadRec( m_root, a_stream );
+        intersection.m_min[index] = std::max( a_rectA->m_min[index], a_rectB->m_min[index] );
+        intersection.m_max[index] = std::min( a_rectA->m_max[index], a_rectB->m_max[index] );
+
+        if( intersection.m_min[index] > intersection.m_max[index] )
+        {
+            return 0;
+        }
     }
 
-    return result;
+    return RectArea( intersection );
 }
 
 
+// Copy branches from the buffer into two nodes according to the partition.
 RTREE_TEMPLATE
-bool RTREE_QUAL::LoadRec( const Node* a_node, RTFileStream& a_stream ) const
+void RTREE_QUAL::LoadNodes( Node* a_nodeA, Node* a_nodeB, PartitionVars* a_parVars ) const
 {
-    a_stream.Read( a_node->m_level );
-    a_stream.Read( a_node->m_count );
+    ASSERT( a_nodeA );
+    ASSERT( a_nodeB );
+    ASSERT( a_parVars );
 
-    if( a_node->IsInternalNode() ) // not a leaf node
+    for( int index = 0; index < a_parVars->m_total; ++index )
     {
-        for( int index = 0; index < a_node->m_count; ++index )
-        {
-            const Branch* curBranch = &a_node->m_branch[index];
-
-            a_stream.ReadArray( curBranch->m_rect.m_min, NUMDIMS );
-            a_stream.ReadArray( curBranch->m_rect.m_max, NUMDIMS );
+        ASSERT( a_parVars->m_partition[index] == 0 || a_parVars->m_partition[index] == 1 );
 
-            curBranch->m_child = AllocNode();
-            LoadRec( curBranch->m_child, a_stream );
+        if( a_parVars->m_partition[index] == 0 )
+        {
+            AddBranch( &a_parVars->m_branchBuf[index], a_nodeA, NULL );
         }
-    }
-    else // A leaf node
-    {
-        for( int index = 0; index < a_node->m_count; ++index )
+        else if( a_parVars->m_partition[index] == 1 )
         {
-            const Branch* curBranch = &a_node->m_branch[index];
-
-            a_stream.ReadArray( curBranch->m_rect.m_min, NUMDIMS );
-            a_stream.ReadArray( curBranch->m_rect.m_max, NUMDIMS );
-
-            a_stream.Read( curBranch->m_data );
+            AddBranch( &a_parVars->m_branchBuf[index], a_nodeB, NULL );
         }
     }
+}
 
-    return true; // Should do more error checking on I/O operations
+
+// Initialize a PartitionVars structure.
+RTREE_TEMPLATE
+void RTREE_QUAL::InitParVars( PartitionVars* a_parVars, int a_maxRects, int a_minFill ) const
+{
+    ASSERT( a_parVars );
+
+    a_parVars->m_count[0]   = a_parVars->m_count[1] = 0;
+    a_parVars->m_area[0]    = a_parVars->m_area[1] = (ELEMTYPEREAL) 0;
+    a_parVars->m_total      = a_maxRects;
+    a_parVars->m_minFill    = a_minFill;
+
+    for( int index = 0; index < a_maxRects; ++index )
+    {
+        a_parVars->m_taken[index]       = false;
+        a_parVars->m_partition[index]   = -1;
+    }
 }
 
 
 RTREE_TEMPLATE
-bool RTREE_QUAL::Save( const char* a_fileName )
+void RTREE_QUAL::PickSeeds( PartitionVars* a_parVars ) const
 {
-    RTFileStream stream;
+    int             seed0 = 0, seed1 = 0;
+    ELEMTYPEREAL    worst, waste;
+    ELEMTYPEREAL    area[MAXNODES + 1];
 
-    if( !stream.OpenWrite( a_fileName ) )
+    for( int index = 0; index<a_parVars->m_total; ++index )
     {
-        return false;
+        area[index] = CalcRectVolume( &a_parVars->m_branchBuf[index].m_rect );
     }
 
-    bool result = Save( stream );
+    worst = -a_parVars->m_coverSplitArea - 1;
 
-    stream.Close();
+    for( int indexA = 0; indexA < a_parVars->m_total - 1; ++indexA )
+    {
+        for( int indexB = indexA + 1; indexB < a_parVars->m_total; ++indexB )
+        {
+            Rect oneRect = CombineRect( &a_parVars->m_branchBuf[indexA].m_rect,
+                                        &a_parVars->m_branchBuf[indexB].m_rect );
+            waste = CalcRectVolume( &oneRect ) - area[indexA] - area[indexB];
 
-    return result;
+            if( waste >= worst )
+            {
+                worst   = waste;
+                seed0   = indexA;
+                seed1   = indexB;
+            }
+        }
+    }
+
+    Classify( seed0, 0, a_parVars );
+    Classify( seed1, 1, a_parVars );
 }
 
 
+// Put a branch in one of the groups.
 RTREE_TEMPLATE
-bool RTREE_QUAL::Save( RTFileStream& a_stream ) const
+void RTREE_QUAL::Classify( int a_index, int a_group, PartitionVars* a_parVars ) const
 {
-    // Write some kind of header
-    int dataFileId          = ('R' << 0) | ('T' << 8) | ('R' << 16) | ('E' << 24);
-    int dataSize            = sizeof(DATATYPE);
-    int dataNumDims         = NUMDIMS;
-    int dataElemSize        = sizeof(ELEMTYPE);
-    int dataElemRealSize    = sizeof(ELEMTYPEREAL);
-    int dataMaxNodes        = TMAXNODES;
-    int dataMinNodes        = TMINNODES;
+    ASSERT( a_parVars );
+    ASSERT( !a_parVars->m_taken[a_index] );
 
-    a_stream.Write( dataFileId );
-    a_stream.Write( dataSize );
-    a_stream.Write( dataNumDims );
-    a_stream.Write( dataElemSize );
-    a_stream.Write( dataElemRealSize );
-    a_stream.Write( dataMaxNodes );
-    a_stream.Write( dataMinNodes );
+    a_parVars->m_partition[a_index] = a_group;
+    a_parVars->m_taken[a_index]     = true;
 
-    // Recursively save tree
-    bool result = SaveRec( m_root, a_stream );
+    if( a_parVars->m_count[a_group] == 0 )
+    {
+        a_parVars->m_cover[a_group] = a_parVars->m_branchBuf[a_index].m_rect;
+    }
+    else
+    {
+        a_parVars->m_cover[a_group] = CombineRect( &a_parVars->m_branchBuf[a_index].m_rect,
+                                                   &a_parVars->m_cover[a_group] );
+    }
 
-    return result;
+    a_parVars->m_area[a_group] = CalcRectVolume( &a_parVars->m_cover[a_group] );
+    ++a_parVars->m_count[a_group];
 }
 
 
+// Delete a data rectangle from an index structure.
+// Pass in a pointer to a Rect, the tid of the record, ptr to ptr to root node.
+// Returns 1 if record not found, 0 if success.
+// RemoveRect provides for eliminating the root.
 RTREE_TEMPLATE
-bool RTREE_QUAL::SaveRec( const Node* a_node, RTFileStream& a_stream ) const
+bool RTREE_QUAL::RemoveRect( const Rect* a_rect, const DATATYPE& a_id, Node** a_root ) const
 {
-    a_stream.Write( a_node->m_level );
-    a_stream.Write( a_node->m_count );
+    ASSERT( a_rect && a_root );
+    ASSERT( *a_root );
 
-    if( a_node->IsInternalNode() ) // not a leaf node
+    Node*       tempNode;
+    ListNode*   reInsertList = NULL;
+
+    if( !RemoveRectRec( a_rect, a_id, *a_root, &reInsertList ) )
     {
-        for( int index = 0; index < a_node->m_count; ++index )
+        // Found and deleted a data item
+        // Reinsert any branches from eliminated nodes
+        while( reInsertList )
         {
-            const Branch* curBranch = &a_node->m_branch[index];
+            tempNode = reInsertList->m_node;
 
-            a_stream.WriteArray( curBranch->m_rect.m_min, NUMDIMS );
-            a_stream.WriteArray( curBranch->m_rect.m_max, NUMDIMS );
+            for( int index = 0; index < tempNode->m_count; ++index )
+            {
+                InsertRect( &(tempNode->m_branch[index]), a_root, tempNode->m_level );
+            }
 
-            SaveRec( curBranch->m_child, a_stream );
+            ListNode* remLNode = reInsertList;
+            reInsertList = reInsertList->m_next;
+
+            FreeNode( remLNode->m_node );
+            FreeListNode( remLNode );
         }
-    }
-    else // A leaf node
-    {
-        for( int index = 0; index < a_node->m_count; ++index )
-        {
-            const Branch* curBranch = &a_node->m_branch[index];
 
-            a_stream.WriteArray( curBranch->m_rect.m_min, NUMDIMS );
-            a_stream.WriteArray( curBranch->m_rect.m_max, NUMDIMS );
+        // Check for redundant root (not leaf, 1 child) and eliminate
+        if( (*a_root)->m_count == 1 && (*a_root)->IsInternalNode() )
+        {
+            tempNode = (*a_root)->m_branch[0].m_child;
 
-            a_stream.Write( curBranch->m_data );
+            ASSERT( tempNode );
+            FreeNode( *a_root );
+            *a_root = tempNode;
         }
-    }
 
-    return true; // Should do more error checking on I/O operations
+        return false;
+    }
+    else
+    {
+        return true;
+    }
 }
 
 
+// Delete a rectangle from non-root part of an index structure.
+// Called by RemoveRect.  Descends tree recursively,
+// merges branches on the way back up.
+// Returns 1 if record not found, 0 if success.
 RTREE_TEMPLATE
-void RTREE_QUAL::RemoveAll()
+bool RTREE_QUAL::RemoveRectRec( const Rect*     a_rect,
+                                const DATATYPE& a_id,
+                                Node*           a_node,
+                                ListNode**      a_listNode ) const
 {
-    // Delete all existing nodes
-    Reset();
-
-    m_root = AllocNode();
-    m_root->m_level = 0;
-}
+    ASSERT( a_rect && a_node && a_listNode );
+    ASSERT( a_node->m_level >= 0 );
 
+    if( a_node->IsInternalNode() ) // not a leaf node
+    {
+        for( int index = 0; index < a_node->m_count; ++index )
+        {
+            if( Overlap( a_rect, &(a_node->m_branch[index].m_rect) ) )
+            {
+                const int childEntries = a_node->m_branch[index].m_child->m_entryCount;
 
-RTREE_TEMPLATE
-void RTREE_QUAL::Reset() const
-{
-#ifdef RTREE_DONT_USE_MEMPOOLS
-    // Delete all existing nodes
-    RemoveAllRec( m_root );
-#else    // RTREE_DONT_USE_MEMPOOLS
-    // Just reset memory pools.  We are not using complex types
-    // EXAMPLE
-#endif    // RTREE_DONT_USE_MEMPOOLS
-}
+                if( !RemoveRectRec( a_rect, a_id, a_node->m_branch[index].m_child, a_listNode ) )
+                {
+                    // The subtree lost the entry and any nodes eliminated below
+                    a_node->m_entryCount += a_node->m_branch[index].m_child->m_entryCount - childEntries;
 
+                    if( a_node->m_branch[index].m_child->m_count >= MINNODES )
+                    {
+                        // child removed, just resize parent rect
+                        RefreshBranch( a_node, index );
+                    }
+                    else
+                    {
+                        // child removed, not enough entries in node, eliminate node
+                        ReInsert( a_node->m_branch[index].m_child, a_listNode );
+                        DisconnectBranch( a_node, index ); // Must return after this call as count has changed
+                    }
 
-RTREE_TEMPLATE
-void RTREE_QUAL::RemoveAllRec( Node* a_node ) const
-{
-    ASSERT( a_node );
-    ASSERT( a_node->m_level >= 0 );
+                    return false;
+                }
+            }
+        }
 
-    if( a_node->IsInternalNode() ) // This is an internal node in the tree
+        return true;
+    }
+    else // A leaf node
     {
         for( int index = 0; index < a_node->m_count; ++index )
         {
-            RemoveAllRec( a_node->m_branch[index].m_child );
+            if( BranchData( a_node->m_branch[index] ) == a_id )
+            {
+                ReleaseData( a_node->m_branch[index].m_data );
+                DisconnectBranch( a_node, index ); // Must return after this call as count has changed
+                return false;
+            }
         }
-    }
-
-    FreeNode( a_node );
-}
-
-
-RTREE_TEMPLATE
-typename RTREE_QUAL::Node* RTREE_QUAL::AllocNode() const
-{
-    Node* newNode;
 
-#ifdef RTREE_DONT_USE_MEMPOOLS
-    newNode = new Node;
-#else       // RTREE_DONT_USE_MEMPOOLS
-    // EXAMPLE
-#endif      // RTREE_DONT_USE_MEMPOOLS
-    InitNode( newNode );
-    return newNode;
+        return true;
+    }
 }
 
 
+// Keep a_data for a new leaf branch.  Side stored data reuses released slots first,
+// so m_payloads only grows with the peak number of entries.
 RTREE_TEMPLATE
-void RTREE_QUAL::FreeNode( Node* a_node ) const
+typename RTREE_QUAL::DataSlot RTREE_QUAL::StoreData( const DATATYPE& a_data ) const
 {
-    ASSERT( a_node );
-
-#ifdef RTREE_DONT_USE_MEMPOOLS
-    delete a_node;
-#else       // RTREE_DONT_USE_MEMPOOLS
-    // EXAMPLE
-#endif      // RTREE_DONT_USE_MEMPOOLS
-}
+    if constexpr( INLINE_DATA )
+    {
+        return a_data;
+    }
+    else
+    {
+        if( !m_freeSlots.empty() )
+        {
+            const uint32_t slot = m_freeSlots.back();
+            m_freeSlots.pop_back();
+            m_payloads[slot] = a_data;
+            return slot;
+        }
 
+        ASSERT( m_payloads.size() < std::numeric_limits<uint32_t>::max() );
 
-// Allocate space for a node in the list used in DeletRect to
-// store Nodes that are too empty.
-RTREE_TEMPLATE
-typename RTREE_QUAL::ListNode* RTREE_QUAL::AllocListNode() const
-{
-#ifdef RTREE_DONT_USE_MEMPOOLS
-    return new ListNode;
-#else       // RTREE_DONT_USE_MEMPOOLS
-    // EXAMPLE
-#endif      // RTREE_DONT_USE_MEMPOOLS
+        m_payloads.push_back( a_data );
+        return (uint32_t) m_payloads.size() - 1;
+    }
 }
 
 
+// Release the data of a removed leaf branch.
 RTREE_TEMPLATE
-void RTREE_QUAL::FreeListNode( ListNode* a_listNode ) const
+void RTREE_QUAL::ReleaseData( DataSlot a_slot ) const
 {
-#ifdef RTREE_DONT_USE_MEMPOOLS
-    delete a_listNode;
-#else       // RTREE_DONT_USE_MEMPOOLS
-    // EXAMPLE
-#endif      // RTREE_DONT_USE_MEMPOOLS
-}
-
+    if constexpr( !INLINE_DATA )
+    {
+        // Drop what the payload owns now rather than when the slot is reused
+        if constexpr( std::is_default_constructible<DATATYPE>::value )
+            m_payloads[a_slot] = DATATYPE();
 
-RTREE_TEMPLATE
-void RTREE_QUAL::InitNode( Node* a_node ) const
-{
-    a_node->m_count = 0;
-    a_node->m_level = -1;
+        m_freeSlots.push_back( a_slot );
+    }
 }
 
 
+// Move the side stored data below a_node to the end of a_ordered, leaf by leaf.
 RTREE_TEMPLATE
-void RTREE_QUAL::InitRect( Rect* a_rect ) const
+void RTREE_QUAL::OrderDataRec( Node* a_node, std::vector<DATATYPE>& a_ordered )
 {
-    for( int index = 0; index < NUMDIMS; ++index )
+    for( int index = 0; index < a_node->m_count; ++index )
     {
-        a_rect->m_min[index] = (ELEMTYPE) 0;
-        a_rect->m_max[index] = (ELEMTYPE) 0;
+        Branch& branch = a_node->m_branch[index];
+
+        if( a_node->IsInternalNode() )
+        {
+            OrderDataRec( branch.m_child, a_ordered );
+        }
+        else
+        {
+            a_ordered.push_back( std::move( m_payloads[branch.m_data] ) );
+            branch.m_data = (uint32_t) a_ordered.size() - 1;
+        }
     }
 }
 
 
-// Inserts a new data rectangle into the index structure.
-// Recursively descends tree, propagates splits back up.
-// Returns 0 if node was not split.  Old node updated.
-// If node was split, returns 1 and sets the pointer pointed to by
-// new_node to point to the new node.  Old node updated to become one of two.
-// The level argument specifies the number of steps up from the leaf
-// level to insert; e.g. a data rectangle goes in at level = 0.
+// Find the leaf entry with the given id below a_node, descending only branches
+// overlapping a_rect like RemoveRectRec.  On success a_path holds the node and
+// branch index of every level from a_node down to the entry.
 RTREE_TEMPLATE
-bool RTREE_QUAL::InsertRectRec( const Rect*     a_rect,
-                                const DATATYPE& a_id,
-                                Node*           a_node,
-                                Node**          a_newNode,
-                                int             a_level ) const
+bool RTREE_QUAL::FindEntryPath( const Rect* a_rect, const DATATYPE& a_id, Node* a_node,
+                                std::vector<std::pair<Node*, int>>& a_path ) const
 {
-    ASSERT( a_rect && a_node && a_newNode );
-    ASSERT( a_level >= 0 && a_level <= a_node->m_level );
-
-    int     index;
-    Branch  branch;
-    Node*   otherNode;
+    ASSERT( a_rect && a_node );
 
-    // Still above level for insertion, go down tree recursively
-    if( a_node->m_level > a_level )
+    for( int index = 0; index < a_node->m_count; ++index )
     {
-        index = PickBranch( a_rect, a_node );
-
-        if( !InsertRectRec( a_rect, a_id, a_node->m_branch[index].m_child, &otherNode, a_level ) )
+        if( a_node->IsInternalNode() )
         {
-            // Child was not split
-            a_node->m_branch[index].m_rect =
-                CombineRect( a_rect, &(a_node->m_branch[index].m_rect) );
-            return false;
+            if( !Overlap( a_rect, &(a_node->m_branch[index].m_rect) ) )
+            {
+                continue;
+            }
+
+            a_path.emplace_back( a_node, index );
+
+            if( FindEntryPath( a_rect, a_id, a_node->m_branch[index].m_child, a_path ) )
+            {
+                return true;
+            }
+
+            a_path.pop_back();
         }
-        else // Child was split
+        else if( BranchData( a_node->m_branch[index] ) == a_id )
         {
-            a_node->m_branch[index].m_rect = NodeCover( a_node->m_branch[index].m_child );
-            branch.m_child  = otherNode;
-            branch.m_rect   = NodeCover( otherNode );
-            return AddBranch( &branch, a_node, a_newNode );
+            a_path.emplace_back( a_node, index );
+            return true;
         }
     }
-    else if( a_node->m_level == a_level ) // Have reached level for insertion. Add rect, split if necessary
-    {
-        branch.m_rect   = *a_rect;
-        branch.m_child  = (Node*) a_id;
-        // Child field of leaves contains id of data record
-        return AddBranch( &branch, a_node, a_newNode );
-    }
-    else
-    {
-        // Should never occur
-        ASSERT( 0 );
-        return false;
-    }
+
+    return false;
 }
 
 
-// Insert a data rectangle into an index structure.
-// InsertRect provides for splitting the root;
-// returns 1 if root was split, 0 if it was not.
-// The level argument specifies the number of steps up from the leaf
-// level to insert; e.g. a data rectangle goes in at level = 0.
-// InsertRect2 does the recursion.
-//
+// Decide whether two rectangles overlap.
 RTREE_TEMPLATE
-bool RTREE_QUAL::InsertRect( const Rect* a_rect, const DATATYPE& a_id, Node** a_root, int a_level ) const
+bool RTREE_QUAL::Overlap( const Rect* a_rectA, const Rect* a_rectB )
 {
-    ASSERT( a_rect && a_root );
-    ASSERT( a_level >= 0 && a_level <= (*a_root)->m_level );
-#ifdef _DEBUG
+    ASSERT( a_rectA && a_rectB );
 
     for( int index = 0; index < NUMDIMS; ++index )
     {
-        ASSERT( a_rect->m_min[index] <= a_rect->m_max[index] );
-    }
-
-#endif    // _DEBUG
-
-    Node*   newRoot;
-    Node*   newNode;
-    Branch  branch;
-
-    if( InsertRectRec( a_rect, a_id, *a_root, &newNode, a_level ) ) // Root split
-    {
-        newRoot = AllocNode();                                      // Grow tree taller and new root
-        newRoot->m_level    = (*a_root)->m_level + 1;
-        branch.m_rect       = NodeCover( *a_root );
-        branch.m_child      = *a_root;
-        AddBranch( &branch, newRoot, NULL );
-        branch.m_rect   = NodeCover( newNode );
-        branch.m_child  = newNode;
-        AddBranch( &branch, newRoot, NULL );
-        *a_root = newRoot;
-        return true;
+        if( a_rectA->m_min[index] > a_rectB->m_max[index]
+            || a_rectB->m_min[index] > a_rectA->m_max[index] )
+        {
+            return false;
+        }
     }
 
-    return false;
+    return true;
 }
 
 
-// Find the smallest rectangle that includes all rectangles in branches of a node.
+// Decide whether a_inner lies completely inside a_outer.
 RTREE_TEMPLATE
-typename RTREE_QUAL::Rect RTREE_QUAL::NodeCover( Node* a_node ) const
+bool RTREE_QUAL::Contains( const Rect* a_outer, const Rect* a_inner )
 {
-    ASSERT( a_node );
-
-    bool     firstTime = true;
-    Rect    rect;
-    InitRect( &rect );
+    ASSERT( a_outer && a_inner );
 
-    for( int index = 0; index < a_node->m_count; ++index )
+    for( int index = 0; index < NUMDIMS; ++index )
     {
-        if( firstTime )
-        {
-            rect = a_node->m_branch[index].m_rect;
-            firstTime = false;
-        }
-        else
+        if( a_inner->m_min[index] < a_outer->m_min[index] || a_inner->m_max[index] > a_outer->m_max[index] )
         {
-            rect = CombineRect( &rect, &(a_node->m_branch[index].m_rect) );
+            return false;
         }
     }
 
-    return rect;
+    return true;
 }
 
 
-// Add a branch to a node.  Split the node if necessary.
-// Returns 0 if node not split.  Old node updated.
-// Returns 1 if node split, sets *new_node to address of new node.
-// Old node updated, becomes one of two.
+// Replace the rect of a branch, keeping the node layout lanes in sync.
 RTREE_TEMPLATE
-bool RTREE_QUAL::AddBranch( const Branch* a_branch, Node* a_node, Node** a_newNode ) const
+void RTREE_QUAL::SetBranchRect( Node* a_node, int a_index, const Rect& a_rect ) const
 {
-    ASSERT( a_branch );
-    ASSERT( a_node );
+    ASSERT( a_node && a_index >= 0 && a_index < a_node->m_count );
 
-    if( a_node->m_count < MAXNODES ) // Split won't be necessary
-    {
-        a_node->m_branch[a_node->m_count] = *a_branch;
-        ++a_node->m_count;
+    a_node->m_branch[a_index].m_rect = a_rect;
+    a_node->UpdateLane( a_index );
+}
 
-        return false;
-    }
-    else
-    {
-        ASSERT( a_newNode );
 
-        SplitNode( a_node, a_branch, a_newNode );
-        return true;
-    }
+// Add a node to the reinsertion list.  All its branches will later
+// be reinserted into the index structure.
+RTREE_TEMPLATE
+void RTREE_QUAL::ReInsert( Node* a_node, ListNode** a_listNode ) const
+{
+    ListNode* newListNode;
+
+    newListNode = AllocListNode();
+    newListNode->m_node = a_node;
+    newListNode->m_next = *a_listNode;
+    *a_listNode = newListNode;
 }
 
 
-// Disconnect a dependent node.
-// Caller must return (or stop using iteration index) after this as count has changed
+// Search in an index tree or subtree for all data rectangles that overlap the argument rectangle.
 RTREE_TEMPLATE
-void RTREE_QUAL::DisconnectBranch( Node* a_node, int a_index ) const
+bool RTREE_QUAL::Search( const Node* a_node, const Rect* a_rect, int& a_foundCount,
+        std::function<bool (const DATATYPE&)> a_callback ) const
 {
-    ASSERT( a_node && (a_index >= 0) && (a_index < MAXNODES) );
-    ASSERT( a_node->m_count > 0 );
+    ASSERT( a_node );
+    ASSERT( a_node->m_level >= 0 );
+    ASSERT( a_rect );
 
-    // Remove element by swapping with the last element to prevent gaps in array
-    a_node->m_branch[a_index] = a_node->m_branch[a_node->m_count - 1];
+    RTREE_COUNT( nodesVisited, 1 );
+    RTREE_COUNT( leavesTested, a_node->IsLeaf() ? 1 : 0 );
+    RTREE_COUNT( overlapTests, a_node->m_count );
 
-    --a_node->m_count;
+    if( a_node->IsInternalNode() ) // This is an internal node in the tree
+    {
+        return ForEachOverlap( a_node, a_rect,
+                               [&]( int index )
+                               {
+                                   return Search( a_node->m_branch[index].m_child, a_rect, a_foundCount,
+                                                  a_callback );
+                               } );
+    }
+    else // This is a leaf node
+    {
+        return ForEachOverlap( a_node, a_rect,
+                               [&]( int index )
+                               {
+                                   const DATATYPE& id = BranchData( a_node->m_branch[index] );
+                                   ++a_foundCount;
+
+                                   // Return false to stop searching
+                                   return !a_callback || a_callback( id );
+                               } );
+    }
 }
 
 
-// Pick a branch.  Pick the one that will need the smallest increase
-// in area to accomodate the new rectangle.  This will result in the
-// least total area for the covering rectangles in the current node.
-// In case of a tie, pick the one which was smaller before, to get
-// the best resolution when searching.
+//calculate the minimum distance between a point and a rectangle as defined by Manolopoulos et al.
+// returns Euclidean norm to ensure value fits in ELEMTYPE
 RTREE_TEMPLATE
-int RTREE_QUAL::PickBranch( const Rect* a_rect, Node* a_node ) const
+ELEMTYPE RTREE_QUAL::MinDist( const ELEMTYPE a_point[NUMDIMS], const Rect& a_rect ) const
 {
-    ASSERT( a_rect && a_node );
-
-    bool            firstTime = true;
-    ELEMTYPEREAL    increase;
-    ELEMTYPEREAL    bestIncr = (ELEMTYPEREAL) -1;
-    ELEMTYPEREAL    area;
-    ELEMTYPEREAL    bestArea = 0;
-    int             best = 0;
-    Rect            tempRect;
+    const ELEMTYPE *q, *s, *t;
+    q = a_point;
+    s = a_rect.m_min;
+    t = a_rect.m_max;
+    double minDist = 0.0;
 
-    for( int index = 0; index < a_node->m_count; ++index )
+    for( int index = 0; index < NUMDIMS; index++ )
     {
-        Rect* curRect = &a_node->m_branch[index].m_rect;
-        area        = CalcRectVolume( curRect );
-        tempRect    = CombineRect( a_rect, curRect );
-        increase    = CalcRectVolume( &tempRect ) - area;
+        ELEMTYPE r = q[index];
 
-        if( (increase < bestIncr) || firstTime )
+        if( q[index] < s[index] )
         {
-            best        = index;
-            bestArea    = area;
-            bestIncr    = increase;
-            firstTime   = false;
+            r = s[index];
         }
-        else if( (increase == bestIncr) && (area < bestArea) )
+        else if( q[index] > t[index] )
         {
-            best        = index;
-            bestArea    = area;
-            bestIncr    = increase;
+            r = t[index];
         }
+
+        double addend = q[index] - r;
+        minDist += addend * addend;
     }
 
-    return best;
+    return std::lround( std::sqrt( minDist ) );
 }
 
 
-// Combine two rectangles into larger one containing both
 RTREE_TEMPLATE
-typename RTREE_QUAL::Rect RTREE_QUAL::CombineRect( const Rect* a_rectA, const Rect* a_rectB ) const
+ELEMTYPEREAL RTREE_QUAL::MinDistSq( const ELEMTYPE a_point[NUMDIMS], const Rect& a_rect )
 {
-    ASSERT( a_rectA && a_rectB );
+    return RTreeMinDistSq<ELEMTYPEREAL, NUMDIMS>( a_point, a_rect.m_min, a_rect.m_max );
+}
 
-    Rect newRect;
+
+RTREE_TEMPLATE
+template <class COORD>
+typename RTREE_QUAL::Ray RTREE_QUAL::MakeRay( const COORD a_origin[NUMDIMS], const COORD a_direction[NUMDIMS] )
+{
+    static_assert( std::is_floating_point<ELEMTYPEREAL>::value,
+                   "Reciprocal directions truncate unless ELEMTYPEREAL is a floating point type" );
+
+    Ray ray;
+
+    for( int axis = 0; axis < NUMDIMS; ++axis )
+    {
+        ray.m_origin[axis]   = (ELEMTYPEREAL) a_origin[axis];
+        ray.m_parallel[axis] = a_direction[axis] == 0;
+        ray.m_invDir[axis]   = ray.m_parallel[axis] ? 0 : (ELEMTYPEREAL) 1 / (ELEMTYPEREAL) a_direction[axis];
+    }
+
+    return ray;
+}
+
+
+RTREE_TEMPLATE
+ELEMTYPEREAL RTREE_QUAL::MaxDistSq( const ELEMTYPE a_point[NUMDIMS], const Rect& a_rect )
+{
+    ELEMTYPEREAL maxDist = 0;
 
     for( int index = 0; index < NUMDIMS; ++index )
     {
-        newRect.m_min[index] = std::min( a_rectA->m_min[index], a_rectB->m_min[index] );
-        newRect.m_max[index] = std::max( a_rectA->m_max[index], a_rectB->m_max[index] );
+        const ELEMTYPEREAL addend = std::max( std::abs( (ELEMTYPEREAL) a_point[index] - a_rect.m_min[index] ),
+                                              std::abs( (ELEMTYPEREAL) a_rect.m_max[index] - a_point[index] ) );
+
+        maxDist += addend * addend;
     }
 
-    return newRect;
+    return maxDist;
 }
 
 
-// Split a node.
-// Divides the nodes branches and the extra one between two nodes.
-// Old node is one of the new ones, and one really new one is created.
-// Tries more than one method for choosing a partition, uses best result.
+// Slab test: the ray is inside the rect between the largest entry and the smallest exit
+// over all axes.  a_t receives the entry, clamped to the start of the ray.
 RTREE_TEMPLATE
-void RTREE_QUAL::SplitNode( Node* a_node, const Branch* a_branch, Node** a_newNode ) const
+bool RTREE_QUAL::RayEnter( const Ray& a_ray, const Rect& a_rect, ELEMTYPEREAL a_limit, ELEMTYPEREAL& a_t )
 {
-    ASSERT( a_node );
-    ASSERT( a_branch );
+    ELEMTYPEREAL enter = 0;
+    ELEMTYPEREAL leave = a_limit;
 
-    // Could just use local here, but member or external is faster since it is reused
-    PartitionVars   localVars;
-    PartitionVars*  parVars = &localVars;
-    int             level;
+    for( int axis = 0; axis < NUMDIMS; ++axis )
+    {
+        const ELEMTYPEREAL low  = (ELEMTYPEREAL) a_rect.m_min[axis] - a_ray.m_origin[axis];
+        const ELEMTYPEREAL high = (ELEMTYPEREAL) a_rect.m_max[axis] - a_ray.m_origin[axis];
 
-    // Load all the branches into a buffer, initialize old node
-    level = a_node->m_level;
-    GetBranches( a_node, a_branch, parVars );
+        if( a_ray.m_parallel[axis] )
+        {
+            if( low > 0 || high < 0 )
+                return false;
 
-    // Find partition
-    ChoosePartition( parVars, MINNODES );
+            continue;
+        }
 
-    // Put branches from buffer into 2 nodes according to chosen partition
-    *a_newNode = AllocNode();
-    (*a_newNode)->m_level = a_node->m_level = level;
-    LoadNodes( a_node, *a_newNode, parVars );
+        ELEMTYPEREAL slabEnter = low * a_ray.m_invDir[axis];
+        ELEMTYPEREAL slabLeave = high * a_ray.m_invDir[axis];
 
-    ASSERT( (a_node->m_count + (*a_newNode)->m_count) == parVars->m_total );
+        if( slabEnter > slabLeave )
+            std::swap( slabEnter, slabLeave );
+
+        enter = std::max( enter, slabEnter );
+        leave = std::min( leave, slabLeave );
+
+        if( enter > leave )
+            return false;
+    }
+
+    a_t = enter;
+    return true;
 }
 
 
-// Calculate the n-dimensional volume of a rectangle
+// Build a packed tree from the given leaf branches, level by level from the bottom up.
+// Returns the new root, the caller owns the previous one.
 RTREE_TEMPLATE
-ELEMTYPEREAL RTREE_QUAL::RectVolume( const Rect* a_rect ) const
+typename RTREE_QUAL::Node* RTREE_QUAL::PackBranches( std::vector<Branch>& a_branches,
+                                                     BulkLoadMethod       a_method ) const
 {
-    ASSERT( a_rect );
-
-    ELEMTYPEREAL volume = (ELEMTYPEREAL) 1;
+    if( a_branches.empty() )
+    {
+        Node* root = AllocNode();
+        root->m_level = 0;
+        return root;
+    }
 
-    for( int index = 0; index<NUMDIMS; ++index )
+    // Hilbert order of the leaves carries over to the parents, only the leaves need sorting.
+    // The Hilbert policy sorts by the entry keys instead, so each node holds one key range.
+    if constexpr( SPLITPOLICY::HILBERT )
     {
-        volume *= a_rect->m_max[index] - a_rect->m_min[index];
+        SortByKey( a_branches.data(), a_branches.data() + a_branches.size() );
+    }
+    else if( a_method == BulkLoadMethod::HILBERT )
+    {
+        SortHilbert( a_branches );
     }
 
-    ASSERT( volume >= (ELEMTYPEREAL) 0 );
+    std::vector<Branch> parents;
 
-    return volume;
+    for( int level = 0; ; ++level )
+    {
+        if( !SPLITPOLICY::HILBERT && a_method == BulkLoadMethod::STR )
+        {
+            SortTileRecursive( a_branches.data(), a_branches.data() + a_branches.size(), 0 );
+        }
+
+        parents.clear();
+        PackLevel( a_branches, level, parents );
+
+        if( parents.size() == 1 )
+        {
+            return parents[0].m_child;
+        }
+
+        a_branches.swap( parents );
+    }
 }
 
 
-// The exact volume of the bounding sphere for the given Rect
+// Group consecutive branches into full nodes of the given level and return a branch for each node.
+// When the last node would be underfull it shares the remainder with its neighbour.
 RTREE_TEMPLATE
-ELEMTYPEREAL RTREE_QUAL::RectSphericalVolume( const Rect* a_rect ) const
+void RTREE_QUAL::PackLevel( const std::vector<Branch>& a_branches, int a_level,
+                            std::vector<Branch>& a_parents ) const
 {
-    ASSERT( a_rect );
+    const std::size_t total     = a_branches.size();
+    const std::size_t nodeCount = ( total + MAXNODES - 1 ) / MAXNODES;
+    const std::size_t remainder = total - ( nodeCount - 1 ) * MAXNODES;
 
-    ELEMTYPEREAL sumOfSquares = (ELEMTYPEREAL) 0;
+    std::size_t next = 0;
 
-    for( int index = 0; index < NUMDIMS; ++index )
+    for( std::size_t nodeIndex = 0; nodeIndex < nodeCount; ++nodeIndex )
     {
-        ELEMTYPEREAL halfExtent =
-            ( (ELEMTYPEREAL) a_rect->m_max[index] - (ELEMTYPEREAL) a_rect->m_min[index] ) * 0.5f;
-        sumOfSquares += halfExtent * halfExtent;
+        std::size_t count = MAXNODES;
+
+        if( nodeCount > 1 && remainder < (std::size_t) MINNODES && nodeIndex >= nodeCount - 2 )
+        {
+            const std::size_t lastTwo = MAXNODES + remainder;
+            count = ( nodeIndex == nodeCount - 2 ) ? lastTwo - lastTwo / 2 : lastTwo / 2;
+        }
+
+        count = std::min( count, total - next );
+
+        Node* node = AllocNode();
+        node->m_level = a_level;
+
+        for( std::size_t index = 0; index < count; ++index )
+        {
+            AddBranch( &a_branches[next++], node, NULL );
+        }
+
+        a_parents.push_back( ChildBranch( node ) );
     }
 
-    // Pow maybe slow, so test for common dims like 2,3 and just use x*x, x*x*x.
-    if( NUMDIMS == 2 )
+    ASSERT( next == total );
+}
+
+
+// Sort-Tile-Recursive: sort by the first axis, cut into slabs holding a whole number of nodes,
+// then tile each slab along the remaining axes.
+RTREE_TEMPLATE
+void RTREE_QUAL::SortTileRecursive( Branch* a_first, Branch* a_last, int a_axis ) const
+{
+    const std::size_t count = a_last - a_first;
+
+    // Compare centres, the factor 1/2 does not change the order
+    std::sort( a_first, a_last,
+               [a_axis]( const Branch& a_branchA, const Branch& a_branchB )
+               {
+                   return (ELEMTYPEREAL) a_branchA.m_rect.m_min[a_axis] + a_branchA.m_rect.m_max[a_axis]
+                          < (ELEMTYPEREAL) a_branchB.m_rect.m_min[a_axis] + a_branchB.m_rect.m_max[a_axis];
+               } );
+
+    if( a_axis == NUMDIMS - 1 || count <= (std::size_t) MAXNODES )
     {
-        return sumOfSquares * m_unitSphereVolume;
+        return;
     }
-    else if( NUMDIMS == 3 )
-    {
-        ELEMTYPEREAL radius = (ELEMTYPEREAL) std::sqrt( sumOfSquares );
 
-        return radius * radius * radius * m_unitSphereVolume;
-    }
-    else
-    {
-        ELEMTYPEREAL radius = (ELEMTYPEREAL) std::sqrt( sumOfSquares );
+    const std::size_t pages = ( count + MAXNODES - 1 ) / MAXNODES;
+    const std::size_t slabs =
+            (std::size_t) std::ceil( std::pow( (double) pages, 1.0 / ( NUMDIMS - a_axis ) ) );
+    const std::size_t slabSize = MAXNODES * ( ( pages + slabs - 1 ) / slabs );
 
-        return (ELEMTYPEREAL) (std::pow( radius, NUMDIMS ) * m_unitSphereVolume);
+    for( std::size_t start = 0; start < count; start += slabSize )
+    {
+        SortTileRecursive( a_first + start, a_first + std::min( start + slabSize, count ), a_axis + 1 );
     }
 }
 
 
-// Use one of the methods to calculate retangle volume
+// Sort branches by their keys, the order PickBranchHilbert relies on
 RTREE_TEMPLATE
-ELEMTYPEREAL RTREE_QUAL::CalcRectVolume( const Rect* a_rect ) const
+void RTREE_QUAL::SortByKey( Branch* a_first, Branch* a_last )
 {
-#ifdef RTREE_USE_SPHERICAL_VOLUME
-    return RectSphericalVolume( a_rect );   // Slower but helps certain merge cases
-#else                                       // RTREE_USE_SPHERICAL_VOLUME
-    return RectVolume( a_rect );            // Faster but can cause poor merges
-#endif                                      // RTREE_USE_SPHERICAL_VOLUME
+    if constexpr( SPLITPOLICY::HILBERT )
+    {
+        std::sort( a_first, a_last,
+                   []( const Branch& a_branchA, const Branch& a_branchB )
+                   {
+                       return a_branchA.m_key < a_branchB.m_key;
+                   } );
+    }
 }
 
 
-// Load branch buffer with branches from full node plus the extra branch.
+// Sort branches along the Hilbert curve through the centres of their rects
 RTREE_TEMPLATE
-void RTREE_QUAL::GetBranches( Node* a_node, const Branch* a_branch, PartitionVars* a_parVars ) const
+void RTREE_QUAL::SortHilbert( std::vector<Branch>& a_branches ) const
 {
-    ASSERT( a_node );
-    ASSERT( a_branch );
-
-    ASSERT( a_node->m_count == MAXNODES );
+    Rect bounds = a_branches[0].m_rect;
 
-    // Load the branch buffer
-    for( int index = 0; index < MAXNODES; ++index )
+    for( const Branch& branch : a_branches )
     {
-        a_parVars->m_branchBuf[index] = a_node->m_branch[index];
+        bounds = CombineRect( &bounds, &branch.m_rect );
     }
 
-    a_parVars->m_branchBuf[MAXNODES] = *a_branch;
-    a_parVars->m_branchCount = MAXNODES + 1;
-
-    // Calculate rect containing all in the set
-    a_parVars->m_coverSplit = a_parVars->m_branchBuf[0].m_rect;
+    std::vector<std::pair<uint64_t, Branch>> keyed;
+    keyed.reserve( a_branches.size() );
 
-    for( int index = 1; index < MAXNODES + 1; ++index )
+    for( const Branch& branch : a_branches )
     {
-        a_parVars->m_coverSplit =
-            CombineRect( &a_parVars->m_coverSplit, &a_parVars->m_branchBuf[index].m_rect );
+        keyed.emplace_back( HilbertKey( branch.m_rect, bounds ), branch );
     }
 
-    a_parVars->m_coverSplitArea = CalcRectVolume( &a_parVars->m_coverSplit );
+    std::sort( keyed.begin(), keyed.end(),
+               []( const std::pair<uint64_t, Branch>& a_keyA, const std::pair<uint64_t, Branch>& a_keyB )
+               {
+                   return a_keyA.first < a_keyB.first;
+               } );
 
-    InitNode( a_node );
+    for( std::size_t index = 0; index < keyed.size(); ++index )
+    {
+        a_branches[index] = keyed[index].second;
+    }
 }
 
 
-// Method #0 for choosing a partition:
-// As the seeds for the two groups, pick the two rects that would waste the
-// most area if covered by a single rectangle, i.e. evidently the worst pair
-// to have in the same group.
-// Of the remaining, one at a time is chosen to be put in one of the two groups.
-// The one chosen is the one with the greatest difference in area expansion
-// depending on which group - the rect most strongly attracted to one group
-// and repelled from the other.
-// If one group gets too full (more would force other group to violate min
-// fill requirement) then other group gets the rest.
-// These last are the ones that can go in either group most easily.
+// Hilbert value of the centre of a_rect, quantised to a grid spanning a_bounds.
+// Each axis gets 64 / NUMDIMS bits of resolution, at most 32.
 RTREE_TEMPLATE
-void RTREE_QUAL::ChoosePartition( PartitionVars* a_parVars, int a_minFill ) const
+uint64_t RTREE_QUAL::HilbertKey( const Rect& a_rect, const Rect& a_bounds )
 {
-    ASSERT( a_parVars );
-
-    ELEMTYPEREAL    biggestDiff;
-    int             group, chosen = 0, betterGroup = 0;
+    constexpr int      BITS = std::min( 32, 64 / NUMDIMS );
+    constexpr double   CELLS = (double) ( ( uint64_t( 1 ) << BITS ) - 1 );
 
-    InitParVars( a_parVars, a_parVars->m_branchCount, a_minFill );
-    PickSeeds( a_parVars );
+    uint32_t coord[NUMDIMS];
 
-    while( ( (a_parVars->m_count[0] + a_parVars->m_count[1]) < a_parVars->m_total )
-           && ( a_parVars->m_count[0] < (a_parVars->m_total - a_parVars->m_minFill) )
-           && ( a_parVars->m_count[1] < (a_parVars->m_total - a_parVars->m_minFill) ) )
+    for( int axis = 0; axis < NUMDIMS; ++axis )
     {
-        biggestDiff = (ELEMTYPEREAL) -1;
+        const double extent = (double) a_bounds.m_max[axis] - (double) a_bounds.m_min[axis];
+        const double centre = 0.5 * ( (double) a_rect.m_min[axis] + (double) a_rect.m_max[axis] );
 
-        for( int index = 0; index<a_parVars->m_total; ++index )
-        {
-            if( !a_parVars->m_taken[index] )
-            {
-                const Rect*     curRect = &a_parVars->m_branchBuf[index].m_rect;
-                const Rect      rect0   = CombineRect( curRect, &a_parVars->m_cover[0] );
-                const Rect      rect1   = CombineRect( curRect, &a_parVars->m_cover[1] );
-                ELEMTYPEREAL    growth0 = CalcRectVolume( &rect0 ) - a_parVars->m_area[0];
-                ELEMTYPEREAL    growth1 = CalcRectVolume( &rect1 ) - a_parVars->m_area[1];
-                ELEMTYPEREAL    diff    = growth1 - growth0;
+        coord[axis] = extent > 0 ? (uint32_t) ( ( centre - a_bounds.m_min[axis] ) / extent * CELLS ) : 0;
+    }
 
-                if( diff >= 0 )
-                {
-                    group = 0;
-                }
-                else
-                {
-                    group = 1;
-                    diff  = -diff;
-                }
+    return HilbertIndex( coord );
+}
 
-                if( diff > biggestDiff )
-                {
-                    biggestDiff = diff;
-                    chosen = index;
-                    betterGroup = group;
-                }
-                else if( (diff == biggestDiff)
-                         && (a_parVars->m_count[group] < a_parVars->m_count[betterGroup]) )
-                {
-                    chosen = index;
-                    betterGroup = group;
-                }
-            }
-        }
 
-        Classify( chosen, betterGroup, a_parVars );
-    }
+// Hilbert value of the centre of a_rect without a bounding grid, for keys that must stay fixed
+// while the tree grows.  Each coordinate is mapped to the order preserving integer image of its
+// double and the top 32 bits are kept: sign, exponent and 20 bits of mantissa, so cells are fine
+// near the origin and coarse far from it.  Three dimensions would leave 21 bits and only 9 of
+// mantissa, too few to tell nearby entries apart.  The sign bit comes first, so every axis
+// splits the curve at zero and entries on either side of it never share a key range.
+RTREE_TEMPLATE
+uint64_t RTREE_QUAL::HilbertKey( const Rect& a_rect )
+{
+    static_assert( NUMDIMS <= 2, "RTreeHilbertSplit keys are too coarse above two dimensions" );
 
-    // If one group too full, put remaining rects in the other
-    if( (a_parVars->m_count[0] + a_parVars->m_count[1]) < a_parVars->m_total )
+    constexpr int BITS = std::min( 32, 64 / NUMDIMS );
+
+    uint32_t coord[NUMDIMS];
+
+    for( int axis = 0; axis < NUMDIMS; ++axis )
     {
-        if( a_parVars->m_count[0] >= a_parVars->m_total - a_parVars->m_minFill )
-        {
-            group = 1;
-        }
-        else
-        {
-            group = 0;
-        }
+        const double centre = 0.5 * ( (double) a_rect.m_min[axis] + (double) a_rect.m_max[axis] );
+        uint64_t     bits;
 
-        for( int index = 0; index<a_parVars->m_total; ++index )
-        {
-            if( !a_parVars->m_taken[index] )
-            {
-                Classify( index, group, a_parVars );
-            }
-        }
+        std::memcpy( &bits, &centre, sizeof( bits ) );
+        bits = ( bits >> 63 ) ? ~bits : ( bits | ( uint64_t( 1 ) << 63 ) );
+        coord[axis] = (uint32_t) ( bits >> ( 64 - BITS ) );
     }
 
-    ASSERT( (a_parVars->m_count[0] + a_parVars->m_count[1]) == a_parVars->m_total );
-    ASSERT( (a_parVars->m_count[0] >= a_parVars->m_minFill)
-            && (a_parVars->m_count[1] >= a_parVars->m_minFill) );
+    return HilbertIndex( coord );
 }
 
 
-// Copy branches from the buffer into two nodes according to the partition.
+// Position of a grid cell along the Hilbert curve.
+// Uses the transpose form from J. Skilling, "Programming the Hilbert curve" (2004), which works for
+// any number of dimensions.
 RTREE_TEMPLATE
-void RTREE_QUAL::LoadNodes( Node* a_nodeA, Node* a_nodeB, PartitionVars* a_parVars ) const
+uint64_t RTREE_QUAL::HilbertIndex( uint32_t a_coord[NUMDIMS] )
 {
-    ASSERT( a_nodeA );
-    ASSERT( a_nodeB );
-    ASSERT( a_parVars );
+    constexpr int BITS = std::min( 32, 64 / NUMDIMS );
 
-    for( int index = 0; index < a_parVars->m_total; ++index )
+    uint32_t* coord = a_coord;
+
+    // Inverse undo
+    for( uint32_t q = uint32_t( 1 ) << ( BITS - 1 ); q > 1; q >>= 1 )
     {
-        ASSERT( a_parVars->m_partition[index] == 0 || a_parVars->m_partition[index] == 1 );
+        const uint32_t p = q - 1;
 
-        if( a_parVars->m_partition[index] == 0 )
-        {
-            AddBranch( &a_parVars->m_branchBuf[index], a_nodeA, NULL );
-        }
-        else if( a_parVars->m_partition[index] == 1 )
+        for( int axis = 0; axis < NUMDIMS; ++axis )
         {
-            AddBranch( &a_parVars->m_branchBuf[index], a_nodeB, NULL );
+            if( coord[axis] & q )
+            {
+                coord[0] ^= p;
+            }
+            else
+            {
+                const uint32_t t = ( coord[0] ^ coord[axis] ) & p;
+                coord[0] ^= t;
+                coord[axis] ^= t;
+            }
         }
     }
-}
 
+    // Gray encode
+    for( int axis = 1; axis < NUMDIMS; ++axis )
+    {
+        coord[axis] ^= coord[axis - 1];
+    }
 
-// Initialize a PartitionVars structure.
-RTREE_TEMPLATE
-void RTREE_QUAL::InitParVars( PartitionVars* a_parVars, int a_maxRects, int a_minFill ) const
-{
-    ASSERT( a_parVars );
+    uint32_t t = 0;
 
-    a_parVars->m_count[0]   = a_parVars->m_count[1] = 0;
-    a_parVars->m_area[0]    = a_parVars->m_area[1] = (ELEMTYPEREAL) 0;
-    a_parVars->m_total      = a_maxRects;
-    a_parVars->m_minFill    = a_minFill;
+    for( uint32_t q = uint32_t( 1 ) << ( BITS - 1 ); q > 1; q >>= 1 )
+    {
+        if( coord[NUMDIMS - 1] & q )
+        {
+            t ^= q - 1;
+        }
+    }
 
-    for( int index = 0; index < a_maxRects; ++index )
+    // Interleave the transposed bits, most significant first
+    uint64_t key = 0;
+
+    for( int bit = BITS - 1; bit >= 0; --bit )
     {
-        a_parVars->m_taken[index]       = false;
-        a_parVars->m_partition[index]   = -1;
+        for( int axis = 0; axis < NUMDIMS; ++axis )
+        {
+            key = ( key << 1 ) | ( ( ( coord[axis] ^ t ) >> bit ) & 1 );
+        }
     }
+
+    return key;
 }
 
 
 RTREE_TEMPLATE
-void RTREE_QUAL::PickSeeds( PartitionVars* a_parVars ) const
+typename RTREE_QUAL::CompactStats RTREE_QUAL::Compact( int a_budget, double a_maxBadness )
 {
-    int             seed0 = 0, seed1 = 0;
-    ELEMTYPEREAL    worst, waste;
-    ELEMTYPEREAL    area[MAXNODES + 1];
+    CompactStats stats = CompactStats();
 
-    for( int index = 0; index<a_parVars->m_total; ++index )
+    if( m_root->IsLeaf() )
     {
-        area[index] = CalcRectVolume( &a_parVars->m_branchBuf[index].m_rect );
+        m_compactCursor.clear();
+        stats.sweepDone = true;
+        return stats;
     }
 
-    worst = -a_parVars->m_coverSplitArea - 1;
+    // Node and the child being walked, -1 before the node is visited.  Only nodes above level 0
+    // are visited, their children are what gets repacked.  The tree may have changed since the
+    // cursor was saved; a stale index just resumes the sweep somewhere else.
+    std::vector<std::pair<Node*, int>> stack;
+    Node*                              node = m_root;
 
-    for( int indexA = 0; indexA < a_parVars->m_total - 1; ++indexA )
+    for( int next : m_compactCursor )
     {
-        for( int indexB = indexA + 1; indexB < a_parVars->m_total; ++indexB )
+        stack.emplace_back( node, next );
+
+        if( node->m_level < 2 || next < 0 || next >= node->m_count )
+            break;
+
+        node = node->m_branch[next].m_child;
+    }
+
+    if( stack.empty() )
+        stack.emplace_back( m_root, -1 );
+
+    while( !stack.empty() && a_budget > 0 )
+    {
+        node = stack.back().first;
+        int& next = stack.back().second;
+
+        if( next < 0 )
         {
-            Rect oneRect = CombineRect( &a_parVars->m_branchBuf[indexA].m_rect,
-                                        &a_parVars->m_branchBuf[indexB].m_rect );
-            waste = CalcRectVolume( &oneRect ) - area[indexA] - area[indexB];
+            ++stats.nodesVisited;
+            --a_budget;
 
-            if( waste >= worst )
+            if( NodeBadness( node ) > a_maxBadness )
             {
-                worst   = waste;
-                seed0   = indexA;
-                seed1   = indexB;
+                const int moved = RepackGroup( node, a_budget );
+
+                stats.groupsRepacked += moved > 0;
+                stats.entriesMoved += moved;
+                a_budget -= moved;
             }
+
+            next = 0;
+        }
+        else
+        {
+            ++next;
         }
+
+        if( node->m_level >= 2 && next < node->m_count )
+            stack.emplace_back( node->m_branch[next].m_child, -1 );
+        else
+            stack.pop_back();
     }
 
-    Classify( seed0, 0, a_parVars );
-    Classify( seed1, 1, a_parVars );
+    m_compactCursor.clear();
+
+    for( const auto& entry : stack )
+        m_compactCursor.push_back( entry.second );
+
+    stats.sweepDone = stack.empty();
+
+    return stats;
 }
 
 
-// Put a branch in one of the groups.
+// How much a node would gain from repacking its children: the area they share with each other
+// relative to the node, plus the share of children beyond the fewest that could hold its
+// entries.  Each term lies in [0, 1]; the overlap is capped since the pairwise sum counts an area
+// covered by several children more than once.  Dead space is left out, packing barely changes it
+// at this scale.  A node whose children were just repacked scores near zero.
 RTREE_TEMPLATE
-void RTREE_QUAL::Classify( int a_index, int a_group, PartitionVars* a_parVars ) const
+double RTREE_QUAL::NodeBadness( Node* a_node ) const
 {
-    ASSERT( a_parVars );
-    ASSERT( !a_parVars->m_taken[a_index] );
+    const double area = (double) RectArea( NodeCover( a_node ) );
+    const int    fewest = TileCount( a_node->m_entryCount, a_node->m_level );
+    const double slack = (double) std::max( a_node->m_count - fewest, 0 ) / a_node->m_count;
 
-    a_parVars->m_partition[a_index] = a_group;
-    a_parVars->m_taken[a_index]     = true;
+    double overlap = 0;
 
-    if( a_parVars->m_count[a_group] == 0 )
-    {
-        a_parVars->m_cover[a_group] = a_parVars->m_branchBuf[a_index].m_rect;
-    }
-    else
+    for( int index = 0; index < a_node->m_count; ++index )
     {
-        a_parVars->m_cover[a_group] = CombineRect( &a_parVars->m_branchBuf[a_index].m_rect,
-                                                   &a_parVars->m_cover[a_group] );
+        for( int other = index + 1; other < a_node->m_count; ++other )
+        {
+            overlap += (double) OverlapArea( &a_node->m_branch[index].m_rect, &a_node->m_branch[other].m_rect );
+        }
     }
 
-    a_parVars->m_area[a_group] = CalcRectVolume( &a_parVars->m_cover[a_group] );
-    ++a_parVars->m_count[a_group];
+    if( area <= 0 )
+        return slack;
+
+    return std::min( overlap / area, 1.0 ) + slack;
 }
 
 
-// Delete a data rectangle from an index structure.
-// Pass in a pointer to a Rect, the tid of the record, ptr to ptr to root node.
-// Returns 1 if record not found, 0 if success.
-// RemoveRect provides for eliminating the root.
+// Rebuild a group of the node's children, all of them if the budget allows, otherwise the child
+// sharing most volume with its siblings and the siblings closest to it.  Returns the number of
+// entries moved, zero if no group of two or more fits the budget.
 RTREE_TEMPLATE
-bool RTREE_QUAL::RemoveRect( const Rect* a_rect, const DATATYPE& a_id, Node** a_root ) const
+int RTREE_QUAL::RepackGroup( Node* a_node, int a_budget ) const
 {
-    ASSERT( a_rect && a_root );
-    ASSERT( *a_root );
+    ASSERT( a_node->IsInternalNode() );
 
-    Node*       tempNode;
-    ListNode*   reInsertList = NULL;
+    bool member[MAXNODES] = {};
+    int  memberCount = 0;
+    int  entryCount = 0;
 
-    if( !RemoveRectRec( a_rect, a_id, *a_root, &reInsertList ) )
+    if( a_node->m_entryCount <= a_budget )
     {
-        // Found and deleted a data item
-        // Reinsert any branches from eliminated nodes
-        while( reInsertList )
+        std::fill( member, member + a_node->m_count, true );
+        memberCount = a_node->m_count;
+        entryCount = a_node->m_entryCount;
+    }
+    else
+    {
+        int    seed = -1;
+        double seedOverlap = -1;
+
+        for( int index = 0; index < a_node->m_count; ++index )
         {
-            tempNode = reInsertList->m_node;
+            if( a_node->m_branch[index].m_child->m_entryCount > a_budget )
+                continue;
 
-            for( int index = 0; index < tempNode->m_count; ++index )
+            double overlap = 0;
+
+            for( int other = 0; other < a_node->m_count; ++other )
             {
-                InsertRect( &(tempNode->m_branch[index].m_rect),
-                            tempNode->m_branch[index].m_data,
-                            a_root,
-                            tempNode->m_level );
+                if( other != index )
+                {
+                    overlap += (double) OverlapArea( &a_node->m_branch[index].m_rect,
+                                                       &a_node->m_branch[other].m_rect );
+                }
             }
 
-            ListNode* remLNode = reInsertList;
-            reInsertList = reInsertList->m_next;
+            if( overlap > seedOverlap )
+            {
+                seed = index;
+                seedOverlap = overlap;
+            }
+        }
 
-            FreeNode( remLNode->m_node );
-            FreeListNode( remLNode );
+        if( seed < 0 )
+            return 0;
+
+        const Rect& seedRect = a_node->m_branch[seed].m_rect;
+        double      distance[MAXNODES];
+        bool        tried[MAXNODES] = {};
+
+        for( int index = 0; index < a_node->m_count; ++index )
+        {
+            const Rect& rect = a_node->m_branch[index].m_rect;
+
+            distance[index] = 0;
+
+            for( int axis = 0; axis < NUMDIMS; ++axis )
+            {
+                const double delta = ( (double) rect.m_min[axis] + rect.m_max[axis] )
+                                     - ( (double) seedRect.m_min[axis] + seedRect.m_max[axis] );
+                distance[index] += delta * delta;
+            }
         }
 
-        // Check for redundant root (not leaf, 1 child) and eliminate
-        if( (*a_root)->m_count == 1 && (*a_root)->IsInternalNode() )
+        // Closest centres first, the seed itself at distance zero
+        for( int round = 0; round < a_node->m_count; ++round )
         {
-            tempNode = (*a_root)->m_branch[0].m_child;
+            int nearest = -1;
 
-            ASSERT( tempNode );
-            FreeNode( *a_root );
-            *a_root = tempNode;
+            for( int index = 0; index < a_node->m_count; ++index )
+            {
+                if( !tried[index] && ( nearest < 0 || distance[index] < distance[nearest] ) )
+                    nearest = index;
+            }
+
+            tried[nearest] = true;
+
+            const int childEntries = a_node->m_branch[nearest].m_child->m_entryCount;
+
+            if( entryCount + childEntries <= a_budget )
+            {
+                member[nearest] = true;
+                ++memberCount;
+                entryCount += childEntries;
+            }
         }
+    }
 
-        return false;
+    if( memberCount < 2 )
+        return 0;
+
+    // Take the group out, keeping the other branches
+    Branch              kept[MAXNODES];
+    int                 keptCount = 0;
+    std::vector<Branch> entries;
+
+    entries.reserve( entryCount );
+
+    for( int index = 0; index < a_node->m_count; ++index )
+    {
+        if( member[index] )
+            CollectEntriesRec( a_node->m_branch[index].m_child, entries );
+        else
+            kept[keptCount++] = a_node->m_branch[index];
     }
-    else
+
+    a_node->m_count = 0;
+    a_node->m_entryCount = 0;
+
+    for( int index = 0; index < keptCount; ++index )
     {
-        return true;
+        AddBranch( &kept[index], a_node, NULL );
     }
-}
 
+    // As few subtrees as hold the entries, but not so few the node drops below its minimum
+    const int         childLevel = a_node->m_level - 1;
+    const std::size_t capacity = LevelCapacity( childLevel, MAXNODES );
+    const int         minCount = ( a_node == m_root ) ? 2 : MINNODES;
 
-// Delete a rectangle from non-root part of an index structure.
-// Called by RemoveRect.  Descends tree recursively,
-// merges branches on the way back up.
-// Returns 1 if record not found, 0 if success.
-RTREE_TEMPLATE
-bool RTREE_QUAL::RemoveRectRec( const Rect*     a_rect,
-                                const DATATYPE& a_id,
-                                Node*           a_node,
-                                ListNode**      a_listNode ) const
-{
-    ASSERT( a_rect && a_node && a_listNode );
-    ASSERT( a_node->m_level >= 0 );
+    int tiles = (int) ( entries.size() / capacity + ( entries.size() % capacity != 0 ) );
+    tiles = std::max( tiles, minCount - keptCount );
+    tiles = std::min( std::min( tiles, memberCount ), (int) entries.size() );
 
-    if( a_node->IsInternalNode() ) // not a leaf node
-    {
-        for( int index = 0; index < a_node->m_count; ++index )
-        {
-            if( Overlap( a_rect, &(a_node->m_branch[index].m_rect) ) )
-            {
-                if( !RemoveRectRec( a_rect, a_id, a_node->m_branch[index].m_child, a_listNode ) )
-                {
-                    if( a_node->m_branch[index].m_child->m_count >= MINNODES )
-                    {
-                        // child removed, just resize parent rect
-                        a_node->m_branch[index].m_rect =
-                            NodeCover( a_node->m_branch[index].m_child );
-                    }
-                    else
-                    {
-                        // child removed, not enough entries in node, eliminate node
-                        ReInsert( a_node->m_branch[index].m_child, a_listNode );
-                        DisconnectBranch( a_node, index ); // Must return after this call as count has changed
-                    }
+    std::vector<Branch*> ends;
+    Branch*              first = entries.data();
 
-                    return false;
-                }
-            }
-        }
+    PartitionTiles( first, first + entries.size(), tiles, 0, ends );
 
-        return true;
-    }
-    else // A leaf node
+    for( Branch* last : ends )
     {
-        for( int index = 0; index < a_node->m_count; ++index )
-        {
-            if( a_node->m_branch[index].m_child == (Node*) a_id )
-            {
-                DisconnectBranch( a_node, index ); // Must return after this call as count has changed
-                return false;
-            }
-        }
+        Branch branch = ChildBranch( BuildTopDown( first, last, childLevel ) );
+        AddBranch( &branch, a_node, NULL );
+        first = last;
+    }
 
-        return true;
+    return entryCount;
+}
+
+
+// Append the data branches under a node and free the node and everything below it.
+RTREE_TEMPLATE
+void RTREE_QUAL::CollectEntriesRec( Node* a_node, std::vector<Branch>& a_entries ) const
+{
+    for( int index = 0; index < a_node->m_count; ++index )
+    {
+        if( a_node->IsInternalNode() )
+            CollectEntriesRec( a_node->m_branch[index].m_child, a_entries );
+        else
+            a_entries.push_back( a_node->m_branch[index] );
     }
+
+    FreeNode( a_node );
 }
 
 
-// Decide whether two rectangles overlap.
+// Packed subtree of exactly the given level, built top-down: the entries are tiled into as
+// many children as they need and each tile becomes a subtree one level lower.  Unlike the
+// bottom-up PackBranches the height is fixed, so the subtree can take the place of another.
+// The entries must fit, at most MAXNODES^(level + 1), and every node gets at least MINNODES
+// branches when there are MINNODES^(level + 1) entries or more.
 RTREE_TEMPLATE
-bool RTREE_QUAL::Overlap( const Rect* a_rectA, const Rect* a_rectB )
+typename RTREE_QUAL::Node* RTREE_QUAL::BuildTopDown( Branch* a_first, Branch* a_last, int a_level ) const
 {
-    ASSERT( a_rectA && a_rectB );
+    Node* node = AllocNode();
+    node->m_level = a_level;
 
-    for( int index = 0; index < NUMDIMS; ++index )
+    if( a_level == 0 )
     {
-        if( a_rectA->m_min[index] > a_rectB->m_max[index]
-            || a_rectB->m_min[index] > a_rectA->m_max[index] )
+        ASSERT( a_last - a_first <= MAXNODES );
+
+        for( ; a_first != a_last; ++a_first )
         {
-            return false;
+            AddBranch( a_first, node, NULL );
         }
+
+        return node;
     }
 
-    return true;
+    std::vector<Branch*> ends;
+
+    PartitionTiles( a_first, a_last, TileCount( a_last - a_first, a_level ), 0, ends );
+
+    for( Branch* last : ends )
+    {
+        Branch branch = ChildBranch( BuildTopDown( a_first, last, a_level - 1 ) );
+        AddBranch( &branch, node, NULL );
+        a_first = last;
+    }
+
+    return node;
 }
 
 
-// Add a node to the reinsertion list.  All its branches will later
-// be reinserted into the index structure.
+// Children of a packed node at a_level holding a_entries: enough to fit them, and MINNODES if
+// the entries can fill that many without leaving a child underfull.
 RTREE_TEMPLATE
-void RTREE_QUAL::ReInsert( Node* a_node, ListNode** a_listNode ) const
+int RTREE_QUAL::TileCount( std::size_t a_entries, int a_level ) const
 {
-    ListNode* newListNode;
+    const std::size_t capacity = LevelCapacity( a_level - 1, MAXNODES );
+    const std::size_t minimum  = LevelCapacity( a_level - 1, MINNODES );
 
-    newListNode = AllocListNode();
-    newListNode->m_node = a_node;
-    newListNode->m_next = *a_listNode;
-    *a_listNode = newListNode;
+    std::size_t tiles = a_entries / capacity + ( a_entries % capacity != 0 );
+    tiles = std::max( tiles, std::min( (std::size_t) MINNODES, std::max<std::size_t>( a_entries / minimum, 1 ) ) );
+
+    return (int) std::min( tiles, a_entries );
 }
 
 
-// Search in an index tree or subtree for all data rectangles that overlap the argument rectangle.
+// Split the branches into a_tiles runs of equal size, give or take one, in the manner of
+// Sort-Tile-Recursive: slabs along the first axis, each tiled along the remaining ones.
+// Under the Hilbert policy the runs follow the entry keys instead, so that siblings keep
+// disjoint key ranges.  Appends the end of every run to a_ends.
 RTREE_TEMPLATE
-bool RTREE_QUAL::Search( const Node* a_node, const Rect* a_rect, int& a_foundCount,
-        std::function<bool (const DATATYPE&)> a_callback ) const
+void RTREE_QUAL::PartitionTiles( Branch* a_first, Branch* a_last, int a_tiles, int a_axis,
+                                 std::vector<Branch*>& a_ends ) const
 {
-    ASSERT( a_node );
-    ASSERT( a_node->m_level >= 0 );
-    ASSERT( a_rect );
+    const std::size_t count = a_last - a_first;
 
-    if( a_node->IsInternalNode() ) // This is an internal node in the tree
+    if( a_tiles == 1 )
     {
-        for( int index = 0; index < a_node->m_count; ++index )
+        a_ends.push_back( a_last );
+        return;
+    }
+
+    if constexpr( SPLITPOLICY::HILBERT )
+    {
+        SortByKey( a_first, a_last );
+
+        for( int tile = 0; tile < a_tiles; ++tile )
         {
-            if( Overlap( a_rect, &a_node->m_branch[index].m_rect ) )
-            {
-                if( !Search( a_node->m_branch[index].m_child, a_rect, a_foundCount, a_callback ) )
-                {
-                    return false; // Don't continue searching
-                }
-            }
+            a_ends.push_back( a_first + count * ( tile + 1 ) / a_tiles );
         }
+
+        return;
     }
-    else // This is a leaf node
+
+    std::sort( a_first, a_last,
+               [a_axis]( const Branch& a_branchA, const Branch& a_branchB )
+               {
+                   return (ELEMTYPEREAL) a_branchA.m_rect.m_min[a_axis] + a_branchA.m_rect.m_max[a_axis]
+                          < (ELEMTYPEREAL) a_branchB.m_rect.m_min[a_axis] + a_branchB.m_rect.m_max[a_axis];
+               } );
+
+    // Tile t gets count / a_tiles entries, the first count % a_tiles one more
+    const std::size_t base = count / a_tiles;
+    const std::size_t extra = count % a_tiles;
+
+    if( a_axis == NUMDIMS - 1 )
     {
-        for( int index = 0; index < a_node->m_count; ++index )
+        for( int tile = 0; tile < a_tiles; ++tile )
         {
-            if( Overlap( a_rect, &a_node->m_branch[index].m_rect ) )
-            {
-                DATATYPE& id = a_node->m_branch[index].m_data;
-                ++a_foundCount;
-
-                if( a_callback && !a_callback( id ) )
-                {
-                    return false; // Don't continue searching
-                }
-            }
+            a_first += base + ( (std::size_t) tile < extra );
+            a_ends.push_back( a_first );
         }
+
+        return;
     }
 
-    return true; // Continue searching
+    const int slabs = std::min( a_tiles, (int) std::ceil( std::pow( (double) a_tiles, 1.0 / ( NUMDIMS - a_axis ) ) ) );
+    int       firstTile = 0;
+
+    for( int slab = 0; slab < slabs; ++slab )
+    {
+        const int slabTiles = a_tiles / slabs + ( slab < a_tiles % slabs );
+        const int lastTile = firstTile + slabTiles;
+
+        std::size_t slabSize = slabTiles * base;
+        slabSize += std::max( 0, std::min( (int) extra, lastTile ) - std::min( (int) extra, firstTile ) );
+
+        PartitionTiles( a_first, a_first + slabSize, slabTiles, a_axis + 1, a_ends );
+
+        a_first += slabSize;
+        firstTile = lastTile;
+    }
 }
 
 
-//calculate the minimum distance between a point and a rectangle as defined by Manolopoulos et al.
-// returns Euclidean norm to ensure value fits in ELEMTYPE
+// a_fanout^(a_level + 1), the entries under a node of a_level with a_fanout branches in every
+// node, saturating instead of overflowing
 RTREE_TEMPLATE
-ELEMTYPE RTREE_QUAL::MinDist( const ELEMTYPE a_point[NUMDIMS], const Rect& a_rect ) const
+std::size_t RTREE_QUAL::LevelCapacity( int a_level, int a_fanout )
 {
-    const ELEMTYPE *q, *s, *t;
-    q = a_point;
-    s = a_rect.m_min;
-    t = a_rect.m_max;
-    double minDist = 0.0;
+    std::size_t capacity = a_fanout;
 
-    for( int index = 0; index < NUMDIMS; index++ )
+    for( int level = 0; level < a_level; ++level )
     {
-        int r = q[index];
-
-        if( q[index] < s[index] )
-        {
-            r = s[index];
-        }
-        else if( q[index] > t[index] )
-        {
-            r = t[index];
-        }
+        if( capacity > std::numeric_limits<std::size_t>::max() / a_fanout )
+            return std::numeric_limits<std::size_t>::max();
 
-        double addend = q[index] - r;
-        minDist += addend * addend;
+        capacity *= a_fanout;
     }
 
-    return std::lround( std::sqrt( minDist ) );
+    return capacity;
 }
 
 
@@ -2011,5 +6274,6 @@ ELEMTYPE RTREE_QUAL::MinDist( const ELEMTYPE a_point[NUMDIMS], const Rect& a_rec
 #undef RTREE_QUAL
 #undef RTREE_SEARCH_TEMPLATE
 #undef RTREE_SEARCH_QUAL
+#undef RTREE_COUNT
 
 #endif    // RTREE_H
@@ -0,0 +1,388 @@
+#ifndef RTREE_CONCURRENT_H
+#define RTREE_CONCURRENT_H
+
+// RTree for one writer at a time and any number of readers that never take a lock.
+//
+// Published nodes are never changed.  A writer copies the nodes on the path it changes, edits
+// the copies and publishes the new root with one atomic store, so a reader walks either the old
+// tree or the new one, never a mix.  Nodes replaced by a publish are retired to an epoch domain
+// and freed once no reader that might still be walking the old tree is left.
+
+#include "rtree_pathcopy.h"
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+
+/// \class RTreeEpochDomain
+/// Epoch based reclamation for readers of lock-free structures.  A reader pins the current epoch
+/// for the length of its traversal; memory retired at epoch E may be freed once every pinned
+/// epoch is greater than E.
+class RTreeEpochDomain
+{
+public:
+    static constexpr int      SLOTS = 128;          ///< Readers that can be pinned at the same time
+    static constexpr uint64_t IDLE  = UINT64_MAX;   ///< Slot not pinned
+
+    /// Pins the current epoch while in scope
+    class Guard
+    {
+    public:
+        explicit Guard( RTreeEpochDomain& a_domain );
+
+        ~Guard()
+        {
+            m_slot->store( IDLE, std::memory_order_release );
+        }
+
+        Guard( const Guard& ) = delete;
+        Guard& operator=( const Guard& ) = delete;
+
+    private:
+        std::atomic<uint64_t>* m_slot;
+    };
+
+    /// Start a new epoch
+    /// \return The epoch that ended, the one to tag memory retired before the call with
+    uint64_t Advance()
+    {
+        return m_epoch.fetch_add( 1 );
+    }
+
+    /// Smallest epoch pinned by a reader, IDLE if there is none
+    uint64_t OldestPinned() const
+    {
+        uint64_t oldest = IDLE;
+
+        for( const Slot& slot : m_slots )
+        {
+            oldest = std::min( oldest, slot.m_epoch.load() );
+        }
+
+        return oldest;
+    }
+
+private:
+    struct alignas( 64 ) Slot
+    {
+        std::atomic<uint64_t> m_epoch{ IDLE };
+    };
+
+    Slot                  m_slots[SLOTS];   ///< One cache line each, readers do not share them
+    std::atomic<uint64_t> m_epoch{ 1 };
+};
+
+
+inline RTreeEpochDomain::Guard::Guard( RTreeEpochDomain& a_domain )
+{
+    // Every thread starts probing at its own slot, so readers rarely contend for one
+    static thread_local const size_t start = std::hash<std::thread::id>()( std::this_thread::get_id() );
+
+    for( size_t probe = 0; ; ++probe )
+    {
+        Slot&    slot = a_domain.m_slots[( start + probe ) % SLOTS];
+        uint64_t idle = IDLE;
+
+        // The epoch may have moved on before the slot is taken, which only keeps more memory alive
+        if( slot.m_epoch.compare_exchange_strong( idle, a_domain.m_epoch.load() ) )
+        {
+            m_slot = &slot.m_epoch;
+            return;
+        }
+
+        if( probe % SLOTS == SLOTS - 1 )
+            std::this_thread::yield();
+    }
+}
+
+
+/// Node state RTreeConcurrent keeps next to the branches
+struct RTreeConcurrentNodeBase
+{
+    uint64_t m_writeStamp;                          ///< Write that created the node, only it may change the node
+};
+
+
+#define RTREE_CONCURRENT_TEMPLATE template <class DATATYPE, class ELEMTYPE, int NUMDIMS, class ELEMTYPEREAL, \
+    int TMAXNODES, int TMINNODES>
+#define RTREE_CONCURRENT_QUAL     RTreeConcurrent<DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL, TMAXNODES, TMINNODES>
+
+
+/// \class RTreeConcurrent
+/// RTree whose Search and Count may run on any thread while Insert and Remove run on others.
+/// Writers are serialised by a mutex but never wait for readers; readers take no lock and see
+/// the tree as last published when their call started.
+///
+/// DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL, TMAXNODES and TMINNODES as for RTree.  DATATYPE
+/// needs to be copyable and comparable, it is kept next to the child pointer in every branch.
+/// Splits use the R* choice of axis and distribution.
+template <class DATATYPE, class ELEMTYPE, int NUMDIMS, class ELEMTYPEREAL = ELEMTYPE, int TMAXNODES = 8,
+          int TMINNODES = TMAXNODES / 2>
+class RTreeConcurrent : public RTreePathCopy<RTreeConcurrent<DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL, TMAXNODES,
+                                                             TMINNODES>,
+                                             RTreeConcurrentNodeBase, DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL,
+                                             TMAXNODES, TMINNODES>
+{
+    typedef RTreePathCopy<RTreeConcurrent, RTreeConcurrentNodeBase, DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL,
+                          TMAXNODES, TMINNODES> PathCopy;
+
+    friend PathCopy;
+
+public:
+    typedef typename PathCopy::Rect Rect;
+
+    RTreeConcurrent();
+
+    /// No reader or writer may be running
+    ~RTreeConcurrent();
+
+    RTreeConcurrent( const RTreeConcurrent& ) = delete;
+    RTreeConcurrent& operator=( const RTreeConcurrent& ) = delete;
+
+    /// Insert entry, visible to readers starting after the call returns
+    void Insert( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS], const DATATYPE& a_dataId );
+
+    /// Remove entry
+    /// \return true if record not found, false if success, as RTree::Remove
+    bool Remove( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS], const DATATYPE& a_dataId );
+
+    /// Remove all entries from tree
+    void RemoveAll();
+
+    /// Find all within search rectangle, in the tree as published when the call started
+    /// \param a_visitor functor bool( const DATATYPE& ).  Return 'true' to continue searching
+    /// \return Returns the number of entries found
+    template <class VISITOR>
+    int Search( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS], VISITOR&& a_visitor ) const;
+
+    /// Count the data elements in the tree as published when the call started
+    int Count() const;
+
+    /// Nodes replaced by writers and not freed yet, because a reader may still be walking them
+    size_t RetiredCount() const;
+
+protected:
+    typedef typename PathCopy::Node   Node;
+    typedef typename PathCopy::Branch Branch;
+
+    Node*   NewNode( int a_level );
+    Node*   Writable( const Node* a_node );
+    void    Drop( const Node* a_node );
+    void    Retire( const Node* a_node );
+    void    Publish( const Node* a_root );
+    void    DeleteRec( const Node* a_node );
+
+    std::atomic<const Node*>    m_root;         ///< Published root, read by everyone
+    mutable RTreeEpochDomain    m_epochs;
+
+    // Owned by the writer holding m_writeMutex
+    mutable std::mutex                              m_writeMutex;
+    uint64_t                                        m_writeStamp;   ///< Current write, see Node::m_writeStamp
+    std::vector<const Node*>                        m_replaced;     ///< Nodes the current write replaced
+    std::deque<std::pair<uint64_t, const Node*>>    m_retired;      ///< Replaced nodes by retire epoch, oldest first
+};
+
+
+RTREE_CONCURRENT_TEMPLATE
+RTREE_CONCURRENT_QUAL::RTreeConcurrent() : m_writeStamp( 0 )
+{
+    m_root.store( NewNode( 0 ) );
+}
+
+
+RTREE_CONCURRENT_TEMPLATE
+RTREE_CONCURRENT_QUAL::~RTreeConcurrent()
+{
+    DeleteRec( m_root.load() );
+
+    for( const auto& retired : m_retired )
+    {
+        delete retired.second;
+    }
+}
+
+
+RTREE_CONCURRENT_TEMPLATE
+void RTREE_CONCURRENT_QUAL::Insert( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS],
+                                    const DATATYPE& a_dataId )
+{
+    std::lock_guard<std::mutex> lock( m_writeMutex );
+
+    ++m_writeStamp;
+    Publish( this->InsertBranch( m_root.load(), PathCopy::DataBranch( a_min, a_max, a_dataId ) ) );
+}
+
+
+RTREE_CONCURRENT_TEMPLATE
+bool RTREE_CONCURRENT_QUAL::Remove( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS],
+                                    const DATATYPE& a_dataId )
+{
+    std::lock_guard<std::mutex> lock( m_writeMutex );
+
+    Rect rect;
+    std::copy( a_min, a_min + NUMDIMS, rect.m_min );
+    std::copy( a_max, a_max + NUMDIMS, rect.m_max );
+
+    ++m_writeStamp;
+
+    bool        found;
+    const Node* root = this->RemoveBranch( m_root.load(), rect, a_dataId, found );
+
+    if( !found )
+        return true;
+
+    Publish( root );
+
+    return false;
+}
+
+
+RTREE_CONCURRENT_TEMPLATE
+void RTREE_CONCURRENT_QUAL::RemoveAll()
+{
+    std::lock_guard<std::mutex> lock( m_writeMutex );
+
+    ++m_writeStamp;
+    Drop( m_root.load() );
+    Publish( NewNode( 0 ) );
+}
+
+
+RTREE_CONCURRENT_TEMPLATE
+template <class VISITOR>
+int RTREE_CONCURRENT_QUAL::Search( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS],
+                                   VISITOR&& a_visitor ) const
+{
+    Rect rect;
+    std::copy( a_min, a_min + NUMDIMS, rect.m_min );
+    std::copy( a_max, a_max + NUMDIMS, rect.m_max );
+
+    RTreeEpochDomain::Guard guard( m_epochs );
+
+    int foundCount = 0;
+    PathCopy::SearchRec( m_root.load(), rect, a_visitor, foundCount );
+
+    return foundCount;
+}
+
+
+RTREE_CONCURRENT_TEMPLATE
+int RTREE_CONCURRENT_QUAL::Count() const
+{
+    RTreeEpochDomain::Guard guard( m_epochs );
+
+    return m_root.load()->m_entryCount;
+}
+
+
+RTREE_CONCURRENT_TEMPLATE
+size_t RTREE_CONCURRENT_QUAL::RetiredCount() const
+{
+    std::lock_guard<std::mutex> lock( m_writeMutex );
+
+    return m_retired.size();
+}
+
+
+RTREE_CONCURRENT_TEMPLATE
+typename RTREE_CONCURRENT_QUAL::Node* RTREE_CONCURRENT_QUAL::NewNode( int a_level )
+{
+    Node* node = new Node();
+    node->m_count      = 0;
+    node->m_level      = a_level;
+    node->m_entryCount = 0;
+    node->m_writeStamp = m_writeStamp;
+    return node;
+}
+
+
+// A node the current write may change: nodes it created itself are changed in place, published
+// ones are copied and the original is replaced.
+RTREE_CONCURRENT_TEMPLATE
+typename RTREE_CONCURRENT_QUAL::Node* RTREE_CONCURRENT_QUAL::Writable( const Node* a_node )
+{
+    if( a_node->m_writeStamp == m_writeStamp )
+        return const_cast<Node*>( a_node );
+
+    Node* copy = new Node( *a_node );
+    copy->m_writeStamp = m_writeStamp;
+    m_replaced.push_back( a_node );
+    return copy;
+}
+
+
+// Retire a subtree the current write no longer links to
+RTREE_CONCURRENT_TEMPLATE
+void RTREE_CONCURRENT_QUAL::Drop( const Node* a_node )
+{
+    if( a_node->IsInternalNode() )
+    {
+        for( int index = 0; index < a_node->m_count; ++index )
+        {
+            Drop( a_node->m_branch[index].m_child );
+        }
+    }
+
+    Retire( a_node );
+}
+
+
+// Readers cannot have seen a node created by this write, only published ones have to wait
+RTREE_CONCURRENT_TEMPLATE
+void RTREE_CONCURRENT_QUAL::Retire( const Node* a_node )
+{
+    if( a_node->m_writeStamp == m_writeStamp )
+        delete a_node;
+    else
+        m_replaced.push_back( a_node );
+}
+
+
+// Make a_root visible to readers, then free what no reader can reach any more
+RTREE_CONCURRENT_TEMPLATE
+void RTREE_CONCURRENT_QUAL::Publish( const Node* a_root )
+{
+    m_root.store( a_root );
+
+    // A reader pinned at this epoch or earlier may have loaded the old root
+    const uint64_t epoch = m_epochs.Advance();
+
+    for( const Node* node : m_replaced )
+    {
+        m_retired.emplace_back( epoch, node );
+    }
+
+    m_replaced.clear();
+
+    const uint64_t oldest = m_epochs.OldestPinned();
+
+    while( !m_retired.empty() && m_retired.front().first < oldest )
+    {
+        delete m_retired.front().second;
+        m_retired.pop_front();
+    }
+}
+
+
+RTREE_CONCURRENT_TEMPLATE
+void RTREE_CONCURRENT_QUAL::DeleteRec( const Node* a_node )
+{
+    if( a_node->IsInternalNode() )
+    {
+        for( int index = 0; index < a_node->m_count; ++index )
+        {
+            DeleteRec( a_node->m_branch[index].m_child );
+        }
+    }
+
+    delete a_node;
+}
+
+
+#undef RTREE_CONCURRENT_TEMPLATE
+#undef RTREE_CONCURRENT_QUAL
+
+#endif    // RTREE_CONCURRENT_H
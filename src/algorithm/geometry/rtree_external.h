@@ -0,0 +1,875 @@
+#ifndef RTREE_EXTERNAL_H
+#define RTREE_EXTERNAL_H
+
+// Bulk build of a packed RTree in the mapped file format from more records than fit in memory.
+//
+// The input is a flat file of Record.  A first pass finds the bounds of the data.  The records
+// are then sorted by the Hilbert key of their centre with an external merge sort: chunks that
+// fit the memory budget are sorted and written as runs, and the runs are merged, several at a
+// time, until one merge pass can feed the tree.  Leaves are packed full from the sorted stream
+// and every level is written straight into its place in the output file; the covers of its
+// nodes go to a scratch file that the level above reads back.  Nothing but the current chunk
+// or the merge buffers is ever held in memory, so a file of any size opens with RTreeMappedView.
+
+#include "rtree.h"
+#include "rtree_mapped.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+
+
+#define RTREE_EXTERNAL_TEMPLATE template <class DATATYPE, class ELEMTYPE, int NUMDIMS, class ELEMTYPEREAL, \
+    int TMAXNODES>
+#define RTREE_EXTERNAL_QUAL     RTreeExternalBuilder<DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL, TMAXNODES>
+
+
+/// \class RTreeExternalBuilder
+/// Writes a file for RTreeMappedView from a file of records, in bounded memory.
+///
+/// DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL as for RTree.  TMAXNODES is the number of branches
+/// per node, every node but the last of each level is full.
+template <class DATATYPE, class ELEMTYPE, int NUMDIMS, class ELEMTYPEREAL = ELEMTYPE, int TMAXNODES = 8>
+class RTreeExternalBuilder
+{
+public:
+    typedef RTreeMappedView<DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL> View;
+    typedef RTree<DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL, TMAXNODES> Tree;
+    typedef typename Tree::Rect Rect;
+
+    /// Input record, the input file is an array of them in the byte order of this machine
+    struct Record
+    {
+        ELEMTYPE m_min[NUMDIMS];
+        ELEMTYPE m_max[NUMDIMS];
+        DATATYPE m_data;
+    };
+
+    /// Steps of Build, in order
+    enum class Phase
+    {
+        SCAN,       ///< Reading the input for its bounds, counts records
+        SORT,       ///< Sorting chunks into runs, counts records
+        MERGE,      ///< Merging runs into longer runs, counts records of the current pass
+        PACK,       ///< Writing the levels, counts nodes
+        CHECKSUM,   ///< Reading the output back for its checksum, counts bytes
+        COUNT
+    };
+
+    struct Progress {
+        Phase    phase;
+        uint64_t done;
+        uint64_t total;
+    };
+
+    struct BuildStats {
+        uint64_t records;
+        uint64_t nodeCount;
+        int      height;
+        int      runs;                                  ///< Sorted runs written, 1 if the input fit in memory
+        int      mergePasses;                           ///< Passes over the runs, 0 if the input fit in memory
+        uint64_t bytesRead;                             ///< Input, runs and scratch levels read
+        uint64_t bytesWritten;                          ///< Runs, scratch levels and the output written
+        double   seconds;
+        double   phaseSeconds[(int) Phase::COUNT];
+        double   readMBps;                              ///< bytesRead over the whole build
+        double   writeMBps;                             ///< bytesWritten over the whole build
+    };
+
+    /// \param a_memoryBytes Budget for the sort chunk and the merge buffers, which is what the
+    /// build holds at its peak.  The fixed per file buffers of stdio come on top.
+    /// \param a_tempPrefix Runs and scratch levels are written to this prefix plus a suffix,
+    /// empty to use the output file name
+    explicit RTreeExternalBuilder( size_t a_memoryBytes = size_t( 256 ) << 20,
+                                   const std::string& a_tempPrefix = std::string() );
+
+    /// Called at the start and end of each phase and every PROGRESS_STEP units in between
+    void SetProgress( std::function<void( const Progress& )> a_callback )
+    {
+        m_progress = std::move( a_callback );
+    }
+
+    /// Sort a_inputFile and write the packed tree to a_outputFile.  Scratch files are removed.
+    /// \return false if a file could not be read or written, or the input is not a whole
+    /// number of records
+    bool Build( const char* a_inputFile, const char* a_outputFile );
+
+    /// Stats of the last Build
+    const BuildStats& GetStats() const { return m_stats; }
+
+    enum
+    {
+        PROGRESS_STEP = 1 << 16,
+        MIN_MERGE_BUFFER = 256     ///< Keyed records per run buffer, bounds the merge fan-in
+    };
+
+protected:
+    typedef typename View::Header Header;
+    typedef typename View::Node   ViewNode;
+    typedef typename View::Branch ViewBranch;
+
+    struct Keyed
+    {
+        uint64_t m_key;
+        Record   m_record;
+    };
+
+    /// Buffered reader of one run
+    struct RunReader
+    {
+        FILE*               m_file;
+        std::vector<Keyed>  m_buffer;
+        size_t              m_size;         ///< Records in m_buffer
+        size_t              m_next;
+    };
+
+    /// k-way merge of runs, pulled one record at a time
+    struct Merge
+    {
+        std::vector<RunReader>                   m_readers;
+        std::vector<std::pair<uint64_t, size_t>> m_heap;    ///< Key and reader of each head, min-heap
+        bool                                     m_failed;
+    };
+
+    /// Node and branch counts of every level, leaves first
+    struct Shape
+    {
+        std::vector<uint64_t> m_nodes;
+        std::vector<uint64_t> m_branches;
+        std::vector<uint64_t> m_firstNode;      ///< Breadth first index of the level's first node
+        std::vector<uint64_t> m_firstBranch;    ///< Index of the level's first branch
+    };
+
+    static Shape    ComputeShape( uint64_t a_records );
+    static bool     Seek( FILE* a_file, uint64_t a_offset );
+    static uint64_t FileSize( FILE* a_file );
+
+    bool            Scan( FILE* a_input, uint64_t a_records, Rect& a_bounds );
+    bool            MakeRuns( FILE* a_input, uint64_t a_records, const Rect& a_bounds,
+                              std::vector<Keyed>& a_chunk, std::vector<std::string>& a_runs );
+    bool            MergePass( std::vector<std::string>& a_runs, size_t a_fanIn );
+
+    bool            OpenMerge( Merge& a_merge, const std::vector<std::string>& a_runs, size_t a_first,
+                               size_t a_count );
+    bool            NextMerged( Merge& a_merge, Keyed& a_keyed );
+    bool            Refill( RunReader& a_reader );
+    static void     CloseMerge( Merge& a_merge );
+
+    template <class NEXT>
+    bool            WriteLevel( int a_level, const Shape& a_shape, const Header& a_header, FILE* a_nodes,
+                                FILE* a_branches, FILE* a_covers, NEXT&& a_next );
+    bool            WriteLevels( const Shape& a_shape, Header& a_header, const char* a_outputFile,
+                                 const std::vector<Keyed>& a_chunk, const std::vector<std::string>& a_runs );
+    bool            WriteChecksum( const char* a_outputFile, Header& a_header );
+
+    size_t          Read( void* a_data, size_t a_size, size_t a_count, FILE* a_file );
+    bool            Write( const void* a_data, size_t a_size, size_t a_count, FILE* a_file );
+    std::string     TempName( const char* a_kind );
+    void            Report( Phase a_phase, uint64_t a_done, uint64_t a_total, bool a_force = false );
+    void            EndPhase( Phase a_phase );
+
+    size_t                                  m_memoryBytes;
+    std::string                             m_tempPrefix;
+    std::string                             m_prefix;           ///< m_tempPrefix or the output name
+    int                                     m_tempCount;        ///< Scratch files named so far
+    std::function<void( const Progress& )>  m_progress;
+    uint64_t                                m_lastReport;       ///< done of the last Report
+    std::chrono::steady_clock::time_point   m_phaseStart;
+    BuildStats                              m_stats;
+};
+
+
+RTREE_EXTERNAL_TEMPLATE
+RTREE_EXTERNAL_QUAL::RTreeExternalBuilder( size_t a_memoryBytes, const std::string& a_tempPrefix ) :
+        m_memoryBytes( a_memoryBytes ),
+        m_tempPrefix( a_tempPrefix ),
+        m_tempCount( 0 ),
+        m_lastReport( 0 ),
+        m_stats()
+{
+}
+
+
+RTREE_EXTERNAL_TEMPLATE
+bool RTREE_EXTERNAL_QUAL::Build( const char* a_inputFile, const char* a_outputFile )
+{
+    static_assert( std::is_trivially_copyable<DATATYPE>::value, "Records are read as raw bytes" );
+    static_assert( TMAXNODES > 1 && TMAXNODES <= 0xffff, "Node counts are stored in 16 bits" );
+
+    const auto start = std::chrono::steady_clock::now();
+
+    m_stats = BuildStats();
+    m_prefix = m_tempPrefix.empty() ? std::string( a_outputFile ) : m_tempPrefix;
+    m_tempCount = 0;
+    m_phaseStart = start;
+
+    FILE* input = std::fopen( a_inputFile, "rb" );
+
+    if( !input )
+        return false;
+
+    const uint64_t inputBytes = FileSize( input );
+    const uint64_t records = inputBytes / sizeof( Record );
+    const Shape    shape = ComputeShape( records );
+
+    m_stats.records = records;
+    m_stats.height = (int) shape.m_nodes.size();
+
+    // Everything but the checksum is known from the record count
+    Header header;
+
+    std::memset( &header, 0, sizeof( header ) );
+    std::memcpy( header.m_magic, "RTREEMAP", sizeof( header.m_magic ) );
+    header.m_version    = Header::VERSION;
+    header.m_byteOrder  = Header::ORDER_MARK;
+    header.m_dataSize   = sizeof( DATATYPE );
+    header.m_elemSize   = sizeof( ELEMTYPE );
+    header.m_elemFloat  = std::is_floating_point<ELEMTYPE>::value;
+    header.m_numDims    = NUMDIMS;
+    header.m_height     = (uint32_t) shape.m_nodes.size();
+    header.m_itemCount  = records;
+
+    for( size_t level = 0; level < shape.m_nodes.size(); ++level )
+    {
+        header.m_nodeCount += shape.m_nodes[level];
+        header.m_branchCount += shape.m_branches[level];
+    }
+
+    auto alignUp = []( uint64_t a_offset )
+    {
+        return ( a_offset + Header::ALIGNMENT - 1 ) & ~uint64_t( Header::ALIGNMENT - 1 );
+    };
+
+    header.m_nodeOffset   = alignUp( sizeof( Header ) );
+    header.m_branchOffset = alignUp( header.m_nodeOffset + header.m_nodeCount * sizeof( ViewNode ) );
+    header.m_fileSize     = header.m_branchOffset + header.m_branchCount * sizeof( ViewBranch );
+    m_stats.nodeCount     = header.m_nodeCount;
+
+    // The view indexes branches and queues nodes with 32 bits
+    if( inputBytes % sizeof( Record ) || header.m_branchCount > 0xffffffffull
+        || header.m_nodeCount > 0xffffffffull )
+    {
+        std::fclose( input );
+        return false;
+    }
+
+    Rect                     bounds;
+    std::vector<Keyed>       chunk;
+    std::vector<std::string> runs;
+    bool                     result = Scan( input, records, bounds )
+                                      && MakeRuns( input, records, bounds, chunk, runs );
+
+    std::fclose( input );
+
+    // Merge down to as many runs as one pass can take, the last pass feeds the leaves
+    const size_t fanIn = std::max<size_t>( 2, m_memoryBytes / ( sizeof( Keyed ) * MIN_MERGE_BUFFER ) );
+
+    while( result && runs.size() > fanIn )
+    {
+        result = MergePass( runs, fanIn );
+    }
+
+    EndPhase( Phase::MERGE );
+
+    if( !runs.empty() )
+        ++m_stats.mergePasses;
+
+    result = result && WriteLevels( shape, header, a_outputFile, chunk, runs );
+
+    for( const std::string& run : runs )
+        std::remove( run.c_str() );
+
+    result = result && WriteChecksum( a_outputFile, header );
+
+    if( !result )
+        std::remove( a_outputFile );
+
+    m_stats.seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+    if( m_stats.seconds > 0 )
+    {
+        m_stats.readMBps = m_stats.bytesRead / m_stats.seconds / 1e6;
+        m_stats.writeMBps = m_stats.bytesWritten / m_stats.seconds / 1e6;
+    }
+
+    return result;
+}
+
+
+// Levels of a packed tree over a_records entries, leaves first.  The root level has one node,
+// an empty tree is a single empty leaf.
+RTREE_EXTERNAL_TEMPLATE
+typename RTREE_EXTERNAL_QUAL::Shape RTREE_EXTERNAL_QUAL::ComputeShape( uint64_t a_records )
+{
+    Shape    shape;
+    uint64_t branches = a_records;
+
+    do
+    {
+        const uint64_t nodes = std::max<uint64_t>( 1, ( branches + TMAXNODES - 1 ) / TMAXNODES );
+
+        shape.m_nodes.push_back( nodes );
+        shape.m_branches.push_back( branches );
+        branches = nodes;
+    } while( branches > 1 );
+
+    // Breadth first, the root level comes first in the file
+    const size_t height = shape.m_nodes.size();
+
+    shape.m_firstNode.assign( height, 0 );
+    shape.m_firstBranch.assign( height, 0 );
+
+    for( size_t level = height - 1; level-- > 0; )
+    {
+        shape.m_firstNode[level] = shape.m_firstNode[level + 1] + shape.m_nodes[level + 1];
+        shape.m_firstBranch[level] = shape.m_firstBranch[level + 1] + shape.m_branches[level + 1];
+    }
+
+    return shape;
+}
+
+
+RTREE_EXTERNAL_TEMPLATE
+bool RTREE_EXTERNAL_QUAL::Seek( FILE* a_file, uint64_t a_offset )
+{
+#ifdef _WIN32
+    return _fseeki64( a_file, (__int64) a_offset, SEEK_SET ) == 0;
+#else
+    return fseeko( a_file, (off_t) a_offset, SEEK_SET ) == 0;
+#endif
+}
+
+
+// Size in bytes, the file is left at its start
+RTREE_EXTERNAL_TEMPLATE
+uint64_t RTREE_EXTERNAL_QUAL::FileSize( FILE* a_file )
+{
+    if( std::fseek( a_file, 0, SEEK_END ) != 0 )
+        return 0;
+
+#ifdef _WIN32
+    const int64_t size = _ftelli64( a_file );
+#else
+    const int64_t size = (int64_t) ftello( a_file );
+#endif
+
+    Seek( a_file, 0 );
+    return size > 0 ? (uint64_t) size : 0;
+}
+
+
+// Bounds of the record centres, the grid of the Hilbert keys
+RTREE_EXTERNAL_TEMPLATE
+bool RTREE_EXTERNAL_QUAL::Scan( FILE* a_input, uint64_t a_records, Rect& a_bounds )
+{
+    Report( Phase::SCAN, 0, a_records, true );
+
+    for( int axis = 0; axis < NUMDIMS; ++axis )
+    {
+        a_bounds.m_min[axis] = std::numeric_limits<ELEMTYPE>::max();
+        a_bounds.m_max[axis] = std::numeric_limits<ELEMTYPE>::lowest();
+    }
+
+    Record record;
+
+    for( uint64_t index = 0; index < a_records; ++index )
+    {
+        if( Read( &record, sizeof( Record ), 1, a_input ) != 1 )
+            return false;
+
+        for( int axis = 0; axis < NUMDIMS; ++axis )
+        {
+            a_bounds.m_min[axis] = std::min( a_bounds.m_min[axis], record.m_min[axis] );
+            a_bounds.m_max[axis] = std::max( a_bounds.m_max[axis], record.m_max[axis] );
+        }
+
+        Report( Phase::SCAN, index + 1, a_records );
+    }
+
+    Report( Phase::SCAN, a_records, a_records, true );
+    EndPhase( Phase::SCAN );
+    return Seek( a_input, 0 );
+}
+
+
+// Sort chunks of the memory budget by key.  If the whole input is one chunk it stays in
+// a_chunk, otherwise every chunk is written as a run and a_chunk is released.
+RTREE_EXTERNAL_TEMPLATE
+bool RTREE_EXTERNAL_QUAL::MakeRuns( FILE* a_input, uint64_t a_records, const Rect& a_bounds,
+                                    std::vector<Keyed>& a_chunk, std::vector<std::string>& a_runs )
+{
+    const uint64_t chunkRecords = std::max<uint64_t>( 1, m_memoryBytes / sizeof( Keyed ) );
+    uint64_t       done = 0;
+
+    Report( Phase::SORT, 0, a_records, true );
+    a_chunk.reserve( (size_t) std::min( chunkRecords, a_records ) );
+
+    while( done < a_records )
+    {
+        const uint64_t count = std::min( chunkRecords, a_records - done );
+
+        a_chunk.resize( (size_t) count );
+
+        for( Keyed& keyed : a_chunk )
+        {
+            if( Read( &keyed.m_record, sizeof( Record ), 1, a_input ) != 1 )
+                return false;
+
+            Rect rect;
+
+            std::copy( keyed.m_record.m_min, keyed.m_record.m_min + NUMDIMS, rect.m_min );
+            std::copy( keyed.m_record.m_max, keyed.m_record.m_max + NUMDIMS, rect.m_max );
+            keyed.m_key = Tree::HilbertKey( rect, a_bounds );
+        }
+
+        std::sort( a_chunk.begin(), a_chunk.end(),
+                   []( const Keyed& a_keyedA, const Keyed& a_keyedB )
+                   {
+                       return a_keyedA.m_key < a_keyedB.m_key;
+                   } );
+
+        done += count;
+        ++m_stats.runs;
+        Report( Phase::SORT, done, a_records );
+
+        if( done == count && done == a_records )
+            break;          // Fits in memory, pack straight from the chunk
+
+        a_runs.push_back( TempName( "run" ) );
+
+        FILE* run = std::fopen( a_runs.back().c_str(), "wb" );
+
+        if( !run )
+            return false;
+
+        const bool written = Write( a_chunk.data(), sizeof( Keyed ), a_chunk.size(), run );
+
+        if( std::fclose( run ) != 0 || !written )
+            return false;
+    }
+
+    if( a_records == 0 )
+        m_stats.runs = 1;
+
+    if( !a_runs.empty() )
+        std::vector<Keyed>().swap( a_chunk );
+
+    Report( Phase::SORT, a_records, a_records, true );
+    EndPhase( Phase::SORT );
+    return true;
+}
+
+
+// Merge groups of a_fanIn runs into longer ones, replacing a_runs
+RTREE_EXTERNAL_TEMPLATE
+bool RTREE_EXTERNAL_QUAL::MergePass( std::vector<std::string>& a_runs, size_t a_fanIn )
+{
+    std::vector<std::string> merged;
+    uint64_t                 done = 0;
+    bool                     result = true;
+
+    Report( Phase::MERGE, 0, m_stats.records, true );
+
+    for( size_t first = 0; result && first < a_runs.size(); first += a_fanIn )
+    {
+        Merge merge;
+
+        merged.push_back( TempName( "run" ) );
+
+        FILE* output = std::fopen( merged.back().c_str(), "wb" );
+
+        result = output && OpenMerge( merge, a_runs, first, std::min( a_fanIn, a_runs.size() - first ) );
+
+        Keyed keyed;
+
+        while( result && NextMerged( merge, keyed ) )
+        {
+            result = Write( &keyed, sizeof( Keyed ), 1, output );
+            Report( Phase::MERGE, ++done, m_stats.records );
+        }
+
+        result = result && !merge.m_failed;
+        CloseMerge( merge );
+
+        if( output )
+            result = std::fclose( output ) == 0 && result;
+    }
+
+    for( const std::string& run : a_runs )
+        std::remove( run.c_str() );
+
+    a_runs.swap( merged );
+    ++m_stats.mergePasses;
+
+    Report( Phase::MERGE, m_stats.records, m_stats.records, true );
+    return result;
+}
+
+
+// Open a_count runs from a_first with a share of the memory budget each
+RTREE_EXTERNAL_TEMPLATE
+bool RTREE_EXTERNAL_QUAL::OpenMerge( Merge& a_merge, const std::vector<std::string>& a_runs, size_t a_first,
+                                     size_t a_count )
+{
+    const size_t bufferRecords = std::max<size_t>( 1, m_memoryBytes / ( a_count * sizeof( Keyed ) ) );
+
+    a_merge.m_failed = false;
+    a_merge.m_readers.resize( a_count );
+    a_merge.m_heap.clear();
+
+    for( size_t index = 0; index < a_count; ++index )
+    {
+        RunReader& reader = a_merge.m_readers[index];
+
+        reader.m_file = std::fopen( a_runs[a_first + index].c_str(), "rb" );
+        reader.m_buffer.resize( bufferRecords );
+        reader.m_size = 0;
+        reader.m_next = 0;
+
+        if( !reader.m_file || !Refill( reader ) )
+        {
+            a_merge.m_failed = true;
+            return false;
+        }
+
+        if( reader.m_size > 0 )
+            a_merge.m_heap.emplace_back( reader.m_buffer[0].m_key, index );
+    }
+
+    std::make_heap( a_merge.m_heap.begin(), a_merge.m_heap.end(), std::greater<std::pair<uint64_t, size_t>>() );
+    return true;
+}
+
+
+// Next record in key order, false once all runs are drained or on a read error
+RTREE_EXTERNAL_TEMPLATE
+bool RTREE_EXTERNAL_QUAL::NextMerged( Merge& a_merge, Keyed& a_keyed )
+{
+    const auto greater = std::greater<std::pair<uint64_t, size_t>>();
+
+    if( a_merge.m_heap.empty() || a_merge.m_failed )
+        return false;
+
+    std::pop_heap( a_merge.m_heap.begin(), a_merge.m_heap.end(), greater );
+
+    RunReader& reader = a_merge.m_readers[a_merge.m_heap.back().second];
+
+    a_keyed = reader.m_buffer[reader.m_next++];
+
+    if( reader.m_next == reader.m_size && !Refill( reader ) )
+    {
+        a_merge.m_failed = true;
+        return false;
+    }
+
+    if( reader.m_next < reader.m_size )
+    {
+        a_merge.m_heap.back().first = reader.m_buffer[reader.m_next].m_key;
+        std::push_heap( a_merge.m_heap.begin(), a_merge.m_heap.end(), greater );
+    }
+    else
+    {
+        a_merge.m_heap.pop_back();
+    }
+
+    return true;
+}
+
+
+RTREE_EXTERNAL_TEMPLATE
+bool RTREE_EXTERNAL_QUAL::Refill( RunReader& a_reader )
+{
+    a_reader.m_size = Read( a_reader.m_buffer.data(), sizeof( Keyed ), a_reader.m_buffer.size(), a_reader.m_file );
+    a_reader.m_next = 0;
+    return !std::ferror( a_reader.m_file );
+}
+
+
+RTREE_EXTERNAL_TEMPLATE
+void RTREE_EXTERNAL_QUAL::CloseMerge( Merge& a_merge )
+{
+    for( RunReader& reader : a_merge.m_readers )
+    {
+        if( reader.m_file )
+            std::fclose( reader.m_file );
+
+        reader.m_file = NULL;
+    }
+}
+
+
+// Write the nodes of one level and their branches at their place in the output, pulling each
+// branch from a_next( ViewBranch& ).  The cover of every node is appended to a_covers for the
+// level above, unless it is NULL.
+RTREE_EXTERNAL_TEMPLATE
+template <class NEXT>
+bool RTREE_EXTERNAL_QUAL::WriteLevel( int a_level, const Shape& a_shape, const Header& a_header, FILE* a_nodes,
+                                      FILE* a_branches, FILE* a_covers, NEXT&& a_next )
+{
+    if( !Seek( a_nodes, a_header.m_nodeOffset + a_shape.m_firstNode[a_level] * sizeof( ViewNode ) )
+        || !Seek( a_branches, a_header.m_branchOffset + a_shape.m_firstBranch[a_level] * sizeof( ViewBranch ) ) )
+    {
+        return false;
+    }
+
+    uint64_t remaining = a_shape.m_branches[a_level];
+    uint64_t written = 0;
+
+    for( int level = 0; level < a_level; ++level )
+    {
+        written += a_shape.m_nodes[level];
+    }
+
+    for( uint64_t index = 0; index < a_shape.m_nodes[a_level]; ++index )
+    {
+        ViewNode   node;
+        ViewBranch branches[TMAXNODES];
+        Rect       cover = Rect();
+
+        node.m_firstBranch = (uint32_t) ( a_shape.m_firstBranch[a_level] + index * TMAXNODES );
+        node.m_count       = (uint16_t) std::min<uint64_t>( TMAXNODES, remaining );
+        node.m_level       = (uint16_t) a_level;
+        remaining -= node.m_count;
+
+        // Padding of the union is checksummed, keep it zero
+        std::memset( (void*) branches, 0, sizeof( branches ) );
+
+        for( int branch = 0; branch < node.m_count; ++branch )
+        {
+            if( !a_next( branches[branch] ) )
+                return false;
+
+            for( int axis = 0; axis < NUMDIMS; ++axis )
+            {
+                cover.m_min[axis] = branch ? std::min( cover.m_min[axis], branches[branch].m_min[axis] )
+                                           : branches[branch].m_min[axis];
+                cover.m_max[axis] = branch ? std::max( cover.m_max[axis], branches[branch].m_max[axis] )
+                                           : branches[branch].m_max[axis];
+            }
+        }
+
+        if( !Write( &node, sizeof( ViewNode ), 1, a_nodes )
+            || !Write( branches, sizeof( ViewBranch ), node.m_count, a_branches )
+            || ( a_covers && !Write( &cover, sizeof( Rect ), 1, a_covers ) ) )
+        {
+            return false;
+        }
+
+        Report( Phase::PACK, ++written, a_header.m_nodeCount );
+    }
+
+    return true;
+}
+
+
+// Leaves from the sorted chunk or the last merge, then every level above from the covers of
+// the one below
+RTREE_EXTERNAL_TEMPLATE
+bool RTREE_EXTERNAL_QUAL::WriteLevels( const Shape& a_shape, Header& a_header, const char* a_outputFile,
+                                       const std::vector<Keyed>& a_chunk, const std::vector<std::string>& a_runs )
+{
+    const int   height = (int) a_shape.m_nodes.size();
+    FILE*       nodes = std::fopen( a_outputFile, "wb+" );
+    FILE*       branches = nodes ? std::fopen( a_outputFile, "rb+" ) : NULL;
+    std::string coverNames[2] = { TempName( "level" ), TempName( "level" ) };
+    FILE*       covers[2] = { NULL, NULL };
+    Merge       merge;
+    size_t      next = 0;
+
+    // Size the file up front, the gaps between the regions read back as zeros.  The header is
+    // written again with the checksum.
+    const char zero = 0;
+    bool       result = branches && Write( &a_header, sizeof( Header ), 1, nodes )
+                        && Seek( nodes, a_header.m_fileSize - 1 ) && Write( &zero, 1, 1, nodes );
+
+    Report( Phase::PACK, 0, a_header.m_nodeCount, true );
+
+    if( result && !a_runs.empty() )
+        result = OpenMerge( merge, a_runs, 0, a_runs.size() );
+
+    for( int level = 0; result && level < height; ++level )
+    {
+        FILE* below = covers[( level + 1 ) % 2];
+        FILE* above = NULL;
+
+        if( level + 1 < height )
+        {
+            above = covers[level % 2] = std::fopen( coverNames[level % 2].c_str(), "wb+" );
+            result = above != NULL;
+        }
+
+        if( !result )
+            break;
+
+        if( level == 0 )
+        {
+            result = WriteLevel( level, a_shape, a_header, nodes, branches, above,
+                                 [&]( ViewBranch& a_branch )
+                                 {
+                                     Keyed keyed;
+
+                                     if( a_runs.empty() )
+                                         keyed = a_chunk[next++];
+                                     else if( !NextMerged( merge, keyed ) )
+                                         return false;
+
+                                     std::copy( keyed.m_record.m_min, keyed.m_record.m_min + NUMDIMS, a_branch.m_min );
+                                     std::copy( keyed.m_record.m_max, keyed.m_record.m_max + NUMDIMS, a_branch.m_max );
+                                     a_branch.m_data = keyed.m_record.m_data;
+                                     return true;
+                                 } );
+        }
+        else
+        {
+            const uint64_t firstChild = a_shape.m_firstNode[level - 1];
+
+            next = 0;
+            result = Seek( below, 0 )
+                     && WriteLevel( level, a_shape, a_header, nodes, branches, above,
+                                    [&]( ViewBranch& a_branch )
+                                    {
+                                        Rect cover;
+
+                                        if( Read( &cover, sizeof( Rect ), 1, below ) != 1 )
+                                            return false;
+
+                                        std::copy( cover.m_min, cover.m_min + NUMDIMS, a_branch.m_min );
+                                        std::copy( cover.m_max, cover.m_max + NUMDIMS, a_branch.m_max );
+                                        a_branch.m_child = firstChild + next++;
+                                        return true;
+                                    } );
+        }
+
+        // The level below is consumed, drop its covers
+        if( below )
+        {
+            std::fclose( below );
+            std::remove( coverNames[( level + 1 ) % 2].c_str() );
+            covers[( level + 1 ) % 2] = NULL;
+        }
+
+        if( level == 0 )
+            CloseMerge( merge );
+    }
+
+    CloseMerge( merge );
+
+    for( int index = 0; index < 2; ++index )
+    {
+        if( covers[index] )
+        {
+            std::fclose( covers[index] );
+            std::remove( coverNames[index].c_str() );
+        }
+    }
+
+    if( branches )
+        result = std::fclose( branches ) == 0 && result;
+
+    if( nodes )
+        result = std::fclose( nodes ) == 0 && result;
+
+    Report( Phase::PACK, a_header.m_nodeCount, a_header.m_nodeCount, true );
+    EndPhase( Phase::PACK );
+    return result;
+}
+
+
+// Read the output back for the checksum, then write the header
+RTREE_EXTERNAL_TEMPLATE
+bool RTREE_EXTERNAL_QUAL::WriteChecksum( const char* a_outputFile, Header& a_header )
+{
+    FILE* file = std::fopen( a_outputFile, "rb+" );
+
+    if( !file )
+        return false;
+
+    // Blocks of whole 64-bit words, as RTreeMappedChecksum needs
+    const size_t      blockBytes = std::max<size_t>( 4096, std::min<size_t>( m_memoryBytes, size_t( 1 ) << 20 ) ) & ~size_t( 7 );
+    std::vector<char> block( blockBytes );
+    const uint64_t    total = a_header.m_fileSize - sizeof( Header );
+    uint64_t          done = 0;
+    uint64_t          hash = RTreeMappedChecksum( NULL, 0 );
+    bool              result = FileSize( file ) == a_header.m_fileSize && Seek( file, sizeof( Header ) );
+
+    Report( Phase::CHECKSUM, 0, total, true );
+
+    while( result && done < total )
+    {
+        const size_t size = (size_t) std::min<uint64_t>( blockBytes, total - done );
+
+        result = Read( block.data(), 1, size, file ) == size;
+        hash = RTreeMappedChecksum( block.data(), size, hash );
+        done += size;
+        Report( Phase::CHECKSUM, done, total );
+    }
+
+    a_header.m_checksum = hash;
+    result = result && Seek( file, 0 ) && Write( &a_header, sizeof( Header ), 1, file );
+    result = std::fclose( file ) == 0 && result;
+
+    Report( Phase::CHECKSUM, total, total, true );
+    EndPhase( Phase::CHECKSUM );
+    return result;
+}
+
+
+RTREE_EXTERNAL_TEMPLATE
+size_t RTREE_EXTERNAL_QUAL::Read( void* a_data, size_t a_size, size_t a_count, FILE* a_file )
+{
+    const size_t count = std::fread( a_data, a_size, a_count, a_file );
+
+    m_stats.bytesRead += count * a_size;
+    return count;
+}
+
+
+RTREE_EXTERNAL_TEMPLATE
+bool RTREE_EXTERNAL_QUAL::Write( const void* a_data, size_t a_size, size_t a_count, FILE* a_file )
+{
+    const size_t count = std::fwrite( a_data, a_size, a_count, a_file );
+
+    m_stats.bytesWritten += count * a_size;
+    return count == a_count;
+}
+
+
+RTREE_EXTERNAL_TEMPLATE
+std::string RTREE_EXTERNAL_QUAL::TempName( const char* a_kind )
+{
+    return m_prefix + "." + a_kind + std::to_string( m_tempCount++ );
+}
+
+
+// Call the progress callback when forced or PROGRESS_STEP units after the last call
+RTREE_EXTERNAL_TEMPLATE
+void RTREE_EXTERNAL_QUAL::Report( Phase a_phase, uint64_t a_done, uint64_t a_total, bool a_force )
+{
+    if( !a_force && a_done - m_lastReport < PROGRESS_STEP )
+        return;
+
+    m_lastReport = a_done;
+
+    if( m_progress )
+        m_progress( Progress{ a_phase, a_done, a_total } );
+}
+
+
+RTREE_EXTERNAL_TEMPLATE
+void RTREE_EXTERNAL_QUAL::EndPhase( Phase a_phase )
+{
+    const auto now = std::chrono::steady_clock::now();
+
+    m_stats.phaseSeconds[(int) a_phase] += std::chrono::duration<double>( now - m_phaseStart ).count();
+    m_phaseStart = now;
+}
+
+
+#undef RTREE_EXTERNAL_TEMPLATE
+#undef RTREE_EXTERNAL_QUAL
+
+#endif    // RTREE_EXTERNAL_H
@@ -0,0 +1,410 @@
+#ifndef RTREE_FROZEN_H
+#define RTREE_FROZEN_H
+
+// Immutable copy of an RTree in a single contiguous array, for indexes that stop changing
+// after they are built.
+//
+// Every node becomes a run of branches in one std::vector, placed either breadth first or in
+// van Emde Boas order.  The van Emde Boas order lays out the top half of the levels first and
+// then each subtree below them the same way, recursively, so the nodes on any root to leaf path
+// share cache lines and pages whatever their size.  A branch refers to its child run by a
+// 32-bit index and count, so a query touches nothing but the branch array.
+
+#include "rtree.h"
+
+#include <type_traits>
+#include <unordered_map>
+
+
+/// Order of the nodes in an RTreeFrozen
+enum class RTreeFrozenLayout
+{
+    BREADTH_FIRST,  ///< Level by level from the root
+    VAN_EMDE_BOAS   ///< Recursive halves of the levels, cache oblivious
+};
+
+
+#define RTREE_FROZEN_TEMPLATE template <class DATATYPE, class ELEMTYPE, int NUMDIMS, class ELEMTYPEREAL>
+#define RTREE_FROZEN_QUAL     RTreeFrozen<DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL>
+
+
+/// \class RTreeFrozen
+/// Read-only RTree copied from a built one by Freeze.  Offers the query side of RTree: Search,
+/// Count and NearestNeighbors.
+///
+/// DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL as for RTree.  Data is kept in the leaf branches
+/// under the same rule as RTree, anything else in a side array in leaf order.
+template <class DATATYPE, class ELEMTYPE, int NUMDIMS, class ELEMTYPEREAL = ELEMTYPE>
+class RTreeFrozen
+{
+    static constexpr bool INLINE_DATA = std::is_trivially_copyable<DATATYPE>::value
+                                        && sizeof( DATATYPE ) <= sizeof( uint64_t );
+
+    typedef typename std::conditional<INLINE_DATA, DATATYPE, uint32_t>::type DataSlot;
+
+public:
+    typedef DATATYPE DataType;
+
+    /// Run of branches forming one node
+    struct Child
+    {
+        uint32_t m_first;                           ///< Index of the first branch
+        uint16_t m_count;
+        uint16_t m_level;                           ///< Leaf is zero, others positive
+
+        bool IsLeaf() const { return m_level == 0; }
+    };
+
+    struct Branch
+    {
+        ELEMTYPE m_min[NUMDIMS];
+        ELEMTYPE m_max[NUMDIMS];
+        union
+        {
+            Child    m_child;
+            DataSlot m_data;
+        };
+    };
+
+    /// Scratch storage for NearestNeighbors, see RTree::NearestNeighborBuffer
+    class NearestNeighborBuffer
+    {
+    public:
+        typedef std::pair<ELEMTYPEREAL, DATATYPE> Result;
+
+        /// Matches of the last query, ordered by ascending squared distance
+        const std::vector<Result>& Results() const
+        {
+            return m_results;
+        }
+
+    private:
+        std::vector<std::pair<ELEMTYPEREAL, Child>> m_queue;    ///< Node distance and run, min-heap
+        std::vector<Result>                         m_results;
+
+        friend class RTreeFrozen;
+    };
+
+    RTreeFrozen();
+
+    /// Freeze a_tree, see Freeze
+    template <class RTREE>
+    explicit RTreeFrozen( const RTREE& a_tree, RTreeFrozenLayout a_layout = RTreeFrozenLayout::VAN_EMDE_BOAS );
+
+    /// Replace the contents with a copy of a_tree, which is left untouched
+    /// \param a_tree RTree with the same DATATYPE, ELEMTYPE and NUMDIMS, other parameters may differ
+    template <class RTREE>
+    void Freeze( const RTREE& a_tree, RTreeFrozenLayout a_layout = RTreeFrozenLayout::VAN_EMDE_BOAS );
+
+    /// Count the data elements
+    int Count() const { return m_count; }
+
+    /// Bytes held by the branch array and the side stored data
+    size_t MemoryBytes() const
+    {
+        return m_branches.capacity() * sizeof( Branch ) + m_payloads.capacity() * sizeof( DATATYPE );
+    }
+
+    /// Find all within search rectangle
+    /// \param a_visitor functor bool( const DATATYPE& ).  Return 'true' to continue searching
+    /// \return Returns the number of entries found
+    template <class VISITOR>
+    int Search( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS], VISITOR&& a_visitor ) const;
+
+    /// Find the a_k nearest data elements to a point, see RTree::NearestNeighbors
+    template <class DISTANCE, class FILTER>
+    int NearestNeighbors( const ELEMTYPE aPoint[NUMDIMS], int aK, DISTANCE&& aSquaredDist, FILTER&& aFilter,
+                          NearestNeighborBuffer& aBuffer ) const;
+
+private:
+    template <class TREENODE>
+    static void OrderVanEmdeBoas( const TREENODE* a_node, int a_height, std::vector<const TREENODE*>& a_order );
+
+    template <class TREENODE>
+    static void CollectDepth( const TREENODE* a_node, int a_depth, std::vector<const TREENODE*>& a_nodes );
+
+    const DATATYPE& BranchData( const Branch& a_branch ) const
+    {
+        if constexpr( INLINE_DATA )
+            return a_branch.m_data;
+        else
+            return m_payloads[a_branch.m_data];
+    }
+
+    /// Node access for RTreeNearestSearch
+    struct NearestAccess
+    {
+        typedef typename RTreeFrozen::Child NodeRef;
+
+        const RTreeFrozen* m_frozen;
+        const ELEMTYPE*    m_point;
+
+        NodeRef Root() const { return m_frozen->m_root; }
+
+        bool IsLeaf( NodeRef a_node ) const { return a_node.IsLeaf(); }
+
+        int Count( NodeRef a_node ) const { return a_node.m_count; }
+
+        bool Skip( NodeRef, int ) const { return false; }
+
+        ELEMTYPEREAL MinDistSq( NodeRef a_node, int a_index ) const
+        {
+            const Branch& branch = m_frozen->m_branches[a_node.m_first + a_index];
+
+            return RTreeMinDistSq<ELEMTYPEREAL, NUMDIMS>( m_point, branch.m_min, branch.m_max );
+        }
+
+        NodeRef Child( NodeRef a_node, int a_index ) const
+        {
+            return m_frozen->m_branches[a_node.m_first + a_index].m_child;
+        }
+
+        const DATATYPE& Data( NodeRef a_node, int a_index ) const
+        {
+            return m_frozen->BranchData( m_frozen->m_branches[a_node.m_first + a_index] );
+        }
+
+        void Visited( NodeRef ) const {}
+
+        void Pushed() const {}
+    };
+
+    static bool Overlap( const Branch& a_branch, const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS] );
+
+    template <class VISITOR>
+    bool SearchRec( Child a_node, const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS],
+                    VISITOR& a_visitor, int& a_foundCount ) const;
+
+    std::vector<Branch>     m_branches;     ///< Runs of all nodes in layout order, the root first
+    std::vector<DATATYPE>   m_payloads;     ///< Leaf data by slot, unless INLINE_DATA
+    Child                   m_root;
+    int                     m_count;
+};
+
+
+RTREE_FROZEN_TEMPLATE
+RTREE_FROZEN_QUAL::RTreeFrozen() : m_count( 0 )
+{
+    m_root.m_first = 0;
+    m_root.m_count = 0;
+    m_root.m_level = 0;
+}
+
+
+RTREE_FROZEN_TEMPLATE
+template <class RTREE>
+RTREE_FROZEN_QUAL::RTreeFrozen( const RTREE& a_tree, RTreeFrozenLayout a_layout ) : RTreeFrozen()
+{
+    Freeze( a_tree, a_layout );
+}
+
+
+RTREE_FROZEN_TEMPLATE
+template <class RTREE>
+void RTREE_FROZEN_QUAL::Freeze( const RTREE& a_tree, RTreeFrozenLayout a_layout )
+{
+    typedef typename RTREE::Node TreeNode;
+
+    static_assert( std::is_same<typename RTREE::DataType, DATATYPE>::value
+                   && std::is_same<decltype( RTREE::Rect::m_min ), ELEMTYPE[NUMDIMS]>::value,
+                   "Tree and frozen copy must agree on DATATYPE, ELEMTYPE and NUMDIMS" );
+
+    std::vector<const TreeNode*> order;
+
+    if( a_layout == RTreeFrozenLayout::VAN_EMDE_BOAS )
+    {
+        OrderVanEmdeBoas( a_tree.m_root, a_tree.m_root->m_level + 1, order );
+    }
+    else
+    {
+        order.push_back( a_tree.m_root );
+
+        for( size_t index = 0; index < order.size(); ++index )
+        {
+            if( order[index]->IsInternalNode() )
+            {
+                for( int branch = 0; branch < order[index]->m_count; ++branch )
+                {
+                    order.push_back( order[index]->m_branch[branch].m_child );
+                }
+            }
+        }
+    }
+
+    // Place the runs, then fill them knowing where every child went
+    std::unordered_map<const TreeNode*, uint32_t> firstBranch;
+    uint32_t                                      branchCount = 0;
+
+    firstBranch.reserve( order.size() );
+
+    for( const TreeNode* node : order )
+    {
+        firstBranch[node] = branchCount;
+        branchCount += node->m_count;
+    }
+
+    m_branches.assign( branchCount, Branch() );
+    m_payloads.clear();
+    m_count = 0;
+
+    for( const TreeNode* node : order )
+    {
+        Branch* target = &m_branches[firstBranch[node]];
+
+        for( int index = 0; index < node->m_count; ++index, ++target )
+        {
+            const auto& source = node->m_branch[index];
+
+            std::copy( source.m_rect.m_min, source.m_rect.m_min + NUMDIMS, target->m_min );
+            std::copy( source.m_rect.m_max, source.m_rect.m_max + NUMDIMS, target->m_max );
+
+            if( node->IsInternalNode() )
+            {
+                target->m_child.m_first = firstBranch[source.m_child];
+                target->m_child.m_count = (uint16_t) source.m_child->m_count;
+                target->m_child.m_level = (uint16_t) source.m_child->m_level;
+            }
+            else if constexpr( INLINE_DATA )
+            {
+                target->m_data = a_tree.BranchData( source );
+            }
+            else
+            {
+                target->m_data = (uint32_t) m_payloads.size();
+                m_payloads.push_back( a_tree.BranchData( source ) );
+            }
+
+            m_count += node->IsLeaf();
+        }
+    }
+
+    m_root.m_first = 0;
+    m_root.m_count = (uint16_t) a_tree.m_root->m_count;
+    m_root.m_level = (uint16_t) a_tree.m_root->m_level;
+}
+
+
+// Top half of the levels first, then every subtree hanging below it, each laid out the same way.
+RTREE_FROZEN_TEMPLATE
+template <class TREENODE>
+void RTREE_FROZEN_QUAL::OrderVanEmdeBoas( const TREENODE* a_node, int a_height,
+                                          std::vector<const TREENODE*>& a_order )
+{
+    if( a_height == 1 )
+    {
+        a_order.push_back( a_node );
+        return;
+    }
+
+    const int topHeight = a_height / 2;
+
+    OrderVanEmdeBoas( a_node, topHeight, a_order );
+
+    std::vector<const TREENODE*> bottomRoots;
+
+    CollectDepth( a_node, topHeight, bottomRoots );
+
+    for( const TREENODE* bottomRoot : bottomRoots )
+    {
+        OrderVanEmdeBoas( bottomRoot, a_height - topHeight, a_order );
+    }
+}
+
+
+RTREE_FROZEN_TEMPLATE
+template <class TREENODE>
+void RTREE_FROZEN_QUAL::CollectDepth( const TREENODE* a_node, int a_depth, std::vector<const TREENODE*>& a_nodes )
+{
+    if( a_depth == 0 )
+    {
+        a_nodes.push_back( a_node );
+        return;
+    }
+
+    for( int index = 0; index < a_node->m_count; ++index )
+    {
+        CollectDepth( a_node->m_branch[index].m_child, a_depth - 1, a_nodes );
+    }
+}
+
+
+RTREE_FROZEN_TEMPLATE
+template <class VISITOR>
+int RTREE_FROZEN_QUAL::Search( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS],
+                               VISITOR&& a_visitor ) const
+{
+    int foundCount = 0;
+
+    SearchRec( m_root, a_min, a_max, a_visitor, foundCount );
+
+    return foundCount;
+}
+
+
+RTREE_FROZEN_TEMPLATE
+template <class VISITOR>
+bool RTREE_FROZEN_QUAL::SearchRec( Child a_node, const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS],
+                                   VISITOR& a_visitor, int& a_foundCount ) const
+{
+    const Branch* branch = m_branches.data() + a_node.m_first;
+    const Branch* last = branch + a_node.m_count;
+
+    for( ; branch != last; ++branch )
+    {
+        if( !Overlap( *branch, a_min, a_max ) )
+            continue;
+
+        if( a_node.IsLeaf() )
+        {
+            if( !a_visitor( BranchData( *branch ) ) )
+                return false;
+
+            a_foundCount++;
+        }
+        else if( !SearchRec( branch->m_child, a_min, a_max, a_visitor, a_foundCount ) )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+RTREE_FROZEN_TEMPLATE
+template <class DISTANCE, class FILTER>
+int RTREE_FROZEN_QUAL::NearestNeighbors( const ELEMTYPE aPoint[NUMDIMS], int aK, DISTANCE&& aSquaredDist,
+                                         FILTER&& aFilter, NearestNeighborBuffer& aBuffer ) const
+{
+    const NearestAccess access{ this, aPoint };
+
+    return RTreeNearestSearch(
+            access, aK, std::numeric_limits<ELEMTYPEREAL>::max(),
+            [&]( const DATATYPE& a_data )
+            {
+                return aSquaredDist( aPoint, a_data );
+            },
+            aFilter, aBuffer.m_queue, aBuffer.m_results );
+}
+
+
+RTREE_FROZEN_TEMPLATE
+bool RTREE_FROZEN_QUAL::Overlap( const Branch& a_branch, const ELEMTYPE a_min[NUMDIMS],
+                                 const ELEMTYPE a_max[NUMDIMS] )
+{
+    for( int index = 0; index < NUMDIMS; ++index )
+    {
+        if( a_branch.m_min[index] > a_max[index] || a_min[index] > a_branch.m_max[index] )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+#undef RTREE_FROZEN_TEMPLATE
+#undef RTREE_FROZEN_QUAL
+
+#endif    // RTREE_FROZEN_H
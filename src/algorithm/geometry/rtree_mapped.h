@@ -0,0 +1,645 @@
+#ifndef RTREE_MAPPED_H
+#define RTREE_MAPPED_H
+
+// Flat, position independent file layout for RTree and a read-only view that serves queries
+// straight from a memory mapping, without rebuilding any node.
+//
+// File layout, every array aligned to RTreeMappedHeader::ALIGNMENT:
+//
+//    RTreeMappedHeader
+//    Node   m_nodes[m_nodeCount]       breadth first, the root is node 0
+//    Branch m_branches[m_branchCount]  the branches of each node are contiguous
+//
+// Children are referenced by node index, so the file can be mapped at any address.  Values are
+// stored in the byte order of the writer; m_byteOrder lets a reader on another machine refuse it.
+
+#include "rtree.h"
+
+#include <cstring>
+#include <type_traits>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+/// Fixed part at the start of a mapped RTree file
+struct RTreeMappedHeader
+{
+    enum
+    {
+        VERSION     = 1,
+        ORDER_MARK  = 0x01020304,
+        ALIGNMENT   = 64
+    };
+
+    char     m_magic[8];        ///< "RTREEMAP"
+    uint32_t m_version;         ///< VERSION of the writer
+    uint32_t m_byteOrder;       ///< ORDER_MARK as seen by the writer
+    uint32_t m_dataSize;        ///< sizeof( DATATYPE )
+    uint32_t m_elemSize;        ///< sizeof( ELEMTYPE )
+    uint32_t m_elemFloat;       ///< 1 if ELEMTYPE is a floating point type
+    uint32_t m_numDims;         ///< NUMDIMS
+    uint32_t m_height;          ///< Number of levels, a lone leaf root is 1
+    uint32_t m_reserved;
+    uint64_t m_itemCount;       ///< Data entries in the leaves
+    uint64_t m_nodeCount;
+    uint64_t m_nodeOffset;      ///< Byte offset of the node array from the start of the file
+    uint64_t m_branchCount;
+    uint64_t m_branchOffset;    ///< Byte offset of the branch array from the start of the file
+    uint64_t m_fileSize;        ///< Total size including the header
+    uint64_t m_checksum;        ///< Checksum of everything after the header, see RTreeMappedChecksum
+};
+
+
+/// FNV-1a over 64-bit words, the tail is zero padded.  Pass the hash of the preceding blocks as
+/// a_hash to checksum a file block by block; all blocks but the last must be multiples of 8 bytes.
+inline uint64_t RTreeMappedChecksum( const void* a_data, size_t a_size, uint64_t a_hash = 0xcbf29ce484222325ull )
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>( a_data );
+    uint64_t             hash = a_hash;
+
+    for( size_t offset = 0; offset < a_size; offset += sizeof( uint64_t ) )
+    {
+        uint64_t word = 0;
+
+        std::memcpy( &word, bytes + offset, std::min( sizeof( uint64_t ), a_size - offset ) );
+        hash = ( hash ^ word ) * 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+
+/// Read-only mapping of a whole file
+class RTreeFileMapping
+{
+public:
+    RTreeFileMapping() : m_data( NULL ), m_size( 0 )
+    {
+#ifdef _WIN32
+        m_file = INVALID_HANDLE_VALUE;
+        m_mapping = NULL;
+#endif
+    }
+
+    ~RTreeFileMapping()
+    {
+        Close();
+    }
+
+    RTreeFileMapping( const RTreeFileMapping& ) = delete;
+    RTreeFileMapping& operator=( const RTreeFileMapping& ) = delete;
+
+    bool Open( const char* a_fileName )
+    {
+        Close();
+
+#ifdef _WIN32
+        m_file = CreateFileA( a_fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL );
+
+        LARGE_INTEGER size;
+
+        if( m_file == INVALID_HANDLE_VALUE || !GetFileSizeEx( m_file, &size ) || size.QuadPart == 0 )
+        {
+            Close();
+            return false;
+        }
+
+        m_mapping = CreateFileMappingA( m_file, NULL, PAGE_READONLY, 0, 0, NULL );
+        m_data = m_mapping ? MapViewOfFile( m_mapping, FILE_MAP_READ, 0, 0, 0 ) : NULL;
+        m_size = (size_t) size.QuadPart;
+#else
+        int         file = open( a_fileName, O_RDONLY );
+        struct stat info;
+
+        if( file < 0 || fstat( file, &info ) != 0 || info.st_size == 0 )
+        {
+            if( file >= 0 )
+                close( file );
+
+            return false;
+        }
+
+        void* data = mmap( NULL, (size_t) info.st_size, PROT_READ, MAP_SHARED, file, 0 );
+        close( file );
+
+        m_data = data == MAP_FAILED ? NULL : data;
+        m_size = (size_t) info.st_size;
+#endif
+
+        if( !m_data )
+        {
+            Close();
+            return false;
+        }
+
+        return true;
+    }
+
+    void Close()
+    {
+#ifdef _WIN32
+        if( m_data )
+            UnmapViewOfFile( m_data );
+
+        if( m_mapping )
+            CloseHandle( m_mapping );
+
+        if( m_file != INVALID_HANDLE_VALUE )
+            CloseHandle( m_file );
+
+        m_file = INVALID_HANDLE_VALUE;
+        m_mapping = NULL;
+#else
+        if( m_data )
+            munmap( m_data, m_size );
+#endif
+
+        m_data = NULL;
+        m_size = 0;
+    }
+
+    const void* Data() const { return m_data; }
+    size_t      Size() const { return m_size; }
+
+private:
+    void*   m_data;
+    size_t  m_size;
+
+#ifdef _WIN32
+    HANDLE  m_file;
+    HANDLE  m_mapping;
+#endif
+};
+
+
+#define RTREE_MAPPED_TEMPLATE template <class DATATYPE, class ELEMTYPE, int NUMDIMS, class ELEMTYPEREAL>
+#define RTREE_MAPPED_QUAL     RTreeMappedView<DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL>
+
+
+/// \class RTreeMappedView
+/// Read-only RTree served from a flat buffer, normally a memory-mapped file written by Save.
+/// Opening only checks the header (and the checksum if asked to); Search and NearestNeighbors
+/// then walk the mapped nodes in place.
+///
+/// DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL as for RTree.  DATATYPE is stored by value, so it should
+/// be an id rather than a pointer if the file outlives the process.
+template <class DATATYPE, class ELEMTYPE, int NUMDIMS, class ELEMTYPEREAL = ELEMTYPE>
+class RTreeMappedView
+{
+    static_assert( std::is_trivially_copyable<DATATYPE>::value, "Mapped data must be trivially copyable" );
+
+public:
+    typedef RTreeMappedHeader Header;
+
+    /// Node record, the branches are m_branches[m_firstBranch] .. m_branches[m_firstBranch + m_count]
+    struct Node
+    {
+        uint32_t m_firstBranch;
+        uint16_t m_count;
+        uint16_t m_level;                           ///< Leaf is zero, others positive
+
+        bool IsLeaf() const { return m_level == 0; }
+    };
+
+    /// Branch record, m_child is a node index inside internal nodes
+    struct Branch
+    {
+        ELEMTYPE m_min[NUMDIMS];
+        ELEMTYPE m_max[NUMDIMS];
+        union
+        {
+            uint64_t m_child;
+            DATATYPE m_data;
+        };
+    };
+
+    /// Scratch storage for NearestNeighbors, see RTree::NearestNeighborBuffer
+    class NearestNeighborBuffer
+    {
+    public:
+        typedef std::pair<ELEMTYPEREAL, DATATYPE> Result;
+
+        /// Matches of the last query, ordered by ascending squared distance
+        const std::vector<Result>& Results() const
+        {
+            return m_results;
+        }
+
+    private:
+        std::vector<std::pair<ELEMTYPEREAL, uint32_t>> m_queue;  ///< Node distance and index, min-heap
+        std::vector<Result>                            m_results;
+
+        friend class RTreeMappedView;
+    };
+
+    RTreeMappedView();
+
+    RTreeMappedView( const RTreeMappedView& ) = delete;
+    RTreeMappedView& operator=( const RTreeMappedView& ) = delete;
+
+    /// Write a tree in the mapped format
+    /// \param a_tree RTree with the same DATATYPE, ELEMTYPE and NUMDIMS, other parameters may differ
+    template <class RTREE>
+    static bool Save( const RTREE& a_tree, const char* a_fileName );
+
+    /// Write a tree in the mapped format into a buffer, replacing its contents
+    template <class RTREE>
+    static void Serialize( const RTREE& a_tree, std::vector<char>& a_buffer );
+
+    /// Map a file written by Save.  The header and the links between nodes are always checked, so a
+    /// truncated or corrupt file is refused rather than read out of bounds.
+    /// \param a_verify Also check the checksum, which reads the whole file once
+    bool Open( const char* a_fileName, bool a_verify = true );
+
+    /// Serve queries from a buffer owned by the caller, which must outlive the view and be
+    /// aligned to 8 bytes
+    bool Attach( const void* a_data, size_t a_size, bool a_verify = true );
+
+    void Close();
+
+    bool IsOpen() const { return m_header != NULL; }
+
+    const Header& GetHeader() const { return *m_header; }
+
+    /// Count the data elements, stored in the header
+    uint64_t Count() const { return m_header ? m_header->m_itemCount : 0; }
+
+    /// Find all within search rectangle
+    /// \param a_visitor functor bool( const DATATYPE& ).  Return 'true' to continue searching
+    /// \return Returns the number of entries found
+    template <class VISITOR>
+    int Search( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS], VISITOR&& a_visitor ) const;
+
+    /// Find the a_k nearest data elements to a point, see RTree::NearestNeighbors
+    template <class DISTANCE, class FILTER>
+    int NearestNeighbors( const ELEMTYPE aPoint[NUMDIMS], int aK, DISTANCE&& aSquaredDist, FILTER&& aFilter,
+                          NearestNeighborBuffer& aBuffer ) const;
+
+private:
+    static size_t AlignUp( size_t a_offset )
+    {
+        return ( a_offset + Header::ALIGNMENT - 1 ) & ~size_t( Header::ALIGNMENT - 1 );
+    }
+
+    static bool CheckLinks( const Header& a_header, const Node* a_nodes, const Branch* a_branches );
+
+    /// Node access for RTreeNearestSearch, nodes named by index
+    struct NearestAccess
+    {
+        typedef uint32_t NodeRef;
+
+        const RTreeMappedView* m_view;
+        const ELEMTYPE*        m_point;
+
+        NodeRef Root() const { return 0; }
+
+        bool IsLeaf( NodeRef a_node ) const { return m_view->m_nodes[a_node].IsLeaf(); }
+
+        int Count( NodeRef a_node ) const { return m_view->m_nodes[a_node].m_count; }
+
+        bool Skip( NodeRef, int ) const { return false; }
+
+        const Branch& At( NodeRef a_node, int a_index ) const
+        {
+            return m_view->m_branches[m_view->m_nodes[a_node].m_firstBranch + a_index];
+        }
+
+        ELEMTYPEREAL MinDistSq( NodeRef a_node, int a_index ) const
+        {
+            const Branch& branch = At( a_node, a_index );
+
+            return RTreeMinDistSq<ELEMTYPEREAL, NUMDIMS>( m_point, branch.m_min, branch.m_max );
+        }
+
+        NodeRef Child( NodeRef a_node, int a_index ) const { return (NodeRef) At( a_node, a_index ).m_child; }
+
+        const DATATYPE& Data( NodeRef a_node, int a_index ) const { return At( a_node, a_index ).m_data; }
+
+        void Visited( NodeRef ) const {}
+
+        void Pushed() const {}
+    };
+
+    static bool Overlap( const Branch& a_branch, const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS] );
+
+    template <class VISITOR>
+    bool SearchRec( const Node& a_node, const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS],
+                    VISITOR& a_visitor, int& a_foundCount ) const;
+
+    RTreeFileMapping    m_mapping;
+    const Header*       m_header;
+    const Node*         m_nodes;
+    const Branch*       m_branches;
+};
+
+
+RTREE_MAPPED_TEMPLATE
+RTREE_MAPPED_QUAL::RTreeMappedView() : m_header( NULL ), m_nodes( NULL ), m_branches( NULL )
+{
+}
+
+
+RTREE_MAPPED_TEMPLATE
+template <class RTREE>
+bool RTREE_MAPPED_QUAL::Save( const RTREE& a_tree, const char* a_fileName )
+{
+    std::vector<char> buffer;
+
+    Serialize( a_tree, buffer );
+
+    FILE* file = std::fopen( a_fileName, "wb" );
+
+    if( !file )
+        return false;
+
+    bool result = std::fwrite( buffer.data(), 1, buffer.size(), file ) == buffer.size();
+
+    return std::fclose( file ) == 0 && result;
+}
+
+
+RTREE_MAPPED_TEMPLATE
+template <class RTREE>
+void RTREE_MAPPED_QUAL::Serialize( const RTREE& a_tree, std::vector<char>& a_buffer )
+{
+    typedef typename RTREE::Node TreeNode;
+
+    static_assert( std::is_same<typename RTREE::DataType, DATATYPE>::value
+                   && std::is_same<decltype( RTREE::Rect::m_min ), ELEMTYPE[NUMDIMS]>::value,
+                   "Tree and view must agree on DATATYPE, ELEMTYPE and NUMDIMS" );
+
+    // Breadth first order, children of a node get consecutive indices
+    std::vector<const TreeNode*> order( 1, a_tree.m_root );
+    uint64_t                     branchCount = 0;
+    uint64_t                     itemCount = 0;
+
+    for( size_t index = 0; index < order.size(); ++index )
+    {
+        const TreeNode* node = order[index];
+
+        branchCount += node->m_count;
+
+        for( int branch = 0; branch < node->m_count; ++branch )
+        {
+            if( node->IsInternalNode() )
+                order.push_back( node->m_branch[branch].m_child );
+            else
+                itemCount++;
+        }
+    }
+
+    Header header;
+
+    std::memset( &header, 0, sizeof( header ) );
+    std::memcpy( header.m_magic, "RTREEMAP", sizeof( header.m_magic ) );
+    header.m_version        = Header::VERSION;
+    header.m_byteOrder      = Header::ORDER_MARK;
+    header.m_dataSize       = sizeof( DATATYPE );
+    header.m_elemSize       = sizeof( ELEMTYPE );
+    header.m_elemFloat      = std::is_floating_point<ELEMTYPE>::value;
+    header.m_numDims        = NUMDIMS;
+    header.m_height         = a_tree.m_root->m_level + 1;
+    header.m_itemCount      = itemCount;
+    header.m_nodeCount      = order.size();
+    header.m_nodeOffset     = AlignUp( sizeof( Header ) );
+    header.m_branchCount    = branchCount;
+    header.m_branchOffset   = AlignUp( header.m_nodeOffset + order.size() * sizeof( Node ) );
+    header.m_fileSize       = header.m_branchOffset + branchCount * sizeof( Branch );
+
+    a_buffer.assign( header.m_fileSize, 0 );
+
+    Node*    nodes = reinterpret_cast<Node*>( a_buffer.data() + header.m_nodeOffset );
+    Branch*  branches = reinterpret_cast<Branch*>( a_buffer.data() + header.m_branchOffset );
+    uint32_t nextBranch = 0;
+    uint64_t nextChild = 1;
+
+    for( size_t index = 0; index < order.size(); ++index )
+    {
+        const TreeNode* node = order[index];
+
+        nodes[index].m_firstBranch = nextBranch;
+        nodes[index].m_count       = (uint16_t) node->m_count;
+        nodes[index].m_level       = (uint16_t) node->m_level;
+
+        for( int branch = 0; branch < node->m_count; ++branch )
+        {
+            const auto& source = node->m_branch[branch];
+            Branch&     target = branches[nextBranch++];
+
+            std::copy( source.m_rect.m_min, source.m_rect.m_min + NUMDIMS, target.m_min );
+            std::copy( source.m_rect.m_max, source.m_rect.m_max + NUMDIMS, target.m_max );
+
+            if( node->IsInternalNode() )
+                target.m_child = nextChild++;
+            else
+                target.m_data = a_tree.BranchData( source );
+        }
+    }
+
+    header.m_checksum = RTreeMappedChecksum( a_buffer.data() + sizeof( Header ),
+                                             a_buffer.size() - sizeof( Header ) );
+    std::memcpy( a_buffer.data(), &header, sizeof( header ) );
+}
+
+
+RTREE_MAPPED_TEMPLATE
+bool RTREE_MAPPED_QUAL::Open( const char* a_fileName, bool a_verify )
+{
+    Close();
+
+    if( !m_mapping.Open( a_fileName ) )
+        return false;
+
+    if( !Attach( m_mapping.Data(), m_mapping.Size(), a_verify ) )
+    {
+        m_mapping.Close();
+        return false;
+    }
+
+    return true;
+}
+
+
+RTREE_MAPPED_TEMPLATE
+bool RTREE_MAPPED_QUAL::Attach( const void* a_data, size_t a_size, bool a_verify )
+{
+    m_header = NULL;
+    m_nodes = NULL;
+    m_branches = NULL;
+
+    if( !a_data || a_size < sizeof( Header ) || reinterpret_cast<uintptr_t>( a_data ) % alignof( Branch ) )
+        return false;
+
+    const char*   base = static_cast<const char*>( a_data );
+    const Header* header = reinterpret_cast<const Header*>( base );
+
+    // Test if header was valid and compatible
+    if( std::memcmp( header->m_magic, "RTREEMAP", sizeof( header->m_magic ) ) != 0
+        || header->m_version != Header::VERSION
+        || header->m_byteOrder != Header::ORDER_MARK
+        || header->m_dataSize != sizeof( DATATYPE )
+        || header->m_elemSize != sizeof( ELEMTYPE )
+        || header->m_elemFloat != (uint32_t) std::is_floating_point<ELEMTYPE>::value
+        || header->m_numDims != NUMDIMS
+        || header->m_fileSize != a_size
+        || header->m_nodeCount == 0
+        || header->m_nodeOffset < sizeof( Header )
+        || header->m_nodeOffset > a_size || header->m_branchOffset > a_size
+        || header->m_nodeOffset % alignof( Node ) || header->m_branchOffset % alignof( Branch )
+        || header->m_nodeCount > ( a_size - header->m_nodeOffset ) / sizeof( Node )
+        || header->m_branchOffset < header->m_nodeOffset + header->m_nodeCount * sizeof( Node )
+        || header->m_branchCount > ( a_size - header->m_branchOffset ) / sizeof( Branch ) )
+    {
+        return false;
+    }
+
+    const Node*   nodes = reinterpret_cast<const Node*>( base + header->m_nodeOffset );
+    const Branch* branches = reinterpret_cast<const Branch*>( base + header->m_branchOffset );
+
+    if( !CheckLinks( *header, nodes, branches ) )
+        return false;
+
+    if( a_verify && RTreeMappedChecksum( base + sizeof( Header ), a_size - sizeof( Header ) ) != header->m_checksum )
+        return false;
+
+    m_header = header;
+    m_nodes = nodes;
+    m_branches = branches;
+
+    return true;
+}
+
+
+// Every node's branches lie within the branch array and every child index names a node one level
+// down, so queries stay in bounds and cannot loop.  Reads the nodes and the internal branches only.
+RTREE_MAPPED_TEMPLATE
+bool RTREE_MAPPED_QUAL::CheckLinks( const Header& a_header, const Node* a_nodes, const Branch* a_branches )
+{
+    if( a_header.m_height == 0 || a_nodes[0].m_level != a_header.m_height - 1 )
+        return false;
+
+    for( uint64_t index = 0; index < a_header.m_nodeCount; ++index )
+    {
+        const Node& node = a_nodes[index];
+
+        if( (uint64_t) node.m_firstBranch + node.m_count > a_header.m_branchCount )
+            return false;
+
+        if( node.IsLeaf() )
+            continue;
+
+        for( const Branch* branch = a_branches + node.m_firstBranch;
+             branch != a_branches + node.m_firstBranch + node.m_count; ++branch )
+        {
+            if( branch->m_child >= a_header.m_nodeCount || a_nodes[branch->m_child].m_level != node.m_level - 1 )
+                return false;
+        }
+    }
+
+    return true;
+}
+
+
+RTREE_MAPPED_TEMPLATE
+void RTREE_MAPPED_QUAL::Close()
+{
+    m_header = NULL;
+    m_nodes = NULL;
+    m_branches = NULL;
+    m_mapping.Close();
+}
+
+
+RTREE_MAPPED_TEMPLATE
+template <class VISITOR>
+int RTREE_MAPPED_QUAL::Search( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS],
+                               VISITOR&& a_visitor ) const
+{
+    int foundCount = 0;
+
+    if( m_header )
+        SearchRec( m_nodes[0], a_min, a_max, a_visitor, foundCount );
+
+    return foundCount;
+}
+
+
+RTREE_MAPPED_TEMPLATE
+template <class VISITOR>
+bool RTREE_MAPPED_QUAL::SearchRec( const Node& a_node, const ELEMTYPE a_min[NUMDIMS],
+                                   const ELEMTYPE a_max[NUMDIMS], VISITOR& a_visitor, int& a_foundCount ) const
+{
+    const Branch* branch = m_branches + a_node.m_firstBranch;
+    const Branch* last = branch + a_node.m_count;
+
+    for( ; branch != last; ++branch )
+    {
+        if( !Overlap( *branch, a_min, a_max ) )
+            continue;
+
+        if( a_node.IsLeaf() )
+        {
+            if( !a_visitor( branch->m_data ) )
+                return false;
+
+            a_foundCount++;
+        }
+        else if( !SearchRec( m_nodes[branch->m_child], a_min, a_max, a_visitor, a_foundCount ) )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+RTREE_MAPPED_TEMPLATE
+template <class DISTANCE, class FILTER>
+int RTREE_MAPPED_QUAL::NearestNeighbors( const ELEMTYPE aPoint[NUMDIMS], int aK, DISTANCE&& aSquaredDist,
+                                         FILTER&& aFilter, NearestNeighborBuffer& aBuffer ) const
+{
+    const NearestAccess access{ this, aPoint };
+
+    // Without a file there is no root to start from
+    return RTreeNearestSearch(
+            access, m_header ? aK : 0, std::numeric_limits<ELEMTYPEREAL>::max(),
+            [&]( const DATATYPE& a_data )
+            {
+                return aSquaredDist( aPoint, a_data );
+            },
+            aFilter, aBuffer.m_queue, aBuffer.m_results );
+}
+
+
+RTREE_MAPPED_TEMPLATE
+bool RTREE_MAPPED_QUAL::Overlap( const Branch& a_branch, const ELEMTYPE a_min[NUMDIMS],
+                                 const ELEMTYPE a_max[NUMDIMS] )
+{
+    for( int index = 0; index < NUMDIMS; ++index )
+    {
+        if( a_branch.m_min[index] > a_max[index] || a_min[index] > a_branch.m_max[index] )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+#undef RTREE_MAPPED_TEMPLATE
+#undef RTREE_MAPPED_QUAL
+
+#endif    // RTREE_MAPPED_H
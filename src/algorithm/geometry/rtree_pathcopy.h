@@ -0,0 +1,574 @@
+#ifndef RTREE_PATHCOPY_H
+#define RTREE_PATHCOPY_H
+
+// Insert, remove and search for RTree variants whose nodes are shared and must not change under
+// someone else.  A write copies the nodes on its path and edits the copies, leaving the nodes it
+// came from to the variant: RTreeConcurrent retires them for readers still walking the old tree,
+// RTreePersistent keeps them for the versions still pointing at them.
+
+#include "rtree.h"
+
+
+#define RTREE_PATHCOPY_TEMPLATE template <class DERIVED, class NODEBASE, class DATATYPE, class ELEMTYPE, \
+    int NUMDIMS, class ELEMTYPEREAL, int TMAXNODES, int TMINNODES>
+#define RTREE_PATHCOPY_QUAL     RTreePathCopy<DERIVED, NODEBASE, DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL, \
+    TMAXNODES, TMINNODES>
+
+
+/// \class RTreePathCopy
+/// Tree algorithms written against three operations of DERIVED, which owns the nodes:
+///   Node* NewNode( int a_level )          a new empty node the current write may change
+///   Node* Writable( const Node* a_node )  a node the current write may change in place of a_node,
+///                                         taking over the caller's reference to it
+///   void  Drop( const Node* a_node )      give up the caller's reference to a subtree
+///
+/// NODEBASE is a base of every node holding what DERIVED needs to tell its nodes apart.
+/// DATATYPE needs to be copyable and comparable, it is kept next to the child pointer in every
+/// branch.  Splits use the R* choice of axis and distribution.
+template <class DERIVED, class NODEBASE, class DATATYPE, class ELEMTYPE, int NUMDIMS, class ELEMTYPEREAL,
+          int TMAXNODES, int TMINNODES>
+class RTreePathCopy
+{
+public:
+    enum
+    {
+        MAXNODES = TMAXNODES,   ///< Max elements in node
+        MINNODES = TMINNODES    ///< Min elements in node
+    };
+
+    typedef DATATYPE DataType;
+
+    /// Minimal bounding rectangle (n-dimensional)
+    struct Rect
+    {
+        ELEMTYPE m_min[NUMDIMS];
+        ELEMTYPE m_max[NUMDIMS];
+    };
+
+protected:
+    static_assert( TMAXNODES > TMINNODES && TMINNODES > 0, "Need 0 < TMINNODES < TMAXNODES" );
+
+    struct Node;
+
+    struct Branch
+    {
+        Rect        m_rect;
+        const Node* m_child;                        ///< Child node, unless in a leaf
+        DATATYPE    m_data;                         ///< Data Id or Ptr, in a leaf
+    };
+
+    struct Node : NODEBASE
+    {
+        bool IsInternalNode() const { return m_level > 0; }
+        bool IsLeaf() const { return m_level == 0; }
+
+        int     m_count;
+        int     m_level;                            ///< Leaf is zero, others positive
+        int     m_entryCount;                       ///< Data entries in the subtree
+        Branch  m_branch[MAXNODES];
+    };
+
+    DERIVED& Self() { return static_cast<DERIVED&>( *this ); }
+
+    static Branch DataBranch( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS],
+                              const DATATYPE& a_dataId );
+
+    const Node* InsertBranch( const Node* a_root, const Branch& a_branch );
+    const Node* RemoveBranch( const Node* a_root, const Rect& a_rect, const DATATYPE& a_dataId, bool& a_found );
+    bool        AddBranch( Node* a_node, const Branch& a_branch, Branch& a_sibling );
+
+    static void Partition( Branch* a_branches, int a_count, int& a_split );
+    static int  ChooseSubtree( const Node* a_node, const Rect& a_rect );
+    static bool FindEntry( const Node* a_node, const Rect& a_rect, const DATATYPE& a_id, std::vector<int>& a_path );
+    static void CollectEntries( const Node* a_node, std::vector<Branch>& a_entries );
+
+    template <class VISITOR>
+    static bool SearchRec( const Node* a_node, const Rect& a_rect, VISITOR& a_visitor, int& a_foundCount );
+
+    static Rect         NodeCover( const Node* a_node );
+    static Rect         CombineRect( const Rect& a_rectA, const Rect& a_rectB );
+    static bool         Overlap( const Rect& a_rectA, const Rect& a_rectB );
+    static bool         Contains( const Rect& a_outer, const Rect& a_inner );
+    static ELEMTYPEREAL RectVolume( const Rect& a_rect );
+    static ELEMTYPEREAL OverlapVolume( const Rect& a_rectA, const Rect& a_rectB );
+};
+
+
+RTREE_PATHCOPY_TEMPLATE
+typename RTREE_PATHCOPY_QUAL::Branch RTREE_PATHCOPY_QUAL::DataBranch( const ELEMTYPE  a_min[NUMDIMS],
+                                                                    const ELEMTYPE  a_max[NUMDIMS],
+                                                                    const DATATYPE& a_dataId )
+{
+    Branch branch;
+    std::copy( a_min, a_min + NUMDIMS, branch.m_rect.m_min );
+    std::copy( a_max, a_max + NUMDIMS, branch.m_rect.m_max );
+    branch.m_child = NULL;
+    branch.m_data  = a_dataId;
+    return branch;
+}
+
+
+// Remove an entry below a_root.  Underfull nodes on the path are dropped and their entries
+// inserted again, and the tree loses a level while the root has a single child.  Returns the
+// root of the changed tree, a_root untouched if the entry is not found.
+RTREE_PATHCOPY_TEMPLATE
+const typename RTREE_PATHCOPY_QUAL::Node* RTREE_PATHCOPY_QUAL::RemoveBranch( const Node*     a_root,
+                                                                             const Rect&     a_rect,
+                                                                             const DATATYPE& a_dataId,
+                                                                             bool&           a_found )
+{
+    std::vector<int> path;
+
+    a_found = FindEntry( a_root, a_rect, a_dataId, path );
+
+    if( !a_found )
+        return a_root;
+
+    // Copy the path down to the leaf
+    std::vector<std::pair<Node*, int>> parents;
+    Node*                              node = Self().Writable( a_root );
+    Node*                              root = node;
+
+    for( size_t depth = 0; depth + 1 < path.size(); ++depth )
+    {
+        Node* child = Self().Writable( node->m_branch[path[depth]].m_child );
+        node->m_branch[path[depth]].m_child = child;
+        parents.emplace_back( node, path[depth] );
+        node = child;
+    }
+
+    node->m_branch[path.back()] = node->m_branch[node->m_count - 1];
+    --node->m_count;
+    --node->m_entryCount;
+
+    // Going up, drop underfull nodes and keep their entries for inserting again
+    std::vector<Branch> orphans;
+    int                 lost = 1;   // Entries no longer below the nodes still to be visited
+
+    for( auto parent = parents.rbegin(); parent != parents.rend(); ++parent )
+    {
+        Node* const parentNode = parent->first;
+        const int   index = parent->second;
+        const Node* child = parentNode->m_branch[index].m_child;
+        const bool  underfull = child->m_count < MINNODES;
+
+        if( underfull )
+            lost += child->m_entryCount;
+
+        parentNode->m_entryCount -= lost;
+
+        if( underfull )
+        {
+            parentNode->m_branch[index] = parentNode->m_branch[parentNode->m_count - 1];
+            --parentNode->m_count;
+            CollectEntries( child, orphans );
+            Self().Drop( child );
+        }
+        else
+        {
+            parentNode->m_branch[index].m_rect = NodeCover( child );
+        }
+    }
+
+    // Shorten the tree while the root has a single child, which takes over the root's reference
+    const Node* result = root;
+
+    while( result->IsInternalNode() && result->m_count == 1 )
+    {
+        Node*       single = Self().Writable( result );
+        const Node* child = single->m_branch[0].m_child;
+
+        single->m_count = 0;
+        Self().Drop( single );
+        result = child;
+    }
+
+    for( const Branch& orphan : orphans )
+    {
+        result = InsertBranch( result, orphan );
+    }
+
+    return result;
+}
+
+
+// Append the data branches of a subtree
+RTREE_PATHCOPY_TEMPLATE
+void RTREE_PATHCOPY_QUAL::CollectEntries( const Node* a_node, std::vector<Branch>& a_entries )
+{
+    for( int index = 0; index < a_node->m_count; ++index )
+    {
+        if( a_node->IsInternalNode() )
+            CollectEntries( a_node->m_branch[index].m_child, a_entries );
+        else
+            a_entries.push_back( a_node->m_branch[index] );
+    }
+}
+
+
+RTREE_PATHCOPY_TEMPLATE
+template <class VISITOR>
+bool RTREE_PATHCOPY_QUAL::SearchRec( const Node* a_node, const Rect& a_rect, VISITOR& a_visitor,
+                                     int& a_foundCount )
+{
+    for( int index = 0; index < a_node->m_count; ++index )
+    {
+        const Branch& branch = a_node->m_branch[index];
+
+        if( !Overlap( a_rect, branch.m_rect ) )
+            continue;
+
+        if( a_node->IsLeaf() )
+        {
+            if( !a_visitor( branch.m_data ) )
+                return false;
+
+            ++a_foundCount;
+        }
+        else if( !SearchRec( branch.m_child, a_rect, a_visitor, a_foundCount ) )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+// Insert a data branch below a_root, copying the nodes on the way down.  Returns the root
+// of the changed tree, a new one if the old root was split.
+RTREE_PATHCOPY_TEMPLATE
+const typename RTREE_PATHCOPY_QUAL::Node* RTREE_PATHCOPY_QUAL::InsertBranch( const Node*   a_root,
+                                                                             const Branch& a_branch )
+{
+    std::vector<std::pair<Node*, int>> parents;
+    Node*                              node = Self().Writable( a_root );
+    Node*                              root = node;
+
+    while( node->IsInternalNode() )
+    {
+        const int index = ChooseSubtree( node, a_branch.m_rect );
+        Node*     child = Self().Writable( node->m_branch[index].m_child );
+
+        node->m_branch[index].m_child = child;
+        parents.emplace_back( node, index );
+        node = child;
+    }
+
+    Branch sibling;
+    bool   split = AddBranch( node, a_branch, sibling );
+
+    for( auto parent = parents.rbegin(); parent != parents.rend(); ++parent )
+    {
+        Node* const parentNode = parent->first;
+        Branch&     branch = parentNode->m_branch[parent->second];
+
+        branch.m_rect = NodeCover( branch.m_child );
+
+        if( split )
+        {
+            // One entry more below, part of them now counted again as the sibling is added
+            parentNode->m_entryCount += 1 - sibling.m_child->m_entryCount;
+            split = AddBranch( parentNode, Branch( sibling ), sibling );
+        }
+        else
+        {
+            ++parentNode->m_entryCount;
+        }
+    }
+
+    if( split )
+    {
+        Node* newRoot = Self().NewNode( root->m_level + 1 );
+        Branch branch;
+        branch.m_rect  = NodeCover( root );
+        branch.m_child = root;
+        AddBranch( newRoot, branch, sibling );
+        AddBranch( newRoot, Branch( sibling ), sibling );
+        root = newRoot;
+    }
+
+    return root;
+}
+
+
+// Add a branch to a node.  When the node is full its branches and the new one are shared with a
+// new sibling, returned in a_sibling.
+RTREE_PATHCOPY_TEMPLATE
+bool RTREE_PATHCOPY_QUAL::AddBranch( Node* a_node, const Branch& a_branch, Branch& a_sibling )
+{
+    auto entries = [a_node]( const Branch& a_entry )
+    {
+        return a_node->IsLeaf() ? 1 : a_entry.m_child->m_entryCount;
+    };
+
+    if( a_node->m_count < MAXNODES )
+    {
+        a_node->m_branch[a_node->m_count++] = a_branch;
+        a_node->m_entryCount += entries( a_branch );
+        return false;
+    }
+
+    Branch buffer[MAXNODES + 1];
+    std::copy( a_node->m_branch, a_node->m_branch + MAXNODES, buffer );
+    buffer[MAXNODES] = a_branch;
+
+    int split;
+    Partition( buffer, MAXNODES + 1, split );
+
+    Node* other = Self().NewNode( a_node->m_level );
+
+    a_node->m_count = 0;
+    a_node->m_entryCount = 0;
+
+    for( int index = 0; index <= MAXNODES; ++index )
+    {
+        Node* target = index < split ? a_node : other;
+        target->m_branch[target->m_count++] = buffer[index];
+        target->m_entryCount += entries( buffer[index] );
+    }
+
+    a_sibling.m_rect  = NodeCover( other );
+    a_sibling.m_child = other;
+
+    return true;
+}
+
+
+// R* split: the axis with the least margin over all distributions, then the distribution along
+// it with the least overlap, ties broken by volume.  Leaves the branches sorted along the axis
+// and the first a_split of them for the first node.
+RTREE_PATHCOPY_TEMPLATE
+void RTREE_PATHCOPY_QUAL::Partition( Branch* a_branches, int a_count, int& a_split )
+{
+    auto sortOnAxis = [a_branches, a_count]( int a_axis )
+    {
+        std::sort( a_branches, a_branches + a_count,
+                   [a_axis]( const Branch& a_branchA, const Branch& a_branchB )
+                   {
+                       return (ELEMTYPEREAL) a_branchA.m_rect.m_min[a_axis] + a_branchA.m_rect.m_max[a_axis]
+                              < (ELEMTYPEREAL) a_branchB.m_rect.m_min[a_axis] + a_branchB.m_rect.m_max[a_axis];
+                   } );
+    };
+
+    // Covers of the first k and of the last count - k branches
+    Rect prefix[MAXNODES + 1];
+    Rect suffix[MAXNODES + 1];
+
+    auto coverRuns = [&]()
+    {
+        prefix[0] = a_branches[0].m_rect;
+        suffix[a_count - 1] = a_branches[a_count - 1].m_rect;
+
+        for( int index = 1; index < a_count; ++index )
+        {
+            prefix[index] = CombineRect( prefix[index - 1], a_branches[index].m_rect );
+            suffix[a_count - 1 - index] = CombineRect( suffix[a_count - index], a_branches[a_count - 1 - index].m_rect );
+        }
+    };
+
+    auto margin = []( const Rect& a_rect )
+    {
+        ELEMTYPEREAL sum = 0;
+
+        for( int axis = 0; axis < NUMDIMS; ++axis )
+        {
+            sum += (ELEMTYPEREAL) a_rect.m_max[axis] - a_rect.m_min[axis];
+        }
+
+        return sum;
+    };
+
+    int          bestAxis = 0;
+    ELEMTYPEREAL bestMargin = std::numeric_limits<ELEMTYPEREAL>::max();
+
+    for( int axis = 0; axis < NUMDIMS; ++axis )
+    {
+        sortOnAxis( axis );
+        coverRuns();
+
+        ELEMTYPEREAL sum = 0;
+
+        for( int split = MINNODES; split <= a_count - MINNODES; ++split )
+        {
+            sum += margin( prefix[split - 1] ) + margin( suffix[split] );
+        }
+
+        if( sum < bestMargin )
+        {
+            bestMargin = sum;
+            bestAxis = axis;
+        }
+    }
+
+    sortOnAxis( bestAxis );
+    coverRuns();
+
+    ELEMTYPEREAL bestOverlap = std::numeric_limits<ELEMTYPEREAL>::max();
+    ELEMTYPEREAL bestVolume = std::numeric_limits<ELEMTYPEREAL>::max();
+
+    a_split = MINNODES;
+
+    for( int split = MINNODES; split <= a_count - MINNODES; ++split )
+    {
+        const ELEMTYPEREAL overlap = OverlapVolume( prefix[split - 1], suffix[split] );
+        const ELEMTYPEREAL volume = RectVolume( prefix[split - 1] ) + RectVolume( suffix[split] );
+
+        if( overlap < bestOverlap || ( overlap == bestOverlap && volume < bestVolume ) )
+        {
+            bestOverlap = overlap;
+            bestVolume = volume;
+            a_split = split;
+        }
+    }
+}
+
+
+// Pick the child needing the least enlargement, ties resolved by the smallest volume
+RTREE_PATHCOPY_TEMPLATE
+int RTREE_PATHCOPY_QUAL::ChooseSubtree( const Node* a_node, const Rect& a_rect )
+{
+    int          best = 0;
+    ELEMTYPEREAL bestIncrease = std::numeric_limits<ELEMTYPEREAL>::max();
+    ELEMTYPEREAL bestVolume = std::numeric_limits<ELEMTYPEREAL>::max();
+
+    for( int index = 0; index < a_node->m_count; ++index )
+    {
+        const Rect&        rect = a_node->m_branch[index].m_rect;
+        const ELEMTYPEREAL volume = RectVolume( rect );
+        const ELEMTYPEREAL increase = RectVolume( CombineRect( a_rect, rect ) ) - volume;
+
+        if( increase < bestIncrease || ( increase == bestIncrease && volume < bestVolume ) )
+        {
+            best = index;
+            bestIncrease = increase;
+            bestVolume = volume;
+        }
+    }
+
+    return best;
+}
+
+
+// Branch indices from a_node down to the entry, the last one in the leaf
+RTREE_PATHCOPY_TEMPLATE
+bool RTREE_PATHCOPY_QUAL::FindEntry( const Node* a_node, const Rect& a_rect, const DATATYPE& a_id,
+                                     std::vector<int>& a_path )
+{
+    for( int index = 0; index < a_node->m_count; ++index )
+    {
+        const Branch& branch = a_node->m_branch[index];
+
+        if( a_node->IsLeaf() )
+        {
+            if( branch.m_data == a_id && Contains( branch.m_rect, a_rect ) && Contains( a_rect, branch.m_rect ) )
+            {
+                a_path.push_back( index );
+                return true;
+            }
+        }
+        else if( Contains( branch.m_rect, a_rect ) )
+        {
+            a_path.push_back( index );
+
+            if( FindEntry( branch.m_child, a_rect, a_id, a_path ) )
+                return true;
+
+            a_path.pop_back();
+        }
+    }
+
+    return false;
+}
+
+
+RTREE_PATHCOPY_TEMPLATE
+typename RTREE_PATHCOPY_QUAL::Rect RTREE_PATHCOPY_QUAL::NodeCover( const Node* a_node )
+{
+    Rect rect = a_node->m_branch[0].m_rect;
+
+    for( int index = 1; index < a_node->m_count; ++index )
+    {
+        rect = CombineRect( rect, a_node->m_branch[index].m_rect );
+    }
+
+    return rect;
+}
+
+
+RTREE_PATHCOPY_TEMPLATE
+typename RTREE_PATHCOPY_QUAL::Rect RTREE_PATHCOPY_QUAL::CombineRect( const Rect& a_rectA, const Rect& a_rectB )
+{
+    Rect rect;
+
+    for( int index = 0; index < NUMDIMS; ++index )
+    {
+        rect.m_min[index] = std::min( a_rectA.m_min[index], a_rectB.m_min[index] );
+        rect.m_max[index] = std::max( a_rectA.m_max[index], a_rectB.m_max[index] );
+    }
+
+    return rect;
+}
+
+
+RTREE_PATHCOPY_TEMPLATE
+bool RTREE_PATHCOPY_QUAL::Overlap( const Rect& a_rectA, const Rect& a_rectB )
+{
+    for( int index = 0; index < NUMDIMS; ++index )
+    {
+        if( a_rectA.m_min[index] > a_rectB.m_max[index] || a_rectB.m_min[index] > a_rectA.m_max[index] )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+RTREE_PATHCOPY_TEMPLATE
+bool RTREE_PATHCOPY_QUAL::Contains( const Rect& a_outer, const Rect& a_inner )
+{
+    for( int index = 0; index < NUMDIMS; ++index )
+    {
+        if( a_inner.m_min[index] < a_outer.m_min[index] || a_inner.m_max[index] > a_outer.m_max[index] )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+RTREE_PATHCOPY_TEMPLATE
+ELEMTYPEREAL RTREE_PATHCOPY_QUAL::RectVolume( const Rect& a_rect )
+{
+    return RTreeRectVolume::template Volume<ELEMTYPEREAL, NUMDIMS>( a_rect.m_min, a_rect.m_max );
+}
+
+
+RTREE_PATHCOPY_TEMPLATE
+ELEMTYPEREAL RTREE_PATHCOPY_QUAL::OverlapVolume( const Rect& a_rectA, const Rect& a_rectB )
+{
+    Rect intersection;
+
+    for( int index = 0; index < NUMDIMS; ++index )
+    {
+        intersection.m_min[index] = std::max( a_rectA.m_min[index], a_rectB.m_min[index] );
+        intersection.m_max[index] = std::min( a_rectA.m_max[index], a_rectB.m_max[index] );
+
+        if( intersection.m_min[index] > intersection.m_max[index] )
+        {
+            return 0;
+        }
+    }
+
+    return RectVolume( intersection );
+}
+
+
+#undef RTREE_PATHCOPY_TEMPLATE
+#undef RTREE_PATHCOPY_QUAL
+
+#endif    // RTREE_PATHCOPY_H
@@ -0,0 +1,279 @@
+#ifndef RTREE_PERSISTENT_H
+#define RTREE_PERSISTENT_H
+
+// RTree with value semantics where every copy is a version.
+//
+// Nodes are reference counted and shared between versions.  Copying a tree only takes a
+// reference to its root; Insert and Remove copy the nodes on the path they change while other
+// versions still hold them, so a write costs one path and the versions kept cost memory in
+// proportion to the changes between them.
+
+#include "rtree_pathcopy.h"
+
+#include <atomic>
+#include <unordered_set>
+
+
+/// Node state RTreePersistent keeps next to the branches
+struct RTreePersistentNodeBase
+{
+    RTreePersistentNodeBase() : m_refCount( 1 ) {}
+
+    /// A copy is a new node, held by whoever made it
+    RTreePersistentNodeBase( const RTreePersistentNodeBase& ) : m_refCount( 1 ) {}
+
+    mutable std::atomic<int> m_refCount;            ///< Versions and parent nodes holding the node
+};
+
+
+#define RTREE_PERSISTENT_TEMPLATE template <class DATATYPE, class ELEMTYPE, int NUMDIMS, class ELEMTYPEREAL, \
+    int TMAXNODES, int TMINNODES>
+#define RTREE_PERSISTENT_QUAL     RTreePersistent<DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL, TMAXNODES, TMINNODES>
+
+
+/// \class RTreePersistent
+/// RTree whose copies are O(1) snapshots sharing all nodes they have in common.  Changing one
+/// version never shows in another.
+///
+/// Different versions may be read and changed on different threads at the same time, the
+/// reference counts are atomic.  A single version is not thread-safe, as for RTree.
+///
+/// DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL, TMAXNODES and TMINNODES as for RTree.  DATATYPE
+/// needs to be copyable and comparable, it is kept next to the child pointer in every branch.
+/// Splits use the R* choice of axis and distribution.
+template <class DATATYPE, class ELEMTYPE, int NUMDIMS, class ELEMTYPEREAL = ELEMTYPE, int TMAXNODES = 8,
+          int TMINNODES = TMAXNODES / 2>
+class RTreePersistent : public RTreePathCopy<RTreePersistent<DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL, TMAXNODES,
+                                                             TMINNODES>,
+                                             RTreePersistentNodeBase, DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL,
+                                             TMAXNODES, TMINNODES>
+{
+    typedef RTreePathCopy<RTreePersistent, RTreePersistentNodeBase, DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL,
+                          TMAXNODES, TMINNODES> PathCopy;
+
+    friend PathCopy;
+
+public:
+    typedef typename PathCopy::Rect Rect;
+
+    RTreePersistent();
+
+    /// Snapshot of a_other, sharing all of its nodes
+    RTreePersistent( const RTreePersistent& a_other );
+    RTreePersistent& operator=( const RTreePersistent& a_other );
+
+    ~RTreePersistent();
+
+    /// Insert entry into this version
+    void Insert( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS], const DATATYPE& a_dataId );
+
+    /// Remove entry from this version
+    /// \return true if record not found, false if success, as RTree::Remove
+    bool Remove( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS], const DATATYPE& a_dataId );
+
+    /// Remove all entries from this version
+    void RemoveAll();
+
+    /// Find all within search rectangle
+    /// \param a_visitor functor bool( const DATATYPE& ).  Return 'true' to continue searching
+    /// \return Returns the number of entries found
+    template <class VISITOR>
+    int Search( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS], VISITOR&& a_visitor ) const;
+
+    /// Count the data elements in this version
+    int Count() const;
+
+    /// Distinct nodes held by a range of versions, each shared node counted once
+    template <class ITERATOR>
+    static size_t CountNodes( ITERATOR a_first, ITERATOR a_last );
+
+    /// Size of one node in bytes, CountNodes() times this is the memory held by the versions
+    static constexpr size_t NodeBytes() { return sizeof( typename PathCopy::Node ); }
+
+protected:
+    typedef typename PathCopy::Node   Node;
+    typedef typename PathCopy::Branch Branch;
+
+    Node*   NewNode( int a_level );
+    Node*   Writable( const Node* a_node );
+    void    Drop( const Node* a_node );
+
+    static void CountNodesRec( const Node* a_node, std::unordered_set<const Node*>& a_seen );
+
+    const Node* m_root;
+};
+
+
+RTREE_PERSISTENT_TEMPLATE
+RTREE_PERSISTENT_QUAL::RTreePersistent() : m_root( NewNode( 0 ) )
+{
+}
+
+
+RTREE_PERSISTENT_TEMPLATE
+RTREE_PERSISTENT_QUAL::RTreePersistent( const RTreePersistent& a_other ) : m_root( a_other.m_root )
+{
+    m_root->m_refCount.fetch_add( 1, std::memory_order_relaxed );
+}
+
+
+RTREE_PERSISTENT_TEMPLATE
+RTREE_PERSISTENT_QUAL& RTREE_PERSISTENT_QUAL::operator=( const RTreePersistent& a_other )
+{
+    // Take the new root before dropping the old one, they may be the same
+    a_other.m_root->m_refCount.fetch_add( 1, std::memory_order_relaxed );
+    Drop( m_root );
+    m_root = a_other.m_root;
+    return *this;
+}
+
+
+RTREE_PERSISTENT_TEMPLATE
+RTREE_PERSISTENT_QUAL::~RTreePersistent()
+{
+    Drop( m_root );
+}
+
+
+RTREE_PERSISTENT_TEMPLATE
+void RTREE_PERSISTENT_QUAL::Insert( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS],
+                                    const DATATYPE& a_dataId )
+{
+    m_root = this->InsertBranch( m_root, PathCopy::DataBranch( a_min, a_max, a_dataId ) );
+}
+
+
+RTREE_PERSISTENT_TEMPLATE
+bool RTREE_PERSISTENT_QUAL::Remove( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS],
+                                    const DATATYPE& a_dataId )
+{
+    Rect rect;
+    std::copy( a_min, a_min + NUMDIMS, rect.m_min );
+    std::copy( a_max, a_max + NUMDIMS, rect.m_max );
+
+    bool found;
+    m_root = this->RemoveBranch( m_root, rect, a_dataId, found );
+
+    return !found;
+}
+
+
+RTREE_PERSISTENT_TEMPLATE
+void RTREE_PERSISTENT_QUAL::RemoveAll()
+{
+    Drop( m_root );
+    m_root = NewNode( 0 );
+}
+
+
+RTREE_PERSISTENT_TEMPLATE
+template <class VISITOR>
+int RTREE_PERSISTENT_QUAL::Search( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS],
+                                   VISITOR&& a_visitor ) const
+{
+    Rect rect;
+    std::copy( a_min, a_min + NUMDIMS, rect.m_min );
+    std::copy( a_max, a_max + NUMDIMS, rect.m_max );
+
+    int foundCount = 0;
+    PathCopy::SearchRec( m_root, rect, a_visitor, foundCount );
+
+    return foundCount;
+}
+
+
+RTREE_PERSISTENT_TEMPLATE
+int RTREE_PERSISTENT_QUAL::Count() const
+{
+    return m_root->m_entryCount;
+}
+
+
+RTREE_PERSISTENT_TEMPLATE
+template <class ITERATOR>
+size_t RTREE_PERSISTENT_QUAL::CountNodes( ITERATOR a_first, ITERATOR a_last )
+{
+    std::unordered_set<const Node*> seen;
+
+    for( ; a_first != a_last; ++a_first )
+    {
+        CountNodesRec( a_first->m_root, seen );
+    }
+
+    return seen.size();
+}
+
+
+RTREE_PERSISTENT_TEMPLATE
+void RTREE_PERSISTENT_QUAL::CountNodesRec( const Node* a_node, std::unordered_set<const Node*>& a_seen )
+{
+    // A node seen before was reached with its whole subtree
+    if( !a_seen.insert( a_node ).second || a_node->IsLeaf() )
+        return;
+
+    for( int index = 0; index < a_node->m_count; ++index )
+    {
+        CountNodesRec( a_node->m_branch[index].m_child, a_seen );
+    }
+}
+
+
+RTREE_PERSISTENT_TEMPLATE
+typename RTREE_PERSISTENT_QUAL::Node* RTREE_PERSISTENT_QUAL::NewNode( int a_level )
+{
+    Node* node = new Node();
+    node->m_count      = 0;
+    node->m_level      = a_level;
+    node->m_entryCount = 0;
+    return node;
+}
+
+
+// A node the current write may change: a node held only by the caller is changed in place, a
+// shared one is copied.  The copy holds the children as well and the caller's reference to the
+// original is given up.
+RTREE_PERSISTENT_TEMPLATE
+typename RTREE_PERSISTENT_QUAL::Node* RTREE_PERSISTENT_QUAL::Writable( const Node* a_node )
+{
+    if( a_node->m_refCount.load( std::memory_order_acquire ) == 1 )
+        return const_cast<Node*>( a_node );
+
+    Node* copy = new Node( *a_node );
+
+    if( copy->IsInternalNode() )
+    {
+        for( int index = 0; index < copy->m_count; ++index )
+        {
+            copy->m_branch[index].m_child->m_refCount.fetch_add( 1, std::memory_order_relaxed );
+        }
+    }
+
+    // The other holders may have let go meanwhile, then the original goes here
+    Drop( a_node );
+    return copy;
+}
+
+
+// Give up a reference to a subtree, freeing the nodes no version holds any more
+RTREE_PERSISTENT_TEMPLATE
+void RTREE_PERSISTENT_QUAL::Drop( const Node* a_node )
+{
+    if( a_node->m_refCount.fetch_sub( 1, std::memory_order_acq_rel ) != 1 )
+        return;
+
+    if( a_node->IsInternalNode() )
+    {
+        for( int index = 0; index < a_node->m_count; ++index )
+        {
+            Drop( a_node->m_branch[index].m_child );
+        }
+    }
+
+    delete a_node;
+}
+
+
+#undef RTREE_PERSISTENT_TEMPLATE
+#undef RTREE_PERSISTENT_QUAL
+
+#endif    // RTREE_PERSISTENT_H
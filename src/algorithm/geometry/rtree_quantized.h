@@ -0,0 +1,326 @@
+#ifndef RTREE_QUANTIZED_H
+#define RTREE_QUANTIZED_H
+
+// Read-only copy of an RTree with compressed nodes, so many more nodes stay in cache.
+//
+// Every node keeps its own cover exactly, as the frame its branches are quantized to: each
+// branch stores its box as 8 or 16-bit codes along the frame, the min rounded down and the max
+// rounded up.  An 8-way node of a 2D double tree shrinks from 336 bytes, six cache lines, to 72
+// with 8-bit codes.  The exact frame alone takes 32 of those, so the node does not fit one 64-byte
+// line: packed back to back, most nodes straddle two lines.
+//
+// A query maps its window into the frame of each node it visits with the same expression
+// that encoded the branches.  That expression never decreases as its input grows, so a branch
+// whose exact box overlaps the window always has codes that overlap the window's codes: the test
+// may let a few extra branches through but never drops one.  Leaves either keep the exact boxes
+// in a side array to re-check candidates, or report the candidates as they are.
+
+#include "rtree.h"
+
+#include <cmath>
+#include <type_traits>
+
+
+/// What the leaves of an RTreeQuantized keep
+enum class RTreeQuantizedLeaves
+{
+    EXACT,      ///< Exact boxes in a side array, Search re-checks candidates and is exact
+    CANDIDATES  ///< Codes only, Search also reports entries whose rounded box touches the window
+};
+
+
+#define RTREE_QUANTIZED_TEMPLATE template <class DATATYPE, class ELEMTYPE, int NUMDIMS, class ELEMTYPEREAL, \
+    int TMAXNODES, class CODE>
+#define RTREE_QUANTIZED_QUAL     RTreeQuantized<DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL, TMAXNODES, CODE>
+
+
+/// \class RTreeQuantized
+/// Read-only RTree with quantized branch boxes, copied from a built one by Quantize.
+///
+/// DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL as for RTree.  TMAXNODES must be at least the
+/// node capacity of the trees copied.  CODE is uint8_t or uint16_t, the resolution of a branch
+/// box within its node.
+template <class DATATYPE, class ELEMTYPE, int NUMDIMS, class ELEMTYPEREAL = ELEMTYPE, int TMAXNODES = 8,
+          class CODE = uint8_t>
+class RTreeQuantized
+{
+    static_assert( std::is_same<CODE, uint8_t>::value || std::is_same<CODE, uint16_t>::value,
+                   "Branch boxes are quantized to 8 or 16 bits" );
+
+public:
+    typedef DATATYPE DataType;
+
+    static constexpr CODE MAX_CODE = std::numeric_limits<CODE>::max();
+
+    /// Box of a branch in the frame of its node
+    struct Code
+    {
+        CODE m_min[NUMDIMS];
+        CODE m_max[NUMDIMS];
+    };
+
+    /// Node with its exact cover, the children of an internal node are consecutive
+    struct Node
+    {
+        ELEMTYPE m_min[NUMDIMS];                    ///< Frame of m_codes
+        ELEMTYPE m_max[NUMDIMS];
+        uint32_t m_first;                           ///< First child node, or first entry of a leaf
+        uint16_t m_count;
+        uint16_t m_level;                           ///< Leaf is zero, others positive
+        Code     m_codes[TMAXNODES];
+
+        bool IsLeaf() const { return m_level == 0; }
+    };
+
+    RTreeQuantized();
+
+    /// Quantize a_tree, see Quantize
+    template <class RTREE>
+    explicit RTreeQuantized( const RTREE& a_tree, RTreeQuantizedLeaves a_leaves = RTreeQuantizedLeaves::EXACT );
+
+    /// Replace the contents with a compressed copy of a_tree, which is left untouched
+    /// \param a_tree RTree with the same DATATYPE, ELEMTYPE and NUMDIMS and at most TMAXNODES
+    /// branches per node, other parameters may differ
+    template <class RTREE>
+    void Quantize( const RTREE& a_tree, RTreeQuantizedLeaves a_leaves = RTreeQuantizedLeaves::EXACT );
+
+    /// Count the data elements
+    int Count() const { return (int) m_data.size(); }
+
+    /// Bytes held by the nodes, the data and the exact leaf boxes
+    size_t MemoryBytes() const
+    {
+        return m_nodes.capacity() * sizeof( Node ) + m_data.capacity() * sizeof( DATATYPE )
+               + m_exact.capacity() * sizeof( ExactBox );
+    }
+
+    /// Find all within search rectangle.  With RTreeQuantizedLeaves::CANDIDATES the visitor also
+    /// sees entries just outside it, within the rounding of their leaf.
+    /// \param a_visitor functor bool( const DATATYPE& ).  Return 'true' to continue searching
+    /// \return Returns the number of entries found
+    template <class VISITOR>
+    int Search( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS], VISITOR&& a_visitor ) const;
+
+private:
+    struct ExactBox
+    {
+        ELEMTYPE m_min[NUMDIMS];
+        ELEMTYPE m_max[NUMDIMS];
+    };
+
+    /// Code units per ELEMTYPE unit along an axis of a_node's frame, zero for an empty or
+    /// unbounded frame, which makes every branch cover the whole frame
+    static double Scale( const Node& a_node, int a_axis )
+    {
+        const double extent = (double) a_node.m_max[a_axis] - (double) a_node.m_min[a_axis];
+
+        return extent > 0 && extent <= std::numeric_limits<double>::max() ? MAX_CODE / extent : 0;
+    }
+
+    /// Position of a_value along the frame, in code units.  Encoding and queries must both go
+    /// through here: it is monotone in a_value, which is what keeps the test conservative.
+    static double Scaled( ELEMTYPE a_value, ELEMTYPE a_frameMin, double a_scale )
+    {
+        return ( (double) a_value - (double) a_frameMin ) * a_scale;
+    }
+
+    static CODE LowCode( double a_scaled )
+    {
+        return a_scaled <= 0 ? 0 : a_scaled >= MAX_CODE ? MAX_CODE : (CODE) std::floor( a_scaled );
+    }
+
+    static CODE HighCode( double a_scaled )
+    {
+        return a_scaled <= 0 ? 0 : a_scaled >= MAX_CODE ? MAX_CODE : (CODE) std::ceil( a_scaled );
+    }
+
+    template <class VISITOR>
+    bool SearchRec( const Node& a_node, const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS],
+                    VISITOR& a_visitor, int& a_foundCount ) const;
+
+    std::vector<Node>       m_nodes;        ///< Breadth first, the root first
+    std::vector<DATATYPE>   m_data;         ///< Leaf entries in leaf order
+    std::vector<ExactBox>   m_exact;        ///< Exact box of each entry, empty for CANDIDATES
+};
+
+
+RTREE_QUANTIZED_TEMPLATE
+RTREE_QUANTIZED_QUAL::RTreeQuantized()
+{
+}
+
+
+RTREE_QUANTIZED_TEMPLATE
+template <class RTREE>
+RTREE_QUANTIZED_QUAL::RTreeQuantized( const RTREE& a_tree, RTreeQuantizedLeaves a_leaves )
+{
+    Quantize( a_tree, a_leaves );
+}
+
+
+RTREE_QUANTIZED_TEMPLATE
+template <class RTREE>
+void RTREE_QUANTIZED_QUAL::Quantize( const RTREE& a_tree, RTreeQuantizedLeaves a_leaves )
+{
+    typedef typename RTREE::Node TreeNode;
+
+    static_assert( std::is_same<typename RTREE::DataType, DATATYPE>::value
+                   && std::is_same<decltype( RTREE::Rect::m_min ), ELEMTYPE[NUMDIMS]>::value,
+                   "Tree and quantized copy must agree on DATATYPE, ELEMTYPE and NUMDIMS" );
+    static_assert( RTREE::MAXNODES <= TMAXNODES, "Nodes of the tree must fit TMAXNODES" );
+
+    // Breadth first, so the children of every node are consecutive
+    std::vector<const TreeNode*> order( 1, a_tree.m_root );
+
+    for( size_t index = 0; index < order.size(); ++index )
+    {
+        if( order[index]->IsInternalNode() )
+        {
+            for( int branch = 0; branch < order[index]->m_count; ++branch )
+            {
+                order.push_back( order[index]->m_branch[branch].m_child );
+            }
+        }
+    }
+
+    m_nodes.assign( order.size(), Node() );
+    m_data.clear();
+    m_exact.clear();
+
+    uint32_t nextChild = 1;
+
+    for( size_t index = 0; index < order.size(); ++index )
+    {
+        const TreeNode* source = order[index];
+        Node&           node = m_nodes[index];
+        const auto      cover = a_tree.NodeCover( const_cast<TreeNode*>( source ) );
+        double          scale[NUMDIMS];
+
+        std::copy( cover.m_min, cover.m_min + NUMDIMS, node.m_min );
+        std::copy( cover.m_max, cover.m_max + NUMDIMS, node.m_max );
+        node.m_count = (uint16_t) source->m_count;
+        node.m_level = (uint16_t) source->m_level;
+        node.m_first = source->IsLeaf() ? (uint32_t) m_data.size() : nextChild;
+
+        for( int axis = 0; axis < NUMDIMS; ++axis )
+        {
+            scale[axis] = Scale( node, axis );
+        }
+
+        for( int branch = 0; branch < source->m_count; ++branch )
+        {
+            const auto& rect = source->m_branch[branch].m_rect;
+            Code&       code = node.m_codes[branch];
+
+            for( int axis = 0; axis < NUMDIMS; ++axis )
+            {
+                code.m_min[axis] = LowCode( Scaled( rect.m_min[axis], node.m_min[axis], scale[axis] ) );
+                code.m_max[axis] = HighCode( Scaled( rect.m_max[axis], node.m_min[axis], scale[axis] ) );
+            }
+
+            if( source->IsInternalNode() )
+            {
+                ++nextChild;
+            }
+            else
+            {
+                m_data.push_back( a_tree.BranchData( source->m_branch[branch] ) );
+
+                if( a_leaves == RTreeQuantizedLeaves::EXACT )
+                {
+                    ExactBox exact;
+
+                    std::copy( rect.m_min, rect.m_min + NUMDIMS, exact.m_min );
+                    std::copy( rect.m_max, rect.m_max + NUMDIMS, exact.m_max );
+                    m_exact.push_back( exact );
+                }
+            }
+        }
+    }
+}
+
+
+RTREE_QUANTIZED_TEMPLATE
+template <class VISITOR>
+int RTREE_QUANTIZED_QUAL::Search( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS],
+                                  VISITOR&& a_visitor ) const
+{
+    int foundCount = 0;
+
+    if( !m_nodes.empty() )
+        SearchRec( m_nodes[0], a_min, a_max, a_visitor, foundCount );
+
+    return foundCount;
+}
+
+
+RTREE_QUANTIZED_TEMPLATE
+template <class VISITOR>
+bool RTREE_QUANTIZED_QUAL::SearchRec( const Node& a_node, const ELEMTYPE a_min[NUMDIMS],
+                                      const ELEMTYPE a_max[NUMDIMS], VISITOR& a_visitor, int& a_foundCount ) const
+{
+    Code window;
+
+    // The exact frame first: it keeps the clamped window codes from matching branches on the
+    // frame's border when the window lies beyond it
+    for( int axis = 0; axis < NUMDIMS; ++axis )
+    {
+        if( a_node.m_min[axis] > a_max[axis] || a_min[axis] > a_node.m_max[axis] )
+            return true;
+
+        const double scale = Scale( a_node, axis );
+
+        window.m_min[axis] = LowCode( Scaled( a_min[axis], a_node.m_min[axis], scale ) );
+        window.m_max[axis] = HighCode( Scaled( a_max[axis], a_node.m_min[axis], scale ) );
+    }
+
+    for( int index = 0; index < a_node.m_count; ++index )
+    {
+        const Code& code = a_node.m_codes[index];
+        bool        overlap = true;
+
+        for( int axis = 0; axis < NUMDIMS; ++axis )
+        {
+            overlap &= code.m_min[axis] <= window.m_max[axis] && window.m_min[axis] <= code.m_max[axis];
+        }
+
+        if( !overlap )
+            continue;
+
+        const uint32_t target = a_node.m_first + index;
+
+        if( !a_node.IsLeaf() )
+        {
+            if( !SearchRec( m_nodes[target], a_min, a_max, a_visitor, a_foundCount ) )
+                return false;
+
+            continue;
+        }
+
+        if( !m_exact.empty() )
+        {
+            const ExactBox& exact = m_exact[target];
+
+            for( int axis = 0; axis < NUMDIMS; ++axis )
+            {
+                overlap &= exact.m_min[axis] <= a_max[axis] && a_min[axis] <= exact.m_max[axis];
+            }
+
+            if( !overlap )
+                continue;
+        }
+
+        if( !a_visitor( m_data[target] ) )
+            return false;
+
+        a_foundCount++;
+    }
+
+    return true;
+}
+
+
+#undef RTREE_QUANTIZED_TEMPLATE
+#undef RTREE_QUANTIZED_QUAL
+
+#endif    // RTREE_QUANTIZED_H
@@ -0,0 +1,873 @@
+#ifndef RTREE_SHARDED_H
+#define RTREE_SHARDED_H
+
+// RTree split into spatial shards, each written by a thread of its own.
+//
+// A k-d partition cuts space into K regions.  Every region has its own RTree and writer thread;
+// Insert and Remove only push the operation onto a lock-free queue of the region holding the
+// centre of the rect, so callers on many threads neither wait for each other nor for a tree.
+// Queries visit the shards whose entries they overlap, locking only those.  When one shard grows
+// well past the average, the partition is recomputed from the entries and the shards are rebuilt.
+
+#include "rtree.h"
+#include "rtree_concurrent.h"
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+
+#define RTREE_SHARDED_TEMPLATE template <class DATATYPE, class ELEMTYPE, int NUMDIMS, class ELEMTYPEREAL, \
+    int TMAXNODES, int TMINNODES>
+#define RTREE_SHARDED_QUAL     RTreeSharded<DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL, TMAXNODES, TMINNODES>
+
+
+/// \class RTreeSharded
+/// Spatial index for ingesting from many threads.  Insert and Remove are queued and return at
+/// once; the writer of the shard they fall into applies them soon after.  Flush() waits until
+/// they are applied.  Operations on one entry are applied in the order they were queued.
+///
+/// Search and NearestNeighbors may run on any thread and see each shard as its writer last left
+/// it; a query and a writer only wait for each other on the shards the query overlaps.  Their
+/// visitors and filters run while the shards are being read and must not call back into the
+/// index.
+///
+/// DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL, TMAXNODES and TMINNODES as for RTree.
+template <class DATATYPE, class ELEMTYPE, int NUMDIMS, class ELEMTYPEREAL = ELEMTYPE, int TMAXNODES = 8,
+          int TMINNODES = TMAXNODES / 2>
+class RTreeSharded
+{
+public:
+    typedef RTree<DATATYPE, ELEMTYPE, NUMDIMS, ELEMTYPEREAL, TMAXNODES, TMINNODES> Tree;
+    typedef typename Tree::Rect Rect;
+
+    /// Cut the box into a_shardCount regions of equal volume and start a writer for each.
+    /// Entries outside the box go to the regions on its border; the first rebalance fits the
+    /// regions to the entries.
+    /// \param a_maxImbalance Rebalance when a shard holds more than this times the average
+    /// \param a_minRebalance ... and at least this many entries.  When a rebalance would not make
+    ///                     the largest shard smaller, for instance because its entries share one
+    ///                     centre, it is skipped and the next waits until that shard has doubled.
+    RTreeSharded( int a_shardCount, const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS],
+                  double a_maxImbalance = 2.0, int a_minRebalance = 4096 );
+
+    /// Stops the writers, operations still queued are dropped
+    ~RTreeSharded();
+
+    RTreeSharded( const RTreeSharded& ) = delete;
+    RTreeSharded& operator=( const RTreeSharded& ) = delete;
+
+    /// Queue an insert into the shard holding the centre of the rect
+    void Insert( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS], const DATATYPE& a_dataId );
+
+    /// Queue removal of an entry inserted with the same rect and id.  Nothing happens if the
+    /// entry is not there when the removal is applied.
+    void Remove( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS], const DATATYPE& a_dataId );
+
+    /// Wait until the queues are empty, everything queued before the call is applied then
+    void Flush();
+
+    /// Recompute the partition from the current entries and rebuild the shards.  Inserts and
+    /// queries wait meanwhile.
+    void Rebalance();
+
+    /// Find all within search rectangle, over the shards whose entries may overlap it
+    /// \param a_visitor functor bool( const DATATYPE& ).  Return 'true' to continue searching
+    /// \return Returns the number of entries found
+    template <class VISITOR>
+    int Search( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS], VISITOR&& a_visitor ) const;
+
+    /// Scratch storage for NearestNeighbors, keep one per thread
+    class NearestNeighborBuffer
+    {
+    public:
+        typedef std::pair<ELEMTYPEREAL, DATATYPE> Result;
+
+        /// Matches of the last query, ordered by ascending squared distance
+        const std::vector<Result>& Results() const
+        {
+            return m_results;
+        }
+
+    private:
+        typename Tree::NearestNeighborBuffer        m_shard;    ///< Scratch of the shard being queried
+        std::vector<std::pair<ELEMTYPEREAL, int>>   m_order;    ///< Shards by distance to their cover
+        std::vector<Result>                         m_results;  ///< Best matches so far, max-heap on distance
+
+        friend class RTreeSharded;
+    };
+
+    /// Find the aK nearest data elements to a point, as RTree::NearestNeighbors.  Shards are
+    /// queried nearest first, each bounded by the k-th distance found so far, and shards farther
+    /// than that are skipped.
+    template <class DISTANCE, class FILTER>
+    int NearestNeighbors( const ELEMTYPE aPoint[NUMDIMS], int aK, DISTANCE&& aSquaredDist, FILTER&& aFilter,
+                          NearestNeighborBuffer& aBuffer ) const;
+
+    /// Count the entries applied so far
+    int Count() const;
+
+    int ShardCount() const
+    {
+        return (int) m_shards.size();
+    }
+
+    /// Entries applied to one shard so far
+    int ShardEntryCount( int a_shard ) const
+    {
+        return m_shards[a_shard]->m_count.load();
+    }
+
+    /// Rebalances done since construction
+    int RebalanceCount() const
+    {
+        return m_rebalances.load();
+    }
+
+protected:
+    typedef std::array<ELEMTYPE, NUMDIMS> Point;
+    typedef typename Tree::Node           TreeNode;
+
+    struct Operation
+    {
+        Operation*  m_next;
+        Rect        m_rect;
+        DATATYPE    m_data;
+        bool        m_remove;
+    };
+
+    struct alignas( 64 ) Shard
+    {
+        /// Copy m_cover for queries.  Call with m_mutex held exclusively, so a query that then
+        /// reads the tree also sees the cover.
+        void PublishCover()
+        {
+            for( int axis = 0; axis < NUMDIMS; ++axis )
+            {
+                m_publishedMin[axis].store( m_cover.m_min[axis], std::memory_order_relaxed );
+                m_publishedMax[axis].store( m_cover.m_max[axis], std::memory_order_relaxed );
+            }
+        }
+
+        /// m_cover as last published, read without the lock.  Between rebalances the cover of
+        /// a shard with entries only grows, so even a mix of old and new coordinates covers what
+        /// was there before.
+        Rect PublishedCover() const
+        {
+            Rect cover;
+
+            for( int axis = 0; axis < NUMDIMS; ++axis )
+            {
+                cover.m_min[axis] = m_publishedMin[axis].load( std::memory_order_relaxed );
+                cover.m_max[axis] = m_publishedMax[axis].load( std::memory_order_relaxed );
+            }
+
+            return cover;
+        }
+
+        mutable std::shared_mutex   m_mutex;                ///< Shared by queries, exclusive by the writer
+        Tree                        m_tree;
+        Rect                        m_cover;                ///< Covers every entry of m_tree, under m_mutex
+        std::atomic<ELEMTYPE>       m_publishedMin[NUMDIMS] = {};
+        std::atomic<ELEMTYPE>       m_publishedMax[NUMDIMS] = {};
+        std::atomic<int>            m_count{ 0 };           ///< Entries in m_tree
+
+        std::atomic<Operation*>     m_queue{ nullptr };     ///< Queued operations, newest first
+        std::atomic<int>            m_queued{ 0 };          ///< Operations queued and not applied yet
+        std::atomic<bool>           m_idle{ false };        ///< The writer waits for m_wake
+        std::mutex                  m_wakeMutex;
+        std::condition_variable     m_wake;
+        std::thread                 m_writer;
+    };
+
+    /// k-d cuts of space with the shards as leaves
+    struct Partition
+    {
+        struct Cut
+        {
+            int         m_axis;
+            ELEMTYPE    m_value;    ///< Points below go to m_low, the others to m_high
+            int         m_low;      ///< Index of a cut, or ~shard
+            int         m_high;
+        };
+
+        int ShardOf( const Point& a_point ) const;
+
+        std::vector<Cut>    m_cuts;
+        int                 m_root;
+    };
+
+    static Point    Centre( const Rect& a_rect );
+    static int      BuildPartition( Partition& a_partition, Point* a_first, Point* a_last, int a_firstShard,
+                                    int a_shardCount, const Rect& a_bounds );
+    static void     CollectRec( const Tree& a_tree, const TreeNode* a_node,
+                                std::vector<std::pair<Rect, DATATYPE>>& a_entries );
+
+    void    Push( const Rect& a_rect, const DATATYPE& a_dataId, bool a_remove );
+    void    WriterLoop( Shard& a_shard );
+    int     Apply( Shard& a_shard, Operation* a_newestFirst );
+    void    Settle( Shard& a_shard, int a_applied );
+    bool    NeedsRebalance( const Shard& a_shard ) const;
+    void    RebalanceLocked( bool a_force );
+
+    std::vector<std::unique_ptr<Shard>>     m_shards;
+    Rect                                    m_bounds;           ///< Box given to the constructor
+    const double                            m_maxImbalance;
+    const int                               m_minRebalance;
+    std::atomic<int>                        m_rebalanceFloor{ 0 };  ///< Set after a rebalance that did not help
+
+    /// Shared by queries for their whole length, exclusive while a rebalance moves entries
+    /// between shards, so a query never sees an entry twice or misses one being moved
+    mutable std::shared_mutex               m_layoutMutex;
+
+    std::atomic<const Partition*>           m_partition;        ///< Routes inserts, null while rebalancing
+    std::unique_ptr<Partition>              m_partitionStore;
+    mutable RTreeEpochDomain                m_producers;        ///< Pinned by Push while it routes
+    std::mutex                              m_rebalanceMutex;
+    std::atomic<int>                        m_rebalances{ 0 };
+
+    std::mutex                              m_flushMutex;
+    std::condition_variable                 m_flushed;
+    std::atomic<bool>                       m_stopping{ false };
+};
+
+
+RTREE_SHARDED_TEMPLATE
+RTREE_SHARDED_QUAL::RTreeSharded( int a_shardCount, const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS],
+                                  double a_maxImbalance, int a_minRebalance ) :
+        m_maxImbalance( a_maxImbalance ),
+        m_minRebalance( a_minRebalance )
+{
+    ASSERT( a_shardCount > 0 );
+
+    std::copy( a_min, a_min + NUMDIMS, m_bounds.m_min );
+    std::copy( a_max, a_max + NUMDIMS, m_bounds.m_max );
+
+    m_partitionStore.reset( new Partition() );
+    m_partitionStore->m_root = BuildPartition( *m_partitionStore, nullptr, nullptr, 0, a_shardCount, m_bounds );
+    m_partition.store( m_partitionStore.get() );
+
+    for( int index = 0; index < a_shardCount; ++index )
+    {
+        m_shards.emplace_back( new Shard() );
+    }
+
+    for( auto& shard : m_shards )
+    {
+        Shard* writing = shard.get();
+        shard->m_writer = std::thread( [this, writing]() { WriterLoop( *writing ); } );
+    }
+}
+
+
+RTREE_SHARDED_TEMPLATE
+RTREE_SHARDED_QUAL::~RTreeSharded()
+{
+    m_stopping.store( true );
+
+    for( auto& shard : m_shards )
+    {
+        std::lock_guard<std::mutex> wake( shard->m_wakeMutex );
+        shard->m_wake.notify_one();
+    }
+
+    for( auto& shard : m_shards )
+    {
+        shard->m_writer.join();
+
+        for( Operation* op = shard->m_queue.load(); op; )
+        {
+            Operation* next = op->m_next;
+            delete op;
+            op = next;
+        }
+    }
+}
+
+
+RTREE_SHARDED_TEMPLATE
+void RTREE_SHARDED_QUAL::Insert( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS],
+                                 const DATATYPE& a_dataId )
+{
+    Rect rect;
+    std::copy( a_min, a_min + NUMDIMS, rect.m_min );
+    std::copy( a_max, a_max + NUMDIMS, rect.m_max );
+
+    Push( rect, a_dataId, false );
+}
+
+
+RTREE_SHARDED_TEMPLATE
+void RTREE_SHARDED_QUAL::Remove( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS],
+                                 const DATATYPE& a_dataId )
+{
+    Rect rect;
+    std::copy( a_min, a_min + NUMDIMS, rect.m_min );
+    std::copy( a_max, a_max + NUMDIMS, rect.m_max );
+
+    Push( rect, a_dataId, true );
+}
+
+
+RTREE_SHARDED_TEMPLATE
+void RTREE_SHARDED_QUAL::Flush()
+{
+    std::unique_lock<std::mutex> lock( m_flushMutex );
+
+    m_flushed.wait( lock, [this]()
+                    {
+                        for( const auto& shard : m_shards )
+                        {
+                            if( shard->m_queued.load() )
+                                return false;
+                        }
+
+                        return true;
+                    } );
+}
+
+
+RTREE_SHARDED_TEMPLATE
+void RTREE_SHARDED_QUAL::Rebalance()
+{
+    std::lock_guard<std::mutex> lock( m_rebalanceMutex );
+
+    RebalanceLocked( true );
+}
+
+
+RTREE_SHARDED_TEMPLATE
+template <class VISITOR>
+int RTREE_SHARDED_QUAL::Search( const ELEMTYPE a_min[NUMDIMS], const ELEMTYPE a_max[NUMDIMS],
+                                VISITOR&& a_visitor ) const
+{
+    Rect rect;
+    std::copy( a_min, a_min + NUMDIMS, rect.m_min );
+    std::copy( a_max, a_max + NUMDIMS, rect.m_max );
+
+    int  foundCount = 0;
+    bool going      = true;
+
+    auto visit = [&]( const DATATYPE& a_data )
+    {
+        return going = a_visitor( a_data );
+    };
+
+    std::shared_lock<std::shared_mutex> layout( m_layoutMutex );
+
+    for( const auto& shard : m_shards )
+    {
+        if( !shard->m_count.load() )
+            continue;
+
+        const Rect cover = shard->PublishedCover();
+
+        if( !Tree::Overlap( &cover, &rect ) )
+            continue;
+
+        std::shared_lock<std::shared_mutex> lock( shard->m_mutex );
+
+        foundCount += shard->m_tree.Search( a_min, a_max, visit );
+
+        if( !going )
+            break;
+    }
+
+    return foundCount;
+}
+
+
+RTREE_SHARDED_TEMPLATE
+template <class DISTANCE, class FILTER>
+int RTREE_SHARDED_QUAL::NearestNeighbors( const ELEMTYPE aPoint[NUMDIMS], int aK, DISTANCE&& aSquaredDist,
+                                          FILTER&& aFilter, NearestNeighborBuffer& aBuffer ) const
+{
+    typedef typename NearestNeighborBuffer::Result Result;
+
+    auto nearerResult = []( const Result& a_resultA, const Result& a_resultB )
+    {
+        return a_resultA.first < a_resultB.first;
+    };
+
+    std::vector<std::pair<ELEMTYPEREAL, int>>& order   = aBuffer.m_order;
+    std::vector<Result>&                       results = aBuffer.m_results;
+
+    order.clear();
+    results.clear();
+
+    if( aK <= 0 )
+        return 0;
+
+    std::shared_lock<std::shared_mutex> layout( m_layoutMutex );
+
+    for( int index = 0; index < (int) m_shards.size(); ++index )
+    {
+        const Shard& shard = *m_shards[index];
+
+        if( shard.m_count.load() )
+            order.emplace_back( Tree::MinDistSq( aPoint, shard.PublishedCover() ), index );
+    }
+
+    std::sort( order.begin(), order.end() );
+
+    for( const auto& candidate : order )
+    {
+        const Shard&       shard = *m_shards[candidate.second];
+        const bool         full  = (int) results.size() == aK;
+        const ELEMTYPEREAL bound = full ? results.front().first : std::numeric_limits<ELEMTYPEREAL>::max();
+
+        // The shards are ordered, none of the rest can come closer
+        if( candidate.first > bound )
+            break;
+
+        std::shared_lock<std::shared_mutex> lock( shard.m_mutex );
+
+        shard.m_tree.NearestNeighbors( aPoint, aK, Tree::ALL_LAYERS, bound, aSquaredDist, aFilter,
+                                       aBuffer.m_shard );
+
+        for( const Result& result : aBuffer.m_shard.Results() )
+        {
+            if( (int) results.size() < aK )
+            {
+                results.push_back( result );
+                std::push_heap( results.begin(), results.end(), nearerResult );
+            }
+            else if( result.first < results.front().first )
+            {
+                std::pop_heap( results.begin(), results.end(), nearerResult );
+                results.back() = result;
+                std::push_heap( results.begin(), results.end(), nearerResult );
+            }
+            else
+            {
+                // The shard's results are ordered, the rest are no better
+                break;
+            }
+        }
+    }
+
+    std::sort_heap( results.begin(), results.end(), nearerResult );
+
+    return (int) results.size();
+}
+
+
+RTREE_SHARDED_TEMPLATE
+int RTREE_SHARDED_QUAL::Count() const
+{
+    int count = 0;
+
+    for( const auto& shard : m_shards )
+    {
+        count += shard->m_count.load();
+    }
+
+    return count;
+}
+
+
+RTREE_SHARDED_TEMPLATE
+int RTREE_SHARDED_QUAL::Partition::ShardOf( const Point& a_point ) const
+{
+    int index = m_root;
+
+    while( index >= 0 )
+    {
+        const Cut& cut = m_cuts[index];
+        index = a_point[cut.m_axis] < cut.m_value ? cut.m_low : cut.m_high;
+    }
+
+    return ~index;
+}
+
+
+RTREE_SHARDED_TEMPLATE
+typename RTREE_SHARDED_QUAL::Point RTREE_SHARDED_QUAL::Centre( const Rect& a_rect )
+{
+    Point centre;
+
+    for( int axis = 0; axis < NUMDIMS; ++axis )
+    {
+        centre[axis] = a_rect.m_min[axis] + ( a_rect.m_max[axis] - a_rect.m_min[axis] ) / 2;
+    }
+
+    return centre;
+}
+
+
+// Cut a_shardCount shards out of the bounds, recursively halving the shard range.  Each cut
+// goes across the widest spread of the points and leaves each side points in proportion to its
+// shards; without points the bounds are cut by volume.  Returns the index of the top cut, or
+// ~shard for a single shard.
+RTREE_SHARDED_TEMPLATE
+int RTREE_SHARDED_QUAL::BuildPartition( Partition& a_partition, Point* a_first, Point* a_last, int a_firstShard,
+                                        int a_shardCount, const Rect& a_bounds )
+{
+    if( a_shardCount == 1 )
+        return ~a_firstShard;
+
+    const int lowShards = a_shardCount / 2;
+    Rect      bounds    = a_bounds;
+
+    if( a_first != a_last )
+    {
+        for( int axis = 0; axis < NUMDIMS; ++axis )
+        {
+            bounds.m_min[axis] = bounds.m_max[axis] = ( *a_first )[axis];
+        }
+
+        for( const Point* point = a_first; point != a_last; ++point )
+        {
+            for( int axis = 0; axis < NUMDIMS; ++axis )
+            {
+                bounds.m_min[axis] = std::min( bounds.m_min[axis], ( *point )[axis] );
+                bounds.m_max[axis] = std::max( bounds.m_max[axis], ( *point )[axis] );
+            }
+        }
+    }
+
+    typename Partition::Cut cut;
+    cut.m_axis = 0;
+
+    for( int axis = 1; axis < NUMDIMS; ++axis )
+    {
+        if( bounds.m_max[axis] - bounds.m_min[axis] > bounds.m_max[cut.m_axis] - bounds.m_min[cut.m_axis] )
+            cut.m_axis = axis;
+    }
+
+    const int axis = cut.m_axis;
+    Point*    middle = a_first;
+
+    if( a_first != a_last )
+    {
+        Point* nth = a_first + ( a_last - a_first ) * lowShards / a_shardCount;
+
+        std::nth_element( a_first, nth, a_last, [axis]( const Point& a_pointA, const Point& a_pointB )
+                          {
+                              return a_pointA[axis] < a_pointB[axis];
+                          } );
+
+        cut.m_value = ( *nth )[axis];
+        middle      = std::partition( a_first, a_last, [&cut]( const Point& a_point )
+                                      {
+                                          return a_point[cut.m_axis] < cut.m_value;
+                                      } );
+    }
+    else
+    {
+        cut.m_value = bounds.m_min[axis]
+                      + (ELEMTYPE) ( (ELEMTYPEREAL) ( bounds.m_max[axis] - bounds.m_min[axis] ) * lowShards
+                                     / a_shardCount );
+    }
+
+    Rect lowBounds  = bounds;
+    Rect highBounds = bounds;
+    lowBounds.m_max[axis]  = cut.m_value;
+    highBounds.m_min[axis] = cut.m_value;
+
+    // Children are added behind the cut, which is filled in once their indexes are known
+    const int index = (int) a_partition.m_cuts.size();
+    a_partition.m_cuts.push_back( cut );
+
+    const int low  = BuildPartition( a_partition, a_first, middle, a_firstShard, lowShards, lowBounds );
+    const int high = BuildPartition( a_partition, middle, a_last, a_firstShard + lowShards,
+                                     a_shardCount - lowShards, highBounds );
+
+    a_partition.m_cuts[index].m_low  = low;
+    a_partition.m_cuts[index].m_high = high;
+
+    return index;
+}
+
+
+RTREE_SHARDED_TEMPLATE
+void RTREE_SHARDED_QUAL::CollectRec( const Tree& a_tree, const TreeNode* a_node,
+                                     std::vector<std::pair<Rect, DATATYPE>>& a_entries )
+{
+    for( int index = 0; index < a_node->m_count; ++index )
+    {
+        if( a_node->IsInternalNode() )
+            CollectRec( a_tree, a_node->m_branch[index].m_child, a_entries );
+        else
+            a_entries.emplace_back( a_node->m_branch[index].m_rect, a_tree.BranchData( a_node->m_branch[index] ) );
+    }
+}
+
+
+// Route the operation by the current partition and queue it.  While routing, the thread is
+// pinned in m_producers, so a rebalance can wait until no operation is routed by the partition
+// it replaces.
+RTREE_SHARDED_TEMPLATE
+void RTREE_SHARDED_QUAL::Push( const Rect& a_rect, const DATATYPE& a_dataId, bool a_remove )
+{
+    Operation* op = new Operation{ nullptr, a_rect, a_dataId, a_remove };
+    const Point centre = Centre( a_rect );
+
+    for( ;; )
+    {
+        {
+            RTreeEpochDomain::Guard guard( m_producers );
+
+            if( const Partition* partition = m_partition.load() )
+            {
+                Shard& shard = *m_shards[partition->ShardOf( centre )];
+
+                shard.m_queued.fetch_add( 1 );
+                op->m_next = shard.m_queue.load( std::memory_order_relaxed );
+
+                while( !shard.m_queue.compare_exchange_weak( op->m_next, op ) )
+                {
+                }
+
+                // Pairs with the writer setting m_idle before it checks the queue
+                if( shard.m_idle.load() )
+                {
+                    std::lock_guard<std::mutex> wake( shard.m_wakeMutex );
+                    shard.m_wake.notify_one();
+                }
+
+                return;
+            }
+        }
+
+        // A rebalance is running, wait for it to finish
+        std::lock_guard<std::mutex> lock( m_rebalanceMutex );
+    }
+}
+
+
+RTREE_SHARDED_TEMPLATE
+void RTREE_SHARDED_QUAL::WriterLoop( Shard& a_shard )
+{
+    for( ;; )
+    {
+        {
+            std::unique_lock<std::mutex> wake( a_shard.m_wakeMutex );
+
+            a_shard.m_idle.store( true );
+            a_shard.m_wake.wait( wake, [&]()
+                                 {
+                                     return a_shard.m_queue.load() || m_stopping.load();
+                                 } );
+            a_shard.m_idle.store( false );
+        }
+
+        if( m_stopping.load() )
+            return;
+
+        int  applied;
+        bool rebalance;
+
+        {
+            // Taken under the lock, so a rebalance holding it sees every queued operation
+            std::unique_lock<std::shared_mutex> lock( a_shard.m_mutex );
+
+            applied   = Apply( a_shard, a_shard.m_queue.exchange( nullptr ) );
+            rebalance = NeedsRebalance( a_shard );
+        }
+
+        if( rebalance )
+        {
+            std::lock_guard<std::mutex> lock( m_rebalanceMutex );
+
+            // Another writer may have rebalanced meanwhile
+            if( NeedsRebalance( a_shard ) )
+                RebalanceLocked( false );
+        }
+
+        // Only now, so Flush() returns with the shards balanced
+        Settle( a_shard, applied );
+    }
+}
+
+
+// Apply and free a list taken from the shard's queue.  The shard must be locked exclusively.
+// Returns the number of operations, for Settle().
+RTREE_SHARDED_TEMPLATE
+int RTREE_SHARDED_QUAL::Apply( Shard& a_shard, Operation* a_newestFirst )
+{
+    // Reverse into queue order
+    Operation* oldestFirst = nullptr;
+    int        applied     = 0;
+
+    while( a_newestFirst )
+    {
+        Operation* next = a_newestFirst->m_next;
+        a_newestFirst->m_next = oldestFirst;
+        oldestFirst   = a_newestFirst;
+        a_newestFirst = next;
+    }
+
+    while( oldestFirst )
+    {
+        Operation* op   = oldestFirst;
+        const Rect& rect = op->m_rect;
+
+        if( op->m_remove )
+        {
+            if( !a_shard.m_tree.Remove( rect.m_min, rect.m_max, op->m_data ) )
+                a_shard.m_count.fetch_sub( 1 );
+        }
+        else
+        {
+            if( a_shard.m_count.load() )
+                a_shard.m_cover = a_shard.m_tree.CombineRect( &a_shard.m_cover, &rect );
+            else
+                a_shard.m_cover = rect;
+
+            a_shard.m_tree.Insert( rect.m_min, rect.m_max, op->m_data );
+            a_shard.m_count.fetch_add( 1 );
+        }
+
+        oldestFirst = op->m_next;
+        delete op;
+        ++applied;
+    }
+
+    if( applied )
+        a_shard.PublishCover();
+
+    return applied;
+}
+
+
+// Count applied operations off the queue, waking Flush() when it is empty
+RTREE_SHARDED_TEMPLATE
+void RTREE_SHARDED_QUAL::Settle( Shard& a_shard, int a_applied )
+{
+    if( a_applied && a_shard.m_queued.fetch_sub( a_applied ) == a_applied )
+    {
+        std::lock_guard<std::mutex> lock( m_flushMutex );
+        m_flushed.notify_all();
+    }
+}
+
+
+RTREE_SHARDED_TEMPLATE
+bool RTREE_SHARDED_QUAL::NeedsRebalance( const Shard& a_shard ) const
+{
+    const int count = a_shard.m_count.load();
+
+    return count >= std::max( m_minRebalance, m_rebalanceFloor.load() )
+           && count > m_maxImbalance * Count() / m_shards.size();
+}
+
+
+// Collect every entry, cut space again at the quantiles of their centres and bulk load each
+// shard with the entries whose centre it now holds.  Unless a_force, nothing is rebuilt when
+// the largest shard would not get smaller, and the shards must double before the next try.
+// m_rebalanceMutex must be held.
+RTREE_SHARDED_TEMPLATE
+void RTREE_SHARDED_QUAL::RebalanceLocked( bool a_force )
+{
+    // New operations find no partition and wait for m_rebalanceMutex; the ones routed by the old
+    // partition are waited for, so every queued operation was routed by it
+    m_partition.store( nullptr );
+
+    const uint64_t epoch = m_producers.Advance();
+
+    while( m_producers.OldestPinned() <= epoch )
+    {
+        std::this_thread::yield();
+    }
+
+    std::unique_lock<std::shared_mutex>              layout( m_layoutMutex );
+    std::vector<std::unique_lock<std::shared_mutex>> locks;
+
+    for( auto& shard : m_shards )
+    {
+        locks.emplace_back( shard->m_mutex );
+    }
+
+    std::vector<std::pair<Rect, DATATYPE>> entries;
+    std::vector<int>                       applied;
+    int                                    largest = 0;
+
+    for( auto& shard : m_shards )
+    {
+        applied.push_back( Apply( *shard, shard->m_queue.exchange( nullptr ) ) );
+        CollectRec( shard->m_tree, shard->m_tree.m_root, entries );
+        largest = std::max( largest, shard->m_count.load() );
+    }
+
+    std::vector<Point> centres;
+    centres.reserve( entries.size() );
+
+    for( const auto& entry : entries )
+    {
+        centres.push_back( Centre( entry.first ) );
+    }
+
+    const int shardCount = (int) m_shards.size();
+
+    std::unique_ptr<Partition> partition( new Partition() );
+    partition->m_root = BuildPartition( *partition, centres.data(), centres.data() + centres.size(), 0,
+                                        shardCount, m_bounds );
+
+    // Points equal to a cut value may have gone either way, assign them as Push will route them
+    std::vector<std::vector<std::pair<Rect, DATATYPE>>> buckets( shardCount );
+
+    for( const auto& entry : entries )
+    {
+        buckets[partition->ShardOf( Centre( entry.first ) )].push_back( entry );
+    }
+
+    size_t newLargest = 0;
+
+    for( const auto& bucket : buckets )
+    {
+        newLargest = std::max( newLargest, bucket.size() );
+    }
+
+    if( !a_force && newLargest >= (size_t) largest )
+    {
+        // Keep the shards and the old partition
+        m_rebalanceFloor.store( 2 * largest );
+        m_partition.store( m_partitionStore.get() );
+
+        for( int index = 0; index < shardCount; ++index )
+        {
+            Settle( *m_shards[index], applied[index] );
+        }
+
+        return;
+    }
+
+    for( int index = 0; index < shardCount; ++index )
+    {
+        Shard&      shard  = *m_shards[index];
+        const auto& bucket = buckets[index];
+
+        shard.m_tree.BulkLoad( bucket.begin(), bucket.end() );
+        shard.m_count.store( (int) bucket.size() );
+
+        for( size_t entry = 0; entry < bucket.size(); ++entry )
+        {
+            shard.m_cover = entry ? shard.m_tree.CombineRect( &shard.m_cover, &bucket[entry].first )
+                                  : bucket[entry].first;
+        }
+
+        shard.PublishCover();
+    }
+
+    m_partitionStore = std::move( partition );
+    m_partition.store( m_partitionStore.get() );
+    m_rebalanceFloor.store( 0 );
+    m_rebalances.fetch_add( 1 );
+
+    for( int index = 0; index < shardCount; ++index )
+    {
+        Settle( *m_shards[index], applied[index] );
+    }
+}
+
+
+#undef RTREE_SHARDED_TEMPLATE
+#undef RTREE_SHARDED_QUAL
+
+#endif    // RTREE_SHARDED_H
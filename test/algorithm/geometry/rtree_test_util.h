@@ -0,0 +1,46 @@
+#ifndef RTREE_TEST_UTIL_H
+#define RTREE_TEST_UTIL_H
+
+// R 树各测试共用的工具：可复现的测试矩形、相交判断、排序后的窗口查询结果
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "algorithm/geometry/rtree.h"
+
+// 第 i 个测试矩形：左下角伪随机散布在 [0, 250) 的网格上，宽 0~2、高 0~3，整体平移 offset
+// RECT 可以是任何带 m_min、m_max 数组的二维矩形类型
+template <class RECT = RTree<int, double, 2>::Rect>
+RECT makeRect(int i, double offset = 0) {
+    RECT rect;
+    rect.m_min[0] = offset + ((int64_t) i * 7919 % 1000) / 4.0;
+    rect.m_min[1] = offset + ((int64_t) i * 104729 % 1000) / 4.0;
+    rect.m_max[0] = rect.m_min[0] + i % 3;
+    rect.m_max[1] = rect.m_min[1] + i % 4;
+    return rect;
+}
+
+template <class RECT, class ELEMTYPE>
+bool overlaps(const RECT& rect, const ELEMTYPE min[2], const ELEMTYPE max[2]) {
+    return rect.m_min[0] <= max[0] && rect.m_max[0] >= min[0] && rect.m_min[1] <= max[1] && rect.m_max[1] >= min[1];
+}
+
+template <class T>
+std::vector<T> sorted(std::vector<T> values) {
+    std::sort(values.begin(), values.end());
+    return values;
+}
+
+// 窗口查询命中的 id，升序；TREE 为任何提供 Search(min, max, visitor) 的索引
+template <class TREE, class ELEMTYPE>
+std::vector<int> treeSearch(const TREE& tree, const ELEMTYPE min[2], const ELEMTYPE max[2]) {
+    std::vector<int> ids;
+    tree.Search(min, max, [&ids](const int& id) {
+        ids.push_back(id);
+        return true;
+    });
+    return sorted(ids);
+}
+
+#endif // RTREE_TEST_UTIL_H
@@ -0,0 +1,1505 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "algorithm/geometry/geometry_algo_core.h"
+#include "algorithm/geometry/rtree.h"
+#include "rtree_test_util.h"
+
+typedef RTree<int, double, 2> RTREE2D;
+
+namespace {
+
+// 生成 n x n 的网格矩形，编号即下标
+std::vector<std::pair<RTREE2D::Rect, int>> makeGrid(int n) {
+    std::vector<std::pair<RTREE2D::Rect, int>> entries;
+    for (int i = 0; i < n * n; ++i) {
+        RTREE2D::Rect rect;
+        rect.m_min[0] = (i % n) * 2.0;
+        rect.m_min[1] = (i / n) * 2.0;
+        rect.m_max[0] = rect.m_min[0] + 1.5;
+        rect.m_max[1] = rect.m_min[1] + 1.5;
+        entries.emplace_back(rect, i);
+    }
+    return entries;
+}
+
+// 暴力查询，作为对照
+std::vector<int> bruteSearch(const std::vector<std::pair<RTREE2D::Rect, int>>& entries, const double min[2],
+                             const double max[2]) {
+    std::vector<int> result;
+    for (const auto& entry : entries) {
+        if (overlaps(entry.first, min, max)) {
+            result.push_back(entry.second);
+        }
+    }
+    return result;
+}
+
+template <class TREE>
+void checkWindows(const TREE& tree, const std::vector<std::pair<RTREE2D::Rect, int>>& entries) {
+    const double windows[][4] = {{0, 0, 10, 10}, {37.2, 11.1, 90.5, 60.3}, {-5, -5, 500, 500}, {1.6, 1.6, 1.9, 1.9}};
+    for (const auto& window : windows) {
+        const double min[2] = {window[0], window[1]};
+        const double max[2] = {window[2], window[3]};
+        ASSERT_EQ(treeSearch(tree, min, max), bruteSearch(entries, min, max));
+    }
+}
+
+} // namespace
+
+// STR 打包
+TEST(RTree, bulk_load_str) {
+    auto entries = makeGrid(100);
+
+    RTREE2D tree;
+    auto stats = tree.BulkLoad(entries.begin(), entries.end(), RTREE2D::BulkLoadMethod::STR);
+
+    ASSERT_EQ(tree.Count(), 10000);
+    ASSERT_GT(stats.fillFactor, 0.95);
+    ASSERT_EQ(stats.height, 5);
+    ASSERT_GE(stats.buildTime, 0.0);
+    checkWindows(tree, entries);
+}
+
+// Hilbert 打包
+TEST(RTree, bulk_load_hilbert) {
+    auto entries = makeGrid(100);
+
+    RTREE2D tree(entries.begin(), entries.end(), RTREE2D::BulkLoadMethod::HILBERT);
+    auto stats = tree.CalcStats();
+
+    ASSERT_EQ(stats.totalItems, 10000);
+    ASSERT_GT(stats.fillFactor, 0.95);
+    checkWindows(tree, entries);
+}
+
+// 打包后的树仍可继续插入
+TEST(RTree, bulk_load_then_insert) {
+    auto entries = makeGrid(30);
+
+    RTREE2D tree(entries.begin(), entries.end());
+    auto extra = makeGrid(40);
+    for (auto& entry : extra) {
+        entry.first.m_min[0] += 0.5;
+        entry.first.m_max[0] += 0.5;
+        entry.second += 900;
+        tree.Insert(entry.first.m_min, entry.first.m_max, entry.second);
+    }
+    entries.insert(entries.end(), extra.begin(), extra.end());
+
+    ASSERT_EQ(tree.Count(), 900 + 1600);
+    checkWindows(tree, entries);
+}
+
+// 空数据与单节点
+TEST(RTree, bulk_load_small) {
+    std::vector<std::pair<RTREE2D::Rect, int>> entries;
+    RTREE2D tree;
+    auto stats = tree.BulkLoad(entries.begin(), entries.end());
+    ASSERT_EQ(tree.Count(), 0);
+    ASSERT_EQ(stats.height, 1);
+
+    entries = makeGrid(2);
+    stats = tree.BulkLoad(entries.begin(), entries.end(), RTREE2D::BulkLoadMethod::HILBERT);
+    ASSERT_EQ(tree.Count(), 4);
+    ASSERT_EQ(stats.nodeCount, 1);
+    checkWindows(tree, entries);
+}
+
+// 内存池：回收复用与缓存行对齐
+TEST(RTreeMemoryPool, reuse_and_alignment) {
+    struct BIG {
+        double data[12];
+    };
+    RTreeMemoryPool<BIG, 4> pool;
+
+    std::vector<BIG*> objects;
+    for (int i = 0; i < 10; ++i) {
+        objects.push_back(pool.Allocate());
+        ASSERT_EQ(reinterpret_cast<std::uintptr_t>(objects.back()) % RTreeMemoryPool<BIG>::CACHE_LINE, 0u);
+    }
+    ASSERT_EQ(pool.Capacity(), 3 * 4 * 128u);
+
+    BIG* freed = objects[5];
+    pool.Deallocate(freed);
+    ASSERT_EQ(pool.Allocate(), freed);
+
+    pool.Release();
+    ASSERT_EQ(pool.Capacity(), 0u);
+}
+
+// 反复插入删除，两种分配器结果一致
+template <class TREE>
+void churn(TREE& tree) {
+    auto entries = makeGrid(60);
+    for (int round = 0; round < 3; ++round) {
+        for (auto& entry : entries) {
+            tree.Insert(entry.first.m_min, entry.first.m_max, entry.second);
+        }
+        for (auto& entry : entries) {
+            if (entry.second % 3 != round) {
+                ASSERT_FALSE(tree.Remove(entry.first.m_min, entry.first.m_max, entry.second));
+            }
+        }
+        ASSERT_EQ(tree.Count(), 1200 * (round + 1));
+    }
+    ASSERT_TRUE(tree.Remove(entries[0].first.m_min, entries[0].first.m_max, -1));
+
+    const double min[2] = {10, 10};
+    const double max[2] = {30, 30};
+    int found = tree.Search(min, max, [](const int&) {
+        return true;
+    });
+    ASSERT_EQ(found, 11 * 11);
+
+    tree.RemoveAll();
+    ASSERT_EQ(tree.Count(), 0);
+    tree.Insert(min, max, 1);
+    ASSERT_EQ(tree.Count(), 1);
+}
+
+TEST(RTree, insert_remove_churn) {
+    RTREE2D pooled;
+    churn(pooled);
+
+    RTree<int, double, 2, double, 8, 4, RTreeHeapAllocator> heap;
+    churn(heap);
+}
+
+// SoA 布局与默认布局的查询结果一致
+template <class ELEMTYPE, int MAXNODES>
+void compareLayouts() {
+    typedef RTree<int, ELEMTYPE, 2, ELEMTYPE, MAXNODES, MAXNODES / 2, RTreePoolAllocator, RTreeAoSLayout> AOS;
+    typedef RTree<int, ELEMTYPE, 2, ELEMTYPE, MAXNODES, MAXNODES / 2, RTreePoolAllocator, RTreeSoALayout> SOA;
+    AOS aos;
+    SOA soa;
+
+    for (int i = 0; i < 3000; ++i) {
+        const ELEMTYPE min[2] = {ELEMTYPE((i * 37) % 500), ELEMTYPE((i * 91) % 450)};
+        const ELEMTYPE max[2] = {ELEMTYPE(min[0] + i % 7), ELEMTYPE(min[1] + i % 5)};
+        aos.Insert(min, max, i);
+        soa.Insert(min, max, i);
+    }
+    for (int i = 0; i < 3000; i += 4) {
+        const ELEMTYPE min[2] = {ELEMTYPE((i * 37) % 500), ELEMTYPE((i * 91) % 450)};
+        const ELEMTYPE max[2] = {ELEMTYPE(min[0] + i % 7), ELEMTYPE(min[1] + i % 5)};
+        ASSERT_FALSE(aos.Remove(min, max, i));
+        ASSERT_FALSE(soa.Remove(min, max, i));
+    }
+
+    for (int q = 0; q < 50; ++q) {
+        const ELEMTYPE min[2] = {ELEMTYPE(q * 9), ELEMTYPE(q * 7)};
+        const ELEMTYPE max[2] = {ELEMTYPE(min[0] + 40), ELEMTYPE(min[1] + 25)};
+        std::vector<int> expected, actual;
+        aos.Search(min, max, [&expected](const int& id) {
+            expected.push_back(id);
+            return true;
+        });
+        soa.Search(min, max, [&actual](const int& id) {
+            actual.push_back(id);
+            return true;
+        });
+        std::sort(expected.begin(), expected.end());
+        std::sort(actual.begin(), actual.end());
+        ASSERT_EQ(actual, expected);
+    }
+}
+
+TEST(RTree, soa_layout) {
+    compareLayouts<double, 8>();
+    compareLayouts<float, 8>();
+    compareLayouts<double, 16>();
+    compareLayouts<float, 12>();
+    compareLayouts<int, 8>();
+}
+
+// k 近邻：与暴力结果一致，缓冲区复用后不再分配
+TEST(RTree, nearest_neighbors) {
+    auto entries = makeGrid(80);
+    RTREE2D tree;
+    for (const auto& entry : entries) {
+        tree.Insert(entry.first.m_min, entry.first.m_max, entry.second);
+    }
+
+    // 到矩形中心的平方距离，不小于到矩形的平方距离
+    auto squaredDist = [&entries](const double point[2], const int& id) {
+        const auto& rect = entries[id].first;
+        double dx = (rect.m_min[0] + rect.m_max[0]) / 2 - point[0];
+        double dy = (rect.m_min[1] + rect.m_max[1]) / 2 - point[1];
+        return dx * dx + dy * dy;
+    };
+    auto evenOnly = [](const int& id) {
+        return id % 2 == 0;
+    };
+
+    RTREE2D::NearestNeighborBuffer buffer;
+    for (int q = 0; q < 40; ++q) {
+        const double point[2] = {q * 3.7 + 0.31, q * 2.9 + 0.17};
+        ASSERT_EQ(tree.NearestNeighbors(point, 8, squaredDist, evenOnly, buffer), 8);
+
+        std::vector<std::pair<double, int>> expected;
+        for (const auto& entry : entries) {
+            if (evenOnly(entry.second)) {
+                expected.emplace_back(squaredDist(point, entry.second), entry.second);
+            }
+        }
+        std::sort(expected.begin(), expected.end());
+        expected.resize(8);
+
+        const auto& results = buffer.Results();
+        for (int i = 0; i < 8; ++i) {
+            ASSERT_DOUBLE_EQ(results[i].first, expected[i].first);
+        }
+    }
+
+    // 相同的查询再执行一遍，缓冲区不应重新分配
+    const auto* data = buffer.Results().data();
+    for (int q = 0; q < 40; ++q) {
+        const double point[2] = {q * 3.7 + 0.31, q * 2.9 + 0.17};
+        tree.NearestNeighbors(point, 8, squaredDist, evenOnly, buffer);
+        ASSERT_EQ(buffer.Results().data(), data);
+    }
+
+    const double point[2] = {0, 0};
+    ASSERT_EQ(tree.NearestNeighbors(point, 0, squaredDist, evenOnly, buffer), 0);
+    RTREE2D empty;
+    ASSERT_EQ(empty.NearestNeighbors(point, 3, squaredDist, evenOnly, buffer), 0);
+}
+
+// 检查树的结构：层号连续、非根节点不低于最小填充、父节点矩形恰好包住子节点、子树计数、图层与希尔伯特键正确
+// Update 之后父节点矩形只保证包含子节点，exactCovers 为 false 时只检查包含关系
+template <class TREE>
+class TreeInspector : public TREE {
+public:
+    int validate(bool exactCovers = true) const {
+        return validateRec(this->m_root, true, exactCovers);
+    }
+
+    // 叶子的父分支矩形周长与叶子实际覆盖周长之比的最大值
+    double leafSlack() const {
+        return leafSlackRec(this->m_root);
+    }
+
+    // 条目所在叶子的父分支矩形周长，与叶子中其余条目覆盖周长之比
+    double entryGrowth(int id) const {
+        return entryGrowthRec(this->m_root, nullptr, id);
+    }
+
+    // 分支的字节数，随分裂策略与图层策略附带的字段变化
+    static constexpr size_t branchSize() {
+        return sizeof(typename TREE::Branch);
+    }
+
+    // 希尔伯特策略下同一节点的子树键值区间互不相交，相同的键值可以落在相邻的两个子树
+    bool keyRangesDisjoint() const {
+        std::pair<uint64_t, uint64_t> range;
+        return keyRangesRec(this->m_root, range);
+    }
+
+private:
+    bool keyRangesRec(const typename TREE::Node* node, std::pair<uint64_t, uint64_t>& range) const {
+        range = {UINT64_MAX, 0};
+        std::vector<std::pair<uint64_t, uint64_t>> children;
+        for (int i = 0; i < node->m_count; ++i) {
+            std::pair<uint64_t, uint64_t> child(node->m_branch[i].m_key, node->m_branch[i].m_key);
+            if (node->IsInternalNode() && !keyRangesRec(node->m_branch[i].m_child, child)) {
+                return false;
+            }
+            range.first = std::min(range.first, child.first);
+            range.second = std::max(range.second, child.second);
+            children.push_back(child);
+        }
+        std::sort(children.begin(), children.end());
+        for (size_t i = 1; node->IsInternalNode() && i < children.size(); ++i) {
+            if (children[i].first < children[i - 1].second) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static double margin(const typename TREE::Rect& rect) {
+        return rect.m_max[0] - rect.m_min[0] + rect.m_max[1] - rect.m_min[1];
+    }
+
+    double leafSlackRec(const typename TREE::Node* node) const {
+        double slack = 1;
+        for (int i = 0; node->IsInternalNode() && i < node->m_count; ++i) {
+            const auto* child = node->m_branch[i].m_child;
+            if (child->IsLeaf()) {
+                const double exact = margin(this->NodeCover(const_cast<typename TREE::Node*>(child)));
+                slack = std::max(slack, margin(node->m_branch[i].m_rect) / exact);
+            } else {
+                slack = std::max(slack, leafSlackRec(child));
+            }
+        }
+        return slack;
+    }
+
+    double entryGrowthRec(const typename TREE::Node* node, const typename TREE::Rect* cover, int id) const {
+        for (int i = 0; i < node->m_count; ++i) {
+            if (node->IsInternalNode()) {
+                const double growth = entryGrowthRec(node->m_branch[i].m_child, &node->m_branch[i].m_rect, id);
+                if (growth > 0) {
+                    return growth;
+                }
+            } else if (node->m_branch[i].m_data == id) {
+                typename TREE::Rect others = node->m_branch[i == 0 ? 1 : 0].m_rect;
+                for (int j = 0; j < node->m_count; ++j) {
+                    if (j != i) {
+                        others = this->CombineRect(&others, &node->m_branch[j].m_rect);
+                    }
+                }
+                return margin(*cover) / margin(others);
+            }
+        }
+        return 0;
+    }
+
+    int validateRec(const typename TREE::Node* node, bool isRoot, bool exactCovers) const {
+        if (!isRoot) {
+            EXPECT_GE(node->m_count, TREE::MINNODES);
+        }
+        EXPECT_LE(node->m_count, TREE::MAXNODES);
+        if (node->IsLeaf()) {
+            if constexpr (TREE::SplitPolicy::HILBERT) {
+                for (int i = 0; i < node->m_count; ++i) {
+                    EXPECT_EQ(node->m_branch[i].m_key, TREE::HilbertKey(node->m_branch[i].m_rect));
+                }
+            }
+            EXPECT_EQ(node->m_entryCount, node->m_count);
+            return node->m_count;
+        }
+        int items = 0;
+        for (int i = 0; i < node->m_count; ++i) {
+            const auto* child = node->m_branch[i].m_child;
+            EXPECT_EQ(child->m_level, node->m_level - 1);
+            auto cover = this->NodeCover(const_cast<typename TREE::Node*>(child));
+            for (int axis = 0; axis < 2; ++axis) {
+                if (exactCovers) {
+                    EXPECT_EQ(cover.m_min[axis], node->m_branch[i].m_rect.m_min[axis]);
+                    EXPECT_EQ(cover.m_max[axis], node->m_branch[i].m_rect.m_max[axis]);
+                } else {
+                    EXPECT_GE(cover.m_min[axis], node->m_branch[i].m_rect.m_min[axis]);
+                    EXPECT_LE(cover.m_max[axis], node->m_branch[i].m_rect.m_max[axis]);
+                }
+            }
+            EXPECT_EQ(this->BranchLayers(node->m_branch[i]), this->NodeLayers(child));
+            if constexpr (TREE::SplitPolicy::HILBERT) {
+                EXPECT_EQ(node->m_branch[i].m_key, TREE::NodeKey(child));
+            }
+            items += validateRec(child, false, exactCovers);
+        }
+        EXPECT_EQ(node->m_entryCount, items);
+        return items;
+    }
+};
+
+// R* 插入策略：成簇数据上插入删除后结果正确，结构合法
+TEST(RTree, rstar_split) {
+    typedef TreeInspector<RTree<int, double, 2, double, 8, 3, RTreePoolAllocator, RTreeAoSLayout, RTreeRStarSplit>>
+        RSTAR;
+    RSTAR tree;
+
+    std::vector<std::pair<RTREE2D::Rect, int>> entries;
+    for (int i = 0; i < 6000; ++i) {
+        // 六个簇，簇内按伪随机偏移
+        RTREE2D::Rect rect;
+        rect.m_min[0] = (i % 6) * 100.0 + (i * 7919 % 997) / 50.0;
+        rect.m_min[1] = (i % 6) * 40.0 + (i * 104729 % 991) / 50.0;
+        rect.m_max[0] = rect.m_min[0] + (i % 5) * 0.3;
+        rect.m_max[1] = rect.m_min[1] + (i % 3) * 0.4;
+        entries.emplace_back(rect, i);
+        tree.Insert(rect.m_min, rect.m_max, i);
+    }
+    ASSERT_EQ(tree.validate(), 6000);
+    checkWindows(tree, entries);
+
+    std::vector<std::pair<RTREE2D::Rect, int>> kept;
+    for (const auto& entry : entries) {
+        if (entry.second % 4 == 1) {
+            ASSERT_FALSE(tree.Remove(entry.first.m_min, entry.first.m_max, entry.second));
+        } else {
+            kept.push_back(entry);
+        }
+    }
+    ASSERT_EQ(tree.validate(), (int) kept.size());
+    checkWindows(tree, kept);
+
+    const double windows[][4] = {{100, 40, 120, 60}, {510, 200, 530, 221}, {55, 0, 305, 100}};
+    for (const auto& window : windows) {
+        const double min[2] = {window[0], window[1]};
+        const double max[2] = {window[2], window[3]};
+        ASSERT_EQ(treeSearch(tree, min, max), bruteSearch(kept, min, max));
+    }
+}
+
+// 希尔伯特插入：按键值下行、溢出先分给兄弟节点，流式插入成簇数据后节点至少三分之二满，删除后结构仍合法
+TEST(RTree, hilbert_split) {
+    typedef TreeInspector<RTree<int, double, 2, double, 8, 3, RTreePoolAllocator, RTreeAoSLayout, RTreeHilbertSplit>>
+        HILBERT;
+    HILBERT tree;
+
+    std::vector<std::pair<RTREE2D::Rect, int>> entries;
+    for (int i = 0; i < 6000; ++i) {
+        RTREE2D::Rect rect;
+        rect.m_min[0] = (i % 6) * 100.0 + (i * 7919 % 997) / 50.0;
+        rect.m_min[1] = (i % 6) * 40.0 + (i * 104729 % 991) / 50.0;
+        rect.m_max[0] = rect.m_min[0] + (i % 5) * 0.3;
+        rect.m_max[1] = rect.m_min[1] + (i % 3) * 0.4;
+        entries.emplace_back(rect, i);
+        tree.Insert(rect.m_min, rect.m_max, i);
+    }
+    ASSERT_EQ(tree.validate(), 6000);
+    checkWindows(tree, entries);
+    EXPECT_GE(tree.CalcStats().fillFactor, 2.0 / 3.0);
+
+    // 二分裂的对照树
+    RTREE2D quadratic;
+    for (const auto& entry : entries) {
+        quadratic.Insert(entry.first.m_min, entry.first.m_max, entry.second);
+    }
+    EXPECT_LT(tree.CalcStats().nodeCount, quadratic.CalcStats().nodeCount);
+
+    std::vector<std::pair<RTREE2D::Rect, int>> kept;
+    for (const auto& entry : entries) {
+        if (entry.second % 4 == 1) {
+            ASSERT_FALSE(tree.Remove(entry.first.m_min, entry.first.m_max, entry.second));
+        } else {
+            kept.push_back(entry);
+        }
+    }
+    ASSERT_EQ(tree.validate(), (int) kept.size());
+    checkWindows(tree, kept);
+
+    // 负坐标与远处的条目同样有键值
+    const double farMin[2] = {-1e9, 1e9};
+    const double farMax[2] = {-1e9 + 1, 1e9 + 1};
+    tree.Insert(farMin, farMax, -1);
+    ASSERT_EQ(tree.validate(), (int) kept.size() + 1);
+    EXPECT_EQ(treeSearch(tree, farMin, farMax), std::vector<int>{-1});
+}
+
+// 希尔伯特策略下打包构建与整理按条目键值分组：兄弟子树的键值区间不相交，之后的插入仍能按键值下行
+TEST(RTree, hilbert_packed_key_ranges) {
+    typedef TreeInspector<RTree<int, double, 2, double, 8, 3, RTreePoolAllocator, RTreeAoSLayout, RTreeHilbertSplit>>
+        HILBERT;
+
+    std::vector<std::pair<RTREE2D::Rect, int>> entries;
+    std::vector<std::pair<HILBERT::Rect, int>> packed;
+    for (int i = 0; i < 5000; ++i) {
+        RTREE2D::Rect rect;
+        rect.m_min[0] = (i * 7919 % 5003) / 20.0 - 100;
+        rect.m_min[1] = ((int64_t) i * 104729 % 5003) / 20.0 - 50;
+        rect.m_max[0] = rect.m_min[0] + (i % 5) * 0.3;
+        rect.m_max[1] = rect.m_min[1] + (i % 3) * 0.4;
+        entries.emplace_back(rect, i);
+        HILBERT::Rect copy;
+        std::copy(rect.m_min, rect.m_min + 2, copy.m_min);
+        std::copy(rect.m_max, rect.m_max + 2, copy.m_max);
+        packed.emplace_back(copy, i);
+    }
+
+    for (auto method : {HILBERT::BulkLoadMethod::STR, HILBERT::BulkLoadMethod::HILBERT}) {
+        HILBERT tree;
+        tree.BulkLoad(packed.begin(), packed.end(), method);
+        ASSERT_EQ(tree.validate(), (int) entries.size());
+        EXPECT_TRUE(tree.keyRangesDisjoint());
+    }
+
+    HILBERT tree;
+    for (const auto& entry : entries) {
+        tree.Insert(entry.first.m_min, entry.first.m_max, entry.second);
+    }
+    std::vector<std::pair<RTREE2D::Rect, int>> kept;
+    for (const auto& entry : entries) {
+        if (entry.second % 4 == 0) {
+            kept.push_back(entry);
+        } else {
+            tree.Remove(entry.first.m_min, entry.first.m_max, entry.second);
+        }
+    }
+    int calls = 0;
+    while (!tree.Compact(1 << 20, 0.0).sweepDone && ++calls < 100) {
+    }
+    ASSERT_EQ(tree.validate(), (int) kept.size());
+    EXPECT_TRUE(tree.keyRangesDisjoint());
+    checkWindows(tree, kept);
+}
+
+// 体积度量与分裂策略的各种组合，三维下查询结果与暴力一致
+template <class SPLITPOLICY, class VOLUMEPOLICY>
+void checkPolicies3D() {
+    typedef RTree<int, float, 3, double, 8, 4, RTreePoolAllocator, RTreeAoSLayout, SPLITPOLICY, VOLUMEPOLICY> TREE;
+    TREE tree;
+
+    std::vector<std::pair<typename TREE::Rect, int>> entries;
+    for (int i = 0; i < 4000; ++i) {
+        typename TREE::Rect rect;
+        for (int axis = 0; axis < 3; ++axis) {
+            rect.m_min[axis] = float((i * (31 + axis * 17)) % 211);
+            // 部分矩形在某一维退化为零厚度
+            rect.m_max[axis] = rect.m_min[axis] + float((i + axis) % 4);
+        }
+        entries.emplace_back(rect, i);
+        tree.Insert(rect.m_min, rect.m_max, i);
+    }
+
+    for (int q = 0; q < 30; ++q) {
+        const float min[3] = {float(q * 6), float(q * 5), float(q * 4)};
+        const float max[3] = {min[0] + 30, min[1] + 45, min[2] + 20};
+        std::vector<int> expected;
+        for (const auto& entry : entries) {
+            bool overlap = true;
+            for (int axis = 0; axis < 3; ++axis) {
+                overlap = overlap && entry.first.m_min[axis] <= max[axis] && entry.first.m_max[axis] >= min[axis];
+            }
+            if (overlap) {
+                expected.push_back(entry.second);
+            }
+        }
+        ASSERT_EQ(treeSearch(tree, min, max), expected);
+    }
+}
+
+TEST(RTree, volume_policies) {
+    checkPolicies3D<RTreeQuadraticSplit, RTreeSphericalVolume>();
+    checkPolicies3D<RTreeQuadraticSplit, RTreeRectVolume>();
+    checkPolicies3D<RTreeRStarSplit, RTreeSphericalVolume>();
+    checkPolicies3D<RTreeRStarSplit, RTreeRectVolume>();
+}
+
+// 空间连接：与逐个查询的结果一致，自连接每对只出现一次，并行结果与串行一致
+TEST(RTree, spatial_join) {
+    typedef RTree<int, double, 2, double, 6, 3, RTreeHeapAllocator, RTreeSoALayout, RTreeRStarSplit> OTHER;
+
+    auto parts = makeGrid(40);
+    RTREE2D partTree(parts.begin(), parts.end());
+
+    // 另一棵树的高度不同，矩形大小也不同
+    std::vector<std::pair<RTREE2D::Rect, int>> zones;
+    OTHER zoneTree;
+    for (int i = 0; i < 300; ++i) {
+        RTREE2D::Rect rect;
+        rect.m_min[0] = (i * 37 % 79) + 0.25;
+        rect.m_min[1] = (i * 53 % 83) + 0.5;
+        rect.m_max[0] = rect.m_min[0] + i % 6;
+        rect.m_max[1] = rect.m_min[1] + i % 4;
+        zones.emplace_back(rect, i);
+        zoneTree.Insert(rect.m_min, rect.m_max, i);
+    }
+
+    std::vector<std::pair<int, int>> expected;
+    for (const auto& zone : zones) {
+        for (int part : bruteSearch(parts, zone.first.m_min, zone.first.m_max)) {
+            expected.emplace_back(part, zone.second);
+        }
+    }
+    std::sort(expected.begin(), expected.end());
+
+    std::vector<std::pair<int, int>> actual;
+    int found = partTree.Join(zoneTree, [&actual](const int& part, const int& zone) {
+        actual.emplace_back(part, zone);
+        return true;
+    });
+    std::sort(actual.begin(), actual.end());
+    ASSERT_EQ(found, (int) expected.size());
+    ASSERT_EQ(actual, expected);
+
+    for (int threads : {1, 3, 8}) {
+        auto parallel = partTree.ParallelJoin(zoneTree, threads);
+        std::sort(parallel.begin(), parallel.end());
+        ASSERT_EQ(parallel, expected);
+    }
+
+    // 提前终止
+    int visited = 0;
+    ASSERT_EQ(partTree.Join(zoneTree, [&visited](const int&, const int&) { return ++visited < 5; }), 4);
+
+    // 自连接：无序对，不含自身
+    std::vector<std::pair<int, int>> selfExpected;
+    for (const auto& zone : zones) {
+        std::vector<std::pair<RTREE2D::Rect, int>> others(zones.begin() + zone.second + 1, zones.end());
+        for (int other : bruteSearch(others, zone.first.m_min, zone.first.m_max)) {
+            selfExpected.emplace_back(zone.second, other);
+        }
+    }
+    std::sort(selfExpected.begin(), selfExpected.end());
+
+    auto ordered = [](std::vector<std::pair<int, int>> pairs) {
+        for (auto& pair : pairs) {
+            if (pair.first > pair.second) {
+                std::swap(pair.first, pair.second);
+            }
+        }
+        std::sort(pairs.begin(), pairs.end());
+        return pairs;
+    };
+
+    std::vector<std::pair<int, int>> selfActual;
+    zoneTree.SelfJoin([&selfActual](const int& a, const int& b) {
+        selfActual.emplace_back(a, b);
+        return true;
+    });
+    ASSERT_EQ(ordered(selfActual), selfExpected);
+    for (int threads : {1, 4}) {
+        ASSERT_EQ(ordered(zoneTree.ParallelSelfJoin(threads)), selfExpected);
+    }
+
+    RTREE2D empty;
+    ASSERT_EQ(empty.Join(zoneTree, [](const int&, const int&) { return true; }), 0);
+    ASSERT_TRUE(empty.ParallelSelfJoin(4).empty());
+}
+
+// 批量查询：每个查询的结果区间与单独 Search 一致，结果对象可复用
+TEST(RTree, search_batch) {
+    auto entries = makeGrid(120);
+    RTREE2D tree;
+    for (const auto& entry : entries) {
+        tree.Insert(entry.first.m_min, entry.first.m_max, entry.second);
+    }
+
+    std::vector<RTREE2D::Rect> queries(1000);
+    for (int i = 0; i < (int) queries.size(); ++i) {
+        queries[i].m_min[0] = (i * 7919 % 2400) / 10.0;
+        queries[i].m_min[1] = (i * 104729 % 2400) / 10.0;
+        queries[i].m_max[0] = queries[i].m_min[0] + i % 9;
+        queries[i].m_max[1] = queries[i].m_min[1] + i % 5;
+    }
+
+    RTREE2D::SearchBatchResult result;
+    for (int threads : {1, 4}) {
+        size_t total = tree.SearchBatch(queries.data(), (int) queries.size(), result, threads);
+        ASSERT_EQ(result.Offsets().size(), queries.size() + 1);
+        ASSERT_EQ(total, result.Hits().size());
+
+        for (int i = 0; i < (int) queries.size(); ++i) {
+            std::vector<int> expected;
+            tree.Search(queries[i].m_min, queries[i].m_max, [&expected](const int& id) {
+                expected.push_back(id);
+                return true;
+            });
+            ASSERT_EQ(std::vector<int>(result.begin(i), result.end(i)), expected);
+            ASSERT_EQ(result.HitCount(i), expected.size());
+        }
+    }
+
+    ASSERT_EQ(tree.SearchBatch(queries.data(), 0, result, 2), 0u);
+    ASSERT_EQ(result.Offsets().size(), 1u);
+}
+
+// 按层遍历：结果集合与深度优先的 Search 一致，访问者可以提前停止，缓冲区可复用
+template <class TREE>
+void checkFrontier() {
+    auto entries = makeGrid(90);
+    TREE tree;
+    typename TREE::SearchBuffer buffer;
+    auto frontierSearch = [&tree, &buffer](const double min[2], const double max[2]) {
+        std::vector<int> result;
+        tree.SearchFrontier(min, max, [&result](const int& id) {
+            result.push_back(id);
+            return true;
+        }, buffer);
+        std::sort(result.begin(), result.end());
+        return result;
+    };
+
+    const double all[2][2] = {{-1, -1}, {500, 500}};
+    ASSERT_TRUE(frontierSearch(all[0], all[1]).empty());
+
+    for (const auto& entry : entries) {
+        tree.Insert(entry.first.m_min, entry.first.m_max, entry.second);
+    }
+    for (int q = 0; q < 50; ++q) {
+        const double min[2] = {q * 3.7, q * 2.9};
+        const double max[2] = {min[0] + q % 6 * 4, min[1] + q % 7 * 3};
+        ASSERT_EQ(frontierSearch(min, max), treeSearch(tree, min, max)) << q;
+    }
+    ASSERT_EQ(frontierSearch(all[0], all[1]).size(), entries.size());
+
+    int visited = 0;
+    ASSERT_EQ(tree.SearchFrontier(all[0], all[1], [&visited](const int&) { return ++visited < 20; }, buffer), 19);
+    ASSERT_EQ(visited, 20);
+}
+
+TEST(RTree, search_frontier) {
+    checkFrontier<RTREE2D>();
+    checkFrontier<RTree<int, double, 2, double, 8, 3, RTreePoolAllocator, RTreeSoALayout, RTreeRStarSplit>>();
+}
+
+// 子树计数：各种修改之后仍然正确，窗口计数与查询结果一致
+template <class TREE>
+void checkCounts() {
+    TreeInspector<TREE> tree;
+    auto entries = makeGrid(50);
+    for (const auto& entry : entries) {
+        tree.Insert(entry.first.m_min, entry.first.m_max, entry.second);
+    }
+    for (const auto& entry : entries) {
+        if (entry.second % 3 == 0) {
+            ASSERT_FALSE(tree.Remove(entry.first.m_min, entry.first.m_max, entry.second));
+        }
+    }
+    ASSERT_EQ(tree.validate(), tree.Count());
+    ASSERT_EQ(tree.Count(), 2500 - 834);
+
+    const double windows[][4] = {{0, 0, 100, 100}, {3.9, 7.2, 61.3, 44.4}, {-10, -10, 1000, 1000}, {200, 200, 300, 300}};
+    for (const auto& window : windows) {
+        const double min[2] = {window[0], window[1]};
+        const double max[2] = {window[2], window[3]};
+        int found = tree.Search(min, max, [](const int&) {
+            return true;
+        });
+        ASSERT_EQ(tree.Count(min, max), found);
+    }
+}
+
+TEST(RTree, subtree_counts) {
+    checkCounts<RTREE2D>();
+    checkCounts<RTree<int, double, 2, double, 8, 3, RTreePoolAllocator, RTreeSoALayout, RTreeRStarSplit>>();
+
+    auto entries = makeGrid(70);
+    TreeInspector<RTREE2D> packed;
+    packed.BulkLoad(entries.begin(), entries.end(), RTREE2D::BulkLoadMethod::HILBERT);
+    ASSERT_EQ(packed.validate(), 4900);
+    ASSERT_EQ(packed.Count(), 4900);
+
+    packed.RemoveAll();
+    ASSERT_EQ(packed.Count(), 0);
+}
+
+// 原地更新：小幅移动走原地或扩张路径，大幅移动退回删除再插入，结果与暴力查询一致
+template <class TREE>
+void checkUpdates() {
+    auto entries = makeGrid(40);
+    TreeInspector<TREE> tree;
+    for (const auto& entry : entries) {
+        tree.Insert(entry.first.m_min, entry.first.m_max, entry.second);
+    }
+
+    for (int round = 0; round < 20; ++round) {
+        for (auto& entry : entries) {
+            RTREE2D::Rect moved = entry.first;
+            // 每 50 个中有一个跳到远处
+            const double step = entry.second % 50 == round ? 37.0 : 0.3 * ((entry.second + round) % 3 - 1);
+            for (int axis = 0; axis < 2; ++axis) {
+                moved.m_min[axis] += step;
+                moved.m_max[axis] += step;
+            }
+            ASSERT_NE(tree.Update(entry.first.m_min, entry.first.m_max, moved.m_min, moved.m_max, entry.second),
+                      TREE::UpdatePath::NOT_FOUND);
+            entry.first = moved;
+        }
+        checkWindows(tree, entries);
+    }
+    ASSERT_EQ(tree.validate(false), 1600);
+    ASSERT_EQ(tree.Count(), 1600);
+
+    const auto& stats = tree.GetUpdateStats();
+    EXPECT_GT(stats.inPlace, 0);
+    EXPECT_GT(stats.enlarged, 0);
+    EXPECT_GT(stats.reinserted, 0);
+    EXPECT_EQ(stats.inPlace + stats.enlarged + stats.reinserted, 20 * 1600);
+
+    const double nowhere[2] = {-100, -100};
+    EXPECT_EQ(tree.Update(nowhere, nowhere, nowhere, nowhere, 0), TREE::UpdatePath::NOT_FOUND);
+    EXPECT_EQ(tree.GetUpdateStats().notFound, 1);
+
+    // 移动后删除仍能找到条目
+    for (const auto& entry : entries) {
+        ASSERT_FALSE(tree.Remove(entry.first.m_min, entry.first.m_max, entry.second));
+    }
+    ASSERT_EQ(tree.Count(), 0);
+}
+
+TEST(RTree, update_in_place) {
+    checkUpdates<RTREE2D>();
+    checkUpdates<RTree<int, double, 2, double, 8, 3, RTreePoolAllocator, RTreeSoALayout, RTreeRStarSplit>>();
+    checkUpdates<RTree<int, double, 2, double, 8, 3, RTreePoolAllocator, RTreeSoALayout, RTreeHilbertSplit>>();
+}
+
+// 同一条目反复小步移动：叶子覆盖的增长始终不超过上限，不会逐次累积，走得足够远后被重新插入
+TEST(RTree, update_growth_bounded) {
+    auto entries = makeGrid(40);
+    TreeInspector<RTREE2D> tree;
+    for (const auto& entry : entries) {
+        tree.Insert(entry.first.m_min, entry.first.m_max, entry.second);
+    }
+
+    RTREE2D::Rect rect = entries[20 * 40 + 3].first;
+    for (int step = 0; step < 300; ++step) {
+        RTREE2D::Rect moved = rect;
+        moved.m_min[0] += 0.2;
+        moved.m_max[0] += 0.2;
+        const auto path = tree.Update(rect.m_min, rect.m_max, moved.m_min, moved.m_max, 20 * 40 + 3, 0.25);
+        ASSERT_NE(path, RTREE2D::UpdatePath::NOT_FOUND);
+        rect = moved;
+        if (path == RTREE2D::UpdatePath::ENLARGED) {
+            ASSERT_LE(tree.entryGrowth(20 * 40 + 3), 1.25 + 1e-9) << step;
+        }
+        // 插入时选中的叶子本身可能已超过上限，但松弛不会随移动次数增长
+        ASSERT_LE(tree.leafSlack(), 1.5) << step;
+    }
+    EXPECT_GT(tree.GetUpdateStats().enlarged, 0);
+    EXPECT_GT(tree.GetUpdateStats().reinserted, 0);
+    ASSERT_EQ(tree.validate(false), 1600);
+}
+
+// 任意类型的数据：放不进分支的数据存放在树的旁路数组中，删除后槽位被复用
+class PayloadTree : public RTree<std::string, double, 2> {
+public:
+    size_t payloadSlots() const {
+        return m_payloads.size();
+    }
+};
+
+TEST(RTree, side_stored_payloads) {
+    auto entries = makeGrid(30);
+    auto name = [](int id) {
+        return "item-" + std::to_string(id) + std::string(24, 'x');
+    };
+
+    PayloadTree tree;
+    for (const auto& entry : entries) {
+        tree.Insert(entry.first.m_min, entry.first.m_max, name(entry.second));
+    }
+    ASSERT_EQ(tree.payloadSlots(), 900u);
+
+    const double min[2] = {10, 10};
+    const double max[2] = {20, 20};
+    std::vector<std::string> found;
+    tree.Search(min, max, [&found](const std::string& data) {
+        found.push_back(data);
+        return true;
+    });
+    std::vector<std::string> expected;
+    for (int id : bruteSearch(entries, min, max)) {
+        expected.push_back(name(id));
+    }
+    std::sort(found.begin(), found.end());
+    std::sort(expected.begin(), expected.end());
+    ASSERT_EQ(found, expected);
+
+    // 删除一半再插回，槽位数不变
+    for (int i = 0; i < 900; i += 2) {
+        ASSERT_FALSE(tree.Remove(entries[i].first.m_min, entries[i].first.m_max, name(i)));
+    }
+    ASSERT_EQ(tree.Count(), 450);
+    for (int i = 0; i < 900; i += 2) {
+        tree.Insert(entries[i].first.m_min, entries[i].first.m_max, name(i));
+    }
+    ASSERT_EQ(tree.payloadSlots(), 900u);
+
+    // 远距离移动走删除再插入，数据保持不变
+    const double far[2] = {500, 500};
+    ASSERT_EQ(tree.Update(entries[0].first.m_min, entries[0].first.m_max, far, far, name(0)),
+              PayloadTree::UpdatePath::REINSERTED);
+    found.clear();
+    tree.Search(far, far, [&found](const std::string& data) {
+        found.push_back(data);
+        return true;
+    });
+    ASSERT_EQ(found, std::vector<std::string>{name(0)});
+
+    int iterated = 0;
+    for (auto it = tree.begin(); it != tree.end(); ++it) {
+        EXPECT_EQ(it->compare(0, 5, "item-"), 0);
+        ++iterated;
+    }
+    EXPECT_EQ(iterated, 900);
+
+    int pairs = tree.SelfJoin([](const std::string& a, const std::string& b) {
+        EXPECT_NE(a, b);
+        return true;
+    });
+    EXPECT_EQ(pairs, 0);
+
+    tree.RemoveAll();
+    ASSERT_EQ(tree.payloadSlots(), 0u);
+
+    // 批量构建后数据按叶子顺序重排，查询结果不变
+    std::vector<std::pair<PayloadTree::Rect, std::string>> named(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        std::copy(entries[i].first.m_min, entries[i].first.m_min + 2, named[i].first.m_min);
+        std::copy(entries[i].first.m_max, entries[i].first.m_max + 2, named[i].first.m_max);
+        named[i].second = name(entries[i].second);
+    }
+    tree.BulkLoad(named.begin(), named.end());
+    ASSERT_EQ(tree.payloadSlots(), 900u);
+    found.clear();
+    tree.Search(min, max, [&found](const std::string& data) {
+        found.push_back(data);
+        return true;
+    });
+    std::sort(found.begin(), found.end());
+    ASSERT_EQ(found, expected);
+}
+
+// 光线求交：网格中每个格子内切一个圆，首个命中与暴力求交一致；线段穿过的条目按进入顺序给出
+namespace {
+
+// 光线与编号 id 的圆求交，圆心在格子中心，半径 0.75
+bool hitCircle(int n, int id, const double origin[2], const double direction[2], double& t) {
+    const double center[2] = {(id % n) * 2.0 + 0.75, (id / n) * 2.0 + 0.75};
+    const double offset[2] = {origin[0] - center[0], origin[1] - center[1]};
+    const double a = direction[0] * direction[0] + direction[1] * direction[1];
+    const double b = 2 * (direction[0] * offset[0] + direction[1] * offset[1]);
+    const double c = offset[0] * offset[0] + offset[1] * offset[1] - 0.75 * 0.75;
+    const double disc = b * b - 4 * a * c;
+    if (disc < 0) {
+        return false;
+    }
+    const double t0 = (-b - std::sqrt(disc)) / (2 * a);
+    const double t1 = (-b + std::sqrt(disc)) / (2 * a);
+    if (t1 < 0) {
+        return false;
+    }
+    t = std::max(t0, 0.0);
+    return true;
+}
+
+// 线段是否穿过矩形，t 为进入位置
+bool segmentEnters(const RTREE2D::Rect& rect, const double start[2], const double end[2], double& t) {
+    double enter = 0;
+    double leave = 1;
+    for (int axis = 0; axis < 2; ++axis) {
+        const double delta = end[axis] - start[axis];
+        if (delta == 0) {
+            if (start[axis] < rect.m_min[axis] || start[axis] > rect.m_max[axis]) {
+                return false;
+            }
+            continue;
+        }
+        double t0 = (rect.m_min[axis] - start[axis]) / delta;
+        double t1 = (rect.m_max[axis] - start[axis]) / delta;
+        if (t0 > t1) {
+            std::swap(t0, t1);
+        }
+        enter = std::max(enter, t0);
+        leave = std::min(leave, t1);
+    }
+    t = enter;
+    return enter <= leave;
+}
+
+} // namespace
+
+TEST(RTree, ray_cast) {
+    const int n = 50;
+    auto entries = makeGrid(n);
+    RTREE2D tree;
+    tree.BulkLoad(entries.begin(), entries.end());
+
+    const double rays[][5] = {{-5, 0.7, 1, 0, 1000},      {-5, 1.0, 1, 0.013, 1000}, {50.3, -3, 0, 1, 1000},
+                              {120, 120, -1, -1.3, 1000}, {0.75, 0.75, 1, 1, 1000}, {-5, -5, 1, 1, 4},
+                              {0.2, 120, 0.31, -1, 1000}, {1.8, -1, 0, 1, 1000}};
+    for (const auto& ray : rays) {
+        const double origin[2] = {ray[0], ray[1]};
+        const double direction[2] = {ray[2], ray[3]};
+
+        double expected = ray[4];
+        bool expectedHit = false;
+        for (const auto& entry : entries) {
+            double t;
+            if (hitCircle(n, entry.second, origin, direction, t) && t <= expected) {
+                expected = t;
+                expectedHit = true;
+            }
+        }
+
+        std::pair<double, int> hit(0, -1);
+        const bool found = tree.RayCast(
+                origin, direction, ray[4],
+                [&](const int& id, double& t) {
+                    return hitCircle(n, id, origin, direction, t);
+                },
+                hit);
+        ASSERT_EQ(found, expectedHit);
+        if (found) {
+            EXPECT_NEAR(hit.first, expected, 1e-9);
+            double t;
+            ASSERT_TRUE(hitCircle(n, hit.second, origin, direction, t));
+            EXPECT_NEAR(t, expected, 1e-9);
+        }
+    }
+
+    const double segments[][4] = {{-3, 0.7, 103, 0.9}, {10.1, 10.1, 30.7, 55.2}, {5.3, 80, 5.3, -2}, {60, 60, 61, 61}};
+    for (const auto& segment : segments) {
+        const double start[2] = {segment[0], segment[1]};
+        const double end[2] = {segment[2], segment[3]};
+
+        std::vector<int> expected;
+        for (const auto& entry : entries) {
+            double t;
+            if (segmentEnters(entry.first, start, end, t)) {
+                expected.push_back(entry.second);
+            }
+        }
+
+        std::vector<int> visited;
+        double lastT = 0;
+        const int count = tree.SegmentCast(start, end, [&](const int& id, double t) {
+            EXPECT_GE(t, lastT);
+            lastT = t;
+            visited.push_back(id);
+            return true;
+        });
+        ASSERT_EQ(count, (int) visited.size());
+        std::sort(visited.begin(), visited.end());
+        ASSERT_EQ(visited, expected);
+    }
+
+    // 访问函数返回 false 时停止
+    const double start[2] = {-3, 0.7};
+    const double end[2] = {103, 0.7};
+    std::vector<int> firstTwo;
+    tree.SegmentCast(start, end, [&](const int& id, double) {
+        firstTwo.push_back(id);
+        return firstTwo.size() < 2;
+    });
+    ASSERT_EQ(firstTwo, (std::vector<int>{0, 1}));
+}
+
+// 圆形与多边形区域查询：相交与完全包含两种模式都与暴力判断一致
+namespace {
+
+bool pointInPolygon(const geometry::POLYGON& polygon, double x, double y) {
+    bool inside = false;
+    for (size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++) {
+        if ((polygon[i].y > y) != (polygon[j].y > y) &&
+            x < (polygon[j].x - polygon[i].x) * (y - polygon[i].y) / (polygon[j].y - polygon[i].y) + polygon[i].x) {
+            inside = !inside;
+        }
+    }
+    return inside;
+}
+
+bool segmentsCross(const geometry::POINT& a, const geometry::POINT& b, const geometry::POINT& c,
+                   const geometry::POINT& d) {
+    const double d1 = geometry::multiply(b, c, a);
+    const double d2 = geometry::multiply(b, d, a);
+    const double d3 = geometry::multiply(d, a, c);
+    const double d4 = geometry::multiply(d, b, c);
+    return ((d1 > 0) != (d2 > 0)) && ((d3 > 0) != (d4 > 0));
+}
+
+// 0 不相交，1 相交但不在内部，2 完全在内部
+int rectPolygonRelation(const RTREE2D::Rect& rect, const geometry::POLYGON& polygon) {
+    const geometry::POINT corners[4] = {{rect.m_min[0], rect.m_min[1]},
+                                        {rect.m_max[0], rect.m_min[1]},
+                                        {rect.m_max[0], rect.m_max[1]},
+                                        {rect.m_min[0], rect.m_max[1]}};
+    int cornersInside = 0;
+    for (const auto& corner : corners) {
+        cornersInside += pointInPolygon(polygon, corner.x, corner.y);
+    }
+    bool touches = false;
+    for (size_t i = 0; i < polygon.size(); ++i) {
+        const auto& a = polygon[i];
+        const auto& b = polygon[(i + 1) % polygon.size()];
+        if (a.x >= rect.m_min[0] && a.x <= rect.m_max[0] && a.y >= rect.m_min[1] && a.y <= rect.m_max[1]) {
+            touches = true;
+        }
+        for (int edge = 0; edge < 4; ++edge) {
+            touches = touches || segmentsCross(a, b, corners[edge], corners[(edge + 1) % 4]);
+        }
+    }
+    if (cornersInside == 4 && !touches) {
+        return 2;
+    }
+    return cornersInside > 0 || touches ? 1 : 0;
+}
+
+template <class SEARCH>
+std::vector<int> collectRegion(SEARCH&& search) {
+    std::vector<int> result;
+    search([&result](const int& id) {
+        result.push_back(id);
+        return true;
+    });
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+} // namespace
+
+TEST(RTree, region_queries) {
+    auto entries = makeGrid(40);
+    RTREE2D tree;
+    for (const auto& entry : entries) {
+        tree.Insert(entry.first.m_min, entry.first.m_max, entry.second);
+    }
+
+    const double circles[][3] = {{40.3, 40.1, 0.2}, {40.3, 40.1, 17.3}, {-3, -3, 9.7}, {70.7, 10.2, 300}};
+    for (const auto& circle : circles) {
+        const double center[2] = {circle[0], circle[1]};
+        std::vector<int> overlapping, inside;
+        for (const auto& entry : entries) {
+            if (RTREE2D::MinDistSq(center, entry.first) <= circle[2] * circle[2]) {
+                overlapping.push_back(entry.second);
+            }
+            bool allCorners = true;
+            for (int corner = 0; corner < 4; ++corner) {
+                const double dx = (corner & 1 ? entry.first.m_max[0] : entry.first.m_min[0]) - center[0];
+                const double dy = (corner & 2 ? entry.first.m_max[1] : entry.first.m_min[1]) - center[1];
+                allCorners = allCorners && dx * dx + dy * dy <= circle[2] * circle[2];
+            }
+            if (allCorners) {
+                inside.push_back(entry.second);
+            }
+        }
+        ASSERT_EQ(collectRegion([&](auto visitor) {
+                      tree.SearchRadius(center, circle[2], visitor);
+                  }),
+                  overlapping);
+        ASSERT_EQ(collectRegion([&](auto visitor) {
+                      tree.SearchRadius(center, circle[2], visitor, RTREE2D::RegionMatch::INSIDE);
+                  }),
+                  inside);
+    }
+
+    // 凹多边形，顶点避开网格坐标
+    const geometry::POLYGON polygons[] = {
+            {{5.1, 5.3}, {60.7, 4.9}, {61.3, 60.2}, {33.3, 20.7}, {4.7, 58.9}},
+            {{20.1, 20.1}, {20.9, 20.1}, {20.9, 20.7}},
+            {{-10.1, -10.3}, {100.7, -10.1}, {100.3, 100.9}, {-10.7, 100.1}},
+            {{10.2, 70.4}, {70.6, 70.8}, {40.3, 71.9}},
+    };
+    for (const auto& polygon : polygons) {
+        std::vector<int> overlapping, inside;
+        for (const auto& entry : entries) {
+            const int relation = rectPolygonRelation(entry.first, polygon);
+            if (relation > 0) {
+                overlapping.push_back(entry.second);
+            }
+            if (relation == 2) {
+                inside.push_back(entry.second);
+            }
+        }
+        ASSERT_EQ(collectRegion([&](auto visitor) {
+                      tree.SearchPolygon(polygon, visitor);
+                  }),
+                  overlapping);
+        ASSERT_EQ(collectRegion([&](auto visitor) {
+                      tree.SearchPolygon(polygon, visitor, RTREE2D::RegionMatch::INSIDE);
+                  }),
+                  inside);
+    }
+
+    // 访问函数返回 false 时停止
+    const double center[2] = {40, 40};
+    int visited = 0;
+    const int found = tree.SearchRadius(center, 1000, [&visited](const int&) {
+        return ++visited < 10;
+    });
+    EXPECT_EQ(visited, 10);
+    EXPECT_EQ(found, 9);
+}
+
+// 大量删除后分步整理：每次只做有限的工作，一轮扫完后结构合法、查询结果不变、节点更少更满
+template <class TREE>
+void checkCompact() {
+    std::vector<std::pair<RTREE2D::Rect, int>> entries;
+    for (int i = 0; i < 6000; ++i) {
+        RTREE2D::Rect rect;
+        rect.m_min[0] = (i * 7919 % 6007) / 50.0;
+        rect.m_min[1] = (i * 104729 % 6007) / 50.0;
+        rect.m_max[0] = rect.m_min[0] + (i % 5) * 0.3;
+        rect.m_max[1] = rect.m_min[1] + (i % 7) * 0.2;
+        entries.emplace_back(rect, i);
+    }
+    TreeInspector<TREE> tree;
+    for (const auto& entry : entries) {
+        tree.Insert(entry.first.m_min, entry.first.m_max, entry.second);
+    }
+    std::vector<std::pair<RTREE2D::Rect, int>> kept;
+    for (const auto& entry : entries) {
+        if (entry.second % 4 == 0) {
+            kept.push_back(entry);
+        } else {
+            tree.Remove(entry.first.m_min, entry.first.m_max, entry.second);
+        }
+    }
+    const auto before = tree.CalcStats();
+
+    int calls = 0;
+    auto sweep = [&tree, &calls]() {
+        calls = 0;
+        int moved = 0;
+        typename TREE::CompactStats stats;
+        do {
+            stats = tree.Compact(200);
+            EXPECT_LE(stats.nodesVisited + stats.entriesMoved, 200);
+            moved += stats.entriesMoved;
+            ++calls;
+        } while (!stats.sweepDone && calls < 1000);
+        EXPECT_TRUE(stats.sweepDone);
+        return moved;
+    };
+
+    const int firstMoved = sweep();
+    EXPECT_GT(calls, 1);
+    ASSERT_EQ(tree.validate(), (int) kept.size());
+    checkWindows(tree, kept);
+    EXPECT_LT(tree.CalcStats().nodeCount, before.nodeCount);
+    EXPECT_GT(tree.CalcStats().fillFactor, before.fillFactor);
+
+    // 整理过的树再扫一轮移动的条目更少
+    EXPECT_LT(sweep(), firstMoved);
+    ASSERT_EQ(tree.validate(), (int) kept.size());
+
+    for (const auto& entry : kept) {
+        ASSERT_FALSE(tree.Remove(entry.first.m_min, entry.first.m_max, entry.second));
+    }
+    ASSERT_EQ(tree.Count(), 0);
+    EXPECT_TRUE(tree.Compact(10).sweepDone);
+}
+
+TEST(RTree, compact_after_removal) {
+    checkCompact<RTREE2D>();
+    checkCompact<RTree<int, double, 2, double, 8, 3, RTreePoolAllocator, RTreeSoALayout, RTreeRStarSplit>>();
+    checkCompact<RTree<int, double, 2, double, 8, 3, RTreePoolAllocator, RTreeSoALayout, RTreeHilbertSplit>>();
+}
+
+// 打包构建的网格，相邻格子只共享边：默认阈值下整理不应重建任何节点
+// 扇出 4、32x32 的网格在 STR 与 Hilbert 两种打包下每层都恰好铺成 2x2 的块，子节点之间没有重叠
+TEST(RTree, compact_leaves_packed) {
+    typedef RTree<int, double, 2, double, 4, 2> GRID_TREE;
+    std::vector<std::pair<GRID_TREE::Rect, int>> cells;
+    for (int x = 0; x < 32; ++x) {
+        for (int y = 0; y < 32; ++y) {
+            GRID_TREE::Rect rect;
+            rect.m_min[0] = x;
+            rect.m_min[1] = y;
+            rect.m_max[0] = x + 1;
+            rect.m_max[1] = y + 1;
+            cells.emplace_back(rect, x * 32 + y);
+        }
+    }
+    for (auto method : {GRID_TREE::BulkLoadMethod::STR, GRID_TREE::BulkLoadMethod::HILBERT}) {
+        GRID_TREE tree;
+        tree.BulkLoad(cells.begin(), cells.end(), method);
+        const auto stats = tree.Compact(1 << 20, 0.5);
+        EXPECT_TRUE(stats.sweepDone);
+        EXPECT_GT(stats.nodesVisited, 0);
+        EXPECT_EQ(stats.groupsRepacked, 0);
+    }
+}
+
+// 图层掩码：按图层过滤的窗口查询、k 近邻与连接和暴力结果一致，删除、整理、存取后掩码仍正确
+template <class TREE>
+void checkLayers() {
+    typedef typename TREE::LayerMask LayerMask;
+    typedef typename TREE::Rect Rect;
+    // 图层与位置相关：每个图层集中在一个条带里，另有少数条目散落在所有条带
+    std::vector<std::tuple<Rect, int, LayerMask>> entries;
+    for (int i = 0; i < 4000; ++i) {
+        Rect rect;
+        rect.m_min[0] = (i * 7919 % 4001) / 40.0;
+        rect.m_min[1] = (i * 104729 % 4001) / 40.0;
+        rect.m_max[0] = rect.m_min[0] + (i % 5) * 0.3;
+        rect.m_max[1] = rect.m_min[1] + (i % 7) * 0.2;
+        const int band = (int) (rect.m_min[0] / 20);
+        const LayerMask layers = (i % 50 == 0) ? LayerMask(1) << 7 : LayerMask(1) << band;
+        entries.emplace_back(rect, i, layers);
+    }
+    auto overlaps = [](const auto& rect, const double min[2], const double max[2]) {
+        return rect.m_min[0] <= max[0] && rect.m_max[0] >= min[0] && rect.m_min[1] <= max[1] &&
+               rect.m_max[1] >= min[1];
+    };
+
+    TreeInspector<TREE> tree;
+    for (const auto& entry : entries) {
+        tree.Insert(std::get<0>(entry).m_min, std::get<0>(entry).m_max, std::get<1>(entry), std::get<2>(entry));
+    }
+    std::vector<std::tuple<Rect, int, LayerMask>> kept;
+    for (const auto& entry : entries) {
+        if (std::get<1>(entry) % 3 == 0) {
+            ASSERT_FALSE(tree.Remove(std::get<0>(entry).m_min, std::get<0>(entry).m_max, std::get<1>(entry)));
+        } else {
+            kept.push_back(entry);
+        }
+    }
+    while (!tree.Compact(500).sweepDone) {
+    }
+    ASSERT_EQ(tree.validate(), (int) kept.size());
+
+    TREE packed;
+    packed.BulkLoad(kept.begin(), kept.end());
+
+    const std::string fileName = "test_rtree_layers.bin";
+    ASSERT_TRUE(tree.Save(fileName.c_str()));
+    TREE loaded;
+    ASSERT_TRUE(loaded.Load(fileName.c_str()));
+    std::remove(fileName.c_str());
+
+    const LayerMask masks[] = {1, (1 << 2) | (1 << 4), LayerMask(1) << 7, TREE::ALL_LAYERS, 0};
+    const double windows[][4] = {{0, 0, 30, 30}, {15, 40, 70, 60}, {-5, -5, 200, 200}};
+    for (LayerMask mask : masks) {
+        for (const auto& window : windows) {
+            const double min[2] = {window[0], window[1]};
+            const double max[2] = {window[2], window[3]};
+            std::vector<int> expected;
+            for (const auto& entry : kept) {
+                if ((std::get<2>(entry) & mask) && overlaps(std::get<0>(entry), min, max)) {
+                    expected.push_back(std::get<1>(entry));
+                }
+            }
+            std::sort(expected.begin(), expected.end());
+            for (const TREE* searched : {(const TREE*) &tree, (const TREE*) &packed, (const TREE*) &loaded}) {
+                std::vector<int> actual;
+                const int found = searched->Search(min, max, mask, [&actual](const int& id) {
+                    actual.push_back(id);
+                    return true;
+                });
+                std::sort(actual.begin(), actual.end());
+                ASSERT_EQ(found, (int) actual.size());
+                ASSERT_EQ(actual, expected);
+            }
+        }
+    }
+
+    // k 近邻：只在给定图层中找
+    std::vector<LayerMask> layerOf(entries.size());
+    for (const auto& entry : entries) {
+        layerOf[std::get<1>(entry)] = std::get<2>(entry);
+    }
+    auto squaredDist = [&entries](const double point[2], const int& id) {
+        return TREE::MinDistSq(point, std::get<0>(entries[id]));
+    };
+    auto any = [](const int&) {
+        return true;
+    };
+    typename TREE::NearestNeighborBuffer buffer;
+    for (LayerMask mask : {LayerMask(1) << 1, LayerMask(1) << 7}) {
+        for (int q = 0; q < 10; ++q) {
+            const double point[2] = {q * 9.7 + 0.3, q * 6.1 + 0.7};
+            std::vector<double> expected;
+            for (const auto& entry : kept) {
+                if (std::get<2>(entry) & mask) {
+                    expected.push_back(squaredDist(point, std::get<1>(entry)));
+                }
+            }
+            std::sort(expected.begin(), expected.end());
+            expected.resize(6);
+            ASSERT_EQ(tree.NearestNeighbors(point, 6, mask, squaredDist, any, buffer), 6);
+            for (int i = 0; i < 6; ++i) {
+                ASSERT_EQ(buffer.Results()[i].first, expected[i]);
+                ASSERT_TRUE(layerOf[buffer.Results()[i].second] & mask);
+            }
+        }
+    }
+    const double origin[2] = {0, 0};
+    EXPECT_EQ(tree.NearestNeighbors(origin, 3, 0, squaredDist, any, buffer), 0);
+
+    // 连接：两边各取自己的图层
+    TREE zones;
+    std::vector<std::pair<Rect, int>> zoneEntries;
+    for (int i = 0; i < 60; ++i) {
+        Rect rect;
+        rect.m_min[0] = (i * 37 % 97) + 0.25;
+        rect.m_min[1] = (i * 53 % 89) + 0.5;
+        rect.m_max[0] = rect.m_min[0] + 3;
+        rect.m_max[1] = rect.m_min[1] + 2;
+        zoneEntries.emplace_back(rect, i);
+        zones.Insert(rect.m_min, rect.m_max, i, i % 2 ? 1 : 2);
+    }
+    const LayerMask mask = (1 << 1) | (1 << 3);
+    std::vector<std::pair<int, int>> expected;
+    for (const auto& entry : kept) {
+        for (const auto& zone : zoneEntries) {
+            if ((std::get<2>(entry) & mask) && zone.second % 2 == 0 &&
+                overlaps(std::get<0>(entry), zone.first.m_min, zone.first.m_max)) {
+                expected.emplace_back(std::get<1>(entry), zone.second);
+            }
+        }
+    }
+    std::sort(expected.begin(), expected.end());
+    std::vector<std::pair<int, int>> actual;
+    tree.Join(zones, mask, 2, [&actual](const int& id, const int& zone) {
+        actual.emplace_back(id, zone);
+        return true;
+    });
+    std::sort(actual.begin(), actual.end());
+    ASSERT_FALSE(expected.empty());
+    ASSERT_EQ(actual, expected);
+}
+
+TEST(RTree, layer_masks) {
+    checkLayers<RTree<int, double, 2, double, 8, 4, RTreePoolAllocator, RTreeAoSLayout, RTreeQuadraticSplit,
+                      RTreeSphericalVolume, RTreeNoQueryStats, RTreeLayers>>();
+    checkLayers<RTree<int, double, 2, double, 8, 3, RTreePoolAllocator, RTreeSoALayout, RTreeRStarSplit,
+                      RTreeSphericalVolume, RTreeNoQueryStats, RTreeLayers>>();
+}
+
+namespace {
+
+std::string readFile(const std::string& fileName) {
+    std::ifstream in(fileName, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+} // namespace
+
+// 默认不带图层：分支不多占字节，插入时给的图层被丢弃，每个条目都在所有图层上；
+// 存档仍是没有图层掩码的旧格式 'RTRE'，可被带图层的树读入
+TEST(RTree, layers_compiled_out) {
+    typedef RTree<int, double, 2, double, 8, 4, RTreePoolAllocator, RTreeAoSLayout, RTreeQuadraticSplit,
+                  RTreeSphericalVolume, RTreeNoQueryStats, RTreeLayers>
+        LAYERED;
+    EXPECT_EQ(TreeInspector<LAYERED>::branchSize(), TreeInspector<RTREE2D>::branchSize() + sizeof(uint64_t));
+
+    TreeInspector<RTREE2D> tree;
+    for (int i = 0; i < 500; ++i) {
+        const auto rect = makeRect(i);
+        tree.Insert(rect.m_min, rect.m_max, i, RTREE2D::LayerMask(1) << (i % 4));
+    }
+    ASSERT_EQ(tree.validate(), 500);
+    const double min[2] = {0, 0};
+    const double max[2] = {100, 100};
+    const auto all = treeSearch(tree, min, max);
+    ASSERT_FALSE(all.empty());
+    std::vector<int> onLayer;
+    tree.Search(min, max, 1 << 3, [&onLayer](const int& id) {
+        onLayer.push_back(id);
+        return true;
+    });
+    EXPECT_EQ(sorted(onLayer), all);
+    EXPECT_EQ(tree.Search(min, max, 0, [](const int&) { return true; }), 0);
+
+    // 同样顺序插入的带图层树形状相同，存档只多出每个条目 8 字节的掩码
+    LAYERED layered;
+    for (int i = 0; i < 500; ++i) {
+        const auto rect = makeRect(i);
+        layered.Insert(rect.m_min, rect.m_max, i, LAYERED::LayerMask(1) << (i % 4));
+    }
+    const std::string fileName = "test_rtree_no_layers.bin";
+    const std::string layeredName = "test_rtree_layered.bin";
+    ASSERT_TRUE(tree.Save(fileName.c_str()));
+    ASSERT_TRUE(layered.Save(layeredName.c_str()));
+    const std::string plain = readFile(fileName);
+    const std::string masked = readFile(layeredName);
+    std::remove(layeredName.c_str());
+    EXPECT_EQ(plain.substr(0, 4), "RTRE");
+    EXPECT_EQ(masked.substr(0, 4), "RTRL");
+    EXPECT_EQ(masked.size(), plain.size() + 500 * sizeof(uint64_t));
+
+    LAYERED loaded;
+    ASSERT_TRUE(loaded.Load(fileName.c_str()));
+    std::remove(fileName.c_str());
+    onLayer.clear();
+    loaded.Search(min, max, 1 << 5, [&onLayer](const int& id) {
+        onLayer.push_back(id);
+        return true;
+    });
+    EXPECT_EQ(sorted(onLayer), all);
+}
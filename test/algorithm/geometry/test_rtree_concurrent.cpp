@@ -0,0 +1,138 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "algorithm/geometry/rtree_concurrent.h"
+#include "rtree_test_util.h"
+
+typedef RTreeConcurrent<int, double, 2> CONCURRENT2D;
+
+namespace {
+
+// 检查结构：层号连续、非根节点不低于最小填充、父节点矩形恰好包住子节点、子树计数正确
+class ConcurrentInspector : public CONCURRENT2D {
+public:
+    int validate() const {
+        return validateRec(m_root.load(), true);
+    }
+
+private:
+    int validateRec(const Node* node, bool isRoot) const {
+        if (!isRoot) {
+            EXPECT_GE(node->m_count, MINNODES);
+        }
+        EXPECT_LE(node->m_count, MAXNODES);
+        if (node->IsLeaf()) {
+            EXPECT_EQ(node->m_entryCount, node->m_count);
+            return node->m_count;
+        }
+        int items = 0;
+        for (int i = 0; i < node->m_count; ++i) {
+            const Node* child = node->m_branch[i].m_child;
+            EXPECT_EQ(child->m_level, node->m_level - 1);
+            const Rect cover = NodeCover(child);
+            for (int axis = 0; axis < 2; ++axis) {
+                EXPECT_EQ(cover.m_min[axis], node->m_branch[i].m_rect.m_min[axis]);
+                EXPECT_EQ(cover.m_max[axis], node->m_branch[i].m_rect.m_max[axis]);
+            }
+            items += validateRec(child, false);
+        }
+        EXPECT_EQ(node->m_entryCount, items);
+        return items;
+    }
+};
+
+} // namespace
+
+// 单线程插入删除：结果与暴力查询一致，结构合法，没有读者时被替换的节点立即回收
+TEST(RTreeConcurrent, insert_remove) {
+    ConcurrentInspector tree;
+    std::vector<bool> present(4000, false);
+    for (int i = 0; i < 4000; ++i) {
+        auto rect = makeRect<CONCURRENT2D::Rect>(i);
+        tree.Insert(rect.m_min, rect.m_max, i);
+        present[i] = true;
+    }
+    ASSERT_EQ(tree.validate(), 4000);
+
+    for (int i = 0; i < 4000; i += 3) {
+        auto rect = makeRect<CONCURRENT2D::Rect>(i);
+        ASSERT_FALSE(tree.Remove(rect.m_min, rect.m_max, i));
+        present[i] = false;
+    }
+    auto rect = makeRect<CONCURRENT2D::Rect>(0);
+    EXPECT_TRUE(tree.Remove(rect.m_min, rect.m_max, 0));
+    ASSERT_EQ(tree.validate(), tree.Count());
+    EXPECT_EQ(tree.RetiredCount(), 0u);
+
+    for (int q = 0; q < 40; ++q) {
+        const double min[2] = {q * 6.0, q * 5.0};
+        const double max[2] = {min[0] + 30, min[1] + 20};
+        std::vector<int> expected;
+        for (int i = 0; i < 4000; ++i) {
+            if (present[i] && overlaps(makeRect<CONCURRENT2D::Rect>(i), min, max)) {
+                expected.push_back(i);
+            }
+        }
+        ASSERT_EQ(treeSearch(tree, min, max), expected);
+    }
+
+    tree.RemoveAll();
+    EXPECT_EQ(tree.Count(), 0);
+    EXPECT_EQ(tree.validate(), 0);
+}
+
+// 写线程不停插入删除时，读线程每次都看到完整的常驻条目，且读到的计数都是某个已发布版本的值
+TEST(RTreeConcurrent, readers_during_writes) {
+    CONCURRENT2D tree;
+    // 常驻条目在左半边，写线程只动右半边
+    std::vector<int> resident;
+    for (int i = 0; i < 500; ++i) {
+        const double min[2] = {(double) (i % 25), (double) (i / 25)};
+        const double max[2] = {min[0] + 0.5, min[1] + 0.5};
+        tree.Insert(min, max, i);
+        resident.push_back(i);
+    }
+
+    std::atomic<bool> stop(false);
+    std::atomic<int> failures(0);
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; ++r) {
+        readers.emplace_back([&]() {
+            const double min[2] = {0, 0};
+            const double max[2] = {30, 30};
+            while (!stop.load()) {
+                if (treeSearch(tree, min, max) != resident) {
+                    ++failures;
+                }
+                const int count = tree.Count();
+                // 写线程每次只插入或删除一个，计数在 500 与 600 之间
+                if (count < 500 || count > 600) {
+                    ++failures;
+                }
+            }
+        });
+    }
+
+    for (int round = 0; round < 20; ++round) {
+        for (int i = 0; i < 100; ++i) {
+            const double min[2] = {100.0 + i % 10, (double) (i / 10)};
+            const double max[2] = {min[0] + 0.5, min[1] + 0.5};
+            tree.Insert(min, max, 1000 + i);
+        }
+        for (int i = 0; i < 100; ++i) {
+            const double min[2] = {100.0 + i % 10, (double) (i / 10)};
+            const double max[2] = {min[0] + 0.5, min[1] + 0.5};
+            ASSERT_FALSE(tree.Remove(min, max, 1000 + i));
+        }
+    }
+    stop = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    EXPECT_EQ(failures.load(), 0);
+    EXPECT_EQ(tree.Count(), 500);
+}
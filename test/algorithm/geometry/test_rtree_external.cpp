@@ -0,0 +1,164 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "algorithm/geometry/rtree_external.h"
+#include "rtree_test_util.h"
+
+typedef RTreeExternalBuilder<int, double, 2> BUILDER2D;
+typedef BUILDER2D::View VIEW2D;
+
+namespace {
+
+BUILDER2D::Record makeRecord(int i) {
+    auto record = makeRect<BUILDER2D::Record>(i);
+    record.m_data = i;
+    return record;
+}
+
+bool writeRecords(const char* fileName, int count) {
+    FILE* file = std::fopen(fileName, "wb");
+    if (!file) {
+        return false;
+    }
+    for (int i = 0; i < count; ++i) {
+        const auto record = makeRecord(i);
+        std::fwrite(&record, sizeof(record), 1, file);
+    }
+    return std::fclose(file) == 0;
+}
+
+std::vector<int> bruteSearch(int count, const double min[2], const double max[2]) {
+    std::vector<int> ids;
+    for (int i = 0; i < count; ++i) {
+        if (overlaps(makeRecord(i), min, max)) {
+            ids.push_back(i);
+        }
+    }
+    return ids;
+}
+
+// 查询结果与暴力一致，k 近邻的距离序列也一致
+void checkView(const VIEW2D& view, int count) {
+    ASSERT_EQ(view.Count(), (uint64_t) count);
+    for (int q = 0; q < 30; ++q) {
+        const double min[2] = {q * 8.0, q * 6.5};
+        const double max[2] = {min[0] + 25, min[1] + 15};
+        ASSERT_EQ(treeSearch(view, min, max), bruteSearch(count, min, max));
+    }
+
+    auto squaredDist = [](const double point[2], const int& id) {
+        const auto record = makeRecord(id);
+        double dist = 0;
+        for (int axis = 0; axis < 2; ++axis) {
+            const double delta = std::max({0.0, record.m_min[axis] - point[axis], point[axis] - record.m_max[axis]});
+            dist += delta * delta;
+        }
+        return dist;
+    };
+    VIEW2D::NearestNeighborBuffer buffer;
+    const double point[2] = {120, 80};
+    std::vector<double> expected;
+    for (int i = 0; i < count; ++i) {
+        expected.push_back(squaredDist(point, i));
+    }
+    std::sort(expected.begin(), expected.end());
+    expected.resize(std::min(count, 12));
+    view.NearestNeighbors(point, 12, squaredDist, [](const int&) { return true; }, buffer);
+    std::vector<double> found;
+    for (const auto& result : buffer.Results()) {
+        found.push_back(result.first);
+    }
+    ASSERT_EQ(found, expected);
+}
+
+} // namespace
+
+// 内存预算只够几百条记录：分成多个有序段、多趟归并，映射打开后校验和与查询都正确，临时文件被删掉
+TEST(RTreeExternalBuilder, small_memory_budget) {
+    const int n = 30000;
+    const char* input = "test_rtree_external.in";
+    const char* output = "test_rtree_external.map";
+    ASSERT_TRUE(writeRecords(input, n));
+
+    BUILDER2D builder(64 * 1024, "test_rtree_external.tmp");
+    std::vector<BUILDER2D::Progress> progress;
+    builder.SetProgress([&progress](const BUILDER2D::Progress& step) {
+        progress.push_back(step);
+    });
+    ASSERT_TRUE(builder.Build(input, output));
+
+    const auto& stats = builder.GetStats();
+    EXPECT_EQ(stats.records, (uint64_t) n);
+    EXPECT_GT(stats.runs, 5);
+    EXPECT_GE(stats.mergePasses, 2);
+    EXPECT_GE(stats.bytesRead, 2 * n * sizeof(BUILDER2D::Record));
+    EXPECT_GT(stats.bytesWritten, stats.records * sizeof(BUILDER2D::Record));
+    EXPECT_GT(stats.seconds, 0);
+
+    // 各阶段按顺序出现，每个阶段最后报告的都是完成
+    ASSERT_FALSE(progress.empty());
+    for (size_t i = 1; i < progress.size(); ++i) {
+        EXPECT_LE((int) progress[i - 1].phase, (int) progress[i].phase);
+    }
+    EXPECT_EQ(progress.back().phase, BUILDER2D::Phase::CHECKSUM);
+    EXPECT_EQ(progress.back().done, progress.back().total);
+
+    VIEW2D view;
+    ASSERT_TRUE(view.Open(output, true));
+    EXPECT_EQ(view.GetHeader().m_height, (uint32_t) stats.height);
+    EXPECT_EQ(view.GetHeader().m_nodeCount, stats.nodeCount);
+    checkView(view, n);
+    view.Close();
+
+    // 同样的数据一次装进内存：不写有序段，树的形状相同
+    BUILDER2D inMemory(64 << 20, "test_rtree_external.tmp");
+    ASSERT_TRUE(inMemory.Build(input, output));
+    EXPECT_EQ(inMemory.GetStats().runs, 1);
+    EXPECT_EQ(inMemory.GetStats().mergePasses, 0);
+    EXPECT_EQ(inMemory.GetStats().nodeCount, stats.nodeCount);
+    ASSERT_TRUE(view.Open(output, true));
+    checkView(view, n);
+    view.Close();
+
+    // 临时文件不残留
+    for (const char* name : {"test_rtree_external.tmp.run0", "test_rtree_external.tmp.level0"}) {
+        FILE* file = std::fopen(name, "rb");
+        EXPECT_EQ(file, nullptr) << name;
+        if (file) {
+            std::fclose(file);
+        }
+    }
+    std::remove(input);
+    std::remove(output);
+}
+
+// 空文件、单条记录、缺失或残缺的输入
+TEST(RTreeExternalBuilder, edge_inputs) {
+    const char* input = "test_rtree_external_edge.in";
+    const char* output = "test_rtree_external_edge.map";
+    BUILDER2D builder(4096);
+    VIEW2D view;
+
+    for (int count : {0, 1, 8, 9}) {
+        ASSERT_TRUE(writeRecords(input, count));
+        ASSERT_TRUE(builder.Build(input, output)) << count;
+        ASSERT_TRUE(view.Open(output, true)) << count;
+        checkView(view, count);
+        view.Close();
+    }
+
+    EXPECT_FALSE(builder.Build("test_rtree_external_missing.in", output));
+
+    // 记录被截断
+    FILE* file = std::fopen(input, "ab");
+    ASSERT_NE(file, nullptr);
+    std::fputc(0, file);
+    std::fclose(file);
+    EXPECT_FALSE(builder.Build(input, output));
+
+    std::remove(input);
+    std::remove(output);
+}
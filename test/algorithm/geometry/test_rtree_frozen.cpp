@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "algorithm/geometry/rtree_frozen.h"
+#include "rtree_test_util.h"
+
+typedef RTree<int, double, 2> RTREE2D;
+typedef RTreeFrozen<int, double, 2> FROZEN2D;
+
+// 两种布局冻结后的窗口查询与最近邻结果都和原树一致
+TEST(RTreeFrozen, search_and_nearest) {
+    RTREE2D tree;
+    for (int i = 0; i < 5000; ++i) {
+        auto rect = makeRect(i);
+        tree.Insert(rect.m_min, rect.m_max, i);
+    }
+
+    auto squaredDist = [](const double point[2], const int& id) {
+        auto rect = makeRect(id);
+        double dx = rect.m_min[0] - point[0];
+        double dy = rect.m_min[1] - point[1];
+        return dx * dx + dy * dy;
+    };
+    auto even = [](const int& id) {
+        return id % 2 == 0;
+    };
+
+    for (auto layout : {RTreeFrozenLayout::BREADTH_FIRST, RTreeFrozenLayout::VAN_EMDE_BOAS}) {
+        FROZEN2D frozen(tree, layout);
+        ASSERT_EQ(frozen.Count(), 5000);
+        ASSERT_GT(frozen.MemoryBytes(), 5000 * sizeof(FROZEN2D::Branch) - 1);
+
+        for (int q = 0; q < 50; ++q) {
+            const double min[2] = {q * 4.5, q * 3.5};
+            const double max[2] = {min[0] + 20, min[1] + 12};
+            std::vector<int> expected, actual;
+            tree.Search(min, max, [&expected](const int& id) {
+                expected.push_back(id);
+                return true;
+            });
+            int found = frozen.Search(min, max, [&actual](const int& id) {
+                actual.push_back(id);
+                return true;
+            });
+            ASSERT_EQ(found, (int) actual.size());
+            ASSERT_EQ(sorted(actual), sorted(expected));
+        }
+
+        // 访问器返回 false 时立即停止
+        const double min[2] = {-1, -1};
+        const double max[2] = {300, 300};
+        int visited = 0;
+        frozen.Search(min, max, [&visited](const int&) {
+            return ++visited < 3;
+        });
+        ASSERT_EQ(visited, 3);
+
+        RTREE2D::NearestNeighborBuffer treeBuffer;
+        FROZEN2D::NearestNeighborBuffer frozenBuffer;
+        for (int q = 0; q < 20; ++q) {
+            const double point[2] = {q * 11.3, q * 9.1};
+            ASSERT_EQ(frozen.NearestNeighbors(point, 6, squaredDist, even, frozenBuffer), 6);
+            tree.NearestNeighbors(point, 6, squaredDist, even, treeBuffer);
+            for (int i = 0; i < 6; ++i) {
+                ASSERT_DOUBLE_EQ(frozenBuffer.Results()[i].first, treeBuffer.Results()[i].first);
+                ASSERT_EQ(frozenBuffer.Results()[i].second % 2, 0);
+            }
+        }
+    }
+}
+
+// 空树、旁路存放的数据，以及重新冻结会替换原有内容
+TEST(RTreeFrozen, empty_and_side_stored) {
+    typedef RTree<std::string, double, 2> STRING_TREE;
+    typedef RTreeFrozen<std::string, double, 2> FROZEN_STRINGS;
+
+    STRING_TREE tree;
+    FROZEN_STRINGS frozen(tree);
+    const double min[2] = {-1000, -1000};
+    const double max[2] = {1000, 1000};
+    EXPECT_EQ(frozen.Count(), 0);
+    EXPECT_EQ(frozen.Search(min, max, [](const std::string&) { return true; }), 0);
+
+    std::vector<std::string> expected;
+    for (int i = 0; i < 700; ++i) {
+        auto rect = makeRect(i);
+        expected.push_back("entry " + std::to_string(i));
+        tree.Insert(rect.m_min, rect.m_max, expected.back());
+    }
+    frozen.Freeze(tree, RTreeFrozenLayout::VAN_EMDE_BOAS);
+    tree.RemoveAll();
+
+    std::vector<std::string> actual;
+    EXPECT_EQ(frozen.Search(min, max,
+                            [&actual](const std::string& name) {
+                                actual.push_back(name);
+                                return true;
+                            }),
+              700);
+    EXPECT_EQ(sorted(actual), sorted(expected));
+}
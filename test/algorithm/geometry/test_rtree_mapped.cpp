@@ -0,0 +1,164 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "algorithm/geometry/rtree_mapped.h"
+#include "rtree_test_util.h"
+
+typedef RTree<int, double, 2> RTREE2D;
+typedef RTreeMappedView<int, double, 2> VIEW2D;
+
+// 写出映射格式后直接在映射上查询，结果与原树一致
+TEST(RTreeMappedView, search_and_nearest) {
+    RTREE2D tree;
+    for (int i = 0; i < 5000; ++i) {
+        auto rect = makeRect(i);
+        tree.Insert(rect.m_min, rect.m_max, i);
+    }
+
+    const char* fileName = "test_rtree_mapped.bin";
+    ASSERT_TRUE(VIEW2D::Save(tree, fileName));
+
+    VIEW2D view;
+    ASSERT_TRUE(view.Open(fileName));
+    ASSERT_EQ(view.Count(), 5000u);
+    ASSERT_EQ(view.GetHeader().m_height, (uint32_t) tree.CalcStats().maxDepth);
+
+    for (int q = 0; q < 50; ++q) {
+        const double min[2] = {q * 4.5, q * 3.5};
+        const double max[2] = {min[0] + 20, min[1] + 12};
+        std::vector<int> expected, actual;
+        tree.Search(min, max, [&expected](const int& id) {
+            expected.push_back(id);
+            return true;
+        });
+        int found = view.Search(min, max, [&actual](const int& id) {
+            actual.push_back(id);
+            return true;
+        });
+        ASSERT_EQ(found, (int) actual.size());
+        ASSERT_EQ(sorted(actual), sorted(expected));
+    }
+
+    auto squaredDist = [](const double point[2], const int& id) {
+        auto rect = makeRect(id);
+        double dx = rect.m_min[0] - point[0];
+        double dy = rect.m_min[1] - point[1];
+        return dx * dx + dy * dy;
+    };
+    auto any = [](const int&) {
+        return true;
+    };
+    RTREE2D::NearestNeighborBuffer treeBuffer;
+    VIEW2D::NearestNeighborBuffer viewBuffer;
+    for (int q = 0; q < 20; ++q) {
+        const double point[2] = {q * 11.3, q * 9.1};
+        ASSERT_EQ(view.NearestNeighbors(point, 6, squaredDist, any, viewBuffer), 6);
+        tree.NearestNeighbors(point, 6, squaredDist, any, treeBuffer);
+        for (int i = 0; i < 6; ++i) {
+            ASSERT_DOUBLE_EQ(viewBuffer.Results()[i].first, treeBuffer.Results()[i].first);
+        }
+    }
+
+    view.Close();
+    std::remove(fileName);
+}
+
+// 校验和、类型不符或截断的数据都被拒绝
+TEST(RTreeMappedView, rejects_bad_data) {
+    RTREE2D tree;
+    for (int i = 0; i < 300; ++i) {
+        auto rect = makeRect(i);
+        tree.Insert(rect.m_min, rect.m_max, i);
+    }
+
+    std::vector<char> buffer;
+    VIEW2D::Serialize(tree, buffer);
+
+    VIEW2D view;
+    ASSERT_TRUE(view.Attach(buffer.data(), buffer.size()));
+
+    RTreeMappedView<int, float, 2> floatView;
+    ASSERT_FALSE(floatView.Attach(buffer.data(), buffer.size()));
+    ASSERT_FALSE(view.Attach(buffer.data(), buffer.size() - 8));
+
+    buffer[buffer.size() - 3] ^= 1;
+    ASSERT_FALSE(view.Attach(buffer.data(), buffer.size()));
+    ASSERT_TRUE(view.Attach(buffer.data(), buffer.size(), false));
+
+    // 不校验和时节点与分支的下标仍被检查：越界的分支区间、越界或层级不对的子节点都被拒绝
+    VIEW2D::Header header;
+    std::memcpy(&header, buffer.data(), sizeof(header));
+    auto* nodes = reinterpret_cast<VIEW2D::Node*>(buffer.data() + header.m_nodeOffset);
+    auto* branches = reinterpret_cast<VIEW2D::Branch*>(buffer.data() + header.m_branchOffset);
+    ASSERT_GT(nodes[0].m_level, 0);
+    const auto last = nodes[header.m_nodeCount - 1];
+    nodes[header.m_nodeCount - 1].m_firstBranch = (uint32_t) header.m_branchCount;
+    EXPECT_FALSE(view.Attach(buffer.data(), buffer.size(), false));
+    nodes[header.m_nodeCount - 1] = last;
+    const uint64_t child = branches[nodes[0].m_firstBranch].m_child;
+    branches[nodes[0].m_firstBranch].m_child = header.m_nodeCount;
+    EXPECT_FALSE(view.Attach(buffer.data(), buffer.size(), false));
+    branches[nodes[0].m_firstBranch].m_child = 0;
+    EXPECT_FALSE(view.Attach(buffer.data(), buffer.size(), false));
+    branches[nodes[0].m_firstBranch].m_child = child;
+    ASSERT_TRUE(view.Attach(buffer.data(), buffer.size(), false));
+
+    // 伪造的文件头：节点区起点在文件之外，区间长度不能因减法回绕而通过检查
+    VIEW2D::Header forged = header;
+    forged.m_nodeOffset = (buffer.size() / 64 + 1) * 64;
+    forged.m_nodeCount = 1;
+    forged.m_branchOffset = forged.m_nodeOffset + sizeof(VIEW2D::Node);
+    forged.m_branchCount = 0;
+    std::memcpy(buffer.data(), &forged, sizeof(forged));
+    EXPECT_FALSE(view.Attach(buffer.data(), buffer.size(), false));
+    forged = header;
+    forged.m_branchOffset = (buffer.size() / 64 + 1) * 64;
+    forged.m_branchCount = 0;
+    std::memcpy(buffer.data(), &forged, sizeof(forged));
+    EXPECT_FALSE(view.Attach(buffer.data(), buffer.size(), false));
+    std::memcpy(buffer.data(), &header, sizeof(header));
+    ASSERT_TRUE(view.Attach(buffer.data(), buffer.size(), false));
+
+    RTREE2D empty;
+    VIEW2D::Serialize(empty, buffer);
+    ASSERT_TRUE(view.Attach(buffer.data(), buffer.size()));
+    const double min[2] = {0, 0};
+    const double max[2] = {100, 100};
+    ASSERT_EQ(view.Search(min, max, [](const int&) { return true; }), 0);
+
+    ASSERT_FALSE(view.Open("does_not_exist.bin"));
+}
+
+// 原有的流式格式仍可往返
+TEST(RTreeMappedView, stream_round_trip) {
+    RTREE2D tree;
+    for (int i = 0; i < 700; ++i) {
+        auto rect = makeRect(i);
+        tree.Insert(rect.m_min, rect.m_max, i);
+    }
+
+    const char* fileName = "test_rtree_stream.bin";
+    ASSERT_TRUE(tree.Save(fileName));
+    RTREE2D loaded;
+    ASSERT_TRUE(loaded.Load(fileName));
+    std::remove(fileName);
+
+    ASSERT_EQ(loaded.Count(), 700);
+    const double min[2] = {10, 10};
+    const double max[2] = {90, 120};
+    std::vector<int> expected, actual;
+    tree.Search(min, max, [&expected](const int& id) {
+        expected.push_back(id);
+        return true;
+    });
+    loaded.Search(min, max, [&actual](const int& id) {
+        actual.push_back(id);
+        return true;
+    });
+    ASSERT_EQ(sorted(actual), sorted(expected));
+}
@@ -0,0 +1,146 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "algorithm/geometry/rtree_persistent.h"
+#include "rtree_test_util.h"
+
+typedef RTreePersistent<int, double, 2> PERSISTENT2D;
+
+namespace {
+
+// 与暴力查询逐窗口比较
+void expectMatches(const PERSISTENT2D& tree, const std::vector<bool>& present) {
+    int count = 0;
+    for (bool p : present) {
+        count += p ? 1 : 0;
+    }
+    ASSERT_EQ(tree.Count(), count);
+    for (int q = 0; q < 20; ++q) {
+        const double min[2] = {q * 12.0, q * 9.0};
+        const double max[2] = {min[0] + 30, min[1] + 20};
+        std::vector<int> expected;
+        for (int i = 0; i < (int) present.size(); ++i) {
+            if (present[i] && overlaps(makeRect<PERSISTENT2D::Rect>(i), min, max)) {
+                expected.push_back(i);
+            }
+        }
+        ASSERT_EQ(treeSearch(tree, min, max), expected);
+    }
+}
+
+} // namespace
+
+// 每个版本各自插入删除，互不影响，结果都与暴力查询一致
+TEST(RTreePersistent, versions_independent) {
+    const int n = 3000;
+    std::vector<PERSISTENT2D> versions(1);
+    std::vector<std::vector<bool>> present(1, std::vector<bool>(n, false));
+    for (int step = 0; step < 30; ++step) {
+        versions.push_back(versions.back());
+        present.push_back(present.back());
+        auto& tree = versions.back();
+        auto& live = present.back();
+        // 每个版本插入 100 个，从第 10 个版本起再删除一些
+        for (int i = step * 100; i < (step + 1) * 100 && i < n; ++i) {
+            auto rect = makeRect<PERSISTENT2D::Rect>(i);
+            tree.Insert(rect.m_min, rect.m_max, i);
+            live[i] = true;
+        }
+        if (step >= 10) {
+            for (int i = (step - 10) * 100; i < (step - 9) * 100; i += 2) {
+                auto rect = makeRect<PERSISTENT2D::Rect>(i);
+                ASSERT_FALSE(tree.Remove(rect.m_min, rect.m_max, i));
+                live[i] = false;
+            }
+        }
+    }
+    auto rect = makeRect<PERSISTENT2D::Rect>(0);
+    EXPECT_TRUE(versions.back().Remove(rect.m_min, rect.m_max, 0));
+
+    for (size_t v = 0; v < versions.size(); ++v) {
+        expectMatches(versions[v], present[v]);
+    }
+
+    // 丢掉中间的版本后其余版本不受影响
+    versions.erase(versions.begin() + 5, versions.begin() + 20);
+    present.erase(present.begin() + 5, present.begin() + 20);
+    versions.back().RemoveAll();
+    present.back().assign(n, false);
+    for (size_t v = 0; v < versions.size(); ++v) {
+        expectMatches(versions[v], present[v]);
+    }
+}
+
+// 一百个版本各改一条：共享节点数只随修改量增长，远小于一百份完整副本
+TEST(RTreePersistent, shared_nodes) {
+    PERSISTENT2D base;
+    for (int i = 0; i < 20000; ++i) {
+        auto rect = makeRect<PERSISTENT2D::Rect>(i);
+        base.Insert(rect.m_min, rect.m_max, i);
+    }
+    const size_t baseNodes = PERSISTENT2D::CountNodes(&base, &base + 1);
+
+    std::vector<PERSISTENT2D> versions(1, base);
+    for (int v = 0; v < 100; ++v) {
+        versions.push_back(versions.back());
+        auto rect = makeRect<PERSISTENT2D::Rect>(20000 + v);
+        versions.back().Insert(rect.m_min, rect.m_max, 20000 + v);
+    }
+    EXPECT_EQ(versions.back().Count(), 20100);
+    EXPECT_EQ(versions.front().Count(), 20000);
+
+    // 每次写只复制一条路径（分裂时多一两个节点），树高不超过 8
+    const size_t allNodes = PERSISTENT2D::CountNodes(versions.begin(), versions.end());
+    EXPECT_LE(allNodes, baseNodes + 100 * 10);
+
+    // 没有其它版本共享时原地修改，不再复制
+    PERSISTENT2D alone = versions.back();
+    versions.clear();
+    base = PERSISTENT2D();
+    const size_t before = PERSISTENT2D::CountNodes(&alone, &alone + 1);
+    auto rect = makeRect<PERSISTENT2D::Rect>(30000);
+    alone.Insert(rect.m_min, rect.m_max, 30000);
+    EXPECT_LE(PERSISTENT2D::CountNodes(&alone, &alone + 1), before + 2);
+}
+
+// 多个线程各自修改同一基础版本的副本，共享节点的引用计数不出错
+TEST(RTreePersistent, versions_on_threads) {
+    PERSISTENT2D base;
+    std::vector<bool> basePresent(4000, false);
+    for (int i = 0; i < 2000; ++i) {
+        auto rect = makeRect<PERSISTENT2D::Rect>(i);
+        base.Insert(rect.m_min, rect.m_max, i);
+        basePresent[i] = true;
+    }
+
+    std::vector<PERSISTENT2D> results(4, base);
+    std::vector<std::vector<bool>> present(4, basePresent);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t]() {
+            PERSISTENT2D tree = base;
+            for (int i = 2000 + t; i < 4000; i += 4) {
+                auto rect = makeRect<PERSISTENT2D::Rect>(i);
+                tree.Insert(rect.m_min, rect.m_max, i);
+                present[t][i] = true;
+            }
+            for (int i = t; i < 2000; i += 4) {
+                auto rect = makeRect<PERSISTENT2D::Rect>(i);
+                tree.Remove(rect.m_min, rect.m_max, i);
+                present[t][i] = false;
+            }
+            results[t] = tree;
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    expectMatches(base, basePresent);
+    for (int t = 0; t < 4; ++t) {
+        expectMatches(results[t], present[t]);
+    }
+}
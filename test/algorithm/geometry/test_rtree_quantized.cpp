@@ -0,0 +1,102 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "algorithm/geometry/rtree_quantized.h"
+#include "rtree_test_util.h"
+
+typedef RTree<int, double, 2> RTREE2D;
+
+namespace {
+
+// 精确叶子的结果与原树相同；候选模式是原树结果的超集，且多出来的都紧挨着窗口
+template <class QUANTIZED>
+void checkQuantized(const RTREE2D& tree, double offset, double slack) {
+    QUANTIZED exact(tree, RTreeQuantizedLeaves::EXACT);
+    QUANTIZED candidates(tree, RTreeQuantizedLeaves::CANDIDATES);
+    ASSERT_EQ(exact.Count(), tree.Count());
+    ASSERT_EQ(candidates.Count(), tree.Count());
+    EXPECT_LT(candidates.MemoryBytes(), exact.MemoryBytes());
+
+    size_t extra = 0, found = 0;
+    for (int q = 0; q < 60; ++q) {
+        const double min[2] = {offset + q * 4.25 - 10, offset + q * 3.5 - 5};
+        const double max[2] = {min[0] + q % 7 * 5, min[1] + q % 5 * 4};
+        const auto expected = treeSearch(tree, min, max);
+        ASSERT_EQ(treeSearch(exact, min, max), expected) << q;
+
+        const auto superset = treeSearch(candidates, min, max);
+        ASSERT_TRUE(std::includes(superset.begin(), superset.end(), expected.begin(), expected.end())) << q;
+        for (int id : superset) {
+            const auto rect = makeRect(id, offset);
+            for (int axis = 0; axis < 2; ++axis) {
+                EXPECT_LE(rect.m_min[axis], max[axis] + slack);
+                EXPECT_GE(rect.m_max[axis], min[axis] - slack);
+            }
+        }
+        extra += superset.size() - expected.size();
+        found += expected.size();
+    }
+    EXPECT_GT(found, 0u);
+    // 候选只是少量多出
+    EXPECT_LT(extra, found);
+}
+
+} // namespace
+
+// 8 位与 16 位编码，原点附近和远离原点的坐标
+TEST(RTreeQuantized, search_matches_tree) {
+    for (double offset : {0.0, 1e9}) {
+        RTREE2D tree;
+        for (int i = 0; i < 5000; ++i) {
+            auto rect = makeRect(i, offset);
+            tree.Insert(rect.m_min, rect.m_max, i);
+        }
+        // 根节点覆盖约 250 个单位，8 位时每级舍入不超过 1 个单位左右
+        checkQuantized<RTreeQuantized<int, double, 2>>(tree, offset, 2.0);
+        checkQuantized<RTreeQuantized<int, double, 2, double, 8, uint16_t>>(tree, offset, 0.01);
+    }
+}
+
+// 空树、退化的框、整数坐标、节点更大的树、访问者提前停止
+TEST(RTreeQuantized, edge_cases) {
+    RTREE2D empty;
+    RTreeQuantized<int, double, 2> quantized(empty);
+    const double min[2] = {-1e300, -1e300};
+    const double max[2] = {1e300, 1e300};
+    EXPECT_EQ(quantized.Count(), 0);
+    EXPECT_TRUE(treeSearch(quantized, min, max).empty());
+
+    // 所有框重合在一点：框宽为零，只有包含该点的窗口命中
+    RTREE2D point;
+    const double at[2] = {3.5, -2.0};
+    for (int i = 0; i < 100; ++i) {
+        point.Insert(at, at, i);
+    }
+    quantized.Quantize(point);
+    EXPECT_EQ(treeSearch(quantized, at, at).size(), 100u);
+    const double nearMin[2] = {3.5000001, -3.0};
+    const double nearMax[2] = {4.0, 0.0};
+    EXPECT_TRUE(treeSearch(quantized, nearMin, nearMax).empty());
+    EXPECT_EQ(treeSearch(quantized, min, max).size(), 100u);
+
+    typedef RTree<int, int, 2, double, 16> INTTREE;
+    INTTREE ints;
+    for (int i = 0; i < 3000; ++i) {
+        const int lo[2] = {i * 37 % 2000 - 1000, i * 91 % 1500};
+        const int hi[2] = {lo[0] + i % 5, lo[1] + i % 9};
+        ints.Insert(lo, hi, i);
+    }
+    RTreeQuantized<int, int, 2, double, 16> intQuantized(ints);
+    for (int q = 0; q < 40; ++q) {
+        const int lo[2] = {q * 50 - 1000, q * 37};
+        const int hi[2] = {lo[0] + q % 4 * 30, lo[1] + q % 3 * 40};
+        ASSERT_EQ(treeSearch(intQuantized, lo, hi), treeSearch(ints, lo, hi)) << q;
+    }
+
+    int visited = 0;
+    const int all[2][2] = {{-2000, -2000}, {2000, 2000}};
+    EXPECT_EQ(intQuantized.Search(all[0], all[1], [&visited](const int&) { return ++visited < 10; }), 9);
+    EXPECT_EQ(visited, 10);
+}
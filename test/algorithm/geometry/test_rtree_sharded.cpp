@@ -0,0 +1,209 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "algorithm/geometry/rtree_sharded.h"
+#include "rtree_test_util.h"
+
+typedef RTreeSharded<int, double, 2> SHARDED2D;
+
+namespace {
+
+const double WORLD_MIN[2] = {0, 0};
+const double WORLD_MAX[2] = {250, 250};
+
+// 挤在左下角的条目，初始的等体积分区几乎全落进一个分片
+SHARDED2D::Rect makeCornerRect(int i) {
+    SHARDED2D::Rect rect = makeRect(i);
+    for (int axis = 0; axis < 2; ++axis) {
+        rect.m_min[axis] /= 10;
+        rect.m_max[axis] /= 10;
+    }
+    return rect;
+}
+
+// 多个线程并行提交，每个线程负责 id 模线程数相同的那部分
+template <class FUNC>
+void onThreads(int threadCount, FUNC&& func) {
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&func, t]() {
+            func(t);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+} // namespace
+
+// 并行插入、删除后与暴力结果一致：窗口查询与 k 近邻
+TEST(RTreeSharded, matches_brute_force) {
+    const int n = 20000;
+    SHARDED2D tree(4, WORLD_MIN, WORLD_MAX);
+    onThreads(4, [&](int t) {
+        for (int i = t; i < n; i += 4) {
+            auto rect = makeRect(i);
+            tree.Insert(rect.m_min, rect.m_max, i);
+        }
+        // 同一线程先插入后删除，删除总在插入之后生效
+        for (int i = t; i < n; i += 4) {
+            if (i % 3 == 0) {
+                auto rect = makeRect(i);
+                tree.Remove(rect.m_min, rect.m_max, i);
+            }
+        }
+    });
+    tree.Flush();
+
+    std::vector<bool> present(n, true);
+    for (int i = 0; i < n; i += 3) {
+        present[i] = false;
+    }
+    int count = 0;
+    for (int shard = 0; shard < tree.ShardCount(); ++shard) {
+        count += tree.ShardEntryCount(shard);
+    }
+    EXPECT_EQ(count, n - (n + 2) / 3);
+    EXPECT_EQ(tree.Count(), count);
+
+    for (int q = 0; q < 20; ++q) {
+        const double min[2] = {q * 12.0, q * 9.0};
+        const double max[2] = {min[0] + 30, min[1] + 20};
+        std::vector<int> expected;
+        for (int i = 0; i < n; ++i) {
+            if (present[i] && overlaps(makeRect(i), min, max)) {
+                expected.push_back(i);
+            }
+        }
+        ASSERT_EQ(treeSearch(tree, min, max), expected);
+    }
+
+    // k 近邻：距离序列与暴力结果一致（距离相等时 id 不唯一）
+    auto squaredDist = [](const double point[2], const int& id) {
+        return SHARDED2D::Tree::MinDistSq(point, makeRect(id));
+    };
+    SHARDED2D::NearestNeighborBuffer buffer;
+    for (int q = 0; q < 20; ++q) {
+        const double point[2] = {q * 13.0 - 10, q * 7.0};
+        std::vector<double> expected;
+        for (int i = 0; i < n; ++i) {
+            if (present[i]) {
+                expected.push_back(squaredDist(point, i));
+            }
+        }
+        std::sort(expected.begin(), expected.end());
+        expected.resize(10);
+
+        ASSERT_EQ(tree.NearestNeighbors(point, 10, squaredDist, [](const int&) { return true; }, buffer), 10);
+        std::vector<double> found;
+        for (const auto& result : buffer.Results()) {
+            EXPECT_TRUE(present[result.second]);
+            found.push_back(result.first);
+        }
+        ASSERT_EQ(found, expected);
+    }
+}
+
+// 偏斜的数据让一个分片过大，触发重新分区；之后各分片大致均衡，删除仍能找到条目
+TEST(RTreeSharded, rebalances_skewed_feed) {
+    const int n = 20000;
+    SHARDED2D tree(4, WORLD_MIN, WORLD_MAX, 2.0, 1000);
+    onThreads(4, [&](int t) {
+        for (int i = t; i < n; i += 4) {
+            auto rect = makeCornerRect(i);
+            tree.Insert(rect.m_min, rect.m_max, i);
+        }
+    });
+    tree.Flush();
+
+    EXPECT_EQ(tree.Count(), n);
+    EXPECT_GE(tree.RebalanceCount(), 1);
+    for (int shard = 0; shard < tree.ShardCount(); ++shard) {
+        EXPECT_GT(tree.ShardEntryCount(shard), 0);
+        EXPECT_LE(tree.ShardEntryCount(shard), n / 2);
+    }
+
+    const double min[2] = {5, 5};
+    const double max[2] = {12, 15};
+    std::vector<int> expected;
+    for (int i = 0; i < n; ++i) {
+        if (overlaps(makeCornerRect(i), min, max)) {
+            expected.push_back(i);
+        }
+    }
+    EXPECT_EQ(treeSearch(tree, min, max), expected);
+
+    // 手动重新分区后按新分区路由删除
+    tree.Rebalance();
+    onThreads(4, [&](int t) {
+        for (int i = t; i < n; i += 4) {
+            auto rect = makeCornerRect(i);
+            tree.Remove(rect.m_min, rect.m_max, i);
+        }
+    });
+    tree.Flush();
+    EXPECT_EQ(tree.Count(), 0);
+    EXPECT_TRUE(treeSearch(tree, min, max).empty());
+}
+
+// 所有条目中心相同，任何分区都切不开：重新分区不会带来改善，不应反复重建
+TEST(RTreeSharded, skips_rebalance_that_cannot_help) {
+    const int n = 20000;
+    SHARDED2D tree(4, WORLD_MIN, WORLD_MAX, 2.0, 100);
+    const double centre[2] = {100, 100};
+    onThreads(4, [&](int t) {
+        for (int i = t; i < n; i += 4) {
+            const double min[2] = {centre[0] - i % 5, centre[1] - i % 7};
+            const double max[2] = {centre[0] + i % 5, centre[1] + i % 7};
+            tree.Insert(min, max, i);
+        }
+    });
+    tree.Flush();
+
+    EXPECT_EQ(tree.Count(), n);
+    EXPECT_EQ(tree.RebalanceCount(), 0);
+    EXPECT_EQ(treeSearch(tree, centre, centre).size(), (size_t) n);
+
+    // 手动重新分区照常执行
+    tree.Rebalance();
+    EXPECT_EQ(tree.RebalanceCount(), 1);
+    EXPECT_EQ(tree.Count(), n);
+}
+
+// 边写入边查询：只插入时同一窗口的结果数不会变少，重新分区期间也不会漏掉条目
+TEST(RTreeSharded, queries_during_ingest) {
+    const int n = 40000;
+    SHARDED2D tree(4, WORLD_MIN, WORLD_MAX, 1.5, 500);
+    std::atomic<bool> done(false);
+    std::atomic<bool> shrank(false);
+
+    std::thread reader([&]() {
+        const double min[2] = {0, 0};
+        const double max[2] = {20, 20};
+        size_t last = 0;
+        while (!done.load()) {
+            const size_t found = treeSearch(tree, min, max).size();
+            if (found < last) {
+                shrank.store(true);
+            }
+            last = found;
+        }
+    });
+    onThreads(3, [&](int t) {
+        for (int i = t; i < n; i += 3) {
+            auto rect = i % 2 ? makeCornerRect(i) : makeRect(i);
+            tree.Insert(rect.m_min, rect.m_max, i);
+        }
+    });
+    tree.Flush();
+    done.store(true);
+    reader.join();
+
+    EXPECT_FALSE(shrank.load());
+    EXPECT_EQ(tree.Count(), n);
+}
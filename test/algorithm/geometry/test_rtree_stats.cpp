@@ -0,0 +1,122 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "algorithm/geometry/rtree.h"
+
+namespace {
+
+typedef RTree<int, double, 2, double, 8, 4, RTreePoolAllocator, RTreeAoSLayout, RTreeQuadraticSplit,
+              RTreeSphericalVolume, RTreeQueryStats>
+    STATS_TREE;
+
+// 生成 n x n 的网格，格子之间留有空隙
+void fillGrid(STATS_TREE& tree, int n) {
+    for (int i = 0; i < n * n; ++i) {
+        const double min[2] = {(i % n) * 2.0, (i / n) * 2.0};
+        const double max[2] = {min[0] + 1.5, min[1] + 1.5};
+        tree.Insert(min, max, i);
+    }
+}
+
+} // namespace
+
+// 查询计数：窗口查询、计数与最近邻都会累加，重置后归零
+TEST(RTreeStats, query_counters) {
+    STATS_TREE tree;
+    fillGrid(tree, 40);
+
+    const double min[2] = {10, 10};
+    const double max[2] = {20, 20};
+    int hits = tree.Search(min, max, [](const int&) {
+        return true;
+    });
+    ASSERT_EQ(hits, 36);
+
+    auto stats = tree.GetQueryStats();
+    EXPECT_GT(stats.nodesVisited, 0u);
+    EXPECT_GT(stats.leavesTested, 0u);
+    EXPECT_LE(stats.leavesTested, stats.nodesVisited);
+    EXPECT_GE(stats.overlapTests, stats.nodesVisited);
+    EXPECT_EQ(stats.heapPushes, 0u);
+
+    // 整棵树的窗口访问所有节点
+    tree.ResetQueryStats();
+    const double everywhere[2] = {1000, 1000};
+    const double origin[2] = {-1, -1};
+    tree.Search(origin, everywhere, [](const int&) {
+        return true;
+    });
+    EXPECT_EQ(tree.GetQueryStats().nodesVisited, (uint64_t) tree.CalcStats().nodeCount);
+
+    tree.ResetQueryStats();
+    STATS_TREE::NearestNeighborBuffer buffer;
+    const double point[2] = {30.2, 30.2};
+    tree.NearestNeighbors(
+            point, 3,
+            [](const double*, const int&) {
+                return 1.0;
+            },
+            [](const int&) {
+                return true;
+            },
+            buffer);
+    stats = tree.GetQueryStats();
+    EXPECT_GT(stats.heapPushes, 0u);
+    EXPECT_EQ(stats.overlapTests, 0u);
+
+    tree.ResetQueryStats();
+    stats = tree.GetQueryStats();
+    EXPECT_EQ(stats.nodesVisited + stats.leavesTested + stats.overlapTests + stats.heapPushes, 0u);
+
+    // 默认策略不计数，同一程序里两种树可以并存
+    RTree<int, double, 2> plain;
+    plain.Insert(min, max, 1);
+    plain.Search(min, max, [](const int&) {
+        return true;
+    });
+    const auto plainStats = plain.GetQueryStats();
+    EXPECT_EQ(plainStats.nodesVisited + plainStats.leavesTested + plainStats.overlapTests + plainStats.heapPushes,
+              0u);
+    EXPECT_NE(plain.StatsJson().find("\"counted\":false"), std::string::npos);
+}
+
+// 质量统计：网格无重叠，各层填充率与 CalcStats 一致，JSON 包含各项
+TEST(RTreeStats, quality_and_json) {
+    STATS_TREE tree;
+    fillGrid(tree, 40);
+
+    auto quality = tree.CalcQuality();
+    const auto stats = tree.CalcStats();
+    ASSERT_EQ((int) quality.levels.size(), stats.maxDepth);
+    EXPECT_EQ(quality.levels[0].overlap, 0.0);
+    EXPECT_GE(quality.totalOverlap, 0.0);
+    EXPECT_GT(quality.deadSpace, 0.0);
+    EXPECT_GT(quality.bytesPerEntry, 0.0);
+    EXPECT_EQ(quality.levels.back().nodeCount, 1);
+
+    int nodes = 0;
+    for (const auto& level : quality.levels) {
+        EXPECT_GT(level.fillFactor, 0.0);
+        EXPECT_LE(level.fillFactor, 1.0);
+        nodes += level.nodeCount;
+    }
+    EXPECT_EQ(nodes, stats.nodeCount);
+
+    // 两个完全重合的条目在叶子层产生重叠
+    STATS_TREE pair;
+    const double min[2] = {0, 0};
+    const double max[2] = {2, 3};
+    pair.Insert(min, max, 1);
+    pair.Insert(min, max, 2);
+    quality = pair.CalcQuality();
+    EXPECT_DOUBLE_EQ(quality.totalOverlap, 6.0);
+    EXPECT_EQ(quality.deadSpace, 0.0);
+
+    const std::string json = tree.StatsJson();
+    EXPECT_EQ(json.front(), '{');
+    EXPECT_EQ(json.back(), '}');
+    EXPECT_NE(json.find("\"entries\":1600"), std::string::npos);
+    EXPECT_NE(json.find("\"levels\":[{\"level\":0"), std::string::npos);
+    EXPECT_NE(json.find("\"counted\":true"), std::string::npos);
+}